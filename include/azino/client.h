@@ -1,5 +1,6 @@
 #include <butil/macros.h>
 
+#include <functional>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -20,8 +21,12 @@ class ChannelOptions;
 }  // namespace brpc
 
 namespace azino {
+namespace storage {
+class MVCCScanResponse;
+}  // namespace storage
 class TxIdentifier;
 class TxWriteBuffer;
+class Value;
 
 typedef std::unique_ptr<brpc::ChannelOptions> ChannelOptionsPtr;
 typedef std::shared_ptr<brpc::Channel> ChannelPtr;
@@ -52,16 +57,58 @@ class Transaction {
     Status Put(WriteOptions options, const UserKey& key,
                const UserValue& value);
     Status Get(ReadOptions options, const UserKey& key, UserValue& value);
+    // the result of keys[i] is stored in values[i] and statuses[i], keys not
+    // found in the tx are read from storage in one batch. Returns a non-OK
+    // status if the batch fails as a whole
+    Status MultiGet(ReadOptions options, const std::vector<UserKey>& keys,
+                    std::vector<UserValue>& values,
+                    std::vector<Status>& statuses);
     Status Delete(WriteOptions options, const UserKey& key);
-    // include left_key, not include right_key
+    // include left_key, not include right_key. The versions not persisted to
+    // storage yet and the writes of the tx itself are merged in.
     Status Scan(const UserKey& left_key, const UserKey& right_key,
                 std::vector<UserValue>& keys, std::vector<UserValue>& values);
+    // same as above, but only the keys matching "options" are returned
+    Status Scan(const ScanOptions& options, const UserKey& left_key,
+                const UserKey& right_key, std::vector<UserValue>& keys,
+                std::vector<UserValue>& values);
+    // count the keys Scan() would return, and store the first and the last of
+    // them in "min_key" and "max_key" if any. Storage counts the keys without
+    // sending them, unless the range has versions not persisted yet or writes
+    // of the tx itself, which are then merged in like Scan()
+    Status Count(const ScanOptions& options, const UserKey& left_key,
+                 const UserKey& right_key, uint64_t& count, UserKey& min_key,
+                 UserKey& max_key);
 
     void Reset();
 
    private:
     Status Write(WriteOptions options, const UserKey& key, bool is_delete,
                  const UserValue& value = "");
+    // "in_txindex" is set to false if txindex has no data of "key", then the
+    // read should go on to storage
+    Status ReadTxIndex(const UserKey& key, UserValue& value, bool& in_txindex);
+    // Read "keys[i]" for each i in "idx" from the txindex of "channel" in one
+    // batch like ReadTxIndex, the indexes of the keys to read from storage
+    // are appended to "misses".
+    void BatchReadTxIndex(brpc::Channel* channel,
+                          const std::vector<UserKey>& keys,
+                          const std::vector<size_t>& idx,
+                          std::vector<UserValue>& values,
+                          std::vector<Status>& statuses,
+                          std::vector<size_t>& misses);
+    // Scan storage in a stream, "on_batch" is called with each batch as soon
+    // as it arrives. The matched keys are only counted if "aggregate" is set.
+    Status ScanStorage(
+        const ScanOptions& options, bool aggregate, const UserKey& left_key,
+        const UserKey& right_key,
+        const std::function<void(const storage::MVCCScanResponse&)>& on_batch);
+    // Scan the versions of [left_key, right_key) kept by txindex, which are
+    // newer than the ones in storage, into "versions". Scan() reads them
+    // before storage, so a version persisted and cleared meanwhile is found
+    // in storage.
+    Status ScanTxIndex(const UserKey& left_key, const UserKey& right_key,
+                       std::map<UserKey, Value, BitWiseComparator>& versions);
     Status PreputAll();
     Status CommitAll();
     Status AbortAll();
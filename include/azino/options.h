@@ -14,5 +14,17 @@ struct WriteOptions {
     WriteType type = kAutomatic;
 };
 
+// Filters of a scan, they are evaluated by storage so the keys filtered out
+// are never sent back.
+struct ScanOptions {
+    // only the keys starting with it
+    std::string key_prefix;
+    // only the values starting with it
+    std::string value_prefix;
+    // only the values equal to "value_equals", if "match_value" is set
+    bool match_value = false;
+    std::string value_equals;
+};
+
 }  // namespace azino
 #endif  // AZINO_INCLUDE_OPTIONS_H
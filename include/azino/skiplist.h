@@ -0,0 +1,252 @@
+#ifndef AZINO_INCLUDE_SKIPLIST_H
+#define AZINO_INCLUDE_SKIPLIST_H
+
+#include <butil/macros.h>
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <new>
+
+namespace azino {
+
+// A sorted set of keys with lock-free readers, in the manner of leveldb's
+// memtable skiplist.
+//
+// Writes (Insert) need external synchronization, e.g. a mutex. Reads
+// (Contains and Iterator) need none and may run concurrently with a write:
+// a node is linked with release stores after it is fully built, so a reader
+// sees either nothing or the whole node. Nodes are never removed before the
+// skiplist is destroyed, which is why the keys are immutable once inserted.
+//
+// "Compare" is a strict weak order like std::less.
+template <typename Key, typename Compare = std::less<Key>>
+class SkipList {
+   private:
+    struct Node;
+
+   public:
+    explicit SkipList(Compare cmp = Compare())
+        : _cmp(cmp), _head(new_node(Key(), max_height)), _max_height(1),
+          _rnd(0xdeadbeef) {
+        for (int i = 0; i < max_height; i++) {
+            _head->set_next(i, nullptr);
+        }
+    }
+    DISALLOW_COPY_AND_ASSIGN(SkipList);
+    ~SkipList() {
+        Node* node = _head;
+        while (node != nullptr) {
+            Node* next = node->next(0);
+            delete_node(node);
+            node = next;
+        }
+    }
+
+    // Insert "key" into the list, return false if an equal key is already in
+    // it. Requires external synchronization with other writes.
+    bool Insert(const Key& key) {
+        Node* prev[max_height];
+        Node* x = find_greater_or_equal(key, prev);
+        if (x != nullptr && equal(key, x->key)) {
+            return false;
+        }
+
+        int height = random_height();
+        int current = _max_height.load(std::memory_order_relaxed);
+        if (height > current) {
+            for (int i = current; i < height; i++) {
+                prev[i] = _head;
+            }
+            // readers seeing the new height before the new node just follow
+            // nullptr from the head at the new levels
+            _max_height.store(height, std::memory_order_relaxed);
+        }
+
+        x = new_node(key, height);
+        for (int i = 0; i < height; i++) {
+            x->no_barrier_set_next(i, prev[i]->no_barrier_next(i));
+            prev[i]->set_next(i, x);
+        }
+        return true;
+    }
+
+    // Return true if an entry equal to "key" is in the list.
+    bool Contains(const Key& key) const {
+        Node* x = find_greater_or_equal(key, nullptr);
+        return x != nullptr && equal(key, x->key);
+    }
+
+    // Iteration over the contents of a skiplist, it is not invalidated by
+    // concurrent inserts.
+    class Iterator {
+       public:
+        explicit Iterator(const SkipList* list)
+            : _list(list), _node(nullptr) {}
+
+        bool Valid() const { return _node != nullptr; }
+
+        // Requires Valid().
+        const Key& key() const {
+            assert(Valid());
+            return _node->key;
+        }
+
+        void Next() {
+            assert(Valid());
+            _node = _node->next(0);
+        }
+
+        // Requires Valid(). There are no back links, the predecessor is
+        // searched from the head.
+        void Prev() {
+            assert(Valid());
+            _node = _list->find_less_than(_node->key);
+            if (_node == _list->_head) {
+                _node = nullptr;
+            }
+        }
+
+        // Advance to the first entry with a key >= target.
+        void Seek(const Key& target) {
+            _node = _list->find_greater_or_equal(target, nullptr);
+        }
+
+        void SeekToFirst() { _node = _list->_head->next(0); }
+
+        void SeekToLast() {
+            _node = _list->find_last();
+            if (_node == _list->_head) {
+                _node = nullptr;
+            }
+        }
+
+       private:
+        const SkipList* _list;
+        Node* _node;
+    };
+
+   private:
+    static const int max_height = 12;
+    static const uint32_t branching = 4;
+
+    struct Node {
+        explicit Node(const Key& k) : key(k) {}
+
+        Key const key;
+
+        Node* next(int n) {
+            // acquire, so that a fully initialized node is observed
+            return _next[n].load(std::memory_order_acquire);
+        }
+        void set_next(int n, Node* x) {
+            // release, so that anybody who reads through this pointer
+            // observes a fully initialized version of the inserted node
+            _next[n].store(x, std::memory_order_release);
+        }
+        Node* no_barrier_next(int n) {
+            return _next[n].load(std::memory_order_relaxed);
+        }
+        void no_barrier_set_next(int n, Node* x) {
+            _next[n].store(x, std::memory_order_relaxed);
+        }
+
+       private:
+        // the array length is the node height, _next[0] is the lowest level
+        std::atomic<Node*> _next[1];
+    };
+
+    static Node* new_node(const Key& key, int height) {
+        char* mem = new char[sizeof(Node) +
+                             sizeof(std::atomic<Node*>) * (height - 1)];
+        return new (mem) Node(key);
+    }
+
+    static void delete_node(Node* node) {
+        node->~Node();
+        delete[] reinterpret_cast<char*>(node);
+    }
+
+    int random_height() {
+        // increase the height with probability 1 in "branching"
+        int height = 1;
+        while (height < max_height && next_random() % branching == 0) {
+            height++;
+        }
+        return height;
+    }
+
+    // A Lehmer generator, only called by the writer.
+    uint32_t next_random() {
+        _rnd = static_cast<uint32_t>(
+            (static_cast<uint64_t>(_rnd) * 16807) % 2147483647);
+        return _rnd;
+    }
+
+    bool equal(const Key& a, const Key& b) const {
+        return !_cmp(a, b) && !_cmp(b, a);
+    }
+
+    // Return the earliest node at or after "key", and fill "prev" with the
+    // previous node at every level if it is not nullptr.
+    Node* find_greater_or_equal(const Key& key, Node** prev) const {
+        Node* x = _head;
+        int level = _max_height.load(std::memory_order_relaxed) - 1;
+        while (true) {
+            Node* next = x->next(level);
+            if (next != nullptr && _cmp(next->key, key)) {
+                x = next;
+            } else {
+                if (prev != nullptr) {
+                    prev[level] = x;
+                }
+                if (level == 0) {
+                    return next;
+                }
+                level--;
+            }
+        }
+    }
+
+    // Return the latest node before "key", or the head if there is none.
+    Node* find_less_than(const Key& key) const {
+        Node* x = _head;
+        int level = _max_height.load(std::memory_order_relaxed) - 1;
+        while (true) {
+            Node* next = x->next(level);
+            if (next != nullptr && _cmp(next->key, key)) {
+                x = next;
+            } else if (level == 0) {
+                return x;
+            } else {
+                level--;
+            }
+        }
+    }
+
+    // Return the last node, or the head if the list is empty.
+    Node* find_last() const {
+        Node* x = _head;
+        int level = _max_height.load(std::memory_order_relaxed) - 1;
+        while (true) {
+            Node* next = x->next(level);
+            if (next != nullptr) {
+                x = next;
+            } else if (level == 0) {
+                return x;
+            } else {
+                level--;
+            }
+        }
+    }
+
+    Compare const _cmp;
+    Node* const _head;
+    std::atomic<int> _max_height;  // height of the entire list
+    uint32_t _rnd;
+};
+
+}  // namespace azino
+
+#endif  // AZINO_INCLUDE_SKIPLIST_H
@@ -0,0 +1,29 @@
+#ifndef AZINO_INCLUDE_STREAM_H
+#define AZINO_INCLUDE_STREAM_H
+
+#include <brpc/stream.h>
+#include <butil/iobuf.h>
+#include <google/protobuf/message.h>
+
+namespace azino {
+
+// Write "message" to "stream", wait if the stream is full. Return 0 on
+// success.
+inline int WriteStreamMessage(brpc::StreamId stream,
+                              const google::protobuf::Message& message) {
+    butil::IOBuf buf;
+    butil::IOBufAsZeroCopyOutputStream wrapper(&buf);
+    if (!message.SerializeToZeroCopyStream(&wrapper)) {
+        return -1;
+    }
+    int rc;
+    while ((rc = brpc::StreamWrite(stream, buf)) == EAGAIN) {
+        if (brpc::StreamWait(stream, nullptr) != 0) {
+            return -1;
+        }
+    }
+    return rc;
+}
+
+}  // namespace azino
+#endif  // AZINO_INCLUDE_STREAM_H
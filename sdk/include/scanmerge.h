@@ -0,0 +1,90 @@
+#ifndef AZINO_SDK_INCLUDE_SCANMERGE_H
+#define AZINO_SDK_INCLUDE_SCANMERGE_H
+
+#include <butil/macros.h>
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "azino/comparator.h"
+#include "azino/kv.h"
+#include "azino/options.h"
+#include "service/kv.pb.h"
+
+namespace azino {
+
+// Merges the keys of a storage scan, which come in key order batch by batch,
+// with the newer versions of the same range: those kept by txindex and the
+// writes of the tx itself.
+//
+// The newer versions should be collected before storage is scanned. A
+// version persisted and then cleared from txindex in between is then still
+// found in storage, while the other way round it may be missed by both.
+class ScanMerger {
+   public:
+    typedef std::map<UserKey, Value, BitWiseComparator> Versions;
+
+    ScanMerger(const ScanOptions& options, Versions versions)
+        : _options(options),
+          _versions(std::move(versions)),
+          _next(_versions.begin()) {}
+    DISALLOW_COPY_AND_ASSIGN(ScanMerger);
+    ~ScanMerger() = default;
+
+    // Append the keys of a storage batch to "keys" and "values", along with
+    // the newer versions up to its last key. The keys of a batch go after
+    // those of the batches added before. "Keys" and "Values" are vectors or
+    // the repeated fields of a batch.
+    template <typename Keys, typename Values>
+    void Add(const Keys& storage_keys, const Values& storage_values,
+             std::vector<UserKey>& keys, std::vector<UserValue>& values) {
+        for (size_t i = 0; i < size_t(storage_keys.size()); i++) {
+            const UserKey& key = storage_keys[i];
+            while (_next != _versions.end() && _cmp(_next->first, key)) {
+                emit(keys, values);
+            }
+            if (_next != _versions.end() && _next->first == key) {
+                emit(keys, values);
+                continue;
+            }
+            keys.push_back(key);
+            values.push_back(storage_values[i]);
+        }
+    }
+
+    // Append the newer versions after the last storage key.
+    void Finish(std::vector<UserKey>& keys, std::vector<UserValue>& values) {
+        while (_next != _versions.end()) {
+            emit(keys, values);
+        }
+    }
+
+   private:
+    static bool StartsWith(const std::string& s, const std::string& prefix) {
+        return s.compare(0, prefix.size(), prefix) == 0;
+    }
+
+    // Append the next newer version unless it is a deletion or filtered out
+    // like storage would do.
+    void emit(std::vector<UserKey>& keys, std::vector<UserValue>& values) {
+        const UserKey& key = _next->first;
+        const Value& v = _next->second;
+        if (!v.is_delete() && StartsWith(key, _options.key_prefix) &&
+            StartsWith(v.content(), _options.value_prefix) &&
+            (!_options.match_value || v.content() == _options.value_equals)) {
+            keys.push_back(key);
+            values.push_back(v.content());
+        }
+        _next++;
+    }
+
+    const ScanOptions _options;
+    Versions _versions;
+    Versions::const_iterator _next;
+    BitWiseComparator _cmp;
+};
+
+}  // namespace azino
+#endif  // AZINO_SDK_INCLUDE_SCANMERGE_H
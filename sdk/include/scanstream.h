@@ -0,0 +1,106 @@
+#ifndef AZINO_SDK_INCLUDE_SCANSTREAM_H
+#define AZINO_SDK_INCLUDE_SCANSTREAM_H
+
+#include <brpc/stream.h>
+#include <bthread/condition_variable.h>
+#include <bthread/mutex.h>
+#include <butil/iobuf.h>
+#include <butil/logging.h>
+#include <butil/macros.h>
+
+#include <deque>
+#include <mutex>
+
+#include "service/storage/storage.pb.h"
+
+namespace azino {
+
+// Queues the batches of a streaming mvcc scan, see
+// StorageService.MVCCScanStream, so the caller handles each one with Next()
+// as soon as it arrives. At most "max_pending" batches are queued, brpc then
+// waits for the caller, which keeps storage from sending more. The caller
+// should call Next() until it returns false.
+class ScanStreamReceiver : public brpc::StreamInputHandler {
+   public:
+    explicit ScanStreamReceiver(size_t max_pending = 4)
+        : _max_pending(max_pending) {
+        _status.set_error_code(storage::StorageStatus::Ok);
+    }
+    DISALLOW_COPY_AND_ASSIGN(ScanStreamReceiver);
+    ~ScanStreamReceiver() = default;
+
+    virtual int on_received_messages(brpc::StreamId id,
+                                     butil::IOBuf* const messages[],
+                                     size_t size) override {
+        for (size_t i = 0; i < size; i++) {
+            storage::MVCCScanResponse batch;
+            butil::IOBufAsZeroCopyInputStream wrapper(*messages[i]);
+            std::unique_lock<bthread::Mutex> lck(_mutex);
+            if (!batch.ParseFromZeroCopyStream(&wrapper)) {
+                _status.set_error_code(storage::StorageStatus::Corruption);
+                _status.set_error_message("Fail to parse scan batch");
+                continue;
+            }
+            if (batch.status().error_code() != storage::StorageStatus::Ok &&
+                batch.status().error_code() !=
+                    storage::StorageStatus::NotFound) {
+                _status.CopyFrom(batch.status());
+            }
+            while (_pending.size() >= _max_pending) {
+                _cond.wait(lck);
+            }
+            _pending.emplace_back();
+            _pending.back().Swap(&batch);
+            _batches++;
+            _cond.notify_all();
+        }
+        return 0;
+    }
+
+    virtual void on_idle_timeout(brpc::StreamId id) override {}
+
+    virtual void on_closed(brpc::StreamId id) override {
+        std::lock_guard<bthread::Mutex> lck(_mutex);
+        _closed = true;
+        _cond.notify_all();
+    }
+
+    // Block until the next batch arrives and move it to "batch". Return false
+    // once the stream is closed and all the batches are handled.
+    bool Next(storage::MVCCScanResponse& batch) {
+        std::unique_lock<bthread::Mutex> lck(_mutex);
+        while (_pending.empty() && !_closed) {
+            _cond.wait(lck);
+        }
+        if (_pending.empty()) {
+            return false;
+        }
+        batch.Swap(&_pending.front());
+        _pending.pop_front();
+        _cond.notify_all();
+        return true;
+    }
+
+    // the error of the batches if any, final once Next() returns false
+    storage::StorageStatus status() {
+        std::lock_guard<bthread::Mutex> lck(_mutex);
+        return _status;
+    }
+
+    int batches() {
+        std::lock_guard<bthread::Mutex> lck(_mutex);
+        return _batches;
+    }
+
+   private:
+    const size_t _max_pending;
+    bthread::Mutex _mutex;
+    bthread::ConditionVariable _cond;
+    std::deque<storage::MVCCScanResponse> _pending;
+    bool _closed = false;
+    storage::StorageStatus _status;
+    int _batches = 0;
+};
+
+}  // namespace azino
+#endif  // AZINO_SDK_INCLUDE_SCANSTREAM_H
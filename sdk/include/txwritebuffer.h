@@ -44,6 +44,10 @@ class TxWriteBuffer {
 
     Buffer::iterator find(const UserKey& key) { return _m.find(key); }
 
+    Buffer::iterator lower_bound(const UserKey& key) {
+        return _m.lower_bound(key);
+    }
+
    private:
     Buffer _m;
 };
@@ -1,13 +1,21 @@
 #include "azino/client.h"
 
+#include <brpc/callback.h>
 #include <brpc/channel.h>
+#include <brpc/stream.h>
+#include <bthread/countdown_event.h>
 #include <butil/hash.h>
 
+#include <deque>
+#include <set>
+
 #include "azino/partition.h"
 #include "service/storage/storage.pb.h"
 #include "service/tx.pb.h"
 #include "service/txindex/txindex.pb.h"
 #include "service/txplanner/txplanner.pb.h"
+#include "scanmerge.h"
+#include "scanstream.h"
 #include "txwritebuffer.h"
 
 #define LOG_WRONG_TX_STATUS_CODE(ss, op)              \
@@ -45,6 +53,21 @@ DEFINE_int32(timeout_ms, -1, "RPC timeout in milliseconds");
 static brpc::ChannelOptions channel_options;
 
 namespace azino {
+namespace {
+
+void SignalEvent(bthread::CountdownEvent* event) { event->signal(); }
+
+// A batch sent to one txindex, the batches to all of them are sent at once
+// and waited for together.
+template <typename Request, typename Response>
+struct BatchCall {
+    brpc::Controller cntl;
+    Request req;
+    Response resp;
+};
+
+}  // namespace
+
 Transaction::Transaction(const Options& options)
     : _options(options), _txid(nullptr), _txwritebuffer(nullptr) {
     channel_options.timeout_ms = FLAGS_timeout_ms;
@@ -210,127 +233,235 @@ Status Transaction::Commit() {
 }
 
 Status Transaction::PreputAll() {
-    // todo: parallelize preputing
+    // one batch per txindex
+    std::map<brpc::Channel*, std::vector<Buffer::iterator>> batches;
     for (auto iter = _txwritebuffer->begin(); iter != _txwritebuffer->end();
          iter++) {
         assert(iter->second.status < TxWriteStatus::PREPUTED);
+        batches[Route(iter->first).channel.get()].push_back(iter);
+    }
 
-        azino::txindex::TxOpService_Stub stub(Route(iter->first).channel.get());
-
-        brpc::Controller cntl;
-        azino::txindex::WriteIntentRequest req;
-        azino::txindex::WriteIntentResponse resp;
-        req.set_allocated_txid(new TxIdentifier(*_txid));
-        req.set_key(iter->first);
-        req.set_allocated_value(new Value(iter->second.value));
-        stub.WriteIntent(&cntl, &req, &resp, nullptr);
+    typedef BatchCall<azino::txindex::BatchWriteIntentRequest,
+                      azino::txindex::BatchWriteIntentResponse>
+        Call;
+    std::deque<Call> calls;
+    bthread::CountdownEvent event(batches.size());
+    for (auto& batch : batches) {
+        calls.emplace_back();
+        Call& call = calls.back();
+        call.req.set_allocated_txid(new TxIdentifier(*_txid));
+        for (auto iter : batch.second) {
+            call.req.add_keys(iter->first);
+            call.req.add_values()->CopyFrom(iter->second.value);
+        }
+        azino::txindex::TxOpService_Stub stub(batch.first);
+        stub.BatchWriteIntent(&call.cntl, &call.req, &call.resp,
+                              brpc::NewCallback(&SignalEvent, &event));
+    }
+    event.wait();
+
+    // every response is handled, so the keys written by the other batches
+    // are known whichever batch fails
+    Status sts = Status::Ok();
+    auto call = calls.begin();
+    for (auto& batch : batches) {
+        brpc::Controller& cntl = call->cntl;
+        const azino::txindex::BatchWriteIntentRequest& req = call->req;
+        const azino::txindex::BatchWriteIntentResponse& resp = call->resp;
+        call++;
         if (cntl.Failed()) {
             std::stringstream ss;
             LOG_CONTROLLER_ERROR(cntl, ss)
-            return Status::NetworkErr(ss.str());
+            if (sts.IsOk()) {
+                sts = Status::NetworkErr(ss.str());
+            }
+            continue;
         }
 
-        LOG_SDK(cntl, req, resp, WriteIntent_from_txindex)
+        LOG_SDK(cntl, req, resp, BatchWriteIntent_from_txindex)
 
-        switch (resp.tx_op_status().error_code()) {
-            case TxOpStatus_Code_Ok:
+        if (resp.results_size() != req.keys_size()) {
+            std::stringstream ss;
+            ss << " BatchWriteIntent keys: " << req.keys_size()
+               << " results: " << resp.results_size();
+            if (sts.IsOk()) {
+                sts = Status::TxIndexErr(ss.str());
+            }
+            continue;
+        }
+        std::stringstream ss;
+        for (size_t i = 0; i < batch.second.size(); i++) {
+            auto iter = batch.second[i];
+            if (resp.results(i).tx_op_status().error_code() ==
+                TxOpStatus_Code_Ok) {
                 iter->second.status = TxWriteStatus::PREPUTED;
-                break;
-            default:
-                std::stringstream ss;
-                ss << " Preput key: "
-                   << iter->first
-                   //                   << " value: " <<
-                   //                   iter->second.value.ShortDebugString()
-                   << " error code: " << resp.tx_op_status().error_code()
-                   << " error message: " << resp.tx_op_status().error_message();
-                return Status::TxIndexErr(ss.str());
+            } else if (ss.tellp() == 0) {
+                ss << " Preput key: " << iter->first << " error code: "
+                   << resp.results(i).tx_op_status().error_code()
+                   << " error message: "
+                   << resp.results(i).tx_op_status().error_message();
+            }
+        }
+        // the keys preputed are cleaned by the abort
+        if (ss.tellp() != 0 && sts.IsOk()) {
+            sts = Status::TxIndexErr(ss.str());
         }
     }
-
-    return Status::Ok();
+    return sts;
 }
 
 Status Transaction::CommitAll() {
-    // todo: parallelize committing
+    // one batch per txindex
+    std::map<brpc::Channel*, std::vector<Buffer::iterator>> batches;
     for (auto iter = _txwritebuffer->begin(); iter != _txwritebuffer->end();
          iter++) {
         assert(iter->second.status == TxWriteStatus::PREPUTED);
+        batches[Route(iter->first).channel.get()].push_back(iter);
+    }
 
-        azino::txindex::TxOpService_Stub stub(Route(iter->first).channel.get());
-
-        brpc::Controller cntl;
-        azino::txindex::CommitRequest req;
-        azino::txindex::CommitResponse resp;
-        req.set_allocated_txid(new TxIdentifier(*_txid));
-        req.set_key(iter->first);
-        stub.Commit(&cntl, &req, &resp, nullptr);
+    typedef BatchCall<azino::txindex::BatchCommitRequest,
+                      azino::txindex::BatchCommitResponse>
+        Call;
+    std::deque<Call> calls;
+    bthread::CountdownEvent event(batches.size());
+    for (auto& batch : batches) {
+        calls.emplace_back();
+        Call& call = calls.back();
+        call.req.set_allocated_txid(new TxIdentifier(*_txid));
+        for (auto iter : batch.second) {
+            call.req.add_keys(iter->first);
+        }
+        azino::txindex::TxOpService_Stub stub(batch.first);
+        stub.BatchCommit(&call.cntl, &call.req, &call.resp,
+                         brpc::NewCallback(&SignalEvent, &event));
+    }
+    event.wait();
+
+    // every response is handled, so the keys written by the other batches
+    // are known whichever batch fails
+    Status sts = Status::Ok();
+    auto call = calls.begin();
+    for (auto& batch : batches) {
+        brpc::Controller& cntl = call->cntl;
+        const azino::txindex::BatchCommitRequest& req = call->req;
+        const azino::txindex::BatchCommitResponse& resp = call->resp;
+        call++;
         if (cntl.Failed()) {
             std::stringstream ss;
             LOG_CONTROLLER_ERROR(cntl, ss)
-            return Status::NetworkErr(ss.str());
+            if (sts.IsOk()) {
+                sts = Status::NetworkErr(ss.str());
+            }
+            continue;
         }
 
-        LOG_SDK(cntl, req, resp, Commit_from_txindex)
+        LOG_SDK(cntl, req, resp, BatchCommit_from_txindex)
 
-        switch (resp.tx_op_status().error_code()) {
-            case TxOpStatus_Code_Ok:
+        if (resp.results_size() != req.keys_size()) {
+            std::stringstream ss;
+            ss << " BatchCommit keys: " << req.keys_size()
+               << " results: " << resp.results_size();
+            if (sts.IsOk()) {
+                sts = Status::TxIndexErr(ss.str());
+            }
+            continue;
+        }
+        std::stringstream ss;
+        for (size_t i = 0; i < batch.second.size(); i++) {
+            auto iter = batch.second[i];
+            if (resp.results(i).tx_op_status().error_code() ==
+                TxOpStatus_Code_Ok) {
                 iter->second.status = TxWriteStatus::COMMITTED;
-                break;
-            default:
-                std::stringstream ss;
-                ss << " Commit key: "
-                   << iter->first
-                   //                   << " value: " <<
-                   //                   iter->second.value.ShortDebugString()
-                   << " error code: " << resp.tx_op_status().error_code()
-                   << " error message: " << resp.tx_op_status().error_message();
-                return Status::TxIndexErr(ss.str());
+            } else if (ss.tellp() == 0) {
+                ss << " Commit key: " << iter->first << " error code: "
+                   << resp.results(i).tx_op_status().error_code()
+                   << " error message: "
+                   << resp.results(i).tx_op_status().error_message();
+            }
+        }
+        if (ss.tellp() != 0 && sts.IsOk()) {
+            sts = Status::TxIndexErr(ss.str());
         }
     }
-    return Status::Ok();
+    return sts;
 }
 
 Status Transaction::AbortAll() {
-    // todo: parallelize aborting
+    // one batch per txindex
+    std::map<brpc::Channel*, std::vector<Buffer::iterator>> batches;
     for (auto iter = _txwritebuffer->begin(); iter != _txwritebuffer->end();
          iter++) {
         if (iter->second.status == TxWriteStatus::NONE) {
             continue;
         }
+        batches[Route(iter->first).channel.get()].push_back(iter);
+    }
 
-        azino::txindex::TxOpService_Stub stub(Route(iter->first).channel.get());
-
-        brpc::Controller cntl;
-        azino::txindex::CleanRequest req;
-        azino::txindex::CleanResponse resp;
-        req.set_allocated_txid(new TxIdentifier(*_txid));
-        req.set_key(iter->first);
-        stub.Clean(&cntl, &req, &resp, nullptr);
+    typedef BatchCall<azino::txindex::BatchCleanRequest,
+                      azino::txindex::BatchCleanResponse>
+        Call;
+    std::deque<Call> calls;
+    bthread::CountdownEvent event(batches.size());
+    for (auto& batch : batches) {
+        calls.emplace_back();
+        Call& call = calls.back();
+        call.req.set_allocated_txid(new TxIdentifier(*_txid));
+        for (auto iter : batch.second) {
+            call.req.add_keys(iter->first);
+        }
+        azino::txindex::TxOpService_Stub stub(batch.first);
+        stub.BatchClean(&call.cntl, &call.req, &call.resp,
+                        brpc::NewCallback(&SignalEvent, &event));
+    }
+    event.wait();
+
+    // every response is handled, so the keys written by the other batches
+    // are known whichever batch fails
+    Status sts = Status::Ok();
+    auto call = calls.begin();
+    for (auto& batch : batches) {
+        brpc::Controller& cntl = call->cntl;
+        const azino::txindex::BatchCleanRequest& req = call->req;
+        const azino::txindex::BatchCleanResponse& resp = call->resp;
+        call++;
         if (cntl.Failed()) {
             std::stringstream ss;
             LOG_CONTROLLER_ERROR(cntl, ss)
-            return Status::NetworkErr(ss.str());
+            if (sts.IsOk()) {
+                sts = Status::NetworkErr(ss.str());
+            }
+            continue;
         }
 
-        LOG_SDK(cntl, req, resp, Clean_from_txindex)
+        LOG_SDK(cntl, req, resp, BatchClean_from_txindex)
 
-        switch (resp.tx_op_status().error_code()) {
-            case TxOpStatus_Code_Ok:
+        if (resp.results_size() != req.keys_size()) {
+            std::stringstream ss;
+            ss << " BatchClean keys: " << req.keys_size()
+               << " results: " << resp.results_size();
+            if (sts.IsOk()) {
+                sts = Status::TxIndexErr(ss.str());
+            }
+            continue;
+        }
+        std::stringstream ss;
+        for (size_t i = 0; i < batch.second.size(); i++) {
+            auto iter = batch.second[i];
+            if (resp.results(i).tx_op_status().error_code() ==
+                TxOpStatus_Code_Ok) {
                 iter->second.status = TxWriteStatus::NONE;
-                break;
-            default:
-                std::stringstream ss;
-                ss << " Abort key: "
-                   << iter->first
-                   //                   << " value: " <<
-                   //                   iter->second.value.ShortDebugString()
-                   << " error code: " << resp.tx_op_status().error_code()
-                   << " error message: " << resp.tx_op_status().error_message();
-                return Status::TxIndexErr(ss.str());
+            } else if (ss.tellp() == 0) {
+                ss << " Abort key: " << iter->first << " error code: "
+                   << resp.results(i).tx_op_status().error_code()
+                   << " error message: "
+                   << resp.results(i).tx_op_status().error_message();
+            }
+        }
+        if (ss.tellp() != 0 && sts.IsOk()) {
+            sts = Status::TxIndexErr(ss.str());
         }
     }
-    return Status::Ok();
+    return sts;
 }
 
 Status Transaction::Put(WriteOptions options, const UserKey& key,
@@ -410,6 +541,184 @@ Status Transaction::Get(ReadOptions options, const UserKey& key,
         }
     }
 
+    bool in_txindex = false;
+    Status sts = ReadTxIndex(key, value, in_txindex);
+    if (!sts.IsOk() || in_txindex) {
+        return sts;
+    }
+
+    azino::storage::StorageService_Stub storage_stub(_storage.get());
+    brpc::Controller storage_cntl;
+    azino::storage::MVCCGetRequest storage_req;
+    azino::storage::MVCCGetResponse storage_resp;
+    storage_req.set_key(key);
+    storage_req.set_ts(_txid->start_ts());
+    storage_stub.MVCCGet(&storage_cntl, &storage_req, &storage_resp, nullptr);
+    if (storage_cntl.Failed()) {
+        std::stringstream ss;
+        LOG_CONTROLLER_ERROR(storage_cntl, ss)
+        return Status::NetworkErr(ss.str());
+    }
+
+    LOG_SDK(storage_cntl, storage_req, storage_resp, Read_from_storage)
+
+    switch (storage_resp.status().error_code()) {
+        case storage::StorageStatus_Code_Ok:
+            value = storage_resp.value();
+            return Status::Ok();
+        case storage::StorageStatus_Code_NotFound:
+            return Status::NotFound();
+        default:
+            std::stringstream ss;
+            ss << " Find in Storage Key: "
+               << key
+               //               << " value: " << storage_resp.value()
+               << " error code: " << storage_resp.status().error_code()
+               << " error message: " << storage_resp.status().error_message();
+            return Status::StorageErr(ss.str());
+    }
+}
+
+Status Transaction::MultiGet(ReadOptions options,
+                             const std::vector<UserKey>& keys,
+                             std::vector<UserValue>& values,
+                             std::vector<Status>& statuses) {
+    BEGIN_CHECK(read)
+
+    values.assign(keys.size(), UserValue());
+    statuses.assign(keys.size(), Status::Ok());
+    // indexes of the keys which should be read from txindex, one batch per
+    // txindex
+    std::map<brpc::Channel*, std::vector<size_t>> reads;
+    for (size_t i = 0; i < keys.size(); i++) {
+        auto iter = _txwritebuffer->find(keys[i]);
+        if (iter != _txwritebuffer->end()) {
+            auto& v = iter->second.value;
+            if (v.is_delete()) {
+                statuses[i] = Status::NotFound();
+            } else {
+                values[i] = v.content();
+            }
+            continue;
+        }
+        reads[Route(keys[i]).channel.get()].push_back(i);
+    }
+    // indexes of the keys which should be read from storage
+    std::vector<size_t> misses;
+    for (auto& batch : reads) {
+        BatchReadTxIndex(batch.first, keys, batch.second, values, statuses,
+                         misses);
+    }
+    if (misses.empty()) {
+        return Status::Ok();
+    }
+
+    azino::storage::StorageService_Stub storage_stub(_storage.get());
+    brpc::Controller storage_cntl;
+    azino::storage::BatchMVCCGetRequest storage_req;
+    azino::storage::BatchMVCCGetResponse storage_resp;
+    for (size_t i : misses) {
+        storage_req.add_keys(keys[i]);
+    }
+    storage_req.set_ts(_txid->start_ts());
+    storage_stub.BatchMVCCGet(&storage_cntl, &storage_req, &storage_resp,
+                              nullptr);
+    if (storage_cntl.Failed()) {
+        std::stringstream ss;
+        LOG_CONTROLLER_ERROR(storage_cntl, ss)
+        return Status::NetworkErr(ss.str());
+    }
+
+    LOG_SDK(storage_cntl, storage_req, storage_resp, BatchRead_from_storage)
+
+    if (storage_resp.status().error_code() != storage::StorageStatus_Code_Ok ||
+        storage_resp.results_size() != static_cast<int>(misses.size())) {
+        std::stringstream ss;
+        ss << " Batch find in Storage keys: " << misses.size()
+           << " results: " << storage_resp.results_size()
+           << " error code: " << storage_resp.status().error_code()
+           << " error message: " << storage_resp.status().error_message();
+        return Status::StorageErr(ss.str());
+    }
+    for (size_t j = 0; j < misses.size(); j++) {
+        size_t i = misses[j];
+        const auto& result = storage_resp.results(j);
+        switch (result.status().error_code()) {
+            case storage::StorageStatus_Code_Ok:
+                values[i] = result.value();
+                break;
+            case storage::StorageStatus_Code_NotFound:
+                statuses[i] = Status::NotFound();
+                break;
+            default:
+                std::stringstream ss;
+                ss << " Find in Storage Key: " << keys[i]
+                   << " error code: " << result.status().error_code()
+                   << " error message: " << result.status().error_message();
+                statuses[i] = Status::StorageErr(ss.str());
+        }
+    }
+    return Status::Ok();
+}
+
+void Transaction::BatchReadTxIndex(brpc::Channel* channel,
+                                   const std::vector<UserKey>& keys,
+                                   const std::vector<size_t>& idx,
+                                   std::vector<UserValue>& values,
+                                   std::vector<Status>& statuses,
+                                   std::vector<size_t>& misses) {
+    azino::txindex::TxOpService_Stub stub(channel);
+
+    brpc::Controller cntl;
+    azino::txindex::BatchReadRequest req;
+    azino::txindex::BatchReadResponse resp;
+    req.set_allocated_txid(new TxIdentifier(*_txid));
+    for (size_t i : idx) {
+        req.add_keys(keys[i]);
+    }
+    stub.BatchRead(&cntl, &req, &resp, nullptr);
+    if (cntl.Failed()) {
+        std::stringstream ss;
+        LOG_CONTROLLER_ERROR(cntl, ss)
+        for (size_t i : idx) {
+            statuses[i] = Status::NetworkErr(ss.str());
+        }
+        return;
+    }
+
+    LOG_SDK(cntl, req, resp, BatchRead_from_txindex)
+
+    for (size_t j = 0; j < idx.size(); j++) {
+        size_t i = idx[j];
+        if (j >= size_t(resp.results_size())) {
+            statuses[i] = Status::TxIndexErr(" Missing batch read result");
+            continue;
+        }
+        const auto& result = resp.results(j);
+        switch (result.tx_op_status().error_code()) {
+            case TxOpStatus_Code_Ok:
+                if (result.value().is_delete()) {
+                    statuses[i] = Status::NotFound();
+                } else {
+                    values[i] = result.value().content();
+                }
+                break;
+            case TxOpStatus_Code_NotExist:
+                misses.push_back(i);
+                break;
+            default:
+                std::stringstream ss;
+                ss << " Find in TxIndex Key: " << keys[i]
+                   << " error code: " << result.tx_op_status().error_code()
+                   << " error message: "
+                   << result.tx_op_status().error_message();
+                statuses[i] = Status::TxIndexErr(ss.str());
+        }
+    }
+}
+
+Status Transaction::ReadTxIndex(const UserKey& key, UserValue& value,
+                                bool& in_txindex) {
     azino::txindex::TxOpService_Stub stub(Route(key).channel.get());
 
     brpc::Controller cntl;
@@ -428,6 +737,7 @@ Status Transaction::Get(ReadOptions options, const UserKey& key,
 
     switch (resp.tx_op_status().error_code()) {
         case TxOpStatus_Code_Ok:
+            in_txindex = true;
             if (resp.value().is_delete()) {
                 return Status::NotFound();
             } else {
@@ -435,7 +745,8 @@ Status Transaction::Get(ReadOptions options, const UserKey& key,
                 return Status::Ok();
             }
         case TxOpStatus_Code_NotExist:
-            goto readStorage;
+            in_txindex = false;
+            return Status::Ok();
         default:
             std::stringstream ss;
             ss << " Find in TxIndex Key: "
@@ -445,38 +756,6 @@ Status Transaction::Get(ReadOptions options, const UserKey& key,
                << " error message: " << resp.tx_op_status().error_message();
             return Status::TxIndexErr(ss.str());
     }
-
-readStorage:
-    azino::storage::StorageService_Stub storage_stub(_storage.get());
-    brpc::Controller storage_cntl;
-    azino::storage::MVCCGetRequest storage_req;
-    azino::storage::MVCCGetResponse storage_resp;
-    storage_req.set_key(key);
-    storage_req.set_ts(_txid->start_ts());
-    storage_stub.MVCCGet(&storage_cntl, &storage_req, &storage_resp, nullptr);
-    if (storage_cntl.Failed()) {
-        std::stringstream ss;
-        LOG_CONTROLLER_ERROR(storage_cntl, ss)
-        return Status::NetworkErr(ss.str());
-    }
-
-    LOG_SDK(storage_cntl, storage_req, storage_resp, Read_from_storage)
-
-    switch (storage_resp.status().error_code()) {
-        case storage::StorageStatus_Code_Ok:
-            value = storage_resp.value();
-            return Status::Ok();
-        case storage::StorageStatus_Code_NotFound:
-            return Status::NotFound();
-        default:
-            std::stringstream ss;
-            ss << " Find in Storage Key: "
-               << key
-               //               << " value: " << storage_resp.value()
-               << " error code: " << storage_resp.status().error_code()
-               << " error message: " << storage_resp.status().error_message();
-            return Status::StorageErr(ss.str());
-    }
 }
 
 Region& Transaction::Route(const std::string& key) {
@@ -491,31 +770,220 @@ Region& Transaction::Route(const std::string& key) {
 Status Transaction::Scan(const UserKey& left_key, const UserKey& right_key,
                          std::vector<UserValue>& keys,
                          std::vector<UserValue>& values) {
+    return Scan(ScanOptions(), left_key, right_key, keys, values);
+}
+
+Status Transaction::Scan(const ScanOptions& options, const UserKey& left_key,
+                         const UserKey& right_key, std::vector<UserValue>& keys,
+                         std::vector<UserValue>& values) {
     BEGIN_CHECK(scan)
 
+    // txindex is read before storage, see ScanMerger
+    ScanMerger::Versions versions;
+    Status sts = ScanTxIndex(left_key, right_key, versions);
+    if (!sts.IsOk()) {
+        return sts;
+    }
+    // the writes of the tx itself are the newest
+    BitWiseComparator cmp;
+    for (auto iter = _txwritebuffer->lower_bound(left_key);
+         iter != _txwritebuffer->end() &&
+         (right_key.empty() || cmp(iter->first, right_key));
+         iter++) {
+        versions[iter->first] = iter->second.value;
+    }
+    ScanMerger merger(options, std::move(versions));
+
+    size_t size = keys.size();
+    sts = ScanStorage(options, false, left_key, right_key,
+                      [&](const storage::MVCCScanResponse& batch) {
+                          merger.Add(batch.key(), batch.value(), keys, values);
+                      });
+    if (!sts.IsOk() && !sts.IsNotFound()) {
+        return sts;
+    }
+    merger.Finish(keys, values);
+    if (keys.size() == size) {
+        return Status::NotFound();
+    }
+    return Status::Ok();
+}
+
+Status Transaction::ScanTxIndex(const UserKey& left_key,
+                                const UserKey& right_key,
+                                ScanMerger::Versions& versions) {
+    // a txindex scans all of its regions in the range at once
+    std::set<brpc::Channel*> scanned;
+    auto regions =
+        _route_table.equal_range(azino::Range(left_key, right_key, 1, 0));
+    for (auto region = regions.first; region != regions.second; region++) {
+        if (!scanned.insert(region->second.channel.get()).second) {
+            continue;
+        }
+        azino::txindex::TxOpService_Stub stub(region->second.channel.get());
+
+        brpc::Controller cntl;
+        azino::txindex::ScanIntentRequest req;
+        azino::txindex::ScanIntentResponse resp;
+        req.set_allocated_txid(new TxIdentifier(*_txid));
+        req.set_left_key(left_key);
+        req.set_right_key(right_key);
+        stub.ScanIntent(&cntl, &req, &resp, nullptr);
+        if (cntl.Failed()) {
+            std::stringstream ss;
+            LOG_CONTROLLER_ERROR(cntl, ss)
+            return Status::NetworkErr(ss.str());
+        }
+
+        LOG_SDK(cntl, req, resp, ScanIntent_from_txindex)
+
+        if (resp.tx_op_status().error_code() != TxOpStatus_Code_Ok) {
+            std::stringstream ss;
+            ss << " Scan in TxIndex LeftKey: " << left_key
+               << " RightKey: " << right_key
+               << " error code: " << resp.tx_op_status().error_code()
+               << " error message: " << resp.tx_op_status().error_message();
+            return Status::TxIndexErr(ss.str());
+        }
+        for (int i = 0; i < resp.keys_size() && i < resp.values_size(); i++) {
+            versions[resp.keys(i)] = resp.values(i);
+        }
+    }
+    return Status::Ok();
+}
+
+Status Transaction::Count(const ScanOptions& options, const UserKey& left_key,
+                          const UserKey& right_key, uint64_t& count,
+                          UserKey& min_key, UserKey& max_key) {
+    BEGIN_CHECK(scan)
+
+    // txindex is read before storage, see ScanMerger
+    ScanMerger::Versions versions;
+    Status sts = ScanTxIndex(left_key, right_key, versions);
+    if (!sts.IsOk()) {
+        return sts;
+    }
+    BitWiseComparator cmp;
+    for (auto iter = _txwritebuffer->lower_bound(left_key);
+         iter != _txwritebuffer->end() &&
+         (right_key.empty() || cmp(iter->first, right_key));
+         iter++) {
+        versions[iter->first] = iter->second.value;
+    }
+
+    count = 0;
+    if (versions.empty()) {
+        // nothing newer than storage, let storage count without sending keys
+        sts = ScanStorage(options, true, left_key, right_key,
+                          [&](const storage::MVCCScanResponse& batch) {
+                              if (batch.count() == 0) {
+                                  return;
+                              }
+                              if (count == 0) {
+                                  min_key = batch.min_key();
+                              }
+                              max_key = batch.max_key();
+                              count += batch.count();
+                          });
+    } else {
+        // a newer version may hide or add a key, so the keys are merged like
+        // Scan() does and counted batch by batch
+        ScanMerger merger(options, std::move(versions));
+        std::vector<UserKey> keys;
+        std::vector<UserValue> values;
+        auto add = [&]() {
+            if (keys.empty()) {
+                return;
+            }
+            if (count == 0) {
+                min_key = keys.front();
+            }
+            max_key = keys.back();
+            count += keys.size();
+            keys.clear();
+            values.clear();
+        };
+        sts = ScanStorage(options, false, left_key, right_key,
+                          [&](const storage::MVCCScanResponse& batch) {
+                              merger.Add(batch.key(), batch.value(), keys,
+                                         values);
+                              add();
+                          });
+        if (sts.IsOk() || sts.IsNotFound()) {
+            merger.Finish(keys, values);
+            add();
+        }
+    }
+    if (sts.IsNotFound()) {
+        return Status::Ok();
+    }
+    return sts;
+}
+
+Status Transaction::ScanStorage(
+    const ScanOptions& options, bool aggregate, const UserKey& left_key,
+    const UserKey& right_key,
+    const std::function<void(const storage::MVCCScanResponse&)>& on_batch) {
+    // Storage writes the scanned keys to a stream in batches, which are
+    // consumed while storage is still scanning.
+    ScanStreamReceiver receiver;
+    brpc::StreamOptions stream_options;
+    stream_options.handler = &receiver;
+    brpc::StreamId stream;
     azino::storage::StorageService_Stub storage_stub(_storage.get());
     brpc::Controller storage_cntl;
     azino::storage::MVCCScanRequest storage_req;
     azino::storage::MVCCScanResponse storage_resp;
+    if (brpc::StreamCreate(&stream, storage_cntl, &stream_options) != 0) {
+        return Status::NetworkErr(" Fail to create scan stream.");
+    }
     storage_req.set_left_key(left_key);
     storage_req.set_right_key(right_key);
     storage_req.set_ts(_txid->start_ts());
-    storage_stub.MVCCScan(&storage_cntl, &storage_req, &storage_resp, nullptr);
+    if (!options.key_prefix.empty()) {
+        storage_req.set_key_prefix(options.key_prefix);
+    }
+    if (!options.value_prefix.empty()) {
+        storage_req.set_value_prefix(options.value_prefix);
+    }
+    if (options.match_value) {
+        storage_req.set_value_equals(options.value_equals);
+    }
+    storage_req.set_aggregate(aggregate);
+    storage_stub.MVCCScanStream(&storage_cntl, &storage_req, &storage_resp,
+                                nullptr);
     if (storage_cntl.Failed()) {
         std::stringstream ss;
         LOG_CONTROLLER_ERROR(storage_cntl, storage_ss)
+        brpc::StreamClose(stream);
+        storage::MVCCScanResponse batch;
+        while (receiver.Next(batch)) {
+        }
         return Status::NetworkErr(ss.str());
     }
 
     LOG_SDK(storage_cntl, storage_req, storage_resp, Scan_from_storage)
 
-    // TODO: merge with data in _txwritebuffer
-    switch (storage_resp.status().error_code()) {
+    if (storage_resp.status().error_code() != storage::StorageStatus_Code_Ok) {
+        brpc::StreamClose(stream);
+    }
+    uint64_t received = 0;
+    storage::MVCCScanResponse batch;
+    while (receiver.Next(batch)) {
+        received += batch.key_size();
+        on_batch(batch);
+    }
+    LOG(INFO) << " Sdk: " << storage_cntl.local_side()
+              << " Scan_from_storage: " << storage_cntl.remote_side()
+              << " received keys: " << received
+              << " batches: " << receiver.batches();
+
+    const azino::storage::StorageStatus status =
+        storage_resp.status().error_code() != storage::StorageStatus_Code_Ok
+            ? storage_resp.status()
+            : receiver.status();
+    switch (status.error_code()) {
         case storage::StorageStatus_Code_Ok:
-            for (int i = 0; i < storage_resp.value_size(); i++) {
-                keys.push_back(storage_resp.key(i));
-                values.push_back(storage_resp.value(i));
-            }
             return Status::Ok();
         case storage::StorageStatus_Code_NotFound:
             return Status::NotFound();
@@ -523,8 +991,8 @@ Status Transaction::Scan(const UserKey& left_key, const UserKey& right_key,
             std::stringstream ss;
             ss << " Find in Storage LeftKey: " << left_key
                << " RightKey: " << right_key
-               << " error code: " << storage_resp.status().error_code()
-               << " error message: " << storage_resp.status().error_message();
+               << " error code: " << status.error_code()
+               << " error message: " << status.error_message();
             return Status::StorageErr(ss.str());
     }
 }
@@ -2,6 +2,7 @@
 
 #include "azino/comparator.h"
 #include "azino/range.h"
+#include "scanmerge.h"
 
 class SDKTest : public testing::Test {
    public:
@@ -62,4 +63,32 @@ TEST_F(SDKTest, range) {
     ASSERT_TRUE(iter != m.end());
     ASSERT_EQ("[g, )", iter->Describe());
     ASSERT_TRUE(iter->Contains(azino::Range("x", "x", 1, 1)));
-}
\ No newline at end of file
+}
+// The versions of txindex are read before storage is scanned, "b" is
+// persisted and cleared from txindex in between, so both read it.
+TEST_F(SDKTest, scan_merge) {
+    typedef std::vector<std::string> Strings;
+    azino::ScanMerger::Versions versions;
+    versions["b"].set_content("b1");
+    versions["c"].set_is_delete(true);
+    versions["e"].set_content("e1");
+    azino::ScanMerger merger(azino::ScanOptions(), versions);
+    std::vector<std::string> keys, values;
+    merger.Add(Strings{"a", "b"}, Strings{"a0", "b1"}, keys, values);
+    merger.Add(Strings{"c", "d"}, Strings{"c0", "d0"}, keys, values);
+    merger.Finish(keys, values);
+    ASSERT_EQ(std::vector<std::string>({"a", "b", "d", "e"}), keys);
+    ASSERT_EQ(std::vector<std::string>({"a0", "b1", "d0", "e1"}), values);
+
+    // "b" is cleared before the read of txindex, storage has it then
+    versions.erase("b");
+    azino::ScanOptions options;
+    options.value_prefix = "b";
+    azino::ScanMerger filtered(options, versions);
+    keys.clear();
+    values.clear();
+    filtered.Add(Strings{"b"}, Strings{"b1"}, keys, values);
+    filtered.Finish(keys, values);
+    ASSERT_EQ(std::vector<std::string>({"b"}), keys);
+    ASSERT_EQ(std::vector<std::string>({"b1"}), values);
+}
@@ -0,0 +1,133 @@
+#ifndef AZINO_STORAGE_INCLUDE_BLOB_H
+#define AZINO_STORAGE_INCLUDE_BLOB_H
+
+#include <bthread/mutex.h>
+#include <butil/macros.h>
+#include <gflags/gflags.h>
+#include <leveldb/slice.h>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "service/storage/storage.pb.h"
+
+DECLARE_int32(storage_blob_min_size);
+
+namespace azino {
+namespace storage {
+
+// An append-only blob file, it is closed once the last reader drops it.
+class BlobFile {
+   public:
+    BlobFile(uint64_t number, int fd, uint64_t size)
+        : number(number), fd(fd), size(size) {}
+    DISALLOW_COPY_AND_ASSIGN(BlobFile);
+    ~BlobFile();
+
+    const uint64_t number;
+    const int fd;
+    // bytes written, only changes for the file being appended
+    uint64_t size;
+};
+
+// BlobStore keeps large values out of leveldb, in a directory of append-only
+// blob files, so compactions only move small pointers around. Each record
+// is:
+//
+//   key length(4) | value length(4) | crc32c of value(4) | key | value
+//
+// and the pointer to it, which is stored in leveldb instead of the value, is:
+//
+//   file number(8) | offset of value(8) | value length(4) | crc32c(4)
+//
+// The key is the leveldb key pointing to the record, so the live records of
+// a file can be told by looking their keys up. The dead bytes of each file
+// are counted by its owner, a file mostly dead has its live records
+// rewritten to the newest file and is then removed.
+class BlobStore {
+   public:
+    typedef std::map<uint64_t, std::shared_ptr<BlobFile>> FileSet;
+
+    typedef struct Pointer {
+        uint64_t file;
+        uint64_t offset;
+        uint32_t size;
+        uint32_t crc;
+    } Pointer;
+
+    BlobStore() = default;
+    DISALLOW_COPY_AND_ASSIGN(BlobStore);
+    ~BlobStore() = default;
+
+    // Open the blob files in "dir". The directory is created by the first
+    // Append() if it does not exist.
+    StorageStatus Open(const std::string& dir);
+
+    // Append a record of "key" and "value" to the newest file, and store the
+    // pointer to it in "pointer".
+    StorageStatus Append(const leveldb::Slice& key, const leveldb::Slice& value,
+                         std::string* pointer);
+
+    // Return the files opened now. A reader which keeps them can still read
+    // the files removed later.
+    std::shared_ptr<const FileSet> Files() const;
+
+    // Read the value "pointer" points to into "value", from "pinned" (see
+    // Files()) if it has the file, otherwise from the files opened now.
+    StorageStatus Read(const leveldb::Slice& pointer, std::string* value,
+                       const FileSet* pinned = nullptr) const;
+
+    // Sync the newest file to disk, the older ones are synced when the
+    // newest one is created.
+    StorageStatus Sync();
+
+    // Add "bytes" to the dead bytes of "file", return the sum.
+    uint64_t AddDead(uint64_t file, uint64_t bytes);
+
+    // Return a file, but the newest one, of which at least "ratio" of the
+    // bytes are dead. Return false if there is none.
+    bool PickGarbageFile(double ratio, uint64_t* file) const;
+
+    // Call "fn" with the key, pointer and value of every record in "file" in
+    // order, until it returns false. A record cut short by a crash ends the
+    // file.
+    StorageStatus ForEachRecord(
+        uint64_t file,
+        const std::function<bool(const leveldb::Slice& key,
+                                 const std::string& pointer,
+                                 const leveldb::Slice& value)>& fn) const;
+
+    // Delete "file", the readers which still keep it can go on reading it.
+    StorageStatus RemoveFile(uint64_t file);
+
+    static std::string EncodePointer(const Pointer& pointer);
+    static bool DecodePointer(const leveldb::Slice& input, Pointer* pointer);
+
+    // Return the bytes taken by a record.
+    static uint64_t RecordSize(size_t key_size, size_t value_size);
+
+   private:
+    std::string file_path(uint64_t number) const;
+
+    // Start a new file to append, called with "_append_mutex" held.
+    StorageStatus new_file();
+
+    std::string _dir;
+
+    // serializes the appends
+    bthread::Mutex _append_mutex;
+    // guards "_files", "_current", "_dead" and the sizes of the files
+    mutable bthread::Mutex _mutex;
+    std::shared_ptr<const FileSet> _files = std::make_shared<FileSet>();
+    std::shared_ptr<BlobFile> _current;  // the newest file
+    uint64_t _next_number = 1;
+    std::map<uint64_t, uint64_t> _dead;
+};
+
+}  // namespace storage
+}  // namespace azino
+
+#endif  // AZINO_STORAGE_INCLUDE_BLOB_H
@@ -0,0 +1,62 @@
+#ifndef AZINO_STORAGE_INCLUDE_GC_H
+#define AZINO_STORAGE_INCLUDE_GC_H
+
+#include <brpc/channel.h>
+#include <butil/macros.h>
+#include <gflags/gflags.h>
+
+#include <string>
+#include <vector>
+
+#include "azino/background_task.h"
+#include "azino/kv.h"
+#include "service/storage/storage.pb.h"
+#include "service/txplanner/txplanner.pb.h"
+
+DECLARE_bool(enable_storage_gc);
+
+namespace azino {
+namespace storage {
+class Storage;
+
+// MVCCGC removes the mvcc versions which no reader can see any more. With the
+// safe point of txplanner (min ats), only the newest version at or below it
+// is visible to the active and future transactions, so all the older
+// versions are garbage, and so is the newest one if it is a tombstone.
+//
+// A round walks the whole storage, and deletes the garbage in batches with a
+// pause between them, a fresh iterator is used for every batch so that no
+// snapshot is pinned for long.
+class MVCCGC : public azino::BackgroundTask {
+   public:
+    MVCCGC(Storage* storage, brpc::Channel* txplanner_channel);
+    DISALLOW_COPY_AND_ASSIGN(MVCCGC);
+    ~MVCCGC() = default;
+
+    // Collect the garbage internal keys below "safe_ts" into "garbage",
+    // starting from the encoded user key "start". If all the versions of a
+    // user key are garbage, its user key record is collected too. It stops
+    // at the first user key after at least "limit" keys are collected, and
+    // sets "next" to its encoded user key; "next" is cleared if the end is
+    // reached.
+    StorageStatus CollectGarbage(const std::string& start, TimeStamp safe_ts,
+                                 size_t limit,
+                                 std::vector<std::string>& garbage,
+                                 std::string& next);
+
+    // Collect and delete all the garbage below "safe_ts".
+    StorageStatus GCRound(TimeStamp safe_ts);
+
+   private:
+    bool get_min_ats(TimeStamp& min_ats);
+
+    static void* execute(void* args);
+
+    Storage* _storage;
+    txplanner::RegionService_Stub _txplanner_stub;
+};
+
+}  // namespace storage
+}  // namespace azino
+
+#endif  // AZINO_STORAGE_INCLUDE_GC_H
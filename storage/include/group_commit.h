@@ -0,0 +1,76 @@
+#ifndef AZINO_STORAGE_INCLUDE_GROUP_COMMIT_H
+#define AZINO_STORAGE_INCLUDE_GROUP_COMMIT_H
+
+#include <bthread/execution_queue.h>
+#include <butil/macros.h>
+#include <gflags/gflags.h>
+#include <google/protobuf/service.h>
+
+#include <vector>
+
+#include "io_pool.h"
+#include "service/storage/storage.pb.h"
+#include "storage.h"
+#include "wal_sync.h"
+
+DECLARE_bool(enable_group_commit);
+
+namespace azino {
+namespace storage {
+
+// GroupCommitter coalesces the concurrent BatchStore requests into groups.
+// The requests queued while a group is being written are combined and
+// written by one Storage::BatchStore, i.e. one leveldb write batch and one
+// log append, and acknowledged together when it is done.
+//
+// The requests are written in the order they are queued, so a later write of
+// the same key still wins. The groups are written on the write workers of
+// "io_pool" if it is not nullptr.
+//
+// A group is committed to "syncer" with the strongest durability of its
+// requests, so a group holding Sync requests is synced once for all of them.
+// The durability is ignored if "syncer" is nullptr.
+class GroupCommitter {
+   public:
+    GroupCommitter(Storage* storage, IOWorkerPool* io_pool = nullptr,
+                   WALSyncer* syncer = nullptr);
+    DISALLOW_COPY_AND_ASSIGN(GroupCommitter);
+    ~GroupCommitter();
+
+    // Queue "datas" to be written. "status" is set and "done" is run after
+    // the group containing them is written. The elements of "datas" are moved
+    // into the group, "datas", "status" and "done" should be valid until
+    // "done" is run.
+    void AsyncBatchStore(
+        std::vector<Storage::Data>* datas, StorageStatus* status,
+        google::protobuf::Closure* done,
+        Durability::Level durability = Durability::Default);
+
+    // Same as above, but block until "datas" is written.
+    StorageStatus BatchStore(
+        std::vector<Storage::Data>* datas,
+        Durability::Level durability = Durability::Default);
+
+   private:
+    typedef struct Task {
+        std::vector<Storage::Data>* datas;
+        StorageStatus* status;
+        google::protobuf::Closure* done;
+        Durability::Level durability;
+    } Task;
+
+    static int execute(void* args, bthread::TaskIterator<Task>& iter);
+
+    // Write "group" and acknowledge "tasks".
+    void commit(std::vector<Storage::Data>& group, std::vector<Task>& tasks);
+
+    Storage* _storage;
+    IOWorkerPool* _io_pool;
+    WALSyncer* _syncer;
+    bthread::ExecutionQueueId<Task> _queue;
+};
+
+}  // namespace storage
+}  // namespace azino
+
+#endif  // AZINO_STORAGE_INCLUDE_GROUP_COMMIT_H
@@ -0,0 +1,63 @@
+#ifndef AZINO_STORAGE_INCLUDE_IO_POOL_H
+#define AZINO_STORAGE_INCLUDE_IO_POOL_H
+
+#include <butil/macros.h>
+#include <gflags/gflags.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+DECLARE_int32(storage_io_read_threads);
+DECLARE_int32(storage_io_write_threads);
+
+namespace azino {
+namespace storage {
+
+// IOWorkerPool runs the blocking storage calls on its own pthreads, so that a
+// stalled leveldb write (e.g. a level-0 slowdown or a slow fsync) parks an io
+// worker instead of a bthread worker. Reads and writes have separate queues
+// and workers, reads keep flowing while all the writers are stalled.
+class IOWorkerPool {
+   public:
+    enum Queue { READ = 0, WRITE = 1 };
+
+    // A queue without worker runs its tasks in the calling thread.
+    IOWorkerPool(int read_threads, int write_threads);
+    DISALLOW_COPY_AND_ASSIGN(IOWorkerPool);
+    ~IOWorkerPool();
+
+    // Stop the workers, the queued tasks are run before they quit. It is
+    // called on destruction if not yet.
+    void Stop();
+
+    // Queue "fn" to a worker of "queue" and return true. Return false without
+    // queueing if the caller should run "fn" itself: "queue" has no worker,
+    // the pool is stopped, or the caller is already a worker of the pool.
+    bool Dispatch(Queue queue, std::function<void()> fn);
+
+    // Run "fn" on a worker of "queue" and wait until it is done. A calling
+    // bthread is suspended rather than blocking its worker.
+    void Run(Queue queue, const std::function<void()>& fn);
+
+   private:
+    typedef struct TaskQueue {
+        std::mutex mutex;
+        std::condition_variable cond;
+        std::deque<std::function<void()>> tasks;
+        std::vector<std::thread> workers;
+        bool stopped = false;
+    } TaskQueue;
+
+    void work(Queue queue);
+
+    TaskQueue _queues[2];
+};
+
+}  // namespace storage
+}  // namespace azino
+
+#endif  // AZINO_STORAGE_INCLUDE_IO_POOL_H
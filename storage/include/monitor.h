@@ -0,0 +1,59 @@
+#ifndef AZINO_STORAGE_INCLUDE_MONITOR_H
+#define AZINO_STORAGE_INCLUDE_MONITOR_H
+
+#include <butil/macros.h>
+#include <bvar/bvar.h>
+#include <gflags/gflags.h>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "azino/background_task.h"
+#include "service/storage/storage.pb.h"
+#include "storage.h"
+
+DECLARE_int32(storage_monitor_period_ms);
+
+namespace azino {
+namespace storage {
+
+// StorageMonitor refreshes the stats of the storage engine periodically,
+// exposes them as bvars, and turns them into the Backpressure returned to
+// the writers. The level is the highest of:
+//   level-0 tables  from the compaction trigger (4) to the stop trigger (12)
+//   pending bytes   up to -storage_backpressure_pending_bytes
+//   write stalls    the share of the last period spent in stalled writes
+// and the delay grows with it up to -storage_backpressure_max_delay_ms.
+class StorageMonitor : public azino::BackgroundTask {
+   public:
+    StorageMonitor(Storage* storage);
+    DISALLOW_COPY_AND_ASSIGN(StorageMonitor);
+    ~StorageMonitor() = default;
+
+    // Read the stats and update the bvars and the backpressure.
+    void Refresh();
+
+    // Return the backpressure as of the last refresh.
+    Backpressure Current() const;
+
+   private:
+    static void* execute(void* args);
+
+    Storage* _storage;
+    int64_t _last_refresh_us;
+    int64_t _last_stall_us;
+    std::atomic<uint32_t> _level;
+    std::atomic<uint32_t> _delay_ms;
+
+    bvar::Status<int64_t> _level0_files;
+    bvar::Status<int64_t> _pending_compaction_bytes;
+    bvar::Status<int64_t> _write_stall_us;
+    bvar::Status<int64_t> _backpressure;
+    bvar::Status<std::string> _engine_stats;
+};
+
+}  // namespace storage
+}  // namespace azino
+
+#endif  // AZINO_STORAGE_INCLUDE_MONITOR_H
@@ -0,0 +1,58 @@
+#ifndef AZINO_STORAGE_INCLUDE_PARALLEL_SCAN_H
+#define AZINO_STORAGE_INCLUDE_PARALLEL_SCAN_H
+
+#include <butil/macros.h>
+#include <gflags/gflags.h>
+
+#include <string>
+#include <vector>
+
+#include "azino/kv.h"
+#include "service/storage/storage.pb.h"
+#include "storage.h"
+
+DECLARE_int32(storage_scan_parallelism);
+DECLARE_int64(storage_scan_split_bytes);
+
+namespace azino {
+namespace storage {
+
+// ParallelScanner splits a large mvcc scan into sub-ranges of about the same
+// size on disk, as told by Storage::ApproximateSizes, and scans them on
+// their own bthreads, with iterators on one snapshot (see
+// Storage::NewIterators). The results are stitched back in key order, so it
+// answers exactly like Storage::MVCCScan.
+//
+// Only the scans with neither a limit nor max bytes, such as the aggregating
+// ones, are split. A bounded scan goes to Storage::MVCCScan as is, since every
+// sub-range would read up to the bounds and all but the first be dropped.
+// That is why the batches of a streaming scan (StorageService.MVCCScanStream)
+// are never split, only its whole-range aggregate is.
+class ParallelScanner {
+   public:
+    ParallelScanner(Storage* storage) : _storage(storage) {}
+    DISALLOW_COPY_AND_ASSIGN(ParallelScanner);
+    ~ParallelScanner() = default;
+
+    StorageStatus MVCCScan(const std::string& left_key,
+                           const std::string& right_key, TimeStamp ts,
+                           const Storage::ScanOptions& options,
+                           std::vector<std::string>& key,
+                           std::vector<std::string>& value,
+                           std::vector<TimeStamp>& seeked_ts,
+                           std::string& resume_key);
+
+    // Return the user keys which split [left_key, right_key) into at most
+    // -storage_scan_parallelism sub-ranges of at least
+    // -storage_scan_split_bytes. Empty if the range is not worth splitting.
+    std::vector<std::string> Split(const std::string& left_key,
+                                   const std::string& right_key);
+
+   private:
+    Storage* _storage;
+};
+
+}  // namespace storage
+}  // namespace azino
+
+#endif  // AZINO_STORAGE_INCLUDE_PARALLEL_SCAN_H
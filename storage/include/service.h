@@ -1,17 +1,32 @@
 #ifndef AZINO_STORAGE_INCLUDE_SERVICE_H
 #define AZINO_STORAGE_INCLUDE_SERVICE_H
 
+#include <brpc/channel.h>
+#include <bthread/condition_variable.h>
+#include <bthread/mutex.h>
+
+#include <memory>
+
+#include "gc.h"
+#include "group_commit.h"
+#include "io_pool.h"
+#include "monitor.h"
+#include "parallel_scan.h"
+#include "sharded.h"
+#include "snapshot_export.h"
 #include "service/storage/storage.pb.h"
 #include "storage.h"
+#include "version_cache.h"
+#include "wal_sync.h"
 
 namespace azino {
 namespace storage {
 
 class StorageServiceImpl : public StorageService {
    public:
-    StorageServiceImpl();
+    StorageServiceImpl(brpc::Channel* txplanner_channel);
 
-    virtual ~StorageServiceImpl() = default;
+    virtual ~StorageServiceImpl();
 
     virtual void MVCCPut(::google::protobuf::RpcController* controller,
                          const ::azino::storage::MVCCPutRequest* request,
@@ -23,6 +38,12 @@ class StorageServiceImpl : public StorageService {
                          ::azino::storage::MVCCGetResponse* response,
                          ::google::protobuf::Closure* done) override;
 
+    virtual void BatchMVCCGet(
+        ::google::protobuf::RpcController* controller,
+        const ::azino::storage::BatchMVCCGetRequest* request,
+        ::azino::storage::BatchMVCCGetResponse* response,
+        ::google::protobuf::Closure* done) override;
+
     virtual void MVCCDelete(::google::protobuf::RpcController* controller,
                             const ::azino::storage::MVCCDeleteRequest* request,
                             ::azino::storage::MVCCDeleteResponse* response,
@@ -33,13 +54,43 @@ class StorageServiceImpl : public StorageService {
                           ::azino::storage::MVCCScanResponse* response,
                           ::google::protobuf::Closure* done) override;
 
+    virtual void MVCCScanStream(
+        ::google::protobuf::RpcController* controller,
+        const ::azino::storage::MVCCScanRequest* request,
+        ::azino::storage::MVCCScanResponse* response,
+        ::google::protobuf::Closure* done) override;
+
     virtual void BatchStore(::google::protobuf::RpcController* controller,
                             const ::azino::storage::BatchStoreRequest* request,
                             ::azino::storage::BatchStoreResponse* response,
                             ::google::protobuf::Closure* done) override;
 
+    virtual void BulkLoad(::google::protobuf::RpcController* controller,
+                          const ::azino::storage::BulkLoadRequest* request,
+                          ::azino::storage::BulkLoadResponse* response,
+                          ::google::protobuf::Closure* done) override;
+
+    virtual void ExportSnapshot(
+        ::google::protobuf::RpcController* controller,
+        const ::azino::storage::ExportSnapshotRequest* request,
+        ::azino::storage::ExportSnapshotResponse* response,
+        ::google::protobuf::Closure* done) override;
+
    private:
+    void on_stream_closed();
+
     std::unique_ptr<Storage> _storage;
+    std::unique_ptr<IOWorkerPool> _io_pool;
+    std::unique_ptr<WALSyncer> _syncer;
+    std::unique_ptr<MVCCGC> _gc;
+    std::unique_ptr<GroupCommitter> _committer;
+    std::unique_ptr<ParallelScanner> _scanner;
+    std::unique_ptr<StorageMonitor> _monitor;
+
+    // the running scan streams, which are waited for on destruction
+    bthread::Mutex _stream_mutex;
+    bthread::ConditionVariable _stream_cond;
+    int _streams = 0;
 };
 
 }  // namespace storage
@@ -0,0 +1,141 @@
+#ifndef AZINO_STORAGE_INCLUDE_SHARDED_H
+#define AZINO_STORAGE_INCLUDE_SHARDED_H
+
+#include <bthread/mutex.h>
+#include <butil/macros.h>
+#include <gflags/gflags.h>
+#include <leveldb/iterator.h>
+#include <leveldb/slice.h>
+
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "azino/kv.h"
+#include "service/storage/storage.pb.h"
+#include "storage.h"
+
+DECLARE_int32(storage_shards);
+
+namespace azino {
+namespace storage {
+
+// ShardedStorage splits the key space into ranges of user keys, and keeps
+// each range in its own Storage (a leveldb instance on its own directory), so
+// that the writes and compactions of different ranges go on in parallel.
+//
+// All the versions of a user key, and its user key record, are in the same
+// shard. Raw keys are routed by themselves, compared with the encoded split
+// keys (see InternalKey::EncodeUserKey). Shards are ordered, so an iterator
+// walks them one after another.
+//
+// The shard layout is checked on Open, a database can not be reopened with
+// different split keys.
+class ShardedStorage : public Storage {
+   public:
+    // The layout is read from the flags on Open, see -storage_shards,
+    // -storage_shard_split_keys and -storage_shard_paths.
+    ShardedStorage() = default;
+    DISALLOW_COPY_AND_ASSIGN(ShardedStorage);
+    virtual ~ShardedStorage() = default;
+
+    // "name" is a directory which holds the shards, unless
+    // -storage_shard_paths is set.
+    virtual StorageStatus Open(const std::string& name) override;
+
+    virtual StorageStatus Put(const std::string& key,
+                              const std::string& value) override;
+
+    virtual StorageStatus Delete(const std::string& key) override;
+
+    virtual StorageStatus Get(const std::string& key,
+                              std::string& value) override;
+
+    virtual StorageStatus Seek(const std::string& key, std::string& found_key,
+                               std::string& value) override;
+
+    virtual leveldb::Iterator* NewIterator(TimeStamp ts) override;
+
+    virtual leveldb::Iterator* NewSnapshotIterator(TimeStamp ts) override;
+
+    // Every shard gives its iterators on one snapshot of its own.
+    virtual std::vector<std::unique_ptr<leveldb::Iterator>> NewIterators(
+        TimeStamp ts, size_t n) override;
+
+    // Read from the shard of "key" alone, which holds all of its versions.
+    virtual StorageStatus MVCCGet(const std::string& key, TimeStamp ts,
+                                  std::string& value,
+                                  TimeStamp& seeked_ts) override;
+
+    virtual bool MVCCKeyMayExist(const std::string& key) override;
+
+    // The datas of different shards are written in parallel, a batch is
+    // atomic within each shard only.
+    virtual StorageStatus BatchStore(const std::vector<Data>& datas) override;
+
+    // The shards written are synced, in parallel too.
+    virtual StorageStatus SyncBatchStore(
+        const std::vector<Data>& datas) override;
+
+    virtual StorageStatus BatchDelete(
+        const std::vector<std::string>& keys) override;
+
+    // The shards are synced in parallel.
+    virtual StorageStatus Sync() override;
+
+    // The sizes of all the shards are added up.
+    virtual void ApproximateSizes(const std::vector<std::string>& bounds,
+                                  std::vector<uint64_t>& sizes) override;
+
+    // The level-0 tables are those of the fullest shard, the other stats are
+    // added up.
+    virtual void GetStats(Stats& stats) override;
+
+    virtual StorageStatus BulkLoad(TimeStamp ts,
+                                   const std::vector<Data>& datas) override;
+
+    // The shards share the hidden loads, a load stays hidden in all of them
+    // until it is finished in every one, then it is revealed at once. Once
+    // the loaded versions are synced, the load is recorded as being
+    // finished, so it is finished on Open() if interrupted by a crash.
+    virtual StorageStatus FinishBulkLoad(TimeStamp ts) override;
+
+    virtual StorageStatus AbortBulkLoad(TimeStamp ts) override;
+
+    size_t ShardCount() const { return _shards.size(); }
+
+    // Return the index of the shard which "key" belongs to.
+    size_t ShardOf(const leveldb::Slice& key) const;
+
+    // Return the key a raw or internal key is routed by.
+    static leveldb::Slice RouteKey(const leveldb::Slice& key);
+
+   private:
+    friend class ShardedIterator;
+
+    StorageStatus check_layout(size_t i);
+
+    // Finish the bulk loads recorded as being finished.
+    StorageStatus finish_bulk_loads();
+
+    StorageStatus batch_store(const std::vector<Data>& datas, bool sync);
+
+    // encoded split keys, shard i holds the route keys in
+    // [_split_keys[i - 1], _split_keys[i])
+    std::vector<std::string> _split_keys;
+    std::vector<std::unique_ptr<Storage>> _shards;
+
+    std::shared_ptr<HiddenLoads> _hidden_loads =
+        std::make_shared<HiddenLoads>();
+    // serializes the finishes and aborts of the bulk loads
+    bthread::Mutex _load_mutex;
+    // loads which may be recorded as being finished, held in
+    // "_hidden_loads" and guarded by "_load_mutex"
+    std::set<TimeStamp> _finishing;
+};
+
+}  // namespace storage
+}  // namespace azino
+
+#endif  // AZINO_STORAGE_INCLUDE_SHARDED_H
@@ -0,0 +1,64 @@
+#ifndef AZINO_STORAGE_INCLUDE_SNAPSHOT_EXPORT_H
+#define AZINO_STORAGE_INCLUDE_SNAPSHOT_EXPORT_H
+
+#include <butil/macros.h>
+#include <gflags/gflags.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "azino/kv.h"
+#include "service/storage/storage.pb.h"
+#include "storage.h"
+
+DECLARE_int64(storage_export_bytes_per_sec);
+
+namespace azino {
+namespace storage {
+
+// SnapshotExport reads the visible versions of [left_key, right_key) at "ts"
+// batch by batch from one snapshot iterator (see Storage::NewSnapshotIterator),
+// so all the batches are consistent however long the export takes, and the
+// versions collected by gc meanwhile are still read.
+//
+// The reads are throttled to "bytes_per_sec", which is capped by
+// -storage_export_bytes_per_sec.
+class SnapshotExport {
+   public:
+    SnapshotExport(Storage* storage, const std::string& left_key,
+                   const std::string& right_key, TimeStamp ts,
+                   uint64_t bytes_per_sec);
+    DISALLOW_COPY_AND_ASSIGN(SnapshotExport);
+    ~SnapshotExport() = default;
+
+    // Read the next batch of about "max_bytes". "resume_key" is set like
+    // Storage::MVCCScan, the export is done once it is empty.
+    StorageStatus Next(size_t max_bytes, std::vector<std::string>& key,
+                       std::vector<std::string>& value,
+                       std::vector<TimeStamp>& seeked_ts,
+                       std::string& resume_key);
+
+    // Sleep until the bytes read so far are within the rate.
+    void Throttle();
+
+    bool Done() const { return _done; }
+
+    uint64_t bytes() const { return _bytes; }
+
+   private:
+    std::unique_ptr<leveldb::Iterator> _iter;
+    std::string _left_key;
+    const std::string _right_key;
+    const TimeStamp _ts;
+    uint64_t _bytes_per_sec;
+    const int64_t _start_us;
+    uint64_t _bytes;
+    bool _done;
+};
+
+}  // namespace storage
+}  // namespace azino
+
+#endif  // AZINO_STORAGE_INCLUDE_SNAPSHOT_EXPORT_H
@@ -1,25 +1,89 @@
 #ifndef AZINO_STORAGE_INCLUDE_STORAGE_H
 #define AZINO_STORAGE_INCLUDE_STORAGE_H
 
+#include <bthread/mutex.h>
 #include <butil/logging.h>
 #include <butil/macros.h>
+#include <gflags/gflags.h>
+#include <leveldb/iterator.h>
 
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include "azino/comparator.h"
 #include "azino/kv.h"
 #include "service/storage/storage.pb.h"
 #include "utils.h"
 
+DECLARE_int32(mvcc_scan_max_skipped_versions);
+DECLARE_string(storage_engine);
+
 namespace azino {
 namespace storage {
 
+// The timestamps of the bulk loads not finished yet, whose loaded versions
+// are hidden from the readers. A timestamp stays hidden as long as anyone
+// holds it, so the shards of a ShardedStorage share one and reveal a load in
+// all of them at once.
+class HiddenLoads {
+   public:
+    typedef std::multiset<TimeStamp> TimeStampSet;
+
+    HiddenLoads() : _timestamps(std::make_shared<TimeStampSet>()) {}
+    DISALLOW_COPY_AND_ASSIGN(HiddenLoads);
+    ~HiddenLoads() = default;
+
+    // Return the timestamps hidden now, the set returned never changes.
+    std::shared_ptr<const TimeStampSet> Get() {
+        std::lock_guard<bthread::Mutex> lck(_mutex);
+        return _timestamps;
+    }
+
+    void Hold(TimeStamp ts) {
+        std::lock_guard<bthread::Mutex> lck(_mutex);
+        auto timestamps = std::make_shared<TimeStampSet>(*_timestamps);
+        timestamps->insert(ts);
+        _timestamps = std::move(timestamps);
+    }
+
+    void Release(TimeStamp ts) {
+        std::lock_guard<bthread::Mutex> lck(_mutex);
+        auto it = _timestamps->find(ts);
+        if (it == _timestamps->end()) {
+            return;
+        }
+        auto timestamps = std::make_shared<TimeStampSet>(*_timestamps);
+        timestamps->erase(timestamps->find(ts));
+        _timestamps = std::move(timestamps);
+        _reveals++;
+    }
+
+    // Return the number of times a hold is released, which tells whether
+    // the sets got in between are the same.
+    uint64_t Reveals() {
+        std::lock_guard<bthread::Mutex> lck(_mutex);
+        return _reveals;
+    }
+
+   private:
+    bthread::Mutex _mutex;
+    std::shared_ptr<const TimeStampSet> _timestamps;
+    uint64_t _reveals = 0;
+};
+
 class Storage {
    public:
-    // return the default Storage impl
+    // return the default Storage impl, see -storage_engine
     static Storage* DefaultStorage();
 
+    // return an in-memory Storage impl, which keeps nothing on disk
+    static Storage* InMemoryStorage();
+
     Storage() = default;
     DISALLOW_COPY_AND_ASSIGN(Storage);
     virtual ~Storage() = default;
@@ -56,17 +120,165 @@ class Storage {
     virtual StorageStatus Seek(const std::string& key, std::string& found_key,
                                std::string& value) = 0;
 
+    // Return a heap-allocated iterator over a consistent snapshot of the
+    // database. The caller should delete the iterator when it is no longer
+    // needed.
+    //
+    // The iterator is only used to read mvcc versions whose timestamp is not
+    // bigger than "ts", so the snapshot may be shared with other readers and
+    // miss the writes of bigger timestamps. Pass MAX_TIMESTAMP to see all the
+    // completed writes.
+    //
+    // Return nullptr if the database is not opened.
+    virtual leveldb::Iterator* NewIterator(TimeStamp ts) = 0;
+
+    // Return an iterator like NewIterator(), but on a snapshot of its own
+    // taken now, for long reads such as exports. Its reads should not fill
+    // the block cache, so they do not evict the blocks of foreground reads.
+    virtual leveldb::Iterator* NewSnapshotIterator(TimeStamp ts) {
+        return NewIterator(ts);
+    }
+
+    // Return "n" iterators like NewIterator(), all on one snapshot, so that
+    // they read the same point in time from different threads. Empty if the
+    // database is not opened. By default they are taken one by one.
+    virtual std::vector<std::unique_ptr<leveldb::Iterator>> NewIterators(
+        TimeStamp ts, size_t n) {
+        std::vector<std::unique_ptr<leveldb::Iterator>> iters;
+        for (size_t i = 0; i < n; i++) {
+            iters.emplace_back(NewIterator(ts));
+            if (iters.back() == nullptr) {
+                iters.clear();
+                break;
+            }
+        }
+        return iters;
+    }
+
+    // Return false if "key" surely has no mvcc version, then a read of it can
+    // return NotFound without seeking. It may return true for a key which has
+    // no version.
+    virtual bool MVCCKeyMayExist(const std::string& key) { return true; }
+
+    // Seek "iter" to "key", and store the found key and value like Seek().
+    static StorageStatus IteratorSeek(leveldb::Iterator* iter,
+                                      const std::string& key,
+                                      std::string& found_key,
+                                      std::string& value) {
+        StorageStatus ss;
+        if (iter == nullptr) {
+            ss.set_error_code(StorageStatus::InvalidArgument);
+            ss.set_error_message("Fail to create an iterator");
+            return ss;
+        }
+        iter->Seek(key);
+        if (iter->Valid()) {
+            found_key.assign(iter->key().data(), iter->key().size());
+            value.assign(iter->value().data(), iter->value().size());
+            ss.set_error_code(StorageStatus::Ok);
+        } else if (iter->status().ok()) {
+            ss.set_error_code(StorageStatus::NotFound);
+        } else {
+            ss.set_error_code(iter->status().IsCorruption()
+                                  ? StorageStatus::Corruption
+                                  : StorageStatus::IOError);
+            ss.set_error_message(iter->status().ToString());
+        }
+        return ss;
+    }
+
     struct Data {
-        const std::string key;
-        const std::string value;
-        const TimeStamp ts;
-        const bool is_delete;
+        std::string key;
+        std::string value;
+        TimeStamp ts;
+        bool is_delete;
     };
     // Add a series of database entries for "key" to "value" with timestamp "ts"
     // and tag "is_delete".  Returns OK on success, and a non-OK status on
     // error.
     virtual StorageStatus BatchStore(const std::vector<Data>& datas) = 0;
 
+    // Same as BatchStore, but the write is durable once it returns.
+    virtual StorageStatus SyncBatchStore(const std::vector<Data>& datas) {
+        StorageStatus ss = BatchStore(datas);
+        if (ss.error_code() == StorageStatus::Ok) {
+            ss = Sync();
+        }
+        return ss;
+    }
+
+    // Remove the database entries (if any) for "keys" in one batch.  Returns
+    // OK on success, and a non-OK status on error.
+    //
+    // Meant for keys invisible to all the readers, e.g. mvcc versions
+    // shadowed by newer ones for every active read timestamp.
+    virtual StorageStatus BatchDelete(const std::vector<std::string>& keys) = 0;
+
+    // Make all the completed writes durable, i.e. sync the write-ahead log
+    // to disk.  The writes other than SyncBatchStore never wait for it, see
+    // WALSyncer.  Returns OK on success, and a non-OK status on error.
+    virtual StorageStatus Sync() {
+        StorageStatus ss;
+        ss.set_error_code(StorageStatus::Ok);
+        return ss;
+    }
+
+    // Store in "sizes" the approximate bytes on disk taken by the versions of
+    // the user keys in [bounds[i], bounds[i + 1]), for every i. The sizes
+    // are 0 if unknown.
+    virtual void ApproximateSizes(const std::vector<std::string>& bounds,
+                                  std::vector<uint64_t>& sizes) {
+        sizes.assign(bounds.empty() ? 0 : bounds.size() - 1, 0);
+    }
+
+    struct Stats {
+        // number of level-0 tables, which slow down and then stop the
+        // writes once there are too many of them
+        int64_t level0_files = 0;
+        // estimated bytes the compactions are behind by
+        int64_t pending_compaction_bytes = 0;
+        // total time spent in the writes held back by the engine
+        int64_t write_stall_us = 0;
+        // human readable stats of the engine, e.g. "leveldb.stats"
+        std::string engine_stats;
+    };
+
+    // Store the current stats in "stats", they are 0 if unknown.
+    virtual void GetStats(Stats& stats) { stats = Stats(); }
+
+    // Write "datas" as versions of timestamp "ts" (Data::ts is ignored),
+    // bypassing transactions. The versions are tagged as loaded, see
+    // InternalKey::SetLoadFlag(), and are invisible to the readers, even
+    // across restarts, until FinishBulkLoad(ts) makes all of them visible at
+    // once, or AbortBulkLoad(ts) removes them. The versions of "ts" not
+    // loaded are left alone, still "ts" should be reserved from txplanner,
+    // e.g. as the commit timestamp of an empty transaction.
+    virtual StorageStatus BulkLoad(TimeStamp ts,
+                                   const std::vector<Data>& datas) {
+        StorageStatus ss;
+        ss.set_error_code(StorageStatus::NotSupported);
+        ss.set_error_message("Bulk load is not supported");
+        return ss;
+    }
+
+    virtual StorageStatus FinishBulkLoad(TimeStamp ts) {
+        StorageStatus ss;
+        ss.set_error_code(StorageStatus::NotSupported);
+        ss.set_error_message("Bulk load is not supported");
+        return ss;
+    }
+
+    virtual StorageStatus AbortBulkLoad(TimeStamp ts) {
+        StorageStatus ss;
+        ss.set_error_code(StorageStatus::NotSupported);
+        ss.set_error_message("Bulk load is not supported");
+        return ss;
+    }
+
+    // Hide the bulk loads in "loads", which is shared with other storages,
+    // instead of a set of its own. Called before Open().
+    virtual void ShareHiddenLoads(std::shared_ptr<HiddenLoads> loads) {}
+
     // Add a database entry for "key" to "value" with timestamp "ts".  Returns
     // OK on success, and a non-OK status on error.
     virtual StorageStatus MVCCPut(const std::string& key, TimeStamp ts,
@@ -95,38 +307,58 @@ class Storage {
     // May return some other Status on an error.
     virtual StorageStatus MVCCGet(const std::string& key, TimeStamp ts,
                                   std::string& value, TimeStamp& seeked_ts) {
+        StorageStatus ss;
+        if (!MVCCKeyMayExist(key)) {
+            LOG(INFO) << " Not found mvcc key: " << key << " read ts: " << ts
+                      << " filtered ";
+            ss.set_error_code(StorageStatus_Code_NotFound);
+            return ss;
+        }
+
         auto internal_key = InternalKey(key, ts, false);
         std::string found_key, found_value;
-        StorageStatus ss = Seek(internal_key.Encode(), found_key, found_value);
+        std::unique_ptr<leveldb::Iterator> iter(NewIterator(ts));
+        ss = IteratorSeek(iter.get(), internal_key.Encode(), found_key,
+                          found_value);
 
         if (ss.error_code() == StorageStatus::Ok) {
-            auto found_internal_key = InternalKey(found_key);
-            bool isValid = found_internal_key.Valid();
-            bool isMatch = found_internal_key.UserKey() == key;
-            bool isDeleted = found_internal_key.IsDelete();
-            if (!isValid) {
+            ParsedInternalKey found_internal_key;
+            bool isInternal = InternalKey::IsInternalKey(found_key);
+            bool isValid = InternalKey::Parse(found_key, &found_internal_key);
+            if (!isInternal) {
+                LOG(INFO) << " Not found mvcc key: " << key
+                          << " read ts: " << ts << " mvcc keys end ";
+                ss.set_error_code(StorageStatus_Code_NotFound);
+                return ss;
+            } else if (!isValid) {
                 LOG(ERROR) << " Fail to find mvcc key: " << key
                            << " read ts: " << ts;
                 ss.set_error_code(StorageStatus_Code_Corruption);
                 return ss;
-            } else if (!isMatch) {
+            }
+
+            bool isMatch = found_internal_key.user_key ==
+                           InternalKey::EncodeUserKey(key);
+            bool isDeleted = found_internal_key.is_delete;
+            if (!isMatch) {
                 LOG(INFO) << " Not found mvcc key: " << key
-                          << " read ts: " << ts
-                          << " found key: " << found_internal_key.UserKey()
-                          << " found ts: " << seeked_ts
-                          << " found value: " << found_value;
+                          << " read ts: " << ts << " found key: "
+                          << InternalKey::DecodeUserKey(
+                                 found_internal_key.user_key)
+                          << " found ts: " << found_internal_key.ts;
                 ss.set_error_code(StorageStatus_Code_NotFound);
                 return ss;
             } else if (isDeleted) {
                 LOG(INFO) << " Not found mvcc key: " << key
-                          << " read ts: " << ts << " found ts: " << seeked_ts
+                          << " read ts: " << ts
+                          << " found ts: " << found_internal_key.ts
                           << " who's value is deleted";
                 ss.set_error_code(StorageStatus_Code_NotFound);
                 return ss;
             } else {
                 LOG(INFO) << " Found mvcc key: " << key << " read ts: " << ts;
-                value = found_value;
-                seeked_ts = found_internal_key.TS();
+                value.swap(found_value);
+                seeked_ts = found_internal_key.ts;
                 ss.set_error_code(StorageStatus_Code_Ok);
                 return ss;
             }
@@ -140,12 +372,101 @@ class Storage {
         }
     }
 
+    // Same as MVCCGet, but for each of "keys" at the same timestamp "ts". The
+    // result of keys[i] is stored in values[i], seeked_ts[i] and statuses[i].
+    // Returns OK if the batch is served, the status of a single key is in
+    // "statuses".
+    //
+    // The keys are served in bitwise order from one iterator over a
+    // consistent snapshot, the iterator is moved forward by Next() if the
+    // next key is nearby, otherwise by Seek().
+    virtual StorageStatus BatchMVCCGet(const std::vector<std::string>& keys,
+                                       TimeStamp ts,
+                                       std::vector<std::string>& values,
+                                       std::vector<TimeStamp>& seeked_ts,
+                                       std::vector<StorageStatus>& statuses) {
+        StorageStatus ss;
+        std::unique_ptr<leveldb::Iterator> iter(NewIterator(ts));
+        if (iter == nullptr) {
+            ss.set_error_code(StorageStatus::InvalidArgument);
+            ss.set_error_message("Fail to create an iterator");
+            return ss;
+        }
+
+        values.assign(keys.size(), std::string());
+        seeked_ts.assign(keys.size(), 0);
+        statuses.assign(keys.size(), StorageStatus());
+        std::vector<size_t> order(keys.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+        BitWiseComparator cmp;
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return cmp(keys[a], keys[b]);
+        });
+
+        std::string user_key, target;
+        for (size_t i : order) {
+            if (!MVCCKeyMayExist(keys[i])) {
+                statuses[i].set_error_code(StorageStatus::NotFound);
+                continue;
+            }
+            user_key = InternalKey::EncodeUserKey(keys[i]);
+            target = user_key;
+            InternalKey::EncodeSuffix(ts, false, &target);
+
+            // The iterator is on the first key not less than the previous
+            // target, so there is nothing to do if it is not less than
+            // "target" too.
+            int skipped = 0;
+            while (iter->Valid() && iter->key().compare(target) < 0 &&
+                   skipped++ < FLAGS_mvcc_scan_max_skipped_versions) {
+                iter->Next();
+            }
+            if (!iter->Valid() || iter->key().compare(target) < 0) {
+                if (!iter->status().ok()) {
+                    break;
+                }
+                iter->Seek(target);
+            }
+
+            ParsedInternalKey parsed;
+            if (!iter->Valid() || !InternalKey::IsInternalKey(iter->key())) {
+                statuses[i].set_error_code(StorageStatus::NotFound);
+            } else if (!InternalKey::Parse(iter->key(), &parsed)) {
+                LOG(ERROR) << " Fail to find mvcc key: " << keys[i]
+                           << " read ts: " << ts;
+                statuses[i].set_error_code(StorageStatus::Corruption);
+            } else if (parsed.user_key != user_key || parsed.is_delete) {
+                statuses[i].set_error_code(StorageStatus::NotFound);
+            } else {
+                values[i] = iter->value().ToString();
+                seeked_ts[i] = parsed.ts;
+                statuses[i].set_error_code(StorageStatus::Ok);
+            }
+        }
+
+        if (!iter->status().ok()) {
+            LOG(ERROR) << " Fail to batch get mvcc keys read ts: " << ts
+                       << " error: " << iter->status().ToString();
+            ss.set_error_code(StorageStatus_Code_IOError);
+            ss.set_error_message(iter->status().ToString());
+            return ss;
+        }
+        ss.set_error_code(StorageStatus_Code_Ok);
+        return ss;
+    }
+
     virtual StorageStatus MVCCNextKey(const std::string key,
                                       std::string& next_key) {
         auto internal_key = InternalKey(key, MIN_TIMESTAMP, false);
         std::string found_key, found_value;
         auto ss = Seek(internal_key.Encode(), found_key, found_value);
         if (ss.error_code() == StorageStatus::Ok) {
+            if (!InternalKey::IsInternalKey(found_key)) {
+                ss.set_error_code(StorageStatus_Code_NotFound);
+                return ss;
+            }
             auto found_internal_key = InternalKey(found_key);
             bool isValid = found_internal_key.Valid();
             if (!isValid) {
@@ -160,69 +481,219 @@ class Storage {
         return ss;
     }
 
+    // The keys matched by an aggregating scan, in key order.
+    struct ScanAggregate {
+        uint64_t count = 0;
+        std::string min_key;
+        std::string max_key;
+    };
+
+    struct ScanOptions {
+        // Max number of keys returned, 0 means no limit.
+        size_t limit = 0;
+        // Stop once the returned keys and values take up "max_bytes" bytes,
+        // at least one key is returned. 0 means no limit.
+        size_t max_bytes = 0;
+        // Return the keys and timestamps only, "value" is left untouched.
+        bool keys_only = false;
+        // Filters evaluated by the scan, only the keys matching all of them
+        // are returned. "value_equals" is compared only if "match_value".
+        std::string key_prefix;
+        std::string value_prefix;
+        bool match_value = false;
+        std::string value_equals;
+        // If not nullptr, the matched keys are added to it instead of being
+        // returned, they still count for "limit". The scans adding to the
+        // same aggregate should go in key order.
+        ScanAggregate* aggregate = nullptr;
+    };
+
+    // Narrow [left_key, right_key) to the user keys starting with "prefix".
+    static void NarrowToPrefix(const std::string& prefix,
+                               std::string& left_key,
+                               std::string& right_key) {
+        if (prefix.empty()) {
+            return;
+        }
+        if (left_key < prefix) {
+            left_key = prefix;
+        }
+        // the smallest key after all the keys starting with "prefix"
+        std::string end = prefix;
+        while (!end.empty() && uint8_t(end.back()) == 0xff) {
+            end.pop_back();
+        }
+        if (!end.empty()) {
+            end.back()++;
+            if (right_key.empty() || right_key > end) {
+                right_key = end;
+            }
+        }
+    }
+
+    static bool MatchValue(const ScanOptions& options,
+                           const leveldb::Slice& value) {
+        return value.starts_with(options.value_prefix) &&
+               (!options.match_value || value == options.value_equals);
+    }
+
+    // Return all the visible versions of the user keys in [left_key,
+    // right_key) at timestamp "ts", deleted ones are skipped. An empty
+    // "right_key" means no limit, like the ranges of partitions.
     virtual StorageStatus MVCCScan(const std::string& left_key,
                                    const std::string& right_key, TimeStamp ts,
                                    std::vector<std::string>& key,
                                    std::vector<std::string>& value,
                                    std::vector<TimeStamp>& seeked_ts) {
+        std::string resume_key;
+        return MVCCScan(left_key, right_key, ts, ScanOptions(), key, value,
+                        seeked_ts, resume_key);
+    }
+
+    // Same as above, but the scan stops once "options.limit" or
+    // "options.max_bytes" is reached. If it stops before "right_key",
+    // "resume_key" is set to the first user key not returned, which should be
+    // the "left_key" of the next scan; otherwise "resume_key" is cleared.
+    // The filters of "options" are applied to the visible versions, a key
+    // prefix narrows the range scanned.
+    //
+    // The scan walks one iterator forward over a consistent snapshot, older
+    // versions of a user key are skipped by Next(), and the iterator is only
+    // re-seeked after "--mvcc_scan_max_skipped_versions" internal keys are
+    // skipped in a row.
+    virtual StorageStatus MVCCScan(const std::string& left_key,
+                                   const std::string& right_key, TimeStamp ts,
+                                   const ScanOptions& options,
+                                   std::vector<std::string>& key,
+                                   std::vector<std::string>& value,
+                                   std::vector<TimeStamp>& seeked_ts,
+                                   std::string& resume_key) {
+        std::unique_ptr<leveldb::Iterator> iter(NewIterator(ts));
+        return IteratorMVCCScan(iter.get(), left_key, right_key, ts, options,
+                                key, value, seeked_ts, resume_key);
+    }
+
+    // Scan "iter" like MVCCScan(), it should be created at a timestamp not
+    // smaller than "ts". Successive scans of one iterator read the same
+    // snapshot.
+    static StorageStatus IteratorMVCCScan(leveldb::Iterator* iter,
+                                          const std::string& left_key,
+                                          const std::string& right_key,
+                                          TimeStamp ts,
+                                          const ScanOptions& options,
+                                          std::vector<std::string>& key,
+                                          std::vector<std::string>& value,
+                                          std::vector<TimeStamp>& seeked_ts,
+                                          std::string& resume_key) {
         StorageStatus ss;
-        BitWiseComparator cmp;
-        auto next_key = left_key;
-        while (cmp(next_key, right_key)) {
-            auto internal_key = InternalKey(next_key, ts, false);
-            std::string found_key, found_value;
-            ss = Seek(internal_key.Encode(), found_key, found_value);
-
-            switch (ss.error_code()) {
-                case StorageStatus::Ok: {
-                    auto found_internal_key = InternalKey(found_key);
-                    bool isValid = found_internal_key.Valid();
-                    bool isMatch = found_internal_key.UserKey() == next_key;
-                    bool isDeleted = found_internal_key.IsDelete();
-                    if (!isValid) {
-                        LOG(ERROR) << " Fail to find mvcc key: " << next_key
-                                   << " read ts: " << ts;
-                        ss.set_error_code(StorageStatus_Code_Corruption);
-                        goto out;
-                    }
-                    if (!isMatch) {
-                        next_key = found_internal_key.UserKey();
-                        continue;
-                    }
-                    if (!isDeleted) {
-                        key.push_back(next_key);
-                        value.push_back(found_value);
-                        seeked_ts.push_back(found_internal_key.TS());
-                    }
-                    ss = MVCCNextKey(next_key, next_key);
-                    if (ss.error_code() != StorageStatus::Ok) {
-                        if (ss.error_code() == StorageStatus::NotFound) {
-                            goto ok_out;
-                        } else {
-                            goto out;
-                        }
-                    }
-                    break;
+        size_t count = 0;
+        size_t bytes = 0;
+        resume_key.clear();
+        if (iter == nullptr) {
+            ss.set_error_code(StorageStatus::InvalidArgument);
+            ss.set_error_message("Fail to create an iterator");
+            return ss;
+        }
+
+        std::string left_bound = left_key, right_bound = right_key;
+        NarrowToPrefix(options.key_prefix, left_bound, right_bound);
+        const bool filter_value =
+            !options.value_prefix.empty() || options.match_value;
+        // encoded user key of the last key aggregated
+        std::string last_matched;
+        const bool bounded = !right_bound.empty();
+        const std::string right = InternalKey::EncodeUserKey(right_bound);
+        // encoded user key the iterator is currently on
+        std::string current;
+        // whether the visible version of "current" has been found
+        bool found = false;
+        int skipped = 0;
+        std::string target = InternalKey(left_bound, ts, false).Encode();
+        iter->Seek(target);
+        while (iter->Valid()) {
+            ParsedInternalKey parsed;
+            if (!InternalKey::IsInternalKey(iter->key())) {
+                break;
+            }
+            if (!InternalKey::Parse(iter->key(), &parsed)) {
+                LOG(ERROR) << " Fail to scan mvcc key: "
+                           << iter->key().ToString() << " read ts: " << ts;
+                ss.set_error_code(StorageStatus_Code_Corruption);
+                return ss;
+            }
+            if (bounded && parsed.user_key.compare(right) >= 0) {
+                break;
+            }
+            if (parsed.user_key != current) {
+                current.assign(parsed.user_key.data(), parsed.user_key.size());
+                found = false;
+                skipped = 0;
+            }
+
+            if (found || parsed.ts > ts) {
+                if (++skipped <= FLAGS_mvcc_scan_max_skipped_versions) {
+                    iter->Next();
+                    continue;
                 }
-                case StorageStatus::NotFound: {
-                    goto ok_out;
+                // Too many versions to skip, seek to the visible version of
+                // "current" or to the versions behind all of "current".
+                target = current;
+                if (found) {
+                    InternalKey::EncodeSuffix(MIN_TIMESTAMP, true, &target);
+                } else {
+                    InternalKey::EncodeSuffix(ts, false, &target);
                 }
-                default: {
-                    goto out;
+                skipped = 0;
+                iter->Seek(target);
+                continue;
+            }
+
+            if (!parsed.is_delete &&
+                (!filter_value || MatchValue(options, iter->value()))) {
+                if ((options.limit > 0 && count >= options.limit) ||
+                    (options.max_bytes > 0 && bytes >= options.max_bytes)) {
+                    resume_key = InternalKey::DecodeUserKey(parsed.user_key);
+                    break;
+                }
+                count++;
+                if (options.aggregate != nullptr) {
+                    if (options.aggregate->count++ == 0) {
+                        options.aggregate->min_key =
+                            InternalKey::DecodeUserKey(parsed.user_key);
+                    }
+                    last_matched = current;
+                } else {
+                    key.push_back(InternalKey::DecodeUserKey(parsed.user_key));
+                    bytes += key.back().size();
+                    if (!options.keys_only) {
+                        value.push_back(iter->value().ToString());
+                        bytes += value.back().size();
+                    }
+                    seeked_ts.push_back(parsed.ts);
                 }
             }
+            found = true;
+            skipped = 0;
+            iter->Next();
         }
 
-    ok_out:
-        if (!value.empty()) {
+        if (!iter->status().ok()) {
+            LOG(ERROR) << " Fail to scan mvcc key from: " << left_key
+                       << " to: " << right_key << " read ts: " << ts
+                       << " error: " << iter->status().ToString();
+            ss.set_error_code(StorageStatus_Code_IOError);
+            ss.set_error_message(iter->status().ToString());
+            return ss;
+        }
+        if (!last_matched.empty()) {
+            options.aggregate->max_key =
+                InternalKey::DecodeUserKey(last_matched);
+        }
+        if (count > 0) {
             ss.set_error_code(StorageStatus_Code_Ok);
-            ss.clear_error_message();
         } else {
             ss.set_error_code(StorageStatus_Code_NotFound);
-            ss.clear_error_message();
         }
-
-    out:
         return ss;
     }
 };
@@ -1,11 +1,42 @@
 #ifndef AZINO_STORAGE_INCLUDE_UTILS_H
 #define AZINO_STORAGE_INCLUDE_UTILS_H
 
+#include <leveldb/slice.h>
+
+#include <string>
+
 #include "azino/kv.h"
 
 namespace azino {
 namespace storage {
 
+// A decoded view of an encoded InternalKey, nothing is copied: "user_key"
+// points into the encoded key and is still in its encoded form (see
+// InternalKey::EncodeUserKey), so it can be compared bitwise with another
+// encoded user key.
+struct ParsedInternalKey {
+    leveldb::Slice user_key;
+    TimeStamp ts;
+    bool is_delete;
+    bool is_blob;    // the value is a pointer into the blob files
+    bool is_loaded;  // written by a bulk load, see Storage::BulkLoad()
+};
+
+// InternalKey is the key of one version of a user key in the storage engine.
+// Its binary format is:
+//
+//   tag(1) | escaped user key | 0x00 0x01 | ~ts(8, big endian) | flag(1)
+//
+// The flag has a bit for a deletion, a bit for a value stored in the blob
+// files (see BlobStore), only a pointer to which is kept under the key, and a
+// bit for a version written by a bulk load.
+//
+// Every 0x00 in the user key is escaped to 0x00 0xff, so user keys may contain
+// NULs and the bitwise order of internal keys is user key ascending, then ts
+// descending.
+//
+// Keys written in the legacy text format ("MVCCKEY" + user key + "%016lx" of
+// ~ts + '0'/'1') can still be decoded by the string constructor.
 class InternalKey {
    public:
     InternalKey(const std::string &user_key, TimeStamp ts, bool is_delete)
@@ -18,6 +49,9 @@ class InternalKey {
 
     std::string Encode() const;
 
+    // Append the encoded key to "dst".
+    void EncodeTo(std::string *dst) const;
+
     bool IsDelete() const;
 
     std::string UserKey() const;
@@ -26,15 +60,64 @@ class InternalKey {
 
     bool Valid() const;
 
+    // Return true if "key" is in the (binary) internal key space.
+    static bool IsInternalKey(const leveldb::Slice &key);
+
+    // Return true if "key" is an internal key in the legacy text format.
+    static bool IsLegacyInternalKey(const leveldb::Slice &key);
+
+    // Decode "internal_key" into "result" without any allocation. Return
+    // false if "internal_key" is not a valid internal key.
+    static bool Parse(const leveldb::Slice &internal_key,
+                      ParsedInternalKey *result);
+
+    // Return the encoded form of "user_key", which is the common prefix of all
+    // internal keys of "user_key".
+    static std::string EncodeUserKey(const std::string &user_key);
+
+    // Return true if "key" is an encoded user key alone, without the ts and
+    // flag part (see EncodeUserKey).
+    static bool IsEncodedUserKey(const leveldb::Slice &key);
+
+    // Inverse of EncodeUserKey.
+    static std::string DecodeUserKey(const leveldb::Slice &encoded_user_key);
+
+    // Append the ts and flag part of an internal key to "dst", so that an
+    // encoded user key followed by it is a complete internal key.
+    static void EncodeSuffix(TimeStamp ts, bool is_delete, std::string *dst);
+
+    // Mark the encoded internal key "internal_key" as the key of a blob
+    // pointer.
+    static void SetBlobFlag(std::string *internal_key);
+
+    // Mark the encoded internal key "internal_key" as the key of a version
+    // written by a bulk load.
+    static void SetLoadFlag(std::string *internal_key);
+
+    static const std::string &LegacyPrefix();
+
    private:
     void decode(const std::string &internal_key);
-    constexpr static const char *format_prefix = "MVCCKEY";
-    constexpr static const char *format_user_key = "%s";
-    constexpr static const char *format_ts = "%016lx";
-    constexpr static const char *format_delete_tag = "%c";
-    static const int ts_length = 16;
-    static const int delete_tag_length =
+    void decode_legacy(const std::string &internal_key);
+    static void encode_user_key(const std::string &user_key, std::string *dst);
+
+    constexpr static const char tag = '\x01';
+    constexpr static const char escape = '\x00';
+    constexpr static const char escaped_zero = '\xff';
+    constexpr static const char terminator = '\x01';
+    constexpr static const char delete_flag = 0x01;
+    constexpr static const char blob_flag = 0x02;
+    constexpr static const char load_flag = 0x04;
+    static const int tag_length = 1;
+    static const int terminator_length = 2;  // escape + terminator
+    static const int ts_length = 8;
+    static const int flag_length = 1;
+
+    constexpr static const char *legacy_prefix = "MVCCKEY";
+    static const int legacy_ts_length = 16;
+    static const int legacy_delete_tag_length =
         1;  // A char ('0' or '1') for delete tag
+
     std::string _user_key;
     TimeStamp _ts;
     bool _is_delete;
@@ -0,0 +1,208 @@
+#ifndef AZINO_STORAGE_INCLUDE_VERSION_CACHE_H
+#define AZINO_STORAGE_INCLUDE_VERSION_CACHE_H
+
+#include <bthread/mutex.h>
+#include <butil/macros.h>
+#include <bvar/bvar.h>
+#include <gflags/gflags.h>
+#include <leveldb/iterator.h>
+
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "azino/kv.h"
+#include "service/storage/storage.pb.h"
+#include "storage.h"
+
+DECLARE_int64(storage_latest_cache_capacity);
+
+namespace azino {
+namespace storage {
+
+// LatestVersionCache keeps the newest version of hot user keys, in LRU
+// shards bounded by bytes. Keys are encoded user keys (see
+// InternalKey::EncodeUserKey).
+//
+// A cached version is never replaced by an older one, so a concurrent reader
+// filling in what it read can not hide a newer write. Fill() is dropped if a
+// write reaches the shard after the reader took its epoch, in case the newer
+// version has been evicted meanwhile.
+class LatestVersionCache {
+   public:
+    struct Version {
+        TimeStamp ts;
+        bool is_delete;
+        std::string value;
+    };
+
+    LatestVersionCache(size_t capacity, size_t shards);
+    DISALLOW_COPY_AND_ASSIGN(LatestVersionCache);
+    ~LatestVersionCache() = default;
+
+    // Copy the cached version of "key" to "version", return false on a miss.
+    bool Lookup(const std::string& key, Version& version);
+
+    // Record a version written to storage.
+    void Update(const std::string& key, TimeStamp ts, bool is_delete,
+                const std::string& value);
+
+    // Drop "key" if its cached version is of timestamp "ts".
+    void Invalidate(const std::string& key, TimeStamp ts);
+
+    // Return the write epoch of the shard of "key", to be given to Fill().
+    uint64_t Epoch(const std::string& key);
+
+    // Cache "version" read from storage as the newest one of "key", unless
+    // the shard is written since "epoch".
+    void Fill(const std::string& key, const Version& version, uint64_t epoch);
+
+    // Drop everything, the fills of the readers going on are dropped too.
+    void Clear();
+
+    size_t Bytes() const;
+
+   private:
+    typedef struct Entry {
+        std::string key;
+        Version version;
+        size_t charge;
+    } Entry;
+
+    typedef struct Shard {
+        bthread::Mutex mutex;
+        std::list<Entry> lru;  // most recently used first
+        std::unordered_map<std::string, std::list<Entry>::iterator> index;
+        size_t bytes = 0;
+        uint64_t epoch = 0;
+    } Shard;
+
+    Shard& shard(const std::string& key);
+
+    // Called with the mutex of "s" held.
+    void insert(Shard& s, const std::string& key, const Version& version);
+    void erase(Shard& s, std::list<Entry>::iterator it);
+
+    const size_t _shard_capacity;
+    std::vector<std::unique_ptr<Shard>> _shards;
+};
+
+// A Storage which serves the reads of the newest versions from a
+// LatestVersionCache, all the other calls go to the wrapped storage. The
+// cache is kept by the writes made through it, and filled by the reads which
+// find the newest version of a key.
+class CachedStorage : public Storage {
+   public:
+    // The hits and misses are exposed as "<prefix>_latest_cache_hit" and
+    // "<prefix>_latest_cache_miss", each instance should have its own prefix.
+    CachedStorage(Storage* base, size_t capacity,
+                  const std::string& prefix = "storage");
+    DISALLOW_COPY_AND_ASSIGN(CachedStorage);
+    virtual ~CachedStorage() = default;
+
+    virtual StorageStatus Open(const std::string& name) override {
+        return _base->Open(name);
+    }
+
+    virtual StorageStatus Put(const std::string& key,
+                              const std::string& value) override;
+
+    virtual StorageStatus Delete(const std::string& key) override;
+
+    virtual StorageStatus Get(const std::string& key,
+                              std::string& value) override {
+        return _base->Get(key, value);
+    }
+
+    virtual StorageStatus Seek(const std::string& key, std::string& found_key,
+                               std::string& value) override {
+        return _base->Seek(key, found_key, value);
+    }
+
+    virtual leveldb::Iterator* NewIterator(TimeStamp ts) override {
+        return _base->NewIterator(ts);
+    }
+
+    virtual leveldb::Iterator* NewSnapshotIterator(TimeStamp ts) override {
+        return _base->NewSnapshotIterator(ts);
+    }
+
+    virtual std::vector<std::unique_ptr<leveldb::Iterator>> NewIterators(
+        TimeStamp ts, size_t n) override {
+        return _base->NewIterators(ts, n);
+    }
+
+    virtual bool MVCCKeyMayExist(const std::string& key) override {
+        return _base->MVCCKeyMayExist(key);
+    }
+
+    virtual StorageStatus BatchStore(const std::vector<Data>& datas) override;
+
+    virtual StorageStatus SyncBatchStore(
+        const std::vector<Data>& datas) override;
+
+    virtual StorageStatus BatchDelete(
+        const std::vector<std::string>& keys) override;
+
+    virtual StorageStatus Sync() override { return _base->Sync(); }
+
+    virtual void ApproximateSizes(const std::vector<std::string>& bounds,
+                                  std::vector<uint64_t>& sizes) override {
+        _base->ApproximateSizes(bounds, sizes);
+    }
+
+    virtual void GetStats(Stats& stats) override { _base->GetStats(stats); }
+
+    virtual StorageStatus BulkLoad(TimeStamp ts,
+                                   const std::vector<Data>& datas) override {
+        return _base->BulkLoad(ts, datas);
+    }
+
+    // The loaded versions may be newer than the cached ones.
+    virtual StorageStatus FinishBulkLoad(TimeStamp ts) override;
+
+    virtual StorageStatus AbortBulkLoad(TimeStamp ts) override {
+        return _base->AbortBulkLoad(ts);
+    }
+
+    virtual StorageStatus MVCCGet(const std::string& key, TimeStamp ts,
+                                  std::string& value,
+                                  TimeStamp& seeked_ts) override;
+
+    virtual StorageStatus BatchMVCCGet(
+        const std::vector<std::string>& keys, TimeStamp ts,
+        std::vector<std::string>& values, std::vector<TimeStamp>& seeked_ts,
+        std::vector<StorageStatus>& statuses) override;
+
+    LatestVersionCache& Cache() { return _cache; }
+
+    int64_t Hits() const { return _hits.get_value(); }
+
+    int64_t Misses() const { return _misses.get_value(); }
+
+   private:
+    // Answer a read of "key" at "ts" from the cache, return false on a miss.
+    bool lookup(const std::string& key, TimeStamp ts, std::string& value,
+                TimeStamp& seeked_ts, StorageStatus& ss);
+
+    // Read the newest version of "key" from storage and fill it into the
+    // cache. Return false if the newest version is above "ts", then "key"
+    // should be read at "ts" from storage.
+    bool read_latest(const std::string& key, TimeStamp ts, std::string& value,
+                     TimeStamp& seeked_ts, StorageStatus& ss);
+
+    // Record "datas" in the cache once written with status "ss".
+    void update(const std::vector<Data>& datas, const StorageStatus& ss);
+
+    std::unique_ptr<Storage> _base;
+    LatestVersionCache _cache;
+    bvar::Adder<int64_t> _hits;
+    bvar::Adder<int64_t> _misses;
+};
+
+}  // namespace storage
+}  // namespace azino
+
+#endif  // AZINO_STORAGE_INCLUDE_VERSION_CACHE_H
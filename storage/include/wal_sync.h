@@ -0,0 +1,71 @@
+#ifndef AZINO_STORAGE_INCLUDE_WAL_SYNC_H
+#define AZINO_STORAGE_INCLUDE_WAL_SYNC_H
+
+#include <bthread/condition_variable.h>
+#include <bthread/mutex.h>
+#include <butil/macros.h>
+#include <gflags/gflags.h>
+
+#include <cstdint>
+
+#include "azino/background_task.h"
+#include "service/storage/storage.pb.h"
+
+DECLARE_string(storage_durability);
+
+namespace azino {
+namespace storage {
+class Storage;
+
+// WALSyncer makes the writes durable as their Durability asks:
+//   Async    nothing is done.
+//   Periodic the background syncs every -storage_sync_interval_ms, and the
+//            writer which brings the unsynced bytes to -storage_sync_bytes
+//            syncs at once.
+//   Sync     the write itself is synced by the storage (see
+//            Storage::SyncBatchStore), nothing is left to do here.
+//
+// One sync covers all the writes completed before it starts, so concurrent
+// writers share it: a writer arriving while a sync is in flight waits for it
+// to finish, and then the first of the waiters left uncovered starts the
+// next one for all of them.
+class WALSyncer : public azino::BackgroundTask {
+   public:
+    WALSyncer(Storage* storage);
+    DISALLOW_COPY_AND_ASSIGN(WALSyncer);
+    ~WALSyncer() = default;
+
+    // Return "level", or -storage_durability if it is Durability::Default.
+    Durability::Level Resolve(Durability::Level level) const;
+
+    // Called after "bytes" are written with durability "level", return once
+    // they are as durable as "level" asks. The Sync writes should be written
+    // by Storage::SyncBatchStore.
+    StorageStatus Commit(Durability::Level level, size_t bytes);
+
+    // Return once the writes committed before are synced.
+    StorageStatus Sync();
+
+    // Record the latency of a write of durability "level", from its start to
+    // its Commit() being done.
+    static void RecordWrite(Durability::Level level, int64_t latency_us);
+
+   private:
+    static void* execute(void* args);
+
+    Storage* _storage;
+    Durability::Level _default_level;
+
+    bthread::Mutex _sync_mutex;
+    bthread::ConditionVariable _sync_cond;
+    // number of the writes committed, and of those covered by a sync
+    uint64_t _committed;
+    uint64_t _synced;
+    size_t _unsynced_bytes;
+    bool _syncing;
+};
+
+}  // namespace storage
+}  // namespace azino
+
+#endif  // AZINO_STORAGE_INCLUDE_WAL_SYNC_H
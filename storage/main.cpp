@@ -1,8 +1,10 @@
+#include <brpc/channel.h>
 #include <brpc/server.h>
 #include <butil/logging.h>
 #include <gflags/gflags.h>
 
 DEFINE_string(listen_addr, "0.0.0.0:8000", "Listen addr");
+DEFINE_string(txplanner_addr, "0.0.0.0:8001", "Address of txplanner");
 DEFINE_string(log_file, "log_storage", "log file name for storage");
 namespace logging {
 DECLARE_bool(crash_on_fatal_log);
@@ -26,8 +28,16 @@ int main(int argc, char* argv[]) {
     logging::InitLogging(log_settings);
 
     brpc::Server server;
+    brpc::Channel txplanner_channel;
+    brpc::ChannelOptions channel_options;
+    if (txplanner_channel.Init(FLAGS_txplanner_addr.c_str(),
+                               &channel_options) != 0) {
+        LOG(FATAL) << "Fail to initialize txplanner channel";
+        return -1;
+    }
 
-    azino::storage::StorageServiceImpl storage_service_impl;
+    azino::storage::StorageServiceImpl storage_service_impl(
+        &txplanner_channel);
     if (server.AddService(&storage_service_impl,
                           brpc::SERVER_DOESNT_OWN_SERVICE) != 0) {
         LOG(FATAL) << "Fail to add storage_service_impl";
@@ -0,0 +1,402 @@
+#include "blob.h"
+
+#include <butil/crc32c.h>
+#include <butil/logging.h>
+#include <bvar/bvar.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+DEFINE_int32(storage_blob_min_size, 0,
+             "mvcc values of at least this many bytes are written to the blob "
+             "files instead of leveldb, 0 means never");
+static bvar::GFlag gflag_storage_blob_min_size("storage_blob_min_size");
+DEFINE_int64(storage_blob_file_size, 64 << 20,
+             "bytes of a blob file before a new one is started");
+static bvar::GFlag gflag_storage_blob_file_size("storage_blob_file_size");
+
+namespace azino {
+namespace storage {
+namespace {
+bvar::Adder<int64_t> g_blob_written_bytes("storage_blob_written_bytes");
+bvar::Adder<int64_t> g_blob_read_bytes("storage_blob_read_bytes");
+
+const char blob_suffix[] = ".blob";
+const size_t header_size = 12;
+const size_t pointer_size = 24;
+
+void PutFixed32(std::string* dst, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        dst->push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+    }
+}
+
+void PutFixed64(std::string* dst, uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        dst->push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+    }
+}
+
+uint32_t DecodeFixed32(const char* p) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; i--) {
+        v = (v << 8) | static_cast<unsigned char>(p[i]);
+    }
+    return v;
+}
+
+uint64_t DecodeFixed64(const char* p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) {
+        v = (v << 8) | static_cast<unsigned char>(p[i]);
+    }
+    return v;
+}
+
+StorageStatus IOErrorStatus(const std::string& context) {
+    StorageStatus ss;
+    ss.set_error_code(StorageStatus::IOError);
+    ss.set_error_message(context + ": " + strerror(errno));
+    return ss;
+}
+
+StorageStatus CorruptionStatus(const std::string& message) {
+    StorageStatus ss;
+    ss.set_error_code(StorageStatus::Corruption);
+    ss.set_error_message(message);
+    return ss;
+}
+
+// Return false on a short read or an error, errno is 0 on a short read.
+bool ReadAll(int fd, uint64_t offset, char* buf, size_t n) {
+    while (n > 0) {
+        ssize_t r = pread(fd, buf, n, offset);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            if (r == 0) {
+                errno = 0;
+            }
+            return false;
+        }
+        buf += r;
+        offset += r;
+        n -= r;
+    }
+    return true;
+}
+
+bool WriteAll(int fd, uint64_t offset, const char* buf, size_t n) {
+    while (n > 0) {
+        ssize_t r = pwrite(fd, buf, n, offset);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r < 0) {
+            return false;
+        }
+        buf += r;
+        offset += r;
+        n -= r;
+    }
+    return true;
+}
+}  // namespace
+
+BlobFile::~BlobFile() { close(fd); }
+
+StorageStatus BlobStore::Open(const std::string& dir) {
+    StorageStatus ss;
+    ss.set_error_code(StorageStatus::Ok);
+    _dir = dir;
+    DIR* d = opendir(dir.c_str());
+    if (d == nullptr) {
+        return errno == ENOENT ? ss : IOErrorStatus("Fail to open " + dir);
+    }
+
+    auto files = std::make_shared<FileSet>();
+    uint64_t next_number = 1;
+    const size_t suffix_length = strlen(blob_suffix);
+    while (struct dirent* entry = readdir(d)) {
+        std::string name(entry->d_name);
+        if (name.size() <= suffix_length ||
+            name.compare(name.size() - suffix_length, suffix_length,
+                         blob_suffix) != 0) {
+            continue;
+        }
+        uint64_t number = strtoull(name.c_str(), nullptr, 10);
+        int fd = open(file_path(number).c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            ss = IOErrorStatus("Fail to open " + file_path(number));
+            if (fd >= 0) {
+                close(fd);
+            }
+            break;
+        }
+        (*files)[number] = std::make_shared<BlobFile>(number, fd, st.st_size);
+        next_number = std::max(next_number, number + 1);
+    }
+    closedir(d);
+
+    std::lock_guard<bthread::Mutex> lck(_mutex);
+    _files = files;
+    _next_number = next_number;
+    return ss;
+}
+
+StorageStatus BlobStore::Append(const leveldb::Slice& key,
+                                const leveldb::Slice& value,
+                                std::string* pointer) {
+    std::lock_guard<bthread::Mutex> append_lck(_append_mutex);
+    StorageStatus ss;
+    ss.set_error_code(StorageStatus::Ok);
+    if (_current == nullptr ||
+        _current->size >= uint64_t(FLAGS_storage_blob_file_size)) {
+        ss = new_file();
+        if (ss.error_code() != StorageStatus::Ok) {
+            return ss;
+        }
+    }
+
+    Pointer p{_current->number, _current->size + header_size + key.size(),
+              static_cast<uint32_t>(value.size()),
+              butil::crc32c::Value(value.data(), value.size())};
+    std::string head;
+    head.reserve(header_size + key.size());
+    PutFixed32(&head, key.size());
+    PutFixed32(&head, value.size());
+    PutFixed32(&head, p.crc);
+    head.append(key.data(), key.size());
+    if (!WriteAll(_current->fd, _current->size, head.data(), head.size()) ||
+        !WriteAll(_current->fd, p.offset, value.data(), value.size())) {
+        return IOErrorStatus("Fail to write " + file_path(p.file));
+    }
+    {
+        std::lock_guard<bthread::Mutex> lck(_mutex);
+        _current->size += head.size() + value.size();
+    }
+    g_blob_written_bytes << head.size() + value.size();
+    *pointer = EncodePointer(p);
+    return ss;
+}
+
+std::shared_ptr<const BlobStore::FileSet> BlobStore::Files() const {
+    std::lock_guard<bthread::Mutex> lck(_mutex);
+    return _files;
+}
+
+StorageStatus BlobStore::Read(const leveldb::Slice& pointer, std::string* value,
+                              const FileSet* pinned) const {
+    Pointer p;
+    if (!DecodePointer(pointer, &p)) {
+        return CorruptionStatus("Bad blob pointer");
+    }
+    std::shared_ptr<BlobFile> file;
+    if (pinned != nullptr && pinned->count(p.file) != 0) {
+        file = pinned->at(p.file);
+    } else {
+        auto files = Files();
+        if (files->count(p.file) != 0) {
+            file = files->at(p.file);
+        }
+    }
+    if (file == nullptr) {
+        return CorruptionStatus("Missing blob file " + file_path(p.file));
+    }
+
+    value->resize(p.size);
+    if (!ReadAll(file->fd, p.offset, &(*value)[0], p.size)) {
+        return errno == 0 ? CorruptionStatus("Truncated blob file " +
+                                             file_path(p.file))
+                          : IOErrorStatus("Fail to read " + file_path(p.file));
+    }
+    if (butil::crc32c::Value(value->data(), value->size()) != p.crc) {
+        return CorruptionStatus("Blob checksum mismatch in " +
+                                file_path(p.file));
+    }
+    g_blob_read_bytes << p.size;
+    StorageStatus ss;
+    ss.set_error_code(StorageStatus::Ok);
+    return ss;
+}
+
+StorageStatus BlobStore::Sync() {
+    std::shared_ptr<BlobFile> current;
+    {
+        std::lock_guard<bthread::Mutex> lck(_mutex);
+        current = _current;
+    }
+    if (current != nullptr && fdatasync(current->fd) != 0) {
+        return IOErrorStatus("Fail to sync " + file_path(current->number));
+    }
+    StorageStatus ss;
+    ss.set_error_code(StorageStatus::Ok);
+    return ss;
+}
+
+uint64_t BlobStore::AddDead(uint64_t file, uint64_t bytes) {
+    std::lock_guard<bthread::Mutex> lck(_mutex);
+    return _dead[file] += bytes;
+}
+
+bool BlobStore::PickGarbageFile(double ratio, uint64_t* file) const {
+    std::lock_guard<bthread::Mutex> lck(_mutex);
+    for (auto& f : *_files) {
+        if (f.second == _current) {
+            continue;
+        }
+        auto it = _dead.find(f.first);
+        uint64_t dead = it == _dead.end() ? 0 : it->second;
+        if (dead >= ratio * f.second->size) {
+            *file = f.first;
+            return true;
+        }
+    }
+    return false;
+}
+
+StorageStatus BlobStore::ForEachRecord(
+    uint64_t file,
+    const std::function<bool(const leveldb::Slice& key,
+                             const std::string& pointer,
+                             const leveldb::Slice& value)>& fn) const {
+    std::shared_ptr<BlobFile> f;
+    uint64_t size = 0;
+    {
+        std::lock_guard<bthread::Mutex> lck(_mutex);
+        auto it = _files->find(file);
+        if (it != _files->end()) {
+            f = it->second;
+            size = f->size;
+        }
+    }
+    if (f == nullptr) {
+        return CorruptionStatus("Missing blob file " + file_path(file));
+    }
+
+    std::string buf;
+    uint64_t offset = 0;
+    char head[header_size];
+    while (offset + header_size <= size) {
+        if (!ReadAll(f->fd, offset, head, header_size)) {
+            break;
+        }
+        uint32_t key_size = DecodeFixed32(head);
+        uint32_t value_size = DecodeFixed32(head + 4);
+        uint32_t crc = DecodeFixed32(head + 8);
+        uint64_t record_size = RecordSize(key_size, value_size);
+        if (offset + record_size > size) {
+            break;
+        }
+        buf.resize(key_size + value_size);
+        if (!ReadAll(f->fd, offset + header_size, &buf[0], buf.size())) {
+            break;
+        }
+        leveldb::Slice key(buf.data(), key_size);
+        leveldb::Slice value(buf.data() + key_size, value_size);
+        if (butil::crc32c::Value(value.data(), value.size()) != crc) {
+            return CorruptionStatus("Blob checksum mismatch in " +
+                                    file_path(file));
+        }
+        Pointer p{file, offset + header_size + key_size, value_size, crc};
+        if (!fn(key, EncodePointer(p), value)) {
+            break;
+        }
+        offset += record_size;
+    }
+    StorageStatus ss;
+    ss.set_error_code(StorageStatus::Ok);
+    return ss;
+}
+
+StorageStatus BlobStore::RemoveFile(uint64_t file) {
+    StorageStatus ss;
+    ss.set_error_code(StorageStatus::Ok);
+    {
+        std::lock_guard<bthread::Mutex> lck(_mutex);
+        if (_current != nullptr && _current->number == file) {
+            ss.set_error_code(StorageStatus::InvalidArgument);
+            ss.set_error_message("Can not remove the blob file in use");
+            return ss;
+        }
+        auto files = std::make_shared<FileSet>(*_files);
+        files->erase(file);
+        _files = files;
+        _dead.erase(file);
+    }
+    if (unlink(file_path(file).c_str()) != 0 && errno != ENOENT) {
+        return IOErrorStatus("Fail to remove " + file_path(file));
+    }
+    return ss;
+}
+
+std::string BlobStore::EncodePointer(const Pointer& pointer) {
+    std::string dst;
+    dst.reserve(pointer_size);
+    PutFixed64(&dst, pointer.file);
+    PutFixed64(&dst, pointer.offset);
+    PutFixed32(&dst, pointer.size);
+    PutFixed32(&dst, pointer.crc);
+    return dst;
+}
+
+bool BlobStore::DecodePointer(const leveldb::Slice& input, Pointer* pointer) {
+    if (input.size() != pointer_size) {
+        return false;
+    }
+    pointer->file = DecodeFixed64(input.data());
+    pointer->offset = DecodeFixed64(input.data() + 8);
+    pointer->size = DecodeFixed32(input.data() + 16);
+    pointer->crc = DecodeFixed32(input.data() + 20);
+    return true;
+}
+
+uint64_t BlobStore::RecordSize(size_t key_size, size_t value_size) {
+    return header_size + key_size + value_size;
+}
+
+std::string BlobStore::file_path(uint64_t number) const {
+    return _dir + "/" + std::to_string(number) + blob_suffix;
+}
+
+StorageStatus BlobStore::new_file() {
+    if (mkdir(_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        return IOErrorStatus("Fail to create directory " + _dir);
+    }
+    // the records of the older file are synced from now on only here
+    if (_current != nullptr && fdatasync(_current->fd) != 0) {
+        return IOErrorStatus("Fail to sync " + file_path(_current->number));
+    }
+    uint64_t number = _next_number++;
+    int fd = open(file_path(number).c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return IOErrorStatus("Fail to create " + file_path(number));
+    }
+    int dir_fd = open(_dir.c_str(), O_RDONLY);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+
+    auto file = std::make_shared<BlobFile>(number, fd, 0);
+    std::lock_guard<bthread::Mutex> lck(_mutex);
+    auto files = std::make_shared<FileSet>(*_files);
+    (*files)[number] = file;
+    _files = files;
+    _current = file;
+    StorageStatus ss;
+    ss.set_error_code(StorageStatus::Ok);
+    return ss;
+}
+
+}  // namespace storage
+}  // namespace azino
@@ -1,10 +1,28 @@
+#include <bthread/mutex.h>
 #include <butil/logging.h>
+#include <butil/time.h>
+#include <bvar/bvar.h>
+#include <gflags/gflags.h>
+#include <leveldb/cache.h>
 #include <leveldb/db.h>
+#include <leveldb/filter_policy.h>
 #include <leveldb/write_batch.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <vector>
 
+#include "azino/background_task.h"
 #include "azino/kv.h"
+#include "blob.h"
 #include "storage.h"
 #include "utils.h"
 
@@ -18,17 +36,363 @@
         }                                                      \
     } while (0);
 
+DEFINE_string(storage_engine, "leveldb",
+              "storage engine, leveldb or memory (nothing is persisted)");
+DEFINE_int32(legacy_key_migrate_batch_size, 1000,
+             "number of legacy mvcc keys rewritten per write batch when "
+             "opening a storage written in the legacy key format");
+DEFINE_int32(mvcc_scan_max_skipped_versions, 16,
+             "number of internal keys a mvcc scan skips by Next() before it "
+             "re-seeks the iterator");
+DEFINE_int32(storage_iterator_pool_size, 16,
+             "max number of idle iterators kept for reuse on one read "
+             "snapshot, 0 means iterators are not reused");
+static bvar::GFlag gflag_storage_iterator_pool_size(
+    "storage_iterator_pool_size");
+DEFINE_int32(storage_bloom_bits_per_key, 10,
+             "bits per user key of the bloom filter in leveldb tables, 0 "
+             "means no filter");
+DEFINE_int64(storage_block_cache_size, 64 << 20,
+             "capacity in bytes of leveldb's block cache");
+DEFINE_int64(storage_write_buffer_size, 32 << 20,
+             "bytes of leveldb's memtable before it is converted to a table");
+DEFINE_int32(storage_block_size, 4 << 10,
+             "approximate bytes of user data per leveldb block");
+DEFINE_bool(mvcc_get_check_user_key, true,
+            "whether a mvcc read probes the user key record first, which "
+            "is served by the bloom filter, so an absent key needs no seek");
+static bvar::GFlag gflag_mvcc_get_check_user_key("mvcc_get_check_user_key");
+DEFINE_int32(storage_blob_gc_period_s, 60,
+             "period of the rounds which rewrite the live values of a blob "
+             "file mostly garbage and remove it");
+static bvar::GFlag gflag_storage_blob_gc_period_s("storage_blob_gc_period_s");
+DEFINE_double(storage_blob_gc_ratio, 0.5,
+              "a blob file is collected once this ratio of its bytes is "
+              "garbage");
+static bvar::GFlag gflag_storage_blob_gc_ratio("storage_blob_gc_ratio");
+DEFINE_int32(storage_bulk_load_batch_bytes, 4 << 20,
+             "bytes of bulk loaded versions written by one leveldb write "
+             "batch");
+static bvar::GFlag gflag_storage_bulk_load_batch_bytes(
+    "storage_bulk_load_batch_bytes");
+
 namespace azino {
 namespace storage {
 namespace {
 
 StorageStatus LevelDBStatus(const leveldb::Status &lss);
 
+bvar::Adder<int64_t> g_read_view_created("storage_read_view_created");
+bvar::Adder<int64_t> g_iterator_created("storage_iterator_created");
+bvar::Adder<int64_t> g_iterator_reused("storage_iterator_reused");
+bvar::Adder<int64_t> g_user_key_filtered("storage_user_key_filtered");
+bvar::Adder<int64_t> g_blob_gc_moved_bytes("storage_blob_gc_moved_bytes");
+bvar::Adder<int64_t> g_blob_gc_removed_files("storage_blob_gc_removed_files");
+bvar::Adder<int64_t> g_bulk_loaded_bytes("storage_bulk_loaded_bytes");
+bvar::LatencyRecorder g_write_stall("storage_write_stall");
+
+// A write taking longer than this is counted as stalled, it is the time
+// leveldb sleeps to slow each write down once level 0 has too many tables.
+const int64_t write_stall_threshold_us = 1000;
+// number of level-0 tables which trigger a compaction (leveldb's
+// config::kL0_CompactionTrigger)
+const int level0_compaction_trigger = 4;
+
+// Estimate the bytes the compactions are behind by from "leveldb.stats": the
+// level-0 tables once there are enough of them to be compacted, and the bytes
+// of any other level beyond its target size, which is 10MB for level 1 and 10
+// times that of the previous level after.
+int64_t PendingCompactionBytes(const std::string &stats) {
+    std::istringstream is(stats);
+    std::string line;
+    int64_t pending = 0;
+    while (std::getline(is, line)) {
+        int level, files;
+        double size_mb;
+        // only the rows of the levels start with two numbers
+        if (sscanf(line.c_str(), "%d %d %lf", &level, &files, &size_mb) != 3) {
+            continue;
+        }
+        int64_t bytes = size_mb * 1048576;
+        if (level == 0) {
+            pending += files >= level0_compaction_trigger ? bytes : 0;
+            continue;
+        }
+        int64_t target = 10 << 20;
+        for (int i = 1; i < level; i++) {
+            target *= 10;
+        }
+        pending += std::max<int64_t>(bytes - target, 0);
+    }
+    return pending;
+}
+
+// The format of the database, it is stored under "format_key" once all the
+// keys are upgraded to it. Format 1 is the binary InternalKey with a user key
+// record (the encoded user key alone, with an empty value) for every user key
+// which has mvcc versions.
+const char format_key[] = "\x02azino_storage_format";
+const char format_version[] = "1";
+
+// The dead bytes of blob file N are stored under "blob_dead_prefix" + N.
+const char blob_dead_prefix[] = "\x02azino_blob_dead";
+
+// A bulk load of timestamp T going on is stored under "bulk_load_prefix" + T,
+// along with the range of the encoded user keys it has written (see
+// LevelDBImpl::BulkLoad).
+const char bulk_load_prefix[] = "\x02azino_bulk_load";
+
+// A bloom filter on the user key part of internal keys, so that all the
+// versions of a user key, and its user key record, hit the same bits.
+class UserKeyFilterPolicy : public leveldb::FilterPolicy {
+   public:
+    explicit UserKeyFilterPolicy(int bits_per_key)
+        : _bloom(leveldb::NewBloomFilterPolicy(bits_per_key)) {}
+    DISALLOW_COPY_AND_ASSIGN(UserKeyFilterPolicy);
+    virtual ~UserKeyFilterPolicy() = default;
+
+    // Changing the name makes the filters in existing tables ignored.
+    virtual const char *Name() const override {
+        return "azino.UserKeyBloomFilter";
+    }
+
+    virtual void CreateFilter(const leveldb::Slice *keys, int n,
+                              std::string *dst) const override {
+        std::vector<leveldb::Slice> user_keys(keys, keys + n);
+        for (auto &key : user_keys) {
+            key = user_key(key);
+        }
+        _bloom->CreateFilter(user_keys.data(), n, dst);
+    }
+
+    virtual bool KeyMayMatch(const leveldb::Slice &key,
+                             const leveldb::Slice &filter) const override {
+        return _bloom->KeyMayMatch(user_key(key), filter);
+    }
+
+   private:
+    static leveldb::Slice user_key(const leveldb::Slice &key) {
+        ParsedInternalKey parsed;
+        return InternalKey::Parse(key, &parsed) ? parsed.user_key : key;
+    }
+
+    std::unique_ptr<const leveldb::FilterPolicy> _bloom;
+};
+
+// A leveldb snapshot shared by concurrent readers, along with the idle
+// iterators created on it. The iterators of a view not filling the cache do
+// not load the blocks they read into the block cache.
+class ReadView {
+   public:
+    ReadView(leveldb::DB *db, uint64_t write_seq, bool fill_cache = true)
+        : _db(db),
+          _snapshot(db->GetSnapshot()),
+          _write_seq(write_seq),
+          _fill_cache(fill_cache),
+          _min_write_ts(MAX_TIMESTAMP) {}
+    DISALLOW_COPY_AND_ASSIGN(ReadView);
+    ~ReadView() {
+        for (auto *iter : _idle) {
+            delete iter;
+        }
+        _db->ReleaseSnapshot(_snapshot);
+    }
+
+    // Return an iterator on the snapshot, an idle one is reused if any.
+    leveldb::Iterator *Acquire() {
+        {
+            std::lock_guard<bthread::Mutex> lck(_mutex);
+            if (!_idle.empty()) {
+                leveldb::Iterator *iter = _idle.back();
+                _idle.pop_back();
+                g_iterator_reused << 1;
+                return iter;
+            }
+        }
+        leveldb::ReadOptions opt;
+        opt.snapshot = _snapshot;
+        opt.fill_cache = _fill_cache;
+        g_iterator_created << 1;
+        return _db->NewIterator(opt);
+    }
+
+    // Give back an iterator returned by Acquire().
+    void Release(leveldb::Iterator *iter) {
+        if (iter->status().ok()) {
+            std::lock_guard<bthread::Mutex> lck(_mutex);
+            if (_idle.size() <
+                static_cast<size_t>(FLAGS_storage_iterator_pool_size)) {
+                _idle.push_back(iter);
+                return;
+            }
+        }
+        delete iter;
+    }
+
+    // The following two are called with LevelDBImpl::_view_mutex held.
+
+    // Return true if the snapshot can serve a read at "ts": either nothing is
+    // written since it was taken, or all the writes since then are invisible
+    // at "ts".
+    bool Compatible(uint64_t write_seq, TimeStamp ts) const {
+        return _write_seq == write_seq || _min_write_ts > ts;
+    }
+
+    // Record a write of timestamp "ts" which is not in the snapshot.
+    void NoteWrite(TimeStamp ts) {
+        _min_write_ts = std::min(_min_write_ts, ts);
+    }
+
+   private:
+    leveldb::DB *_db;
+    const leveldb::Snapshot *_snapshot;
+    const uint64_t _write_seq;
+    const bool _fill_cache;
+    TimeStamp _min_write_ts;
+
+    bthread::Mutex _mutex;
+    std::vector<leveldb::Iterator *> _idle;
+};
+
+// An iterator borrowed from a ReadView, it is given back on destruction.
+// Like a new leveldb iterator, it is not valid until it is positioned. User key
+// records are skipped, so only raw keys and mvcc versions are visible.
+//
+// The value of a blob pointer is read from "blobs" when it is asked for, the
+// blob files in "files" are kept readable until the iterator is deleted.
+//
+// The loaded versions of the timestamps in "hidden", those of the bulk loads
+// not finished yet, are skipped as well.
+class PooledIterator : public leveldb::Iterator {
+   public:
+    typedef HiddenLoads::TimeStampSet TimeStampSet;
+
+    PooledIterator(std::shared_ptr<ReadView> view, const BlobStore *blobs,
+                   std::shared_ptr<const BlobStore::FileSet> files,
+                   std::shared_ptr<const TimeStampSet> hidden)
+        : _view(std::move(view)),
+          _iter(_view->Acquire()),
+          _positioned(false),
+          _blobs(blobs),
+          _files(std::move(files)),
+          _blob_read(false),
+          _hidden(std::move(hidden)) {}
+    DISALLOW_COPY_AND_ASSIGN(PooledIterator);
+    virtual ~PooledIterator() { _view->Release(_iter); }
+
+    virtual bool Valid() const override {
+        return _positioned && _iter->Valid();
+    }
+    virtual void SeekToFirst() override {
+        _positioned = true;
+        _iter->SeekToFirst();
+        skip_forward();
+    }
+    virtual void SeekToLast() override {
+        _positioned = true;
+        _iter->SeekToLast();
+        skip_backward();
+    }
+    virtual void Seek(const leveldb::Slice &target) override {
+        _positioned = true;
+        _iter->Seek(target);
+        skip_forward();
+    }
+    virtual void Next() override {
+        _iter->Next();
+        skip_forward();
+    }
+    virtual void Prev() override {
+        _iter->Prev();
+        skip_backward();
+    }
+    virtual leveldb::Slice key() const override { return _iter->key(); }
+    virtual leveldb::Slice value() const override {
+        ParsedInternalKey parsed;
+        if (!InternalKey::Parse(_iter->key(), &parsed) || !parsed.is_blob) {
+            return _iter->value();
+        }
+        if (!_blob_read) {
+            _blob_read = true;
+            StorageStatus ss =
+                _blobs->Read(_iter->value(), &_blob, _files.get());
+            if (ss.error_code() != StorageStatus::Ok) {
+                _blob.clear();
+                _blob_status = ss.error_code() == StorageStatus::IOError
+                                   ? leveldb::Status::IOError(
+                                         ss.error_message())
+                                   : leveldb::Status::Corruption(
+                                         ss.error_message());
+            }
+        }
+        return _blob;
+    }
+    virtual leveldb::Status status() const override {
+        return _blob_status.ok() ? _iter->status() : _blob_status;
+    }
+
+   private:
+    // Called after every move.
+    void skip_forward() {
+        _blob_read = false;
+        while (_iter->Valid() && skipped(_iter->key())) {
+            _iter->Next();
+        }
+    }
+    void skip_backward() {
+        _blob_read = false;
+        while (_iter->Valid() && skipped(_iter->key())) {
+            _iter->Prev();
+        }
+    }
+    bool skipped(const leveldb::Slice &key) const {
+        if (InternalKey::IsEncodedUserKey(key)) {
+            return true;
+        }
+        ParsedInternalKey parsed;
+        return !_hidden->empty() && InternalKey::Parse(key, &parsed) &&
+               parsed.is_loaded && _hidden->count(parsed.ts) != 0;
+    }
+
+    std::shared_ptr<ReadView> _view;
+    leveldb::Iterator *_iter;
+    bool _positioned;
+
+    const BlobStore *_blobs;
+    std::shared_ptr<const BlobStore::FileSet> _files;
+    // the value of the current blob pointer once it is read
+    mutable bool _blob_read;
+    mutable std::string _blob;
+    mutable leveldb::Status _blob_status;
+
+    std::shared_ptr<const TimeStampSet> _hidden;
+};
+
+class LevelDBImpl;
+
+// BlobGC collects one blob file per round: the records still pointed to are
+// appended to the newest blob file and repointed, then the file is removed.
+class BlobGC : public azino::BackgroundTask {
+   public:
+    BlobGC(LevelDBImpl *db) : _db(db) { fn = BlobGC::execute; }
+    DISALLOW_COPY_AND_ASSIGN(BlobGC);
+    ~BlobGC() = default;
+
+   private:
+    static void *execute(void *args);
+
+    LevelDBImpl *_db;
+};
+
 class LevelDBImpl : public Storage {
    public:
-    LevelDBImpl() : _leveldbptr(nullptr) {}
+    LevelDBImpl() : _leveldbptr(nullptr), _write_seq(0), _blob_gc(this) {}
     DISALLOW_COPY_AND_ASSIGN(LevelDBImpl);
-    virtual ~LevelDBImpl() = default;
+    // iterators returned by NewIterator() should be deleted before
+    virtual ~LevelDBImpl() {
+        _blob_gc.Stop();
+        _view.reset();
+    }
 
     virtual StorageStatus Open(const std::string &name) override {
         if (_leveldbptr != nullptr) {
@@ -40,12 +404,35 @@ class LevelDBImpl : public Storage {
         leveldb::DB *leveldbptr;
         leveldb::Options opt;
         opt.create_if_missing = true;
+        opt.write_buffer_size = FLAGS_storage_write_buffer_size;
+        opt.block_size = FLAGS_storage_block_size;
+        _block_cache.reset(
+            leveldb::NewLRUCache(FLAGS_storage_block_cache_size));
+        opt.block_cache = _block_cache.get();
+        if (FLAGS_storage_bloom_bits_per_key > 0) {
+            _filter_policy.reset(
+                new UserKeyFilterPolicy(FLAGS_storage_bloom_bits_per_key));
+            opt.filter_policy = _filter_policy.get();
+        }
         leveldb::Status leveldbstatus;
         leveldbstatus = leveldb::DB::Open(opt, name, &leveldbptr);
-        if (leveldbstatus.ok()) {
-            _leveldbptr.reset(leveldbptr);
+        if (!leveldbstatus.ok()) {
+            return LevelDBStatus(leveldbstatus);
         }
-        return LevelDBStatus(leveldbstatus);
+        _leveldbptr.reset(leveldbptr);
+        leveldbstatus = upgrade_format();
+        if (!leveldbstatus.ok()) {
+            return LevelDBStatus(leveldbstatus);
+        }
+        StorageStatus ss = open_blobs(name + "/blob");
+        if (ss.error_code() != StorageStatus::Ok) {
+            return ss;
+        }
+        ss = open_bulk_loads();
+        if (ss.error_code() == StorageStatus::Ok) {
+            _blob_gc.Start();
+        }
+        return ss;
     }
 
     // Set the database entry for "key" to "value".  Returns OK on success,
@@ -55,22 +442,298 @@ class LevelDBImpl : public Storage {
         CHECK_DB_PTR
         leveldb::WriteOptions opts;
         leveldb::Status leveldbstatus;
-        leveldbstatus = _leveldbptr->Put(opts, key, value);
+        ParsedInternalKey parsed;
+        if (InternalKey::Parse(key, &parsed)) {
+            leveldb::WriteBatch batch;
+            batch.Put(parsed.user_key, leveldb::Slice());
+            auto locks = lock_keys({parsed.user_key.ToString()});
+            std::unique_lock<bthread::Mutex> blob_lck(_blob_mutex,
+                                                      std::defer_lock);
+            std::string version(key);
+            StorageStatus ss = put_version(&version, parsed.is_delete, value,
+                                           blobs_in_use(), blob_lck, &batch);
+            if (ss.error_code() != StorageStatus::Ok) {
+                return ss;
+            }
+            leveldbstatus = write(&batch);
+            note_write(parsed.ts);
+        } else {
+            leveldbstatus = _leveldbptr->Put(opts, key, value);
+            note_write(MIN_TIMESTAMP);
+        }
         return LevelDBStatus(leveldbstatus);
     }
 
     virtual StorageStatus BatchStore(const std::vector<Data> &datas) override {
+        return batch_store(datas, false);
+    }
+
+    // The write is synced itself rather than followed by Sync(), which would
+    // miss the log rotated meanwhile. Leveldb syncs the log once for the
+    // writes grouped with it.
+    virtual StorageStatus SyncBatchStore(
+        const std::vector<Data> &datas) override {
+        return batch_store(datas, true);
+    }
+
+    // A user key record among "keys" is only deleted if no other version of
+    // its key is left, which the writes of the key can't change meanwhile.
+    // A key given twice is deleted once, so its blob record is counted as
+    // dead once.
+    virtual StorageStatus BatchDelete(
+        const std::vector<std::string> &keys) override {
+        CHECK_DB_PTR
+        std::vector<std::string> unique_keys(keys);
+        std::sort(unique_keys.begin(), unique_keys.end());
+        unique_keys.erase(std::unique(unique_keys.begin(), unique_keys.end()),
+                          unique_keys.end());
+        leveldb::WriteBatch batch;
+        TimeStamp min_ts = MAX_TIMESTAMP;
+        bool has_records = false;
+        std::vector<std::string> user_keys;
+        for (auto &key : unique_keys) {
+            ParsedInternalKey parsed;
+            if (InternalKey::IsEncodedUserKey(key)) {
+                user_keys.push_back(key);
+                has_records = true;
+            } else if (InternalKey::Parse(key, &parsed)) {
+                user_keys.push_back(parsed.user_key.ToString());
+            }
+        }
+        auto locks = lock_keys(user_keys);
+        std::unique_lock<bthread::Mutex> blob_lck(_blob_mutex,
+                                                  std::defer_lock);
+        std::set<std::string> deleted;
+        if (has_records) {
+            deleted.insert(unique_keys.begin(), unique_keys.end());
+        }
+        for (auto &key : unique_keys) {
+            if (InternalKey::IsEncodedUserKey(key)) {
+                if (!has_versions(key, deleted)) {
+                    batch.Delete(key);
+                }
+                continue;
+            }
+            batch.Delete(key);
+            min_ts = std::min(min_ts, write_ts(key));
+            if (is_blob(key)) {
+                if (!blob_lck.owns_lock()) {
+                    blob_lck.lock();
+                }
+                note_dead_blob(key, &batch);
+            }
+        }
+        leveldb::Status leveldbstatus = write(&batch);
+        // drop the shared snapshot so that it stops pinning the deleted data
+        note_write(min_ts);
+        return LevelDBStatus(leveldbstatus);
+    }
+
+    // The blob files are synced before the log, which may point into them.
+    // An empty synced write makes leveldb sync the current log up to and
+    // including it. A log rotated before is durable only once its memtable
+    // is flushed to a table, that's why the writes which wait for durability
+    // use SyncBatchStore.
+    virtual StorageStatus Sync() override {
         CHECK_DB_PTR
+        StorageStatus ss = _blobs.Sync();
+        if (ss.error_code() != StorageStatus::Ok) {
+            return ss;
+        }
         leveldb::WriteOptions opts;
-        leveldb::Status leveldbstatus;
+        opts.sync = true;
         leveldb::WriteBatch batch;
+        return LevelDBStatus(_leveldbptr->Write(opts, &batch));
+    }
 
+    // The versions are written sorted, in batches of
+    // -storage_bulk_load_batch_bytes. The first batch of a load also adds "ts"
+    // to the hidden timestamps, and every batch extends the key range stored
+    // under the bulk load key of "ts", which AbortBulkLoad() deletes within.
+    virtual StorageStatus BulkLoad(TimeStamp ts,
+                                   const std::vector<Data> &datas) override {
+        CHECK_DB_PTR
+        if (ts == MIN_TIMESTAMP || ts == MAX_TIMESTAMP) {
+            StorageStatus ss;
+            ss.set_error_code(StorageStatus::InvalidArgument);
+            ss.set_error_message("Invalid bulk load timestamp");
+            return ss;
+        }
+        if (datas.empty()) {
+            StorageStatus ss;
+            ss.set_error_code(StorageStatus::Ok);
+            return ss;
+        }
+        std::vector<const Data *> sorted;
+        sorted.reserve(datas.size());
         for (auto &data : datas) {
-            InternalKey key(data.key, data.ts, data.is_delete);
-            batch.Put(key.Encode(), data.value);
+            sorted.push_back(&data);
         }
-        leveldbstatus = _leveldbptr->Write(opts, &batch);
-        return LevelDBStatus(leveldbstatus);
+        std::stable_sort(sorted.begin(), sorted.end(),
+                         [](const Data *a, const Data *b) {
+                             return a->key < b->key;
+                         });
+
+        // serializes the loads, so the stored ranges only grow
+        std::lock_guard<bthread::Mutex> lck(_load_mutex);
+        auto it = _loads.find(ts);
+        if (it == _loads.end()) {
+            it = _loads.insert(std::make_pair(ts, LoadRange())).first;
+            set_hidden(ts, true);
+        }
+        LoadRange &range = it->second;
+        const bool blobs = blobs_in_use();
+        leveldb::WriteBatch batch;
+        std::string buf;
+        std::vector<std::string> user_keys;
+        size_t begin = 0;
+        while (begin < sorted.size()) {
+            // the versions of the next batch and their user keys
+            size_t end = begin, bytes = 0;
+            user_keys.clear();
+            while (end < sorted.size() &&
+                   bytes < size_t(FLAGS_storage_bulk_load_batch_bytes)) {
+                const Data &data = *sorted[end];
+                if (end == begin || sorted[end - 1]->key != data.key) {
+                    user_keys.push_back(InternalKey::EncodeUserKey(data.key));
+                }
+                bytes += data.key.size() + data.value.size();
+                end++;
+            }
+
+            auto locks = lock_keys(user_keys);
+            std::unique_lock<bthread::Mutex> blob_lck(_blob_mutex,
+                                                      std::defer_lock);
+            size_t next_user_key = 0;
+            bytes = 0;
+            for (size_t i = begin; i < end; i++) {
+                const Data &data = *sorted[i];
+                InternalKey key(data.key, ts, data.is_delete);
+                buf.clear();
+                key.EncodeTo(&buf);
+                InternalKey::SetLoadFlag(&buf);
+                bytes += buf.size() + data.value.size();
+                StorageStatus ss = put_version(&buf, data.is_delete,
+                                               data.value, blobs, blob_lck,
+                                               &batch);
+                if (ss.error_code() != StorageStatus::Ok) {
+                    return ss;
+                }
+                if (i == begin || sorted[i - 1]->key != data.key) {
+                    const std::string &user_key = user_keys[next_user_key++];
+                    batch.Put(user_key, leveldb::Slice());
+                    if (range.first.empty() || user_key < range.first) {
+                        range.first = user_key;
+                    }
+                    if (range.second.empty() || user_key > range.second) {
+                        range.second = user_key;
+                    }
+                }
+            }
+            batch.Put(bulk_load_key(ts), encode_load_range(range));
+            leveldb::Status leveldbstatus = write(&batch);
+            // the snapshots taken before miss the versions revealed later
+            note_write(ts);
+            if (!leveldbstatus.ok()) {
+                return LevelDBStatus(leveldbstatus);
+            }
+            g_bulk_loaded_bytes << bytes;
+            batch.Clear();
+            begin = end;
+        }
+        StorageStatus ss;
+        ss.set_error_code(StorageStatus::Ok);
+        return ss;
+    }
+
+    // The loaded versions are synced before the bulk load key is deleted, so
+    // a load is never half visible after a crash.
+    virtual StorageStatus FinishBulkLoad(TimeStamp ts) override {
+        CHECK_DB_PTR
+        std::lock_guard<bthread::Mutex> lck(_load_mutex);
+        StorageStatus ss;
+        ss.set_error_code(StorageStatus::Ok);
+        if (_loads.count(ts) == 0) {
+            return ss;
+        }
+        ss = Sync();
+        if (ss.error_code() != StorageStatus::Ok) {
+            return ss;
+        }
+        leveldb::WriteOptions opts;
+        opts.sync = true;
+        ss = LevelDBStatus(_leveldbptr->Delete(opts, bulk_load_key(ts)));
+        if (ss.error_code() != StorageStatus::Ok) {
+            return ss;
+        }
+        _loads.erase(ts);
+        set_hidden(ts, false);
+        return ss;
+    }
+
+    virtual void ShareHiddenLoads(
+        std::shared_ptr<HiddenLoads> loads) override {
+        _hidden_loads = std::move(loads);
+    }
+
+    virtual StorageStatus AbortBulkLoad(TimeStamp ts) override {
+        CHECK_DB_PTR
+        std::lock_guard<bthread::Mutex> lck(_load_mutex);
+        StorageStatus ss;
+        ss.set_error_code(StorageStatus::Ok);
+        auto it = _loads.find(ts);
+        if (it == _loads.end()) {
+            return ss;
+        }
+        const LoadRange &range = it->second;
+        leveldb::ReadOptions ropt;
+        ropt.fill_cache = false;
+        leveldb::WriteOptions wopt;
+        leveldb::WriteBatch batch;
+        leveldb::Status leveldbstatus;
+        size_t bytes = 0;
+        std::unique_ptr<leveldb::Iterator> iter(
+            _leveldbptr->NewIterator(ropt));
+        std::lock_guard<bthread::Mutex> blob_lck(_blob_mutex);
+        for (iter->Seek(range.first); iter->Valid(); iter->Next()) {
+            ParsedInternalKey parsed;
+            if (!InternalKey::Parse(iter->key(), &parsed)) {
+                continue;
+            }
+            if (parsed.user_key.compare(range.second) > 0) {
+                break;
+            }
+            if (parsed.ts != ts || !parsed.is_loaded) {
+                continue;
+            }
+            std::string key = iter->key().ToString();
+            batch.Delete(key);
+            if (parsed.is_blob) {
+                note_dead_blob(key, &batch);
+            }
+            bytes += key.size();
+            if (bytes >= size_t(FLAGS_storage_bulk_load_batch_bytes)) {
+                leveldbstatus = _leveldbptr->Write(wopt, &batch);
+                if (!leveldbstatus.ok()) {
+                    return LevelDBStatus(leveldbstatus);
+                }
+                batch.Clear();
+                bytes = 0;
+            }
+        }
+        if (!iter->status().ok()) {
+            return LevelDBStatus(iter->status());
+        }
+        batch.Delete(bulk_load_key(ts));
+        leveldbstatus = _leveldbptr->Write(wopt, &batch);
+        // the snapshots taken before still have the versions deleted
+        note_write(ts);
+        if (!leveldbstatus.ok()) {
+            return LevelDBStatus(leveldbstatus);
+        }
+        _loads.erase(it);
+        set_hidden(ts, false);
+        return ss;
     }
 
     // Remove the database entry (if any) for "key".  Returns OK on
@@ -80,7 +743,18 @@ class LevelDBImpl : public Storage {
         CHECK_DB_PTR
         leveldb::WriteOptions opts;
         leveldb::Status leveldbstatus;
-        leveldbstatus = _leveldbptr->Delete(opts, key);
+        ParsedInternalKey parsed;
+        if (InternalKey::Parse(key, &parsed) && parsed.is_blob) {
+            auto locks = lock_keys({parsed.user_key.ToString()});
+            std::lock_guard<bthread::Mutex> blob_lck(_blob_mutex);
+            leveldb::WriteBatch batch;
+            batch.Delete(key);
+            note_dead_blob(key, &batch);
+            leveldbstatus = write(&batch);
+        } else {
+            leveldbstatus = _leveldbptr->Delete(opts, key);
+        }
+        note_write(write_ts(key));
         return LevelDBStatus(leveldbstatus);
     }
 
@@ -103,26 +777,644 @@ class LevelDBImpl : public Storage {
     virtual StorageStatus Seek(const std::string &key, std::string &found_key,
                                std::string &value) override {
         CHECK_DB_PTR
+        std::unique_ptr<leveldb::Iterator> iter(NewIterator(MAX_TIMESTAMP));
+        return IteratorSeek(iter.get(), key, found_key, value);
+    }
+
+    virtual leveldb::Iterator *NewIterator(TimeStamp ts) override {
+        if (_leveldbptr == nullptr) {
+            return nullptr;
+        }
+        // The blob files are taken before the snapshot, so those it points
+        // into are not removed yet.
+        auto files = _blobs.Files();
+        std::shared_ptr<const PooledIterator::TimeStampSet> hidden;
+        auto view = read_view(ts, &hidden);
+        return new PooledIterator(std::move(view), &_blobs, std::move(files),
+                                  std::move(hidden));
+    }
+
+    // The iterators share the view NewIterator() would read at "ts".
+    virtual std::vector<std::unique_ptr<leveldb::Iterator>> NewIterators(
+        TimeStamp ts, size_t n) override {
+        std::vector<std::unique_ptr<leveldb::Iterator>> iters;
+        if (_leveldbptr == nullptr) {
+            return iters;
+        }
+        auto files = _blobs.Files();
+        std::shared_ptr<const PooledIterator::TimeStampSet> hidden;
+        auto view = read_view(ts, &hidden);
+        for (size_t i = 0; i < n; i++) {
+            iters.emplace_back(
+                new PooledIterator(view, &_blobs, files, hidden));
+        }
+        return iters;
+    }
+
+    // The view is not shared, so the snapshot lives as long as the iterator.
+    virtual leveldb::Iterator *NewSnapshotIterator(TimeStamp ts) override {
+        if (_leveldbptr == nullptr) {
+            return nullptr;
+        }
+        auto files = _blobs.Files();
+        auto hidden = _hidden_loads->Get();
+        auto view = std::make_shared<ReadView>(_leveldbptr.get(), 0, false);
+        g_read_view_created << 1;
+        return new PooledIterator(std::move(view), &_blobs, std::move(files),
+                                  std::move(hidden));
+    }
+
+    // Probe the user key record of "key", which is mostly answered by the
+    // bloom filter without reading any table if "key" is absent.
+    virtual bool MVCCKeyMayExist(const std::string &key) override {
+        if (!FLAGS_mvcc_get_check_user_key || _leveldbptr == nullptr) {
+            return true;
+        }
         leveldb::ReadOptions opt;
-        std::unique_ptr<leveldb::Iterator> iter(_leveldbptr->NewIterator(opt));
-        iter->Seek(key);
-        if (iter->Valid()) {
-            found_key = iter->key().ToString();
-            value = iter->value().ToString();
-            return LevelDBStatus(iter->status());
+        std::string value;
+        leveldb::Status leveldbstatus =
+            _leveldbptr->Get(opt, InternalKey::EncodeUserKey(key), &value);
+        if (leveldbstatus.IsNotFound()) {
+            g_user_key_filtered << 1;
+            return false;
+        }
+        return true;
+    }
+
+    // Sizes of the tables only, the memtable is not counted.
+    virtual void ApproximateSizes(const std::vector<std::string> &bounds,
+                                  std::vector<uint64_t> &sizes) override {
+        sizes.assign(bounds.empty() ? 0 : bounds.size() - 1, 0);
+        if (_leveldbptr == nullptr || sizes.empty()) {
+            return;
+        }
+        std::vector<std::string> keys;
+        keys.reserve(bounds.size());
+        for (auto &bound : bounds) {
+            keys.push_back(InternalKey::EncodeUserKey(bound));
+        }
+        std::vector<leveldb::Range> ranges;
+        ranges.reserve(sizes.size());
+        for (size_t i = 0; i < sizes.size(); i++) {
+            ranges.push_back(leveldb::Range(keys[i], keys[i + 1]));
+        }
+        _leveldbptr->GetApproximateSizes(ranges.data(), ranges.size(),
+                                         sizes.data());
+    }
+
+    virtual void GetStats(Stats &stats) override {
+        stats = Stats();
+        if (_leveldbptr == nullptr) {
+            return;
+        }
+        std::string value;
+        if (_leveldbptr->GetProperty("leveldb.num-files-at-level0", &value)) {
+            stats.level0_files = strtoll(value.c_str(), nullptr, 10);
+        }
+        if (_leveldbptr->GetProperty("leveldb.stats", &stats.engine_stats)) {
+            stats.pending_compaction_bytes =
+                PendingCompactionBytes(stats.engine_stats);
+        }
+        stats.write_stall_us = _write_stall_us.load();
+    }
+
+    // Collect a blob file which is mostly garbage, if any. The records still
+    // pointed to are appended to the newest file and repointed one by one,
+    // and the file is removed once everything is synced.
+    StorageStatus GCBlobs() {
+        CHECK_DB_PTR
+        StorageStatus ss;
+        ss.set_error_code(StorageStatus::Ok);
+        uint64_t file;
+        if (!_blobs.PickGarbageFile(FLAGS_storage_blob_gc_ratio, &file)) {
+            return ss;
+        }
+        leveldb::ReadOptions ropt;
+        leveldb::WriteOptions wopt;
+        StorageStatus rs = _blobs.ForEachRecord(
+            file, [&](const leveldb::Slice &key, const std::string &pointer,
+                      const leveldb::Slice &value) {
+                // repointed only if unchanged, serialized with the writes of
+                // the key and then with the deletions, which count the dead
+                // bytes
+                ParsedInternalKey parsed;
+                if (!InternalKey::Parse(key, &parsed)) {
+                    return true;
+                }
+                auto locks = lock_keys({parsed.user_key.ToString()});
+                std::lock_guard<bthread::Mutex> blob_lck(_blob_mutex);
+                std::string current, moved;
+                leveldb::Status leveldbstatus =
+                    _leveldbptr->Get(ropt, key, &current);
+                if (leveldbstatus.IsNotFound() ||
+                    (leveldbstatus.ok() && current != pointer)) {
+                    return true;
+                }
+                if (!leveldbstatus.ok()) {
+                    ss = LevelDBStatus(leveldbstatus);
+                    return false;
+                }
+                ss = _blobs.Append(key, value, &moved);
+                if (ss.error_code() != StorageStatus::Ok) {
+                    return false;
+                }
+                ss = LevelDBStatus(_leveldbptr->Put(wopt, key, moved));
+                note_write(write_ts(key));
+                g_blob_gc_moved_bytes << value.size();
+                return ss.error_code() == StorageStatus::Ok;
+            });
+        if (rs.error_code() != StorageStatus::Ok) {
+            return rs;
+        }
+        if (ss.error_code() != StorageStatus::Ok) {
+            return ss;
+        }
+
+        // the moved records and pointers must not be lost with the file
+        ss = Sync();
+        if (ss.error_code() != StorageStatus::Ok) {
+            return ss;
+        }
+        ss = _blobs.RemoveFile(file);
+        if (ss.error_code() != StorageStatus::Ok) {
+            return ss;
+        }
+        g_blob_gc_removed_files << 1;
+        LOG(INFO) << " Removed garbage blob file: " << file;
+        return LevelDBStatus(
+            _leveldbptr->Delete(wopt, blob_dead_key(file)));
+    }
+
+   private:
+    // Write "batch", and account the time of a stalled write.
+    leveldb::Status write(leveldb::WriteBatch *batch, bool sync = false) {
+        leveldb::WriteOptions opts;
+        opts.sync = sync;
+        int64_t start_us = butil::gettimeofday_us();
+        leveldb::Status leveldbstatus = _leveldbptr->Write(opts, batch);
+        int64_t latency_us = butil::gettimeofday_us() - start_us;
+        if (latency_us >= write_stall_threshold_us) {
+            _write_stall_us += latency_us;
+            g_write_stall << latency_us;
+        }
+        return leveldbstatus;
+    }
+
+    // Write "datas" in one batch, synced if "sync".
+    StorageStatus batch_store(const std::vector<Data> &datas, bool sync) {
+        CHECK_DB_PTR
+        leveldb::WriteBatch batch;
+        std::string buf;
+        const std::string *last_key = nullptr;
+        std::vector<std::string> user_keys;
+        TimeStamp min_ts = MAX_TIMESTAMP;
+
+        for (auto &data : datas) {
+            if (last_key == nullptr || *last_key != data.key) {
+                user_keys.push_back(InternalKey::EncodeUserKey(data.key));
+                batch.Put(user_keys.back(), leveldb::Slice());
+                last_key = &data.key;
+            }
+        }
+        auto locks = lock_keys(user_keys);
+        std::unique_lock<bthread::Mutex> blob_lck(_blob_mutex,
+                                                  std::defer_lock);
+        const bool blobs = blobs_in_use();
+        for (auto &data : datas) {
+            InternalKey key(data.key, data.ts, data.is_delete);
+            buf.clear();
+            key.EncodeTo(&buf);
+            StorageStatus ss = put_version(&buf, data.is_delete, data.value,
+                                           blobs, blob_lck, &batch);
+            if (ss.error_code() != StorageStatus::Ok) {
+                return ss;
+            }
+            min_ts = std::min(min_ts, data.ts);
+        }
+        if (sync) {
+            // the blobs before the log pointing into them
+            StorageStatus ss = _blobs.Sync();
+            if (ss.error_code() != StorageStatus::Ok) {
+                return ss;
+            }
+        }
+        leveldb::Status leveldbstatus = write(&batch, sync);
+        note_write(min_ts);
+        return LevelDBStatus(leveldbstatus);
+    }
+
+    // Lock the stripes of "_key_mutexes" of the encoded user keys "keys", in
+    // order. The writes of user key records hold them, so that the record of
+    // a user key is deleted only while none of its versions is written.
+    std::vector<std::unique_lock<bthread::Mutex>> lock_keys(
+        const std::vector<std::string> &keys) {
+        std::vector<size_t> stripes;
+        stripes.reserve(keys.size());
+        for (auto &key : keys) {
+            stripes.push_back(std::hash<std::string>()(key) % key_stripes);
+        }
+        std::sort(stripes.begin(), stripes.end());
+        stripes.erase(std::unique(stripes.begin(), stripes.end()),
+                      stripes.end());
+        std::vector<std::unique_lock<bthread::Mutex>> locks;
+        locks.reserve(stripes.size());
+        for (auto i : stripes) {
+            locks.emplace_back(_key_mutexes[i]);
+        }
+        return locks;
+    }
+
+    // Return true if the encoded user key "user_key" has a version stored
+    // other than the keys in "excluded".
+    bool has_versions(const std::string &user_key,
+                      const std::set<std::string> &excluded) {
+        leveldb::ReadOptions ropt;
+        ropt.fill_cache = false;
+        std::unique_ptr<leveldb::Iterator> iter(
+            _leveldbptr->NewIterator(ropt));
+        ParsedInternalKey parsed;
+        for (iter->Seek(user_key); iter->Valid(); iter->Next()) {
+            if (iter->key() == user_key) {
+                continue;
+            }
+            if (!InternalKey::Parse(iter->key(), &parsed) ||
+                parsed.user_key != user_key) {
+                return false;
+            }
+            if (excluded.count(iter->key().ToString()) == 0) {
+                return true;
+            }
+        }
+        // keep the record if unsure
+        return !iter->status().ok();
+    }
+
+    // Return true if "value" of a version is to be stored in the blob files.
+    static bool separate(bool is_delete, const std::string &value) {
+        return !is_delete && FLAGS_storage_blob_min_size > 0 &&
+               value.size() >= size_t(FLAGS_storage_blob_min_size);
+    }
+
+    // Return true if a version may be stored in the blob form, which only
+    // needs to be looked for then.
+    bool blobs_in_use() const {
+        return FLAGS_storage_blob_min_size > 0 || !_blobs.Files()->empty();
+    }
+
+    // Add the version under the encoded internal key "key" of "value" to
+    // "batch", in the blob form if large, which sets the blob flag of "key".
+    // Since -storage_blob_min_size may change, the version stored before in
+    // the other form is deleted, and a blob record replaced is counted as
+    // dead with "blob_lck" locked. Called with the stripe of the key locked,
+    // see lock_keys(), and "blobs" of blobs_in_use().
+    StorageStatus put_version(std::string *key, bool is_delete,
+                              const std::string &value, bool blobs,
+                              std::unique_lock<bthread::Mutex> &blob_lck,
+                              leveldb::WriteBatch *batch) {
+        const bool separated = separate(is_delete, value);
+        if (blobs || separated) {
+            leveldb::ReadOptions ropt;
+            std::string blob_key(*key), pointer;
+            InternalKey::SetBlobFlag(&blob_key);
+            if (_leveldbptr->Get(ropt, blob_key, &pointer).ok()) {
+                if (!blob_lck.owns_lock()) {
+                    blob_lck.lock();
+                }
+                note_dead_blob(blob_key, batch);
+                if (!separated) {
+                    batch->Delete(blob_key);
+                }
+            }
+            if (separated) {
+                batch->Delete(*key);
+            }
+        }
+        StorageStatus ss;
+        ss.set_error_code(StorageStatus::Ok);
+        if (!separated) {
+            batch->Put(*key, value);
+            return ss;
+        }
+        std::string pointer;
+        InternalKey::SetBlobFlag(key);
+        ss = _blobs.Append(*key, value, &pointer);
+        if (ss.error_code() == StorageStatus::Ok) {
+            batch->Put(*key, pointer);
+        }
+        return ss;
+    }
+
+    static bool is_blob(const leveldb::Slice &key) {
+        ParsedInternalKey parsed;
+        return InternalKey::Parse(key, &parsed) && parsed.is_blob;
+    }
+
+    static std::string blob_dead_key(uint64_t file) {
+        return blob_dead_prefix + std::to_string(file);
+    }
+
+    // the first and the last encoded user keys written by a bulk load
+    typedef std::pair<std::string, std::string> LoadRange;
+
+    static std::string bulk_load_key(TimeStamp ts) {
+        return bulk_load_prefix + std::to_string(ts);
+    }
+
+    static std::string encode_load_range(const LoadRange &range) {
+        return std::to_string(range.first.size()) + ":" + range.first +
+               range.second;
+    }
+
+    static bool decode_load_range(const std::string &value, LoadRange *range) {
+        size_t colon = value.find(':');
+        if (colon == std::string::npos) {
+            return false;
+        }
+        size_t size = strtoull(value.c_str(), nullptr, 10);
+        if (size > value.size() - colon - 1) {
+            return false;
+        }
+        range->first = value.substr(colon + 1, size);
+        range->second = value.substr(colon + 1 + size);
+        return true;
+    }
+
+    // Load the bulk loads left going on, their versions stay hidden.
+    StorageStatus open_bulk_loads() {
+        leveldb::ReadOptions ropt;
+        std::unique_ptr<leveldb::Iterator> iter(
+            _leveldbptr->NewIterator(ropt));
+        for (iter->Seek(bulk_load_prefix);
+             iter->Valid() && iter->key().starts_with(bulk_load_prefix);
+             iter->Next()) {
+            std::string ts = iter->key().ToString().substr(
+                sizeof(bulk_load_prefix) - 1);
+            LoadRange range;
+            if (!decode_load_range(iter->value().ToString(), &range)) {
+                StorageStatus ss;
+                ss.set_error_code(StorageStatus::Corruption);
+                ss.set_error_message("Invalid bulk load range of ts " + ts);
+                return ss;
+            }
+            TimeStamp load_ts = strtoull(ts.c_str(), nullptr, 10);
+            _loads[load_ts] = range;
+            set_hidden(load_ts, true);
+            LOG(WARNING) << " Bulk load of ts " << load_ts
+                         << " is not finished yet";
+        }
+        return LevelDBStatus(iter->status());
+    }
+
+    // Hide or reveal the loaded versions of "ts" to the iterators created
+    // from now on. The shared snapshots are renewed by the writes of a load,
+    // so those taken before a load is revealed have all of its versions.
+    void set_hidden(TimeStamp ts, bool hidden) {
+        if (hidden) {
+            _hidden_loads->Hold(ts);
         } else {
-            if (iter->status().ok()) {
-                return LevelDBStatus(leveldb::Status::NotFound(""));
-            } else {
-                return LevelDBStatus(iter->status());
+            _hidden_loads->Release(ts);
+        }
+    }
+
+    // Count the record of the blob pointer under "key" as dead, the new
+    // count is written by "batch", which deletes or overwrites "key". Called
+    // with "_blob_mutex" held.
+    void note_dead_blob(const std::string &key, leveldb::WriteBatch *batch) {
+        leveldb::ReadOptions ropt;
+        std::string pointer;
+        BlobStore::Pointer p;
+        if (!_leveldbptr->Get(ropt, key, &pointer).ok() ||
+            !BlobStore::DecodePointer(pointer, &p)) {
+            return;
+        }
+        uint64_t dead =
+            _blobs.AddDead(p.file, BlobStore::RecordSize(key.size(), p.size));
+        batch->Put(blob_dead_key(p.file), std::to_string(dead));
+    }
+
+    // Open the blob files and load their dead bytes.
+    StorageStatus open_blobs(const std::string &dir) {
+        StorageStatus ss = _blobs.Open(dir);
+        if (ss.error_code() != StorageStatus::Ok) {
+            return ss;
+        }
+        leveldb::ReadOptions ropt;
+        std::unique_ptr<leveldb::Iterator> iter(
+            _leveldbptr->NewIterator(ropt));
+        for (iter->Seek(blob_dead_prefix);
+             iter->Valid() && iter->key().starts_with(blob_dead_prefix);
+             iter->Next()) {
+            std::string file = iter->key().ToString().substr(
+                sizeof(blob_dead_prefix) - 1);
+            _blobs.AddDead(strtoull(file.c_str(), nullptr, 10),
+                           strtoull(iter->value().ToString().c_str(), nullptr,
+                                    10));
+        }
+        return LevelDBStatus(iter->status());
+    }
+
+    // Return the shared snapshot to read at "ts", a new one is taken if the
+    // current one misses some writes visible at "ts". The timestamps hidden
+    // now are stored in "hidden".
+    std::shared_ptr<ReadView> read_view(
+        TimeStamp ts,
+        std::shared_ptr<const PooledIterator::TimeStampSet> *hidden) {
+        std::shared_ptr<ReadView> stale;
+        *hidden = _hidden_loads->Get();
+        std::lock_guard<bthread::Mutex> lck(_view_mutex);
+        if (_view == nullptr || !_view->Compatible(_write_seq, ts)) {
+            stale.swap(_view);
+            _view = std::make_shared<ReadView>(_leveldbptr.get(), _write_seq);
+            g_read_view_created << 1;
+        }
+        return _view;
+    }
+
+    // Called after a write of timestamp "ts" is done. It is serialized with
+    // read_view() by "_view_mutex", so a snapshot taken before the write
+    // completes is always marked.
+    void note_write(TimeStamp ts) {
+        std::lock_guard<bthread::Mutex> lck(_view_mutex);
+        _write_seq++;
+        if (_view != nullptr) {
+            _view->NoteWrite(ts);
+        }
+    }
+
+    // Return the timestamp of an mvcc key, any other key may be read at any
+    // timestamp.
+    static TimeStamp write_ts(const leveldb::Slice &key) {
+        ParsedInternalKey parsed;
+        return InternalKey::Parse(key, &parsed) ? parsed.ts : MIN_TIMESTAMP;
+    }
+
+    // Bring a database written by an older version to the current format,
+    // it is a no-op for a database which is already in the current format.
+    leveldb::Status upgrade_format() {
+        leveldb::ReadOptions ropt;
+        std::string format;
+        leveldb::Status leveldbstatus =
+            _leveldbptr->Get(ropt, format_key, &format);
+        if (leveldbstatus.ok() && format == format_version) {
+            return leveldbstatus;
+        }
+        if (!leveldbstatus.ok() && !leveldbstatus.IsNotFound()) {
+            return leveldbstatus;
+        }
+
+        leveldbstatus = migrate_legacy_keys();
+        if (!leveldbstatus.ok()) {
+            return leveldbstatus;
+        }
+        leveldbstatus = add_user_key_records();
+        if (!leveldbstatus.ok()) {
+            return leveldbstatus;
+        }
+        leveldb::WriteOptions wopt;
+        wopt.sync = true;
+        return _leveldbptr->Put(wopt, format_key, format_version);
+    }
+
+    // Write the user key record of every user key which has mvcc versions.
+    leveldb::Status add_user_key_records() {
+        leveldb::ReadOptions ropt;
+        ropt.fill_cache = false;
+        leveldb::WriteOptions wopt;
+        leveldb::WriteBatch batch;
+        leveldb::Status leveldbstatus;
+        std::string last_user_key;
+        int batch_size = 0;
+        int total = 0;
+
+        std::unique_ptr<leveldb::Iterator> iter(
+            _leveldbptr->NewIterator(ropt));
+        for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+            ParsedInternalKey parsed;
+            if (!InternalKey::Parse(iter->key(), &parsed) ||
+                parsed.user_key == last_user_key) {
+                continue;
             }
+            last_user_key.assign(parsed.user_key.data(),
+                                 parsed.user_key.size());
+            batch.Put(parsed.user_key, leveldb::Slice());
+            total++;
+            if (++batch_size >= FLAGS_legacy_key_migrate_batch_size) {
+                leveldbstatus = _leveldbptr->Write(wopt, &batch);
+                if (!leveldbstatus.ok()) {
+                    return leveldbstatus;
+                }
+                batch.Clear();
+                batch_size = 0;
+            }
+        }
+        if (!iter->status().ok()) {
+            return iter->status();
+        }
+        if (batch_size > 0) {
+            leveldbstatus = _leveldbptr->Write(wopt, &batch);
+        }
+
+        if (total > 0) {
+            LOG(WARNING) << " Added " << total << " user key records";
         }
+        return leveldbstatus;
     }
 
-   private:
+    // Rewrite internal keys in the legacy text format into the binary format,
+    // it is a no-op for a database which has no legacy keys.
+    leveldb::Status migrate_legacy_keys() {
+        const std::string &prefix = InternalKey::LegacyPrefix();
+        leveldb::ReadOptions ropt;
+        ropt.fill_cache = false;
+        leveldb::WriteOptions wopt;
+        leveldb::WriteBatch batch;
+        leveldb::Status leveldbstatus;
+        int batch_size = 0;
+        int total = 0;
+
+        std::unique_ptr<leveldb::Iterator> iter(
+            _leveldbptr->NewIterator(ropt));
+        for (iter->Seek(prefix);
+             iter->Valid() && iter->key().starts_with(prefix); iter->Next()) {
+            InternalKey key(iter->key().ToString());
+            if (!key.Valid()) {
+                LOG(WARNING) << " Skip invalid legacy mvcc key: "
+                             << iter->key().ToString();
+                continue;
+            }
+            batch.Put(key.Encode(), iter->value());
+            batch.Delete(iter->key());
+            total++;
+            if (++batch_size >= FLAGS_legacy_key_migrate_batch_size) {
+                leveldbstatus = _leveldbptr->Write(wopt, &batch);
+                if (!leveldbstatus.ok()) {
+                    return leveldbstatus;
+                }
+                batch.Clear();
+                batch_size = 0;
+            }
+        }
+        if (!iter->status().ok()) {
+            return iter->status();
+        }
+        if (batch_size > 0) {
+            leveldbstatus = _leveldbptr->Write(wopt, &batch);
+        }
+
+        if (total > 0) {
+            LOG(WARNING) << " Migrated " << total << " legacy mvcc keys";
+        }
+        return leveldbstatus;
+    }
+
+    std::atomic<int64_t> _write_stall_us{0};
+
+    // used by "_leveldbptr", so they are destroyed after it
+    std::unique_ptr<leveldb::Cache> _block_cache;
+    std::unique_ptr<const leveldb::FilterPolicy> _filter_policy;
     std::unique_ptr<leveldb::DB> _leveldbptr;
+
+    bthread::Mutex _view_mutex;
+    uint64_t _write_seq;  // number of writes, guarded by "_view_mutex"
+    std::shared_ptr<ReadView> _view;  // guarded by "_view_mutex"
+    // timestamps of the bulk loads not finished, see ShareHiddenLoads()
+    std::shared_ptr<HiddenLoads> _hidden_loads =
+        std::make_shared<HiddenLoads>();
+
+    // serializes the bulk loads
+    bthread::Mutex _load_mutex;
+    // ranges of the bulk loads not finished, guarded by "_load_mutex"
+    std::map<TimeStamp, LoadRange> _loads;
+
+    BlobStore _blobs;
+    // serializes the deletions of blob pointers with the blob gc
+    bthread::Mutex _blob_mutex;
+    // serialize the writes of the user keys by stripes, see lock_keys()
+    static const size_t key_stripes = 64;
+    bthread::Mutex _key_mutexes[key_stripes];
+    BlobGC _blob_gc;
 };
 
+void *BlobGC::execute(void *args) {
+    auto p = reinterpret_cast<BlobGC *>(args);
+    while (true) {
+        bthread_usleep(FLAGS_storage_blob_gc_period_s * 1000 * 1000);
+        {
+            std::lock_guard<bthread::Mutex> lck(p->_mutex);
+            if (p->_stopped) {
+                break;
+            }
+        }
+        StorageStatus ss = p->_db->GCBlobs();
+        if (ss.error_code() != StorageStatus::Ok) {
+            LOG(ERROR) << " Fail to collect blob files error code: "
+                       << ss.error_code()
+                       << " error message: " << ss.error_message();
+        }
+    }
+    return nullptr;
+}
+
 StorageStatus LevelDBStatus(const leveldb::Status &lss) {
     StorageStatus ss;
     if (lss.ok()) {
@@ -147,6 +1439,11 @@ StorageStatus LevelDBStatus(const leveldb::Status &lss) {
 }
 }  // namespace
 
-Storage *Storage::DefaultStorage() { return new LevelDBImpl(); }
+Storage *Storage::DefaultStorage() {
+    if (FLAGS_storage_engine == "memory") {
+        return InMemoryStorage();
+    }
+    return new LevelDBImpl();
+}
 }  // namespace storage
 }  // namespace azino
@@ -0,0 +1,171 @@
+#include "gc.h"
+
+#include <bvar/bvar.h>
+#include <gflags/gflags.h>
+
+#include <memory>
+
+#include "storage.h"
+#include "utils.h"
+
+DEFINE_bool(enable_storage_gc, true,
+            "enable gc to remove the mvcc versions invisible to all readers");
+static bvar::GFlag gflag_enable_storage_gc("enable_storage_gc");
+DEFINE_int32(storage_gc_period_s, 60, "storage gc period time");
+static bvar::GFlag gflag_storage_gc_period_s("storage_gc_period_s");
+DEFINE_int32(storage_gc_batch_size, 1000,
+             "number of garbage versions deleted in one write batch");
+static bvar::GFlag gflag_storage_gc_batch_size("storage_gc_batch_size");
+DEFINE_int32(storage_gc_batch_interval_ms, 10,
+             "pause between two storage gc write batches");
+static bvar::GFlag gflag_storage_gc_batch_interval_ms(
+    "storage_gc_batch_interval_ms");
+
+namespace azino {
+namespace storage {
+namespace {
+bvar::Adder<int64_t> g_gc_deleted_versions("storage_gc_deleted_versions");
+bvar::Status<uint64_t> g_gc_safe_ts("storage_gc_safe_ts", 0);
+}  // namespace
+
+MVCCGC::MVCCGC(Storage *storage, brpc::Channel *txplanner_channel)
+    : _storage(storage), _txplanner_stub(txplanner_channel) {
+    fn = MVCCGC::execute;
+}
+
+void *MVCCGC::execute(void *args) {
+    auto p = reinterpret_cast<MVCCGC *>(args);
+    while (true) {
+        bthread_usleep(FLAGS_storage_gc_period_s * 1000 * 1000);
+        {
+            std::lock_guard<bthread::Mutex> lck(p->_mutex);
+            if (p->_stopped) {
+                break;
+            }
+        }
+        TimeStamp min_ats;
+        if (p->get_min_ats(min_ats)) {
+            p->GCRound(min_ats);
+        }
+    }
+    return nullptr;
+}
+
+StorageStatus MVCCGC::CollectGarbage(const std::string &start,
+                                     TimeStamp safe_ts, size_t limit,
+                                     std::vector<std::string> &garbage,
+                                     std::string &next) {
+    StorageStatus ss;
+    next.clear();
+    std::unique_ptr<leveldb::Iterator> iter(_storage->NewIterator(safe_ts));
+    if (iter == nullptr) {
+        ss.set_error_code(StorageStatus::InvalidArgument);
+        ss.set_error_message("Fail to create an iterator");
+        return ss;
+    }
+
+    // encoded user key the iterator is currently on
+    std::string current;
+    // whether the newest version at or below "safe_ts" of "current" is found
+    bool shadowed = false;
+    // whether all the versions of "current" so far are garbage
+    bool dropped = false;
+    for (iter->Seek(start); iter->Valid(); iter->Next()) {
+        ParsedInternalKey parsed;
+        if (!InternalKey::IsInternalKey(iter->key())) {
+            break;
+        }
+        if (!InternalKey::Parse(iter->key(), &parsed)) {
+            LOG(ERROR) << " Storage gc meets invalid mvcc key: "
+                       << iter->key().ToString();
+            continue;
+        }
+        if (parsed.user_key != current) {
+            if (dropped) {
+                garbage.push_back(current);
+            }
+            if (garbage.size() >= limit) {
+                next.assign(parsed.user_key.data(), parsed.user_key.size());
+                dropped = false;
+                break;
+            }
+            current.assign(parsed.user_key.data(), parsed.user_key.size());
+            shadowed = false;
+            dropped = true;
+        }
+
+        if (parsed.ts > safe_ts) {
+            dropped = false;
+            continue;
+        }
+        if (shadowed || parsed.is_delete) {
+            garbage.push_back(iter->key().ToString());
+        } else {
+            dropped = false;
+        }
+        shadowed = true;
+    }
+    // the user key record goes along with the last version of its key
+    if (dropped) {
+        garbage.push_back(current);
+    }
+
+    if (!iter->status().ok()) {
+        ss.set_error_code(StorageStatus::IOError);
+        ss.set_error_message(iter->status().ToString());
+        return ss;
+    }
+    ss.set_error_code(StorageStatus::Ok);
+    return ss;
+}
+
+StorageStatus MVCCGC::GCRound(TimeStamp safe_ts) {
+    StorageStatus ss;
+    std::string start = InternalKey::EncodeUserKey("");
+    std::string next;
+    int64_t total = 0;
+    g_gc_safe_ts.set_value(safe_ts);
+    do {
+        std::vector<std::string> garbage;
+        ss = CollectGarbage(start, safe_ts, FLAGS_storage_gc_batch_size,
+                            garbage, next);
+        if (ss.error_code() != StorageStatus::Ok) {
+            break;
+        }
+        if (!garbage.empty()) {
+            ss = _storage->BatchDelete(garbage);
+            if (ss.error_code() != StorageStatus::Ok) {
+                break;
+            }
+            total += garbage.size();
+            g_gc_deleted_versions << garbage.size();
+        }
+        start.swap(next);
+        if (!start.empty()) {
+            bthread_usleep(FLAGS_storage_gc_batch_interval_ms * 1000);
+        }
+    } while (!start.empty());
+
+    LOG(INFO) << " Storage gc safe ts: " << safe_ts
+              << " deleted versions: " << total
+              << " error code: " << ss.error_code()
+              << " error message: " << ss.error_message();
+    return ss;
+}
+
+bool MVCCGC::get_min_ats(TimeStamp &min_ats) {
+    brpc::Controller cntl;
+    azino::txplanner::GetMinATSRequest req;
+    azino::txplanner::GetMinATSResponse resp;
+    _txplanner_stub.GetMinATS(&cntl, &req, &resp, NULL);
+    if (cntl.Failed()) {
+        LOG(WARNING) << "Controller failed error code: " << cntl.ErrorCode()
+                     << " error text: " << cntl.ErrorText();
+        return false;
+    }
+    min_ats = resp.min_ats();
+    return true;
+}
+
+}  // namespace storage
+}  // namespace azino
@@ -0,0 +1,141 @@
+#include "group_commit.h"
+
+#include <bthread/countdown_event.h>
+#include <butil/logging.h>
+#include <bvar/bvar.h>
+
+#include <algorithm>
+#include <iterator>
+
+DEFINE_bool(enable_group_commit, true,
+            "coalesce concurrent batch stores into one storage write");
+static bvar::GFlag gflag_enable_group_commit("enable_group_commit");
+DEFINE_int32(storage_group_commit_max_datas, 4096,
+             "max number of datas written by one group commit, a single "
+             "request is never split");
+static bvar::GFlag gflag_storage_group_commit_max_datas(
+    "storage_group_commit_max_datas");
+
+namespace azino {
+namespace storage {
+namespace {
+bvar::Adder<int64_t> g_group_commit_groups("storage_group_commit_groups");
+bvar::IntRecorder g_group_commit_requests("storage_group_commit_requests");
+
+class SyncDone : public google::protobuf::Closure {
+   public:
+    SyncDone() : _event(1) {}
+    virtual void Run() override { _event.signal(); }
+    void Wait() { _event.wait(); }
+
+   private:
+    bthread::CountdownEvent _event;
+};
+}  // namespace
+
+GroupCommitter::GroupCommitter(Storage *storage, IOWorkerPool *io_pool,
+                               WALSyncer *syncer)
+    : _storage(storage), _io_pool(io_pool), _syncer(syncer) {
+    bthread::ExecutionQueueOptions options;
+    if (bthread::execution_queue_start(&_queue, &options,
+                                       GroupCommitter::execute, this) != 0) {
+        LOG(ERROR) << "fail to start execution queue in GroupCommitter";
+    }
+}
+
+GroupCommitter::~GroupCommitter() {
+    if (bthread::execution_queue_stop(_queue) != 0) {
+        LOG(ERROR) << "fail to stop execution queue in GroupCommitter";
+    }
+    if (bthread::execution_queue_join(_queue) != 0) {
+        LOG(ERROR) << "fail to join execution queue in GroupCommitter";
+    }
+}
+
+void GroupCommitter::AsyncBatchStore(std::vector<Storage::Data> *datas,
+                                     StorageStatus *status,
+                                     google::protobuf::Closure *done,
+                                     Durability::Level durability) {
+    if (_syncer != nullptr) {
+        durability = _syncer->Resolve(durability);
+    }
+    if (bthread::execution_queue_execute(
+            _queue, Task{datas, status, done, durability}) != 0) {
+        LOG(ERROR) << "fail to add task execution queue in GroupCommitter";
+        status->set_error_code(StorageStatus::IOError);
+        status->set_error_message("Fail to queue the batch store");
+        done->Run();
+    }
+}
+
+StorageStatus GroupCommitter::BatchStore(std::vector<Storage::Data> *datas,
+                                         Durability::Level durability) {
+    StorageStatus ss;
+    SyncDone done;
+    AsyncBatchStore(datas, &ss, &done, durability);
+    done.Wait();
+    return ss;
+}
+
+int GroupCommitter::execute(void *args, bthread::TaskIterator<Task> &iter) {
+    auto p = reinterpret_cast<GroupCommitter *>(args);
+    if (iter.is_queue_stopped()) {
+        return 0;
+    }
+
+    std::vector<Storage::Data> group;
+    std::vector<Task> tasks;
+    for (; iter; ++iter) {
+        auto datas = iter->datas;
+        if (!group.empty() &&
+            group.size() + datas->size() >
+                size_t(FLAGS_storage_group_commit_max_datas)) {
+            p->commit(group, tasks);
+        }
+        group.insert(group.end(), std::make_move_iterator(datas->begin()),
+                     std::make_move_iterator(datas->end()));
+        tasks.push_back(*iter);
+    }
+    if (!tasks.empty()) {
+        p->commit(group, tasks);
+    }
+    return 0;
+}
+
+void GroupCommitter::commit(std::vector<Storage::Data> &group,
+                            std::vector<Task> &tasks) {
+    size_t bytes = 0;
+    for (auto &data : group) {
+        bytes += data.key.size() + data.value.size();
+    }
+    Durability::Level durability = Durability::Async;
+    for (auto &task : tasks) {
+        durability = std::max(durability, task.durability);
+    }
+    StorageStatus ss;
+    // a group holding Sync requests is synced by the write itself
+    const bool sync = _syncer != nullptr && durability == Durability::Sync;
+    auto write = [&]() {
+        ss = sync ? _storage->SyncBatchStore(group)
+                  : _storage->BatchStore(group);
+        if (ss.error_code() == StorageStatus::Ok && _syncer != nullptr) {
+            ss = _syncer->Commit(durability, bytes);
+        }
+    };
+    if (_io_pool != nullptr) {
+        _io_pool->Run(IOWorkerPool::WRITE, write);
+    } else {
+        write();
+    }
+    g_group_commit_groups << 1;
+    g_group_commit_requests << tasks.size();
+    for (auto &task : tasks) {
+        task.status->CopyFrom(ss);
+        task.done->Run();
+    }
+    group.clear();
+    tasks.clear();
+}
+
+}  // namespace storage
+}  // namespace azino
@@ -0,0 +1,109 @@
+#include "io_pool.h"
+
+#include <bthread/countdown_event.h>
+#include <butil/time.h>
+#include <bvar/bvar.h>
+
+DEFINE_int32(storage_io_read_threads, 8,
+             "number of pthreads running the storage reads, 0 means running "
+             "them on bthread workers");
+DEFINE_int32(storage_io_write_threads, 2,
+             "number of pthreads running the storage writes, 0 means running "
+             "them on bthread workers");
+
+namespace azino {
+namespace storage {
+namespace {
+bvar::Adder<int64_t> g_io_read_pending("storage_io_read_pending");
+bvar::Adder<int64_t> g_io_write_pending("storage_io_write_pending");
+bvar::LatencyRecorder g_io_read_queue_latency("storage_io_read_queue");
+bvar::LatencyRecorder g_io_write_queue_latency("storage_io_write_queue");
+
+// the pool the current thread works for, if any
+thread_local const IOWorkerPool* tls_pool = nullptr;
+}  // namespace
+
+IOWorkerPool::IOWorkerPool(int read_threads, int write_threads) {
+    for (int i = 0; i < read_threads; i++) {
+        _queues[READ].workers.emplace_back(&IOWorkerPool::work, this, READ);
+    }
+    for (int i = 0; i < write_threads; i++) {
+        _queues[WRITE].workers.emplace_back(&IOWorkerPool::work, this, WRITE);
+    }
+}
+
+IOWorkerPool::~IOWorkerPool() { Stop(); }
+
+void IOWorkerPool::Stop() {
+    for (auto& q : _queues) {
+        {
+            std::lock_guard<std::mutex> lck(q.mutex);
+            q.stopped = true;
+        }
+        q.cond.notify_all();
+        for (auto& worker : q.workers) {
+            if (worker.joinable()) {
+                worker.join();
+            }
+        }
+    }
+}
+
+bool IOWorkerPool::Dispatch(Queue queue, std::function<void()> fn) {
+    auto& q = _queues[queue];
+    if (q.workers.empty() || tls_pool == this) {
+        return false;
+    }
+    auto& pending = queue == READ ? g_io_read_pending : g_io_write_pending;
+    auto& latency =
+        queue == READ ? g_io_read_queue_latency : g_io_write_queue_latency;
+    int64_t start_us = butil::gettimeofday_us();
+    auto task = [fn, &pending, &latency, start_us]() {
+        pending << -1;
+        latency << butil::gettimeofday_us() - start_us;
+        fn();
+    };
+    {
+        std::lock_guard<std::mutex> lck(q.mutex);
+        if (q.stopped) {
+            return false;
+        }
+        pending << 1;
+        q.tasks.push_back(std::move(task));
+    }
+    q.cond.notify_one();
+    return true;
+}
+
+void IOWorkerPool::Run(Queue queue, const std::function<void()>& fn) {
+    bthread::CountdownEvent event(1);
+    if (!Dispatch(queue, [&fn, &event]() {
+            fn();
+            event.signal();
+        })) {
+        fn();
+        return;
+    }
+    event.wait();
+}
+
+void IOWorkerPool::work(Queue queue) {
+    tls_pool = this;
+    auto& q = _queues[queue];
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lck(q.mutex);
+            q.cond.wait(lck, [&q]() { return q.stopped || !q.tasks.empty(); });
+            if (q.tasks.empty()) {
+                return;
+            }
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+        }
+        task();
+    }
+}
+
+}  // namespace storage
+}  // namespace azino
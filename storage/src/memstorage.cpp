@@ -0,0 +1,285 @@
+#include <bthread/mutex.h>
+#include <butil/logging.h>
+#include <butil/macros.h>
+#include <leveldb/iterator.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "azino/comparator.h"
+#include "azino/kv.h"
+#include "azino/skiplist.h"
+#include "storage.h"
+#include "utils.h"
+
+#define CHECK_OPENED                                                  \
+    do {                                                              \
+        if (!_opened) {                                               \
+            StorageStatus ss;                                         \
+            ss.set_error_code(StorageStatus::InvalidArgument);        \
+            ss.set_error_message("Haven't opened an memory storage"); \
+            return ss;                                                \
+        }                                                             \
+    } while (0);
+
+namespace azino {
+namespace storage {
+namespace {
+
+// One value of a key, written by the write of sequence "seq". Versions are
+// immutable once published.
+struct Version {
+    std::string value;
+    uint64_t seq;
+    bool deleted;
+    Version* older;
+};
+
+// A key in the skiplist, along with its versions from the newest to the
+// oldest.
+struct Entry {
+    explicit Entry(const leveldb::Slice& k)
+        : key(k.data(), k.size()), versions(nullptr) {}
+    DISALLOW_COPY_AND_ASSIGN(Entry);
+    ~Entry() {
+        Version* v = versions.load(std::memory_order_relaxed);
+        while (v != nullptr) {
+            Version* older = v->older;
+            delete v;
+            v = older;
+        }
+    }
+
+    // Return the newest version visible at "seq", or nullptr if there is
+    // none or it is deleted.
+    const Version* Visible(uint64_t seq) const {
+        const Version* v = versions.load(std::memory_order_acquire);
+        while (v != nullptr && v->seq > seq) {
+            v = v->older;
+        }
+        return v == nullptr || v->deleted ? nullptr : v;
+    }
+
+    const std::string key;
+    std::atomic<Version*> versions;
+};
+
+class EntryComparator {
+   public:
+    bool operator()(const Entry* a, const Entry* b) const {
+        return cmp(a->key, b->key);
+    }
+
+   private:
+    BitWiseComparator cmp;
+};
+
+typedef SkipList<Entry*, EntryComparator> EntryList;
+
+// Iterates the entries visible at sequence "seq", so it reads a consistent
+// snapshot while the writes go on.
+class MemIterator : public leveldb::Iterator {
+   public:
+    MemIterator(const EntryList* list, uint64_t seq)
+        : _iter(list), _seq(seq) {}
+    DISALLOW_COPY_AND_ASSIGN(MemIterator);
+    virtual ~MemIterator() = default;
+
+    virtual bool Valid() const override { return _iter.Valid(); }
+    virtual void SeekToFirst() override {
+        _iter.SeekToFirst();
+        skip_forward();
+    }
+    virtual void SeekToLast() override {
+        _iter.SeekToLast();
+        skip_backward();
+    }
+    virtual void Seek(const leveldb::Slice& target) override {
+        Entry probe(target);
+        _iter.Seek(&probe);
+        skip_forward();
+    }
+    virtual void Next() override {
+        _iter.Next();
+        skip_forward();
+    }
+    virtual void Prev() override {
+        _iter.Prev();
+        skip_backward();
+    }
+    virtual leveldb::Slice key() const override { return _iter.key()->key; }
+    virtual leveldb::Slice value() const override { return _version->value; }
+    virtual leveldb::Status status() const override {
+        return leveldb::Status::OK();
+    }
+
+   private:
+    void skip_forward() {
+        while (_iter.Valid() &&
+               (_version = _iter.key()->Visible(_seq)) == nullptr) {
+            _iter.Next();
+        }
+    }
+    void skip_backward() {
+        while (_iter.Valid() &&
+               (_version = _iter.key()->Visible(_seq)) == nullptr) {
+            _iter.Prev();
+        }
+    }
+
+    EntryList::Iterator _iter;
+    const uint64_t _seq;
+    const Version* _version = nullptr;
+};
+
+// An in-memory Storage on a skiplist, for benchmarks and tests. Readers take
+// no lock, writes are serialized by a mutex. Every write batch gets a
+// sequence number which is published after the whole batch is linked, so
+// iterators see each batch entirely or not at all.
+//
+// Nothing is freed before the storage is destroyed: deletes and overwrites
+// add versions, so the memory grows with the number of writes.
+class MemStorageImpl : public Storage {
+   public:
+    MemStorageImpl() : _opened(false), _last_seq(0) {}
+    DISALLOW_COPY_AND_ASSIGN(MemStorageImpl);
+    // iterators returned by NewIterator() should be deleted before
+    virtual ~MemStorageImpl() {
+        EntryList::Iterator iter(&_list);
+        for (iter.SeekToFirst(); iter.Valid(); iter.Next()) {
+            delete iter.key();
+        }
+    }
+
+    virtual StorageStatus Open(const std::string& name) override {
+        StorageStatus ss;
+        if (_opened) {
+            ss.set_error_code(StorageStatus::InvalidArgument);
+            ss.set_error_message("Already opened an memory storage");
+            return ss;
+        }
+        _opened = true;
+        ss.set_error_code(StorageStatus::Ok);
+        return ss;
+    }
+
+    virtual StorageStatus Put(const std::string& key,
+                              const std::string& value) override {
+        CHECK_OPENED
+        std::lock_guard<bthread::Mutex> lck(_write_mutex);
+        uint64_t seq = _last_seq.load(std::memory_order_relaxed) + 1;
+        add_version(key, value, false, seq);
+        return publish(seq);
+    }
+
+    virtual StorageStatus Delete(const std::string& key) override {
+        CHECK_OPENED
+        std::lock_guard<bthread::Mutex> lck(_write_mutex);
+        uint64_t seq = _last_seq.load(std::memory_order_relaxed) + 1;
+        add_version(key, "", true, seq);
+        return publish(seq);
+    }
+
+    virtual StorageStatus Get(const std::string& key,
+                              std::string& value) override {
+        CHECK_OPENED
+        StorageStatus ss;
+        Entry probe(key);
+        EntryList::Iterator iter(&_list);
+        iter.Seek(&probe);
+        const Version* v = nullptr;
+        if (iter.Valid() && iter.key()->key == key) {
+            v = iter.key()->Visible(_last_seq.load(std::memory_order_acquire));
+        }
+        if (v == nullptr) {
+            ss.set_error_code(StorageStatus::NotFound);
+            return ss;
+        }
+        value = v->value;
+        ss.set_error_code(StorageStatus::Ok);
+        return ss;
+    }
+
+    virtual StorageStatus Seek(const std::string& key, std::string& found_key,
+                               std::string& value) override {
+        CHECK_OPENED
+        std::unique_ptr<leveldb::Iterator> iter(NewIterator(MAX_TIMESTAMP));
+        return IteratorSeek(iter.get(), key, found_key, value);
+    }
+
+    // Every iterator reads the latest snapshot, so "ts" is not used.
+    virtual leveldb::Iterator* NewIterator(TimeStamp ts) override {
+        if (!_opened) {
+            return nullptr;
+        }
+        return new MemIterator(&_list,
+                               _last_seq.load(std::memory_order_acquire));
+    }
+
+    virtual StorageStatus BatchStore(const std::vector<Data>& datas) override {
+        CHECK_OPENED
+        std::string buf;
+        std::lock_guard<bthread::Mutex> lck(_write_mutex);
+        uint64_t seq = _last_seq.load(std::memory_order_relaxed) + 1;
+        for (auto& data : datas) {
+            InternalKey key(data.key, data.ts, data.is_delete);
+            buf.clear();
+            key.EncodeTo(&buf);
+            add_version(buf, data.value, false, seq);
+        }
+        return publish(seq);
+    }
+
+    virtual StorageStatus BatchDelete(
+        const std::vector<std::string>& keys) override {
+        CHECK_OPENED
+        std::lock_guard<bthread::Mutex> lck(_write_mutex);
+        uint64_t seq = _last_seq.load(std::memory_order_relaxed) + 1;
+        for (auto& key : keys) {
+            add_version(key, "", true, seq);
+        }
+        return publish(seq);
+    }
+
+   private:
+    // Called with "_write_mutex" held.
+    void add_version(const std::string& key, const std::string& value,
+                     bool deleted, uint64_t seq) {
+        Entry probe(key);
+        EntryList::Iterator iter(&_list);
+        iter.Seek(&probe);
+        Entry* entry;
+        if (iter.Valid() && iter.key()->key == key) {
+            entry = iter.key();
+        } else if (deleted) {
+            return;
+        } else {
+            entry = new Entry(key);
+            _list.Insert(entry);
+        }
+        Version* older = entry->versions.load(std::memory_order_relaxed);
+        Version* v = new Version{value, seq, deleted, older};
+        entry->versions.store(v, std::memory_order_release);
+    }
+
+    // Make the writes of "seq" visible, called with "_write_mutex" held.
+    StorageStatus publish(uint64_t seq) {
+        _last_seq.store(seq, std::memory_order_release);
+        StorageStatus ss;
+        ss.set_error_code(StorageStatus::Ok);
+        return ss;
+    }
+
+    bool _opened;
+    bthread::Mutex _write_mutex;
+    std::atomic<uint64_t> _last_seq;
+    EntryList _list;
+};
+
+}  // namespace
+
+Storage* Storage::InMemoryStorage() { return new MemStorageImpl(); }
+}  // namespace storage
+}  // namespace azino
@@ -0,0 +1,99 @@
+#include "monitor.h"
+
+#include <butil/time.h>
+
+#include <algorithm>
+
+DEFINE_int32(storage_monitor_period_ms, 1000,
+             "period of refreshing the storage engine stats and the "
+             "backpressure returned to the writers");
+static bvar::GFlag gflag_storage_monitor_period_ms(
+    "storage_monitor_period_ms");
+DEFINE_int64(storage_backpressure_pending_bytes, 1LL << 30,
+             "pending compaction bytes at which the backpressure is full");
+static bvar::GFlag gflag_storage_backpressure_pending_bytes(
+    "storage_backpressure_pending_bytes");
+DEFINE_int32(storage_backpressure_max_delay_ms, 1000,
+             "delay asked of the writers at full backpressure");
+static bvar::GFlag gflag_storage_backpressure_max_delay_ms(
+    "storage_backpressure_max_delay_ms");
+
+namespace azino {
+namespace storage {
+namespace {
+
+// leveldb's config::kL0_CompactionTrigger and config::kL0_StopWritesTrigger
+const int64_t level0_compaction_trigger = 4;
+const int64_t level0_stop_trigger = 12;
+
+int64_t Percent(int64_t value, int64_t full) {
+    if (full <= 0) {
+        return 0;
+    }
+    return std::min<int64_t>(std::max<int64_t>(value * 100 / full, 0), 100);
+}
+
+}  // namespace
+
+StorageMonitor::StorageMonitor(Storage* storage)
+    : _storage(storage),
+      _last_refresh_us(butil::gettimeofday_us()),
+      _last_stall_us(0),
+      _level(0),
+      _delay_ms(0),
+      _level0_files("storage_level0_files", 0),
+      _pending_compaction_bytes("storage_pending_compaction_bytes", 0),
+      _write_stall_us("storage_write_stall_us", 0),
+      _backpressure("storage_backpressure", 0),
+      _engine_stats("storage_engine_stats", "") {
+    fn = StorageMonitor::execute;
+}
+
+void StorageMonitor::Refresh() {
+    Storage::Stats stats;
+    _storage->GetStats(stats);
+    int64_t now_us = butil::gettimeofday_us();
+    int64_t period_us = std::max<int64_t>(now_us - _last_refresh_us, 1);
+
+    int64_t level = Percent(stats.level0_files - level0_compaction_trigger,
+                            level0_stop_trigger - level0_compaction_trigger);
+    level = std::max(level, Percent(stats.pending_compaction_bytes,
+                                    FLAGS_storage_backpressure_pending_bytes));
+    level = std::max(
+        level, Percent(stats.write_stall_us - _last_stall_us, period_us));
+    _level = level;
+    _delay_ms = level * FLAGS_storage_backpressure_max_delay_ms / 100;
+    _last_refresh_us = now_us;
+    _last_stall_us = stats.write_stall_us;
+
+    _level0_files.set_value(stats.level0_files);
+    _pending_compaction_bytes.set_value(stats.pending_compaction_bytes);
+    _write_stall_us.set_value(stats.write_stall_us);
+    _backpressure.set_value(level);
+    _engine_stats.set_value(stats.engine_stats);
+}
+
+Backpressure StorageMonitor::Current() const {
+    Backpressure backpressure;
+    backpressure.set_level(_level);
+    backpressure.set_delay_ms(_delay_ms);
+    return backpressure;
+}
+
+void* StorageMonitor::execute(void* args) {
+    auto p = reinterpret_cast<StorageMonitor*>(args);
+    while (true) {
+        bthread_usleep(FLAGS_storage_monitor_period_ms * 1000);
+        {
+            std::lock_guard<bthread::Mutex> lck(p->_mutex);
+            if (p->_stopped) {
+                break;
+            }
+        }
+        p->Refresh();
+    }
+    return nullptr;
+}
+
+}  // namespace storage
+}  // namespace azino
@@ -0,0 +1,224 @@
+#include "parallel_scan.h"
+
+#include <bthread/bthread.h>
+#include <bvar/bvar.h>
+
+#include <algorithm>
+#include <memory>
+
+DEFINE_int32(storage_scan_parallelism, 4,
+             "max number of sub-ranges scanned in parallel for one mvcc scan "
+             "with neither a limit nor max bytes, 1 means no split. The "
+             "batches of a streaming scan are never split");
+static bvar::GFlag gflag_storage_scan_parallelism("storage_scan_parallelism");
+DEFINE_int64(storage_scan_split_bytes, 32 << 20,
+             "min approximate bytes on disk of a sub-range of a parallel mvcc "
+             "scan");
+static bvar::GFlag gflag_storage_scan_split_bytes("storage_scan_split_bytes");
+
+namespace azino {
+namespace storage {
+namespace {
+
+bvar::Adder<int64_t> g_split_scans("storage_scan_split");
+bvar::Adder<int64_t> g_sub_scans("storage_scan_sub_ranges");
+
+// candidate split keys per sub-range, they are merged by their sizes
+const int candidates_per_part = 8;
+// bytes after the common prefix which the candidates are spread over
+const size_t spread_bytes = 4;
+
+typedef struct SubScan {
+    leveldb::Iterator* iter;
+    std::string left_key;
+    std::string right_key;
+    TimeStamp ts;
+    Storage::ScanOptions options;
+    Storage::ScanAggregate aggregate;
+    std::vector<std::string> key;
+    std::vector<std::string> value;
+    std::vector<TimeStamp> seeked_ts;
+    std::string resume_key;
+    StorageStatus status;
+} SubScan;
+
+void* RunSubScan(void* args) {
+    auto s = reinterpret_cast<SubScan*>(args);
+    s->status = Storage::IteratorMVCCScan(s->iter, s->left_key, s->right_key,
+                                          s->ts, s->options, s->key, s->value,
+                                          s->seeked_ts, s->resume_key);
+    return nullptr;
+}
+
+// Read "spread_bytes" bytes of "key" from "pos" as a big endian number,
+// missing bytes are 0.
+uint64_t KeyNumber(const std::string& key, size_t pos) {
+    uint64_t n = 0;
+    for (size_t i = pos; i < pos + spread_bytes; i++) {
+        n = (n << 8) | (i < key.size() ? uint8_t(key[i]) : 0);
+    }
+    return n;
+}
+
+// Return up to "n" - 1 ascending keys evenly spread in (left_key,
+// right_key), right after their common prefix.
+std::vector<std::string> SpreadKeys(const std::string& left_key,
+                                    const std::string& right_key, int n) {
+    size_t prefix = 0;
+    while (prefix < left_key.size() && prefix < right_key.size() &&
+           left_key[prefix] == right_key[prefix]) {
+        prefix++;
+    }
+    const uint64_t low = KeyNumber(left_key, prefix);
+    const uint64_t high = KeyNumber(right_key, prefix);
+    std::vector<std::string> keys;
+    uint64_t last = low;
+    for (int i = 1; i < n && high > low; i++) {
+        uint64_t number = low + (high - low) * i / n;
+        if (number == last) {
+            continue;
+        }
+        last = number;
+        std::string key = left_key.substr(0, prefix);
+        for (int shift = (spread_bytes - 1) * 8; shift >= 0; shift -= 8) {
+            key.push_back(char(number >> shift));
+        }
+        keys.push_back(key);
+    }
+    return keys;
+}
+
+}  // namespace
+
+std::vector<std::string> ParallelScanner::Split(const std::string& left_key,
+                                                const std::string& right_key) {
+    std::vector<std::string> splits;
+    const int parallelism = FLAGS_storage_scan_parallelism;
+    if (parallelism <= 1 || left_key >= right_key) {
+        return splits;
+    }
+    std::vector<std::string> bounds{left_key};
+    for (auto& key : SpreadKeys(left_key, right_key,
+                                parallelism * candidates_per_part)) {
+        bounds.push_back(key);
+    }
+    bounds.push_back(right_key);
+    std::vector<uint64_t> sizes;
+    _storage->ApproximateSizes(bounds, sizes);
+
+    uint64_t total = 0;
+    for (auto size : sizes) {
+        total += size;
+    }
+    uint64_t parts =
+        total / std::max<int64_t>(FLAGS_storage_scan_split_bytes, 1);
+    parts = std::min<uint64_t>(parts, parallelism);
+    if (parts <= 1) {
+        return splits;
+    }
+    // cut once the sizes add up to the next multiple of total / parts
+    uint64_t sum = 0;
+    for (size_t i = 0; i + 1 < sizes.size() && splits.size() + 1 < parts;
+         i++) {
+        sum += sizes[i];
+        if (sum * parts >= total * (splits.size() + 1)) {
+            splits.push_back(bounds[i + 1]);
+        }
+    }
+    return splits;
+}
+
+StorageStatus ParallelScanner::MVCCScan(const std::string& left_key,
+                                        const std::string& right_key,
+                                        TimeStamp ts,
+                                        const Storage::ScanOptions& options,
+                                        std::vector<std::string>& key,
+                                        std::vector<std::string>& value,
+                                        std::vector<TimeStamp>& seeked_ts,
+                                        std::string& resume_key) {
+    std::string left = left_key, right = right_key;
+    Storage::NarrowToPrefix(options.key_prefix, left, right);
+    std::vector<std::string> splits;
+    // a bounded scan would read up to its bounds from every sub-range but
+    // keep the first ones only
+    if (options.limit == 0 && options.max_bytes == 0) {
+        splits = Split(left, right);
+    }
+    // the sub-ranges are read from one snapshot
+    std::vector<std::unique_ptr<leveldb::Iterator>> iters;
+    if (!splits.empty()) {
+        iters = _storage->NewIterators(ts, splits.size() + 1);
+    }
+    if (iters.empty()) {
+        return _storage->MVCCScan(left_key, right_key, ts, options, key, value,
+                                  seeked_ts, resume_key);
+    }
+    g_split_scans << 1;
+    g_sub_scans << splits.size() + 1;
+
+    std::vector<SubScan> scans(splits.size() + 1);
+    for (size_t i = 0; i < scans.size(); i++) {
+        auto& s = scans[i];
+        s.iter = iters[i].get();
+        s.left_key = i == 0 ? left : splits[i - 1];
+        s.right_key = i == splits.size() ? right : splits[i];
+        s.ts = ts;
+        s.options = options;
+        if (options.aggregate != nullptr) {
+            s.options.aggregate = &s.aggregate;
+        }
+    }
+    // the first sub-range is scanned by the calling bthread
+    std::vector<bthread_t> tids;
+    for (size_t i = 1; i < scans.size(); i++) {
+        bthread_t tid;
+        if (bthread_start_background(&tid, NULL, RunSubScan, &scans[i]) ==
+            0) {
+            tids.push_back(tid);
+        } else {
+            RunSubScan(&scans[i]);
+        }
+    }
+    RunSubScan(&scans[0]);
+    for (auto tid : tids) {
+        bthread_join(tid, NULL);
+    }
+
+    StorageStatus ss;
+    size_t count = 0;
+    resume_key.clear();
+    for (auto& s : scans) {
+        if (s.status.error_code() != StorageStatus::Ok &&
+            s.status.error_code() != StorageStatus::NotFound) {
+            return s.status;
+        }
+    }
+    for (auto& s : scans) {
+        if (options.aggregate != nullptr && s.aggregate.count > 0) {
+            auto aggregate = options.aggregate;
+            if (aggregate->count == 0) {
+                aggregate->min_key = s.aggregate.min_key;
+            }
+            aggregate->max_key = s.aggregate.max_key;
+            aggregate->count += s.aggregate.count;
+            count += s.aggregate.count;
+        }
+        for (size_t i = 0; i < s.key.size(); i++) {
+            key.push_back(std::move(s.key[i]));
+            if (!options.keys_only) {
+                value.push_back(std::move(s.value[i]));
+            }
+            seeked_ts.push_back(s.seeked_ts[i]);
+            count++;
+        }
+        resume_key = s.resume_key;
+        if (!resume_key.empty()) {
+            break;
+        }
+    }
+    ss.set_error_code(count > 0 ? StorageStatus::Ok : StorageStatus::NotFound);
+    return ss;
+}
+
+}  // namespace storage
+}  // namespace azino
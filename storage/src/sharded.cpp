@@ -0,0 +1,675 @@
+#include "sharded.h"
+
+#include <bthread/bthread.h>
+#include <butil/logging.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <sstream>
+
+#include "utils.h"
+
+DEFINE_int32(storage_shards, 1,
+             "number of leveldb instances the storage is split into, 1 means "
+             "no sharding");
+DEFINE_string(storage_shard_split_keys, "",
+              "comma separated user keys where the shards are split, there "
+              "should be storage_shards - 1 ascending keys. If empty, the "
+              "shards are split evenly by the first byte of user keys");
+DEFINE_string(storage_shard_paths, "",
+              "comma separated directories of the shards, one for each. If "
+              "empty, the shards are put under storage_path");
+
+namespace azino {
+namespace storage {
+namespace {
+
+// Stored in every shard to check that it is reopened with the same layout.
+const char layout_key[] = "\x02azino_shard_layout";
+
+// A bulk load of timestamp T being finished is recorded in the first shard
+// under "finishing_load_prefix" + T, once the loaded versions of all the
+// shards are synced, see ShardedStorage::FinishBulkLoad.
+const char finishing_load_prefix[] = "\x02azino_finishing_load";
+
+StorageStatus NotOpened() {
+    StorageStatus ss;
+    ss.set_error_code(StorageStatus::InvalidArgument);
+    ss.set_error_message("Haven't opened a sharded storage");
+    return ss;
+}
+
+std::vector<std::string> SplitFlag(const std::string& flag) {
+    std::vector<std::string> items;
+    if (flag.empty()) {
+        return items;
+    }
+    std::istringstream is(flag);
+    std::string item;
+    while (std::getline(is, item, ',')) {
+        items.push_back(item);
+    }
+    return items;
+}
+
+typedef struct ShardWrite {
+    Storage* shard;
+    std::vector<Storage::Data> datas;
+    bool sync = false;
+    StorageStatus status;
+} ShardWrite;
+
+void* WriteShard(void* args) {
+    auto w = reinterpret_cast<ShardWrite*>(args);
+    w->status = w->sync ? w->shard->SyncBatchStore(w->datas)
+                        : w->shard->BatchStore(w->datas);
+    return nullptr;
+}
+
+void* SyncShard(void* args) {
+    auto w = reinterpret_cast<ShardWrite*>(args);
+    w->status = w->shard->Sync();
+    return nullptr;
+}
+
+}  // namespace
+
+// Walks the shards one after another, each one is limited to its own range
+// so that the keys stored in every shard (e.g. the format key) are seen only
+// once. The iterators of all the shards are taken at once on construction,
+// so the shards are read at the same point in time. They are taken again if
+// a bulk load is revealed meanwhile, which some of them would miss.
+class ShardedIterator : public leveldb::Iterator {
+   public:
+    ShardedIterator(ShardedStorage* storage, TimeStamp ts,
+                    bool snapshot = false)
+        : _storage(storage),
+          _iters(storage->ShardCount()),
+          _current(storage->ShardCount()) {
+        uint64_t reveals;
+        do {
+            reveals = _storage->_hidden_loads->Reveals();
+            for (size_t i = 0; i < _iters.size(); i++) {
+                auto shard = _storage->_shards[i].get();
+                _iters[i].reset(snapshot ? shard->NewSnapshotIterator(ts)
+                                         : shard->NewIterator(ts));
+            }
+        } while (reveals != _storage->_hidden_loads->Reveals());
+    }
+
+    // Walk the iterators "iters" of the shards, one for each.
+    ShardedIterator(ShardedStorage* storage,
+                    std::vector<std::unique_ptr<leveldb::Iterator>> iters)
+        : _storage(storage),
+          _iters(std::move(iters)),
+          _current(storage->ShardCount()) {}
+    DISALLOW_COPY_AND_ASSIGN(ShardedIterator);
+    virtual ~ShardedIterator() = default;
+
+    virtual bool Valid() const override {
+        return _current < _iters.size() && _iters[_current]->Valid();
+    }
+    virtual void SeekToFirst() override {
+        shard(0)->SeekToFirst();
+        settle_forward(0);
+    }
+    virtual void SeekToLast() override {
+        size_t last = _iters.size() - 1;
+        shard(last)->SeekToLast();
+        settle_backward(last);
+    }
+    virtual void Seek(const leveldb::Slice& target) override {
+        size_t i = _storage->ShardOf(target);
+        shard(i)->Seek(target);
+        settle_forward(i);
+    }
+    virtual void Next() override {
+        _iters[_current]->Next();
+        settle_forward(_current);
+    }
+    virtual void Prev() override {
+        _iters[_current]->Prev();
+        settle_backward(_current);
+    }
+    virtual leveldb::Slice key() const override {
+        return _iters[_current]->key();
+    }
+    virtual leveldb::Slice value() const override {
+        return _iters[_current]->value();
+    }
+    virtual leveldb::Status status() const override {
+        for (auto& iter : _iters) {
+            if (!iter->status().ok()) {
+                return iter->status();
+            }
+        }
+        return leveldb::Status::OK();
+    }
+
+   private:
+    leveldb::Iterator* shard(size_t i) { return _iters[i].get(); }
+
+    bool below(size_t i, const leveldb::Slice& key) const {
+        return i > 0 && ShardedStorage::RouteKey(key).compare(
+                            _storage->_split_keys[i - 1]) < 0;
+    }
+
+    bool above(size_t i, const leveldb::Slice& key) const {
+        return i + 1 < _iters.size() && ShardedStorage::RouteKey(key).compare(
+                                            _storage->_split_keys[i]) >= 0;
+    }
+
+    // Move to the first key in range at or after the position of shard "i".
+    void settle_forward(size_t i) {
+        while (true) {
+            auto iter = _iters[i].get();
+            while (iter->Valid() && below(i, iter->key())) {
+                iter->Next();
+            }
+            if (iter->Valid() && !above(i, iter->key())) {
+                _current = i;
+                return;
+            }
+            if (!iter->status().ok() || ++i == _iters.size()) {
+                _current = _iters.size();
+                return;
+            }
+            shard(i)->Seek(_storage->_split_keys[i - 1]);
+        }
+    }
+
+    // Move to the last key in range at or before the position of shard "i".
+    void settle_backward(size_t i) {
+        while (true) {
+            auto iter = _iters[i].get();
+            while (iter->Valid() && above(i, iter->key())) {
+                iter->Prev();
+            }
+            if (iter->Valid() && !below(i, iter->key())) {
+                _current = i;
+                return;
+            }
+            if (!iter->status().ok() || i == 0) {
+                _current = _iters.size();
+                return;
+            }
+            iter = shard(--i);
+            iter->Seek(_storage->_split_keys[i]);
+            if (iter->Valid()) {
+                iter->Prev();
+            } else if (iter->status().ok()) {
+                iter->SeekToLast();
+            }
+        }
+    }
+
+    ShardedStorage* _storage;
+    std::vector<std::unique_ptr<leveldb::Iterator>> _iters;
+    size_t _current;  // index of the current shard, invalid if out of range
+};
+
+StorageStatus ShardedStorage::Open(const std::string& name) {
+    StorageStatus ss;
+    if (!_shards.empty()) {
+        ss.set_error_code(StorageStatus::InvalidArgument);
+        ss.set_error_message("Already opened a sharded storage");
+        return ss;
+    }
+    if (FLAGS_storage_shards < 1 || FLAGS_storage_shards > 256) {
+        ss.set_error_code(StorageStatus::InvalidArgument);
+        ss.set_error_message("storage_shards should be in [1, 256]");
+        return ss;
+    }
+    size_t n = FLAGS_storage_shards;
+
+    std::vector<std::string> split_keys =
+        SplitFlag(FLAGS_storage_shard_split_keys);
+    if (split_keys.empty()) {
+        for (size_t i = 1; i < n; i++) {
+            split_keys.push_back(std::string(1, char(i * 256 / n)));
+        }
+    }
+    if (split_keys.size() != n - 1 ||
+        !std::is_sorted(split_keys.begin(), split_keys.end()) ||
+        std::adjacent_find(split_keys.begin(), split_keys.end()) !=
+            split_keys.end()) {
+        ss.set_error_code(StorageStatus::InvalidArgument);
+        ss.set_error_message(
+            "storage_shard_split_keys should be storage_shards - 1 ascending "
+            "keys");
+        return ss;
+    }
+
+    std::vector<std::string> paths = SplitFlag(FLAGS_storage_shard_paths);
+    if (paths.empty()) {
+        if (mkdir(name.c_str(), 0755) != 0 && errno != EEXIST) {
+            ss.set_error_code(StorageStatus::IOError);
+            ss.set_error_message("Fail to create directory " + name);
+            return ss;
+        }
+        for (size_t i = 0; i < n; i++) {
+            paths.push_back(name + "/shard_" + std::to_string(i));
+        }
+    }
+    if (paths.size() != n) {
+        ss.set_error_code(StorageStatus::InvalidArgument);
+        ss.set_error_message(
+            "storage_shard_paths should have storage_shards directories");
+        return ss;
+    }
+
+    for (auto& key : split_keys) {
+        _split_keys.push_back(InternalKey::EncodeUserKey(key));
+    }
+    for (size_t i = 0; i < n; i++) {
+        std::unique_ptr<Storage> shard(Storage::DefaultStorage());
+        shard->ShareHiddenLoads(_hidden_loads);
+        ss = shard->Open(paths[i]);
+        if (ss.error_code() != StorageStatus::Ok) {
+            break;
+        }
+        _shards.push_back(std::move(shard));
+        ss = check_layout(i);
+        if (ss.error_code() != StorageStatus::Ok) {
+            break;
+        }
+    }
+    if (ss.error_code() == StorageStatus::Ok) {
+        ss = finish_bulk_loads();
+    }
+    if (ss.error_code() != StorageStatus::Ok) {
+        _shards.clear();
+        _split_keys.clear();
+    }
+    return ss;
+}
+
+StorageStatus ShardedStorage::finish_bulk_loads() {
+    std::vector<TimeStamp> timestamps;
+    {
+        std::unique_ptr<leveldb::Iterator> iter(
+            _shards[0]->NewIterator(MAX_TIMESTAMP));
+        for (iter->Seek(finishing_load_prefix);
+             iter->Valid() && iter->key().starts_with(finishing_load_prefix);
+             iter->Next()) {
+            std::string ts = iter->key().ToString().substr(
+                sizeof(finishing_load_prefix) - 1);
+            timestamps.push_back(strtoull(ts.c_str(), nullptr, 10));
+        }
+        if (!iter->status().ok()) {
+            StorageStatus ss;
+            ss.set_error_code(StorageStatus::IOError);
+            ss.set_error_message(iter->status().ToString());
+            return ss;
+        }
+    }
+    StorageStatus ss;
+    ss.set_error_code(StorageStatus::Ok);
+    for (auto ts : timestamps) {
+        LOG(WARNING) << " Bulk load of ts " << ts << " is finished on open";
+        ss = FinishBulkLoad(ts);
+        if (ss.error_code() != StorageStatus::Ok) {
+            break;
+        }
+    }
+    return ss;
+}
+
+StorageStatus ShardedStorage::check_layout(size_t i) {
+    // encoded user keys never contain "\x00\x01", so it separates them
+    std::string layout =
+        std::to_string(i) + "/" + std::to_string(_split_keys.size() + 1);
+    for (auto& key : _split_keys) {
+        layout.append("\x00\x01", 2);
+        layout.append(key);
+    }
+
+    std::string stored;
+    StorageStatus ss = _shards[i]->Get(layout_key, stored);
+    if (ss.error_code() == StorageStatus::NotFound) {
+        return _shards[i]->Put(layout_key, layout);
+    }
+    if (ss.error_code() == StorageStatus::Ok && stored != layout) {
+        ss.set_error_code(StorageStatus::InvalidArgument);
+        ss.set_error_message("Shard " + std::to_string(i) +
+                             " is opened with a different layout");
+    }
+    return ss;
+}
+
+leveldb::Slice ShardedStorage::RouteKey(const leveldb::Slice& key) {
+    ParsedInternalKey parsed;
+    return InternalKey::Parse(key, &parsed) ? parsed.user_key : key;
+}
+
+size_t ShardedStorage::ShardOf(const leveldb::Slice& key) const {
+    leveldb::Slice route = RouteKey(key);
+    return std::upper_bound(_split_keys.begin(), _split_keys.end(), route,
+                            [](const leveldb::Slice& a, const std::string& b) {
+                                return a.compare(b) < 0;
+                            }) -
+           _split_keys.begin();
+}
+
+StorageStatus ShardedStorage::Put(const std::string& key,
+                                  const std::string& value) {
+    if (_shards.empty()) {
+        return NotOpened();
+    }
+    return _shards[ShardOf(key)]->Put(key, value);
+}
+
+StorageStatus ShardedStorage::Delete(const std::string& key) {
+    if (_shards.empty()) {
+        return NotOpened();
+    }
+    return _shards[ShardOf(key)]->Delete(key);
+}
+
+StorageStatus ShardedStorage::Get(const std::string& key, std::string& value) {
+    if (_shards.empty()) {
+        return NotOpened();
+    }
+    return _shards[ShardOf(key)]->Get(key, value);
+}
+
+StorageStatus ShardedStorage::Seek(const std::string& key,
+                                   std::string& found_key,
+                                   std::string& value) {
+    if (_shards.empty()) {
+        return NotOpened();
+    }
+    std::unique_ptr<leveldb::Iterator> iter(NewIterator(MAX_TIMESTAMP));
+    return IteratorSeek(iter.get(), key, found_key, value);
+}
+
+leveldb::Iterator* ShardedStorage::NewIterator(TimeStamp ts) {
+    if (_shards.empty()) {
+        return nullptr;
+    }
+    return new ShardedIterator(this, ts);
+}
+
+leveldb::Iterator* ShardedStorage::NewSnapshotIterator(TimeStamp ts) {
+    if (_shards.empty()) {
+        return nullptr;
+    }
+    return new ShardedIterator(this, ts, true);
+}
+
+std::vector<std::unique_ptr<leveldb::Iterator>> ShardedStorage::NewIterators(
+    TimeStamp ts, size_t n) {
+    std::vector<std::unique_ptr<leveldb::Iterator>> iters;
+    if (_shards.empty()) {
+        return iters;
+    }
+    // shard_iters[i][j] is the iterator of shard i for sharded iterator j
+    std::vector<std::vector<std::unique_ptr<leveldb::Iterator>>> shard_iters;
+    uint64_t reveals;
+    do {
+        reveals = _hidden_loads->Reveals();
+        shard_iters.clear();
+        for (auto& shard : _shards) {
+            shard_iters.push_back(shard->NewIterators(ts, n));
+            if (shard_iters.back().size() != n) {
+                return iters;
+            }
+        }
+    } while (reveals != _hidden_loads->Reveals());
+    for (size_t j = 0; j < n; j++) {
+        std::vector<std::unique_ptr<leveldb::Iterator>> one;
+        for (auto& its : shard_iters) {
+            one.push_back(std::move(its[j]));
+        }
+        iters.emplace_back(new ShardedIterator(this, std::move(one)));
+    }
+    return iters;
+}
+
+StorageStatus ShardedStorage::MVCCGet(const std::string& key, TimeStamp ts,
+                                      std::string& value,
+                                      TimeStamp& seeked_ts) {
+    if (_shards.empty()) {
+        return NotOpened();
+    }
+    std::string encoded = InternalKey::EncodeUserKey(key);
+    return _shards[ShardOf(encoded)]->MVCCGet(key, ts, value, seeked_ts);
+}
+
+bool ShardedStorage::MVCCKeyMayExist(const std::string& key) {
+    if (_shards.empty()) {
+        return true;
+    }
+    std::string encoded = InternalKey::EncodeUserKey(key);
+    return _shards[ShardOf(encoded)]->MVCCKeyMayExist(key);
+}
+
+StorageStatus ShardedStorage::BatchStore(const std::vector<Data>& datas) {
+    return batch_store(datas, false);
+}
+
+StorageStatus ShardedStorage::SyncBatchStore(const std::vector<Data>& datas) {
+    return batch_store(datas, true);
+}
+
+StorageStatus ShardedStorage::batch_store(const std::vector<Data>& datas,
+                                          bool sync) {
+    if (_shards.empty()) {
+        return NotOpened();
+    }
+    StorageStatus ss;
+    ss.set_error_code(StorageStatus::Ok);
+    if (datas.empty()) {
+        return ss;
+    }
+    std::vector<size_t> owners(datas.size());
+    bool single = true;
+    for (size_t i = 0; i < datas.size(); i++) {
+        owners[i] = ShardOf(InternalKey::EncodeUserKey(datas[i].key));
+        single = single && owners[i] == owners[0];
+    }
+    if (single) {
+        return sync ? _shards[owners[0]]->SyncBatchStore(datas)
+                    : _shards[owners[0]]->BatchStore(datas);
+    }
+
+    std::vector<ShardWrite> writes(_shards.size());
+    for (size_t i = 0; i < datas.size(); i++) {
+        writes[owners[i]].datas.push_back(datas[i]);
+    }
+    std::vector<bthread_t> tids;
+    ShardWrite* inline_write = nullptr;
+    for (size_t i = 0; i < writes.size(); i++) {
+        auto& w = writes[i];
+        w.shard = _shards[i].get();
+        w.sync = sync;
+        w.status.set_error_code(StorageStatus::Ok);
+        if (w.datas.empty()) {
+            continue;
+        }
+        // the first shard is written by the calling bthread
+        bthread_t tid;
+        if (inline_write == nullptr) {
+            inline_write = &w;
+        } else if (bthread_start_background(&tid, NULL, WriteShard, &w) ==
+                   0) {
+            tids.push_back(tid);
+        } else {
+            WriteShard(&w);
+        }
+    }
+    WriteShard(inline_write);
+    for (auto tid : tids) {
+        bthread_join(tid, NULL);
+    }
+
+    for (auto& w : writes) {
+        if (w.status.error_code() != StorageStatus::Ok) {
+            return w.status;
+        }
+    }
+    return ss;
+}
+
+StorageStatus ShardedStorage::BatchDelete(
+    const std::vector<std::string>& keys) {
+    if (_shards.empty()) {
+        return NotOpened();
+    }
+    std::vector<std::vector<std::string>> shard_keys(_shards.size());
+    for (auto& key : keys) {
+        shard_keys[ShardOf(key)].push_back(key);
+    }
+    StorageStatus ss;
+    ss.set_error_code(StorageStatus::Ok);
+    for (size_t i = 0; i < shard_keys.size(); i++) {
+        if (shard_keys[i].empty()) {
+            continue;
+        }
+        ss = _shards[i]->BatchDelete(shard_keys[i]);
+        if (ss.error_code() != StorageStatus::Ok) {
+            break;
+        }
+    }
+    return ss;
+}
+
+StorageStatus ShardedStorage::Sync() {
+    if (_shards.empty()) {
+        return NotOpened();
+    }
+    std::vector<ShardWrite> syncs(_shards.size());
+    for (size_t i = 0; i < syncs.size(); i++) {
+        syncs[i].shard = _shards[i].get();
+    }
+    // the first shard is synced by the calling bthread
+    std::vector<bthread_t> tids;
+    for (size_t i = 1; i < syncs.size(); i++) {
+        bthread_t tid;
+        if (bthread_start_background(&tid, NULL, SyncShard, &syncs[i]) == 0) {
+            tids.push_back(tid);
+        } else {
+            SyncShard(&syncs[i]);
+        }
+    }
+    SyncShard(&syncs[0]);
+    for (auto tid : tids) {
+        bthread_join(tid, NULL);
+    }
+
+    for (auto& w : syncs) {
+        if (w.status.error_code() != StorageStatus::Ok) {
+            return w.status;
+        }
+    }
+    return syncs[0].status;
+}
+
+void ShardedStorage::ApproximateSizes(const std::vector<std::string>& bounds,
+                                      std::vector<uint64_t>& sizes) {
+    sizes.assign(bounds.empty() ? 0 : bounds.size() - 1, 0);
+    std::vector<uint64_t> shard_sizes;
+    for (auto& shard : _shards) {
+        shard->ApproximateSizes(bounds, shard_sizes);
+        for (size_t i = 0; i < sizes.size() && i < shard_sizes.size(); i++) {
+            sizes[i] += shard_sizes[i];
+        }
+    }
+}
+
+void ShardedStorage::GetStats(Stats& stats) {
+    stats = Stats();
+    Stats shard_stats;
+    for (size_t i = 0; i < _shards.size(); i++) {
+        _shards[i]->GetStats(shard_stats);
+        stats.level0_files =
+            std::max(stats.level0_files, shard_stats.level0_files);
+        stats.pending_compaction_bytes += shard_stats.pending_compaction_bytes;
+        stats.write_stall_us += shard_stats.write_stall_us;
+        stats.engine_stats += "shard " + std::to_string(i) + "\n" +
+                              shard_stats.engine_stats;
+    }
+}
+
+StorageStatus ShardedStorage::BulkLoad(TimeStamp ts,
+                                       const std::vector<Data>& datas) {
+    if (_shards.empty()) {
+        return NotOpened();
+    }
+    std::vector<std::vector<Data>> shard_datas(_shards.size());
+    for (auto& data : datas) {
+        shard_datas[ShardOf(InternalKey::EncodeUserKey(data.key))].push_back(
+            data);
+    }
+    StorageStatus ss;
+    ss.set_error_code(StorageStatus::Ok);
+    for (size_t i = 0; i < shard_datas.size(); i++) {
+        if (shard_datas[i].empty()) {
+            continue;
+        }
+        ss = _shards[i]->BulkLoad(ts, shard_datas[i]);
+        if (ss.error_code() != StorageStatus::Ok) {
+            break;
+        }
+    }
+    return ss;
+}
+
+StorageStatus ShardedStorage::FinishBulkLoad(TimeStamp ts) {
+    if (_shards.empty()) {
+        return NotOpened();
+    }
+    std::lock_guard<bthread::Mutex> lck(_load_mutex);
+    // hidden in every shard until all of them are finished
+    if (_finishing.insert(ts).second) {
+        _hidden_loads->Hold(ts);
+    }
+    const std::string record = finishing_load_prefix + std::to_string(ts);
+    StorageStatus ss = Sync();
+    if (ss.error_code() != StorageStatus::Ok) {
+        _finishing.erase(ts);
+        _hidden_loads->Release(ts);
+        return ss;
+    }
+    // from now on the load is only finished, by a retry or on Open()
+    ss = _shards[0]->Put(record, "");
+    if (ss.error_code() == StorageStatus::Ok) {
+        ss = _shards[0]->Sync();
+    }
+    for (size_t i = 0;
+         i < _shards.size() && ss.error_code() == StorageStatus::Ok; i++) {
+        ss = _shards[i]->FinishBulkLoad(ts);
+    }
+    if (ss.error_code() != StorageStatus::Ok) {
+        return ss;
+    }
+    _finishing.erase(ts);
+    _hidden_loads->Release(ts);
+    return _shards[0]->Delete(record);
+}
+
+StorageStatus ShardedStorage::AbortBulkLoad(TimeStamp ts) {
+    if (_shards.empty()) {
+        return NotOpened();
+    }
+    std::lock_guard<bthread::Mutex> lck(_load_mutex);
+    StorageStatus ss;
+    if (_finishing.count(ts) != 0) {
+        ss.set_error_code(StorageStatus::InvalidArgument);
+        ss.set_error_message("Bulk load of ts " + std::to_string(ts) +
+                             " is being finished");
+        return ss;
+    }
+    for (auto& shard : _shards) {
+        ss = shard->AbortBulkLoad(ts);
+        if (ss.error_code() != StorageStatus::Ok) {
+            break;
+        }
+    }
+    return ss;
+}
+
+}  // namespace storage
+}  // namespace azino
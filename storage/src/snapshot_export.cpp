@@ -0,0 +1,78 @@
+#include "snapshot_export.h"
+
+#include <bthread/bthread.h>
+#include <butil/time.h>
+#include <bvar/bvar.h>
+
+#include <algorithm>
+
+DEFINE_int64(storage_export_bytes_per_sec, 32 << 20,
+             "max bytes per second read by a snapshot export, 0 means no "
+             "limit");
+static bvar::GFlag gflag_storage_export_bytes_per_sec(
+    "storage_export_bytes_per_sec");
+
+namespace azino {
+namespace storage {
+namespace {
+
+bvar::Adder<int64_t> g_exported_bytes("storage_exported_bytes");
+
+}  // namespace
+
+SnapshotExport::SnapshotExport(Storage* storage, const std::string& left_key,
+                               const std::string& right_key, TimeStamp ts,
+                               uint64_t bytes_per_sec)
+    : _iter(storage->NewSnapshotIterator(ts)),
+      _left_key(left_key),
+      _right_key(right_key),
+      _ts(ts),
+      _bytes_per_sec(bytes_per_sec),
+      _start_us(butil::gettimeofday_us()),
+      _bytes(0),
+      _done(false) {
+    if (FLAGS_storage_export_bytes_per_sec > 0) {
+        uint64_t limit = FLAGS_storage_export_bytes_per_sec;
+        _bytes_per_sec =
+            _bytes_per_sec == 0 ? limit : std::min(_bytes_per_sec, limit);
+    }
+}
+
+StorageStatus SnapshotExport::Next(size_t max_bytes,
+                                   std::vector<std::string>& key,
+                                   std::vector<std::string>& value,
+                                   std::vector<TimeStamp>& seeked_ts,
+                                   std::string& resume_key) {
+    Storage::ScanOptions options;
+    options.max_bytes = max_bytes;
+    StorageStatus ss = Storage::IteratorMVCCScan(
+        _iter.get(), _left_key, _right_key, _ts, options, key, value,
+        seeked_ts, resume_key);
+    if (ss.error_code() != StorageStatus::Ok &&
+        ss.error_code() != StorageStatus::NotFound) {
+        return ss;
+    }
+    size_t bytes = 0;
+    for (size_t i = 0; i < key.size(); i++) {
+        bytes += key[i].size() + value[i].size();
+    }
+    _bytes += bytes;
+    g_exported_bytes << bytes;
+    _done = resume_key.empty();
+    _left_key = resume_key;
+    return ss;
+}
+
+void SnapshotExport::Throttle() {
+    if (_bytes_per_sec == 0) {
+        return;
+    }
+    int64_t due_us = _start_us + _bytes * 1000000 / _bytes_per_sec;
+    int64_t now_us = butil::gettimeofday_us();
+    if (due_us > now_us) {
+        bthread_usleep(due_us - now_us);
+    }
+}
+
+}  // namespace storage
+}  // namespace azino
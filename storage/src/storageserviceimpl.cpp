@@ -1,15 +1,285 @@
 #include <brpc/server.h>
+#include <brpc/stream.h>
+#include <bthread/bthread.h>
 #include <butil/logging.h>
+#include <butil/time.h>
 
+#include <algorithm>
+#include <functional>
+
+#include "azino/stream.h"
 #include "service.h"
 
 DEFINE_string(storage_path, "azino_storage",
               "default name of azino's storage(leveldb)");
+DEFINE_int32(scan_stream_batch_size, 256,
+             "max number of keys in one batch of a streaming mvcc scan");
+DEFINE_int32(scan_stream_batch_bytes, 1 << 20,
+             "max bytes of keys and values in one batch of a streaming mvcc "
+             "scan");
 
 namespace azino {
 namespace storage {
+namespace {
+
+// Return the scan options of "request", but the limits.
+Storage::ScanOptions ScanOptionsOf(const MVCCScanRequest& request) {
+    Storage::ScanOptions options;
+    options.keys_only = request.keys_only();
+    options.key_prefix = request.key_prefix();
+    options.value_prefix = request.value_prefix();
+    options.match_value = request.has_value_equals();
+    options.value_equals = request.value_equals();
+    return options;
+}
+
+// Set the aggregate fields of "response" from "aggregate".
+void SetAggregate(const Storage::ScanAggregate& aggregate,
+                  MVCCScanResponse* response) {
+    response->set_count(aggregate.count);
+    if (aggregate.count > 0) {
+        response->set_min_key(aggregate.min_key);
+        response->set_max_key(aggregate.max_key);
+    }
+}
+
+// Return the storage engine chosen by the flags.
+Storage* NewStorage() {
+    Storage* storage = FLAGS_storage_shards > 1 ? new ShardedStorage()
+                                                : Storage::DefaultStorage();
+    if (FLAGS_storage_latest_cache_capacity > 0) {
+        storage =
+            new CachedStorage(storage, FLAGS_storage_latest_cache_capacity);
+    }
+    return storage;
+}
+
+// Respond a batch store after its group is written.
+class BatchStoreDone : public google::protobuf::Closure {
+   public:
+    BatchStoreDone(brpc::Controller* cntl,
+                   const ::azino::storage::BatchStoreRequest* request,
+                   ::azino::storage::BatchStoreResponse* response,
+                   ::google::protobuf::Closure* done)
+        : _cntl(cntl),
+          _request(request),
+          _response(response),
+          _done(done),
+          _start_us(butil::gettimeofday_us()) {}
+
+    virtual void Run() override {
+        std::unique_ptr<BatchStoreDone> self_guard(this);
+        brpc::ClosureGuard done_guard(_done);
+        _response->set_allocated_status(new StorageStatus(_status));
+        WALSyncer::RecordWrite(durability,
+                               butil::gettimeofday_us() - _start_us);
+
+        LOG(INFO) << " BATCHSTORE remote side: " << _cntl->remote_side()
+                  << " request: " << _request->ShortDebugString()
+                  << " error code: " << _status.error_code()
+                  << " error message: " << _status.error_message();
+    }
+
+    std::vector<Storage::Data> datas;
+    Durability::Level durability;
+    StorageStatus* status() { return &_status; }
 
-StorageServiceImpl::StorageServiceImpl() : _storage(Storage::DefaultStorage()) {
+   private:
+    brpc::Controller* _cntl;
+    const ::azino::storage::BatchStoreRequest* _request;
+    ::azino::storage::BatchStoreResponse* _response;
+    ::google::protobuf::Closure* _done;
+    const int64_t _start_us;
+    StorageStatus _status;
+};
+
+// ScanStream sends the batches of a streaming mvcc scan. Every batch is read
+// on a read worker of the io pool from one snapshot iterator, so the batches
+// are consistent with each other. No bthread waits for the scan meanwhile, a
+// full stream resumes it once writable. It deletes itself when done.
+class ScanStream {
+   public:
+    ScanStream(brpc::StreamId stream, const butil::EndPoint& remote_side,
+               const MVCCScanRequest& req, Storage* storage,
+               ParallelScanner* scanner, IOWorkerPool* io_pool,
+               std::function<void()> on_closed)
+        : _stream(stream),
+          _remote_side(remote_side),
+          _req(req),
+          _storage(storage),
+          _scanner(scanner),
+          _io_pool(io_pool),
+          _on_closed(std::move(on_closed)),
+          _left_key(req.left_key()) {}
+    DISALLOW_COPY_AND_ASSIGN(ScanStream);
+    ~ScanStream() = default;
+
+    // Read and send the batches in the background.
+    void Start() { schedule(); }
+
+   private:
+    // Queue the next batch to the read workers. A worker can't queue to its
+    // own pool, so it is queued from a bthread, behind the reads queued
+    // meanwhile.
+    void schedule() {
+        bthread_t tid;
+        if (bthread_start_background(&tid, nullptr, Dispatch, this) != 0) {
+            Dispatch(this);
+        }
+    }
+
+    static void* Dispatch(void* arg) {
+        auto s = static_cast<ScanStream*>(arg);
+        if (!s->_io_pool->Dispatch(IOWorkerPool::READ, [s]() { s->step(); })) {
+            s->step();
+        }
+        return nullptr;
+    }
+
+    // Read the next batch and send it.
+    void step() {
+        Storage::ScanOptions options = ScanOptionsOf(_req);
+        options.max_bytes = FLAGS_scan_stream_batch_bytes;
+        options.limit = FLAGS_scan_stream_batch_size;
+        if (_req.aggregate()) {
+            // nothing to batch, the matched keys are aggregated at once
+            options.limit = 0;
+        }
+        if (_req.limit() > 0) {
+            options.limit = options.limit == 0
+                                ? _req.limit() - _total
+                                : std::min<uint64_t>(options.limit,
+                                                     _req.limit() - _total);
+        }
+        std::vector<std::string> key;
+        std::vector<std::string> value;
+        std::vector<TimeStamp> ts;
+        std::string resume_key;
+        Storage::ScanAggregate aggregate;
+        if (_req.aggregate()) {
+            options.aggregate = &aggregate;
+        }
+        if (_req.aggregate() && options.limit == 0) {
+            // a single batch, no key is returned so the bytes bound nothing
+            options.max_bytes = 0;
+            _ss = _scanner->MVCCScan(_left_key, _req.right_key(), _req.ts(),
+                                     options, key, value, ts, resume_key);
+        } else {
+            // a bounded batch is never split, see ParallelScanner
+            if (_iter == nullptr) {
+                _iter.reset(_storage->NewSnapshotIterator(_req.ts()));
+            }
+            _ss = Storage::IteratorMVCCScan(_iter.get(), _left_key,
+                                            _req.right_key(), _req.ts(),
+                                            options, key, value, ts,
+                                            resume_key);
+        }
+
+        MVCCScanResponse batch;
+        batch.mutable_status()->CopyFrom(_ss);
+        for (size_t i = 0; i < key.size(); i++) {
+            batch.add_key(key[i]);
+            if (!options.keys_only) {
+                batch.add_value(value[i]);
+            }
+            batch.add_ts(ts[i]);
+        }
+        if (_req.aggregate()) {
+            SetAggregate(aggregate, &batch);
+        }
+        _total += key.size() + aggregate.count;
+        _finished = _ss.error_code() != StorageStatus::Ok ||
+                    resume_key.empty() ||
+                    (_req.limit() > 0 && _total >= _req.limit());
+        if (!resume_key.empty()) {
+            batch.set_resume_key(resume_key);
+        }
+        _left_key.swap(resume_key);
+
+        _pending.clear();
+        butil::IOBufAsZeroCopyOutputStream wrapper(&_pending);
+        if (!batch.SerializeToZeroCopyStream(&wrapper)) {
+            LOG(ERROR) << " MVCCScanStream remote side: " << _remote_side
+                       << " fail to serialize batch";
+            close();
+            return;
+        }
+        send();
+    }
+
+    // Write the pending batch, or wait until the stream is writable.
+    void send() {
+        int rc = brpc::StreamWrite(_stream, _pending);
+        if (rc == EAGAIN) {
+            brpc::StreamWait(_stream, nullptr, OnWritable, this);
+            return;
+        }
+        if (rc != 0) {
+            LOG(ERROR) << " MVCCScanStream remote side: " << _remote_side
+                       << " fail to write stream";
+            close();
+            return;
+        }
+        _batches++;
+        if (_finished) {
+            close();
+        } else {
+            schedule();
+        }
+    }
+
+    static void OnWritable(brpc::StreamId stream, void* arg, int error_code) {
+        auto s = static_cast<ScanStream*>(arg);
+        if (error_code != 0) {
+            LOG(ERROR) << " MVCCScanStream remote side: " << s->_remote_side
+                       << " fail to wait stream, error: " << error_code;
+            s->close();
+            return;
+        }
+        s->send();
+    }
+
+    void close() {
+        brpc::StreamClose(_stream);
+        LOG(INFO) << " MVCCScanStream remote side: " << _remote_side
+                  << " request: " << _req.ShortDebugString()
+                  << " keys: " << _total << " batches: " << _batches
+                  << " error code: " << _ss.error_code()
+                  << " error message: " << _ss.error_message();
+        // the iterator goes before the storage may
+        std::function<void()> on_closed = std::move(_on_closed);
+        delete this;
+        on_closed();
+    }
+
+    const brpc::StreamId _stream;
+    const butil::EndPoint _remote_side;
+    const MVCCScanRequest _req;
+    Storage* _storage;
+    ParallelScanner* _scanner;
+    IOWorkerPool* _io_pool;
+    std::function<void()> _on_closed;
+    std::unique_ptr<leveldb::Iterator> _iter;
+    std::string _left_key;
+    butil::IOBuf _pending;
+    bool _finished = false;
+    uint64_t _total = 0;
+    int _batches = 0;
+    StorageStatus _ss;
+};
+
+}  // namespace
+
+StorageServiceImpl::StorageServiceImpl(brpc::Channel* txplanner_channel)
+    : _storage(NewStorage()),
+      _io_pool(new IOWorkerPool(FLAGS_storage_io_read_threads,
+                                FLAGS_storage_io_write_threads)),
+      _syncer(new WALSyncer(_storage.get())),
+      _gc(new MVCCGC(_storage.get(), txplanner_channel)),
+      _committer(new GroupCommitter(_storage.get(), _io_pool.get(),
+                                    _syncer.get())),
+      _scanner(new ParallelScanner(_storage.get())),
+      _monitor(new StorageMonitor(_storage.get())) {
     StorageStatus ss = _storage->Open(FLAGS_storage_path);
     if (ss.error_code() != StorageStatus::Ok) {
         LOG(FATAL) << " Fail to open storage: " << FLAGS_storage_path
@@ -18,6 +288,27 @@ StorageServiceImpl::StorageServiceImpl() : _storage(Storage::DefaultStorage()) {
     } else {
         LOG(INFO) << " Successes to open storage: " << FLAGS_storage_path;
     }
+    if (FLAGS_enable_storage_gc) {
+        _gc->Start();
+    }
+    _syncer->Start();
+    _monitor->Refresh();
+    _monitor->Start();
+}
+
+StorageServiceImpl::~StorageServiceImpl() {
+    {
+        // the scan streams still read from the storage
+        std::unique_lock<bthread::Mutex> lck(_stream_mutex);
+        while (_streams > 0) {
+            _stream_cond.wait(lck);
+        }
+    }
+    // the other members run their storage calls inline from now on
+    _io_pool->Stop();
+    _gc->Stop();
+    _syncer->Stop();
+    _monitor->Stop();
 }
 
 void StorageServiceImpl::MVCCPut(
@@ -25,11 +316,30 @@ void StorageServiceImpl::MVCCPut(
     const ::azino::storage::MVCCPutRequest* request,
     ::azino::storage::MVCCPutResponse* response,
     ::google::protobuf::Closure* done) {
+    // Handed to an io worker, which calls this again and goes on below.
+    if (_io_pool->Dispatch(IOWorkerPool::WRITE, [=]() {
+            MVCCPut(controller, request, response, done);
+        })) {
+        return;
+    }
     brpc::ClosureGuard done_guard(done);
     brpc::Controller* cntl = static_cast<brpc::Controller*>(controller);
 
-    StorageStatus ss =
-        _storage->MVCCPut(request->key(), request->ts(), request->value());
+    int64_t start_us = butil::gettimeofday_us();
+    Durability::Level durability = _syncer->Resolve(request->durability());
+    StorageStatus ss;
+    if (durability == Durability::Sync) {
+        ss = _storage->SyncBatchStore(
+            {{request->key(), request->value(), request->ts(), false}});
+    } else {
+        ss = _storage->MVCCPut(request->key(), request->ts(),
+                               request->value());
+    }
+    if (ss.error_code() == StorageStatus::Ok) {
+        ss = _syncer->Commit(durability,
+                             request->key().size() + request->value().size());
+    }
+    WALSyncer::RecordWrite(durability, butil::gettimeofday_us() - start_us);
     StorageStatus* ssts = new StorageStatus(ss);
     response->set_allocated_status(ssts);
 
@@ -44,6 +354,11 @@ void StorageServiceImpl::MVCCGet(
     const ::azino::storage::MVCCGetRequest* request,
     ::azino::storage::MVCCGetResponse* response,
     ::google::protobuf::Closure* done) {
+    if (_io_pool->Dispatch(IOWorkerPool::READ, [=]() {
+            MVCCGet(controller, request, response, done);
+        })) {
+        return;
+    }
     brpc::ClosureGuard done_guard(done);
     brpc::Controller* cntl = static_cast<brpc::Controller*>(controller);
 
@@ -62,15 +377,69 @@ void StorageServiceImpl::MVCCGet(
               << " error message: " << ss.error_message();
 }
 
+void StorageServiceImpl::BatchMVCCGet(
+    ::google::protobuf::RpcController* controller,
+    const ::azino::storage::BatchMVCCGetRequest* request,
+    ::azino::storage::BatchMVCCGetResponse* response,
+    ::google::protobuf::Closure* done) {
+    if (_io_pool->Dispatch(IOWorkerPool::READ, [=]() {
+            BatchMVCCGet(controller, request, response, done);
+        })) {
+        return;
+    }
+    brpc::ClosureGuard done_guard(done);
+    brpc::Controller* cntl = static_cast<brpc::Controller*>(controller);
+
+    std::vector<std::string> keys(request->keys().begin(),
+                                  request->keys().end());
+    std::vector<std::string> values;
+    std::vector<TimeStamp> ts;
+    std::vector<StorageStatus> statuses;
+    StorageStatus ss =
+        _storage->BatchMVCCGet(keys, request->ts(), values, ts, statuses);
+    StorageStatus* ssts = new StorageStatus(ss);
+    response->set_allocated_status(ssts);
+    if (ss.error_code() == StorageStatus::Ok) {
+        for (size_t i = 0; i < keys.size(); i++) {
+            auto* result = response->add_results();
+            result->mutable_status()->Swap(&statuses[i]);
+            result->mutable_value()->swap(values[i]);
+            result->set_ts(ts[i]);
+        }
+    }
+
+    LOG(INFO) << " BATCHMVCCGET remote side: " << cntl->remote_side()
+              << " keys: " << request->keys_size() << " ts: " << request->ts()
+              << " error code: " << ss.error_code()
+              << " error message: " << ss.error_message();
+}
+
 void StorageServiceImpl::MVCCDelete(
     ::google::protobuf::RpcController* controller,
     const ::azino::storage::MVCCDeleteRequest* request,
     ::azino::storage::MVCCDeleteResponse* response,
     ::google::protobuf::Closure* done) {
+    if (_io_pool->Dispatch(IOWorkerPool::WRITE, [=]() {
+            MVCCDelete(controller, request, response, done);
+        })) {
+        return;
+    }
     brpc::ClosureGuard done_guard(done);
     brpc::Controller* cntl = static_cast<brpc::Controller*>(controller);
 
-    StorageStatus ss = _storage->MVCCDelete(request->key(), request->ts());
+    int64_t start_us = butil::gettimeofday_us();
+    Durability::Level durability = _syncer->Resolve(request->durability());
+    StorageStatus ss;
+    if (durability == Durability::Sync) {
+        ss = _storage->SyncBatchStore(
+            {{request->key(), "", request->ts(), true}});
+    } else {
+        ss = _storage->MVCCDelete(request->key(), request->ts());
+    }
+    if (ss.error_code() == StorageStatus::Ok) {
+        ss = _syncer->Commit(durability, request->key().size());
+    }
+    WALSyncer::RecordWrite(durability, butil::gettimeofday_us() - start_us);
     StorageStatus* ssts = new StorageStatus(ss);
     response->set_allocated_status(ssts);
 
@@ -85,16 +454,48 @@ void StorageServiceImpl::BatchStore(
     const ::azino::storage::BatchStoreRequest* request,
     ::azino::storage::BatchStoreResponse* response,
     ::google::protobuf::Closure* done) {
+    if (!FLAGS_enable_group_commit &&
+        _io_pool->Dispatch(IOWorkerPool::WRITE, [=]() {
+            BatchStore(controller, request, response, done);
+        })) {
+        return;
+    }
     brpc::ClosureGuard done_guard(done);
     brpc::Controller* cntl = static_cast<brpc::Controller*>(controller);
+    // tell the persistor how hard the engine is pressed by compactions
+    *response->mutable_backpressure() = _monitor->Current();
 
+    if (FLAGS_enable_group_commit) {
+        auto store_done = new BatchStoreDone(cntl, request, response,
+                                             done_guard.release());
+        store_done->durability = _syncer->Resolve(request->durability());
+        store_done->datas.reserve(request->datas_size());
+        for (auto& d : request->datas()) {
+            store_done->datas.push_back({d.key(), d.value().content(), d.ts(),
+                                         d.value().is_delete()});
+        }
+        _committer->AsyncBatchStore(&store_done->datas, store_done->status(),
+                                    store_done, store_done->durability);
+        return;
+    }
+
+    int64_t start_us = butil::gettimeofday_us();
+    Durability::Level durability = _syncer->Resolve(request->durability());
     std::vector<Storage::Data> datas;
     datas.reserve(request->datas_size());
+    size_t bytes = 0;
     for (auto& d : request->datas()) {
         datas.push_back(
             {d.key(), d.value().content(), d.ts(), d.value().is_delete()});
+        bytes += d.key().size() + d.value().content().size();
     }
-    StorageStatus ss = _storage->BatchStore(datas);
+    StorageStatus ss = durability == Durability::Sync
+                           ? _storage->SyncBatchStore(datas)
+                           : _storage->BatchStore(datas);
+    if (ss.error_code() == StorageStatus::Ok) {
+        ss = _syncer->Commit(durability, bytes);
+    }
+    WALSyncer::RecordWrite(durability, butil::gettimeofday_us() - start_us);
     StorageStatus* ssts = new StorageStatus(ss);
     response->set_allocated_status(ssts);
 
@@ -109,22 +510,43 @@ void StorageServiceImpl::MVCCScan(
     const ::azino::storage::MVCCScanRequest* request,
     ::azino::storage::MVCCScanResponse* response,
     ::google::protobuf::Closure* done) {
+    if (_io_pool->Dispatch(IOWorkerPool::READ, [=]() {
+            MVCCScan(controller, request, response, done);
+        })) {
+        return;
+    }
     brpc::ClosureGuard done_guard(done);
     brpc::Controller* cntl = static_cast<brpc::Controller*>(controller);
 
     std::vector<std::string> key;
     std::vector<std::string> value;
     std::vector<TimeStamp> ts;
-    StorageStatus ss =
-        _storage->MVCCScan(request->left_key(), request->right_key(),
-                           request->ts(), key, value, ts);
+    std::string resume_key;
+    Storage::ScanOptions options = ScanOptionsOf(*request);
+    options.limit = request->limit();
+    options.max_bytes = request->max_bytes();
+    Storage::ScanAggregate aggregate;
+    if (request->aggregate()) {
+        options.aggregate = &aggregate;
+    }
+    StorageStatus ss = _scanner->MVCCScan(request->left_key(),
+                                          request->right_key(), request->ts(),
+                                          options, key, value, ts, resume_key);
     StorageStatus* ssts = new StorageStatus(ss);
     response->set_allocated_status(ssts);
-    for (size_t i = 0; i < value.size(); i++) {
+    for (size_t i = 0; i < key.size(); i++) {
         response->add_key(key[i]);
-        response->add_value(value[i]);
+        if (!options.keys_only) {
+            response->add_value(value[i]);
+        }
         response->add_ts(ts[i]);
     }
+    if (request->aggregate()) {
+        SetAggregate(aggregate, response);
+    }
+    if (!resume_key.empty()) {
+        response->set_resume_key(resume_key);
+    }
 
     LOG(INFO) << " MVCCScan remote side: " << cntl->remote_side()
               << " request: " << request->ShortDebugString()
@@ -132,5 +554,157 @@ void StorageServiceImpl::MVCCScan(
               << " error message: " << ss.error_message();
 }
 
+void StorageServiceImpl::MVCCScanStream(
+    ::google::protobuf::RpcController* controller,
+    const ::azino::storage::MVCCScanRequest* request,
+    ::azino::storage::MVCCScanResponse* response,
+    ::google::protobuf::Closure* done) {
+    brpc::ClosureGuard done_guard(done);
+    brpc::Controller* cntl = static_cast<brpc::Controller*>(controller);
+
+    brpc::StreamId stream;
+    if (brpc::StreamAccept(&stream, *cntl, nullptr) != 0) {
+        cntl->SetFailed("Fail to accept stream");
+        LOG(ERROR) << " MVCCScanStream remote side: " << cntl->remote_side()
+                   << " fail to accept stream";
+        return;
+    }
+    response->mutable_status()->set_error_code(StorageStatus::Ok);
+    {
+        std::lock_guard<bthread::Mutex> lck(_stream_mutex);
+        _streams++;
+    }
+    auto scan = new ScanStream(stream, cntl->remote_side(), *request,
+                               _storage.get(), _scanner.get(), _io_pool.get(),
+                               [this]() { on_stream_closed(); });
+    // The stream is usable only after the response is sent.
+    done_guard.reset(nullptr);
+    scan->Start();
+}
+
+void StorageServiceImpl::on_stream_closed() {
+    std::lock_guard<bthread::Mutex> lck(_stream_mutex);
+    _streams--;
+    _stream_cond.notify_all();
+}
+
+void StorageServiceImpl::ExportSnapshot(
+    ::google::protobuf::RpcController* controller,
+    const ::azino::storage::ExportSnapshotRequest* request,
+    ::azino::storage::ExportSnapshotResponse* response,
+    ::google::protobuf::Closure* done) {
+    brpc::ClosureGuard done_guard(done);
+    brpc::Controller* cntl = static_cast<brpc::Controller*>(controller);
+
+    brpc::StreamId stream;
+    if (brpc::StreamAccept(&stream, *cntl, nullptr) != 0) {
+        cntl->SetFailed("Fail to accept stream");
+        LOG(ERROR) << " ExportSnapshot remote side: " << cntl->remote_side()
+                   << " fail to accept stream";
+        return;
+    }
+    response->mutable_status()->set_error_code(StorageStatus::Ok);
+    // The stream is usable only after the response is sent.
+    const butil::EndPoint remote_side = cntl->remote_side();
+    const ExportSnapshotRequest req(*request);
+    done_guard.reset(nullptr);
+
+    SnapshotExport exporter(_storage.get(), req.left_key(), req.right_key(),
+                            req.ts(), req.bytes_per_sec());
+    uint64_t total = 0;
+    int batches = 0;
+    StorageStatus ss;
+    while (!exporter.Done()) {
+        // wait outside of the io workers, so that they keep serving the
+        // foreground reads
+        exporter.Throttle();
+        std::vector<std::string> key;
+        std::vector<std::string> value;
+        std::vector<TimeStamp> ts;
+        std::string resume_key;
+        _io_pool->Run(IOWorkerPool::READ, [&]() {
+            ss = exporter.Next(FLAGS_scan_stream_batch_bytes, key, value, ts,
+                               resume_key);
+        });
+
+        MVCCScanResponse batch;
+        batch.mutable_status()->CopyFrom(ss);
+        for (size_t i = 0; i < key.size(); i++) {
+            batch.add_key(key[i]);
+            batch.add_value(value[i]);
+            batch.add_ts(ts[i]);
+        }
+        if (!resume_key.empty()) {
+            batch.set_resume_key(resume_key);
+        }
+        total += key.size();
+        if (WriteStreamMessage(stream, batch) != 0) {
+            LOG(ERROR) << " ExportSnapshot remote side: " << remote_side
+                       << " fail to write stream";
+            break;
+        }
+        batches++;
+        if (ss.error_code() != StorageStatus::Ok &&
+            ss.error_code() != StorageStatus::NotFound) {
+            break;
+        }
+    }
+    brpc::StreamClose(stream);
+
+    LOG(INFO) << " ExportSnapshot remote side: " << remote_side
+              << " request: " << req.ShortDebugString() << " keys: " << total
+              << " bytes: " << exporter.bytes() << " batches: " << batches
+              << " error code: " << ss.error_code()
+              << " error message: " << ss.error_message();
+}
+
+void StorageServiceImpl::BulkLoad(
+    ::google::protobuf::RpcController* controller,
+    const ::azino::storage::BulkLoadRequest* request,
+    ::azino::storage::BulkLoadResponse* response,
+    ::google::protobuf::Closure* done) {
+    if (_io_pool->Dispatch(IOWorkerPool::WRITE, [=]() {
+            BulkLoad(controller, request, response, done);
+        })) {
+        return;
+    }
+    brpc::ClosureGuard done_guard(done);
+    brpc::Controller* cntl = static_cast<brpc::Controller*>(controller);
+
+    StorageStatus ss;
+    switch (request->action()) {
+        case BulkLoadRequest::Finish:
+            ss = _storage->FinishBulkLoad(request->ts());
+            break;
+        case BulkLoadRequest::Abort:
+            ss = _storage->AbortBulkLoad(request->ts());
+            break;
+        default:
+            if (request->keys_size() != request->values_size()) {
+                ss.set_error_code(StorageStatus::InvalidArgument);
+                ss.set_error_message("Keys and values do not match");
+                break;
+            }
+            std::vector<Storage::Data> datas;
+            datas.reserve(request->keys_size());
+            for (int i = 0; i < request->keys_size(); i++) {
+                datas.push_back({request->keys(i), request->values(i),
+                                 request->ts(), false});
+            }
+            ss = _storage->BulkLoad(request->ts(), datas);
+            break;
+    }
+    StorageStatus* ssts = new StorageStatus(ss);
+    response->set_allocated_status(ssts);
+
+    // the request is not logged as a whole, it carries a large batch
+    LOG(INFO) << " BULKLOAD remote side: " << cntl->remote_side()
+              << " ts: " << request->ts()
+              << " action: " << BulkLoadRequest::Action_Name(request->action())
+              << " keys: " << request->keys_size()
+              << " error code: " << ss.error_code()
+              << " error message: " << ss.error_message();
+}
+
 }  // namespace storage
 }  // namespace azino
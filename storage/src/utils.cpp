@@ -1,84 +1,194 @@
 #include "utils.h"
 
-#include <cassert>
 #include <cstring>
-#include <memory>
 
 namespace azino {
 namespace storage {
 std::string InternalKey::Encode() const {
-    char *buf = new char[strlen(format_prefix) + _user_key.length() +
-                         ts_length + delete_tag_length + 1]();
-    char *index = buf;
+    std::string ans;
+    EncodeTo(&ans);
+    return ans;
+}
+
+void InternalKey::EncodeTo(std::string *dst) const {
+    dst->reserve(dst->size() + tag_length + _user_key.length() +
+                 terminator_length + ts_length + flag_length);
+    encode_user_key(_user_key, dst);
+    EncodeSuffix(_ts, _is_delete, dst);
+}
+
+bool InternalKey::Valid() const { return _valid; }
+
+bool InternalKey::IsDelete() const { return _is_delete; }
 
-    strcpy(buf, format_prefix);
-    index += strlen(format_prefix);
+std::string InternalKey::UserKey() const { return _user_key; }
 
-    unsigned n = sprintf(index, format_user_key, _user_key.data());
-    index += n;
-    assert(n == _user_key.length());
+TimeStamp InternalKey::TS() const { return _ts; }
 
-    n = sprintf(index, format_ts, ~_ts);  // need to inverse timestamp because
-                                          // leveldb's seek find the bigger one
-    index += n;
-    assert(n == ts_length);
+bool InternalKey::IsInternalKey(const leveldb::Slice &key) {
+    return !key.empty() && key[0] == tag;
+}
 
-    n = sprintf(index, format_delete_tag, _is_delete ? '1' : '0');
-    index += n;
-    assert(n == delete_tag_length);
+bool InternalKey::IsLegacyInternalKey(const leveldb::Slice &key) {
+    return key.starts_with(legacy_prefix);
+}
+
+bool InternalKey::Parse(const leveldb::Slice &internal_key,
+                        ParsedInternalKey *result) {
+    const size_t suffix_length = ts_length + flag_length;
+    if (internal_key.size() <
+            tag_length + terminator_length + suffix_length ||
+        internal_key[0] != tag) {
+        return false;
+    }
 
-    auto ans = std::string(buf);
-    delete[] buf;
+    const char *suffix =
+        internal_key.data() + internal_key.size() - suffix_length;
+    if (suffix[-2] != escape || suffix[-1] != terminator) {
+        return false;
+    }
+
+    TimeStamp inversed_ts = 0;
+    for (int i = 0; i < ts_length; i++) {
+        inversed_ts =
+            (inversed_ts << 8) | static_cast<unsigned char>(suffix[i]);
+    }
+
+    result->user_key = leveldb::Slice(internal_key.data(),
+                                      internal_key.size() - suffix_length);
+    result->ts = ~inversed_ts;
+    result->is_delete = (suffix[ts_length] & delete_flag) != 0;
+    result->is_blob = (suffix[ts_length] & blob_flag) != 0;
+    result->is_loaded = (suffix[ts_length] & load_flag) != 0;
+    return true;
+}
+
+std::string InternalKey::EncodeUserKey(const std::string &user_key) {
+    std::string ans;
+    ans.reserve(tag_length + user_key.length() + terminator_length);
+    encode_user_key(user_key, &ans);
     return ans;
 }
 
-bool InternalKey::Valid() const { return _valid; }
+bool InternalKey::IsEncodedUserKey(const leveldb::Slice &key) {
+    // An escaped user key never contains "escape terminator", so an encoded
+    // user key can not be parsed as an internal key and vice versa.
+    ParsedInternalKey parsed;
+    return key.size() >= tag_length + terminator_length && key[0] == tag &&
+           key[key.size() - 2] == escape && key[key.size() - 1] == terminator &&
+           !Parse(key, &parsed);
+}
 
-bool InternalKey::IsDelete() const { return _is_delete; }
+std::string InternalKey::DecodeUserKey(
+    const leveldb::Slice &encoded_user_key) {
+    std::string ans;
+    if (encoded_user_key.size() < tag_length + terminator_length) {
+        return ans;
+    }
+    const char *p = encoded_user_key.data() + tag_length;
+    const char *end =
+        encoded_user_key.data() + encoded_user_key.size() - terminator_length;
+    ans.reserve(end - p);
+    for (; p < end; p++) {
+        ans.push_back(*p);
+        if (*p == escape) {
+            p++;  // skip escaped_zero
+        }
+    }
+    return ans;
+}
 
-std::string InternalKey::UserKey() const { return _user_key; }
+void InternalKey::EncodeSuffix(TimeStamp ts, bool is_delete,
+                               std::string *dst) {
+    // need to inverse timestamp because leveldb's seek find the bigger one
+    TimeStamp inversed_ts = ~ts;
+    char buf[ts_length];
+    for (int i = ts_length - 1; i >= 0; i--) {
+        buf[i] = static_cast<char>(inversed_ts & 0xff);
+        inversed_ts >>= 8;
+    }
+    dst->append(buf, ts_length);
+    dst->push_back(is_delete ? delete_flag : 0);
+}
 
-TimeStamp InternalKey::TS() const { return _ts; }
+void InternalKey::SetBlobFlag(std::string *internal_key) {
+    internal_key->back() |= blob_flag;
+}
+
+void InternalKey::SetLoadFlag(std::string *internal_key) {
+    internal_key->back() |= load_flag;
+}
+
+const std::string &InternalKey::LegacyPrefix() {
+    static const std::string prefix(legacy_prefix);
+    return prefix;
+}
+
+void InternalKey::encode_user_key(const std::string &user_key,
+                                  std::string *dst) {
+    dst->push_back(tag);
+    size_t begin = 0;
+    for (size_t i = 0; i < user_key.length(); i++) {
+        if (user_key[i] == escape) {
+            dst->append(user_key, begin, i + 1 - begin);
+            dst->push_back(escaped_zero);
+            begin = i + 1;
+        }
+    }
+    dst->append(user_key, begin, std::string::npos);
+    dst->push_back(escape);
+    dst->push_back(terminator);
+}
 
 void InternalKey::decode(const std::string &internal_key) {
-    if (internal_key.length() <
-        strlen(format_prefix) + ts_length + delete_tag_length) {
-        _valid = false;
+    if (IsLegacyInternalKey(internal_key)) {
+        decode_legacy(internal_key);
         return;
     }
-    if (internal_key.compare(0, strlen(format_prefix), format_prefix,
-                             strlen(format_prefix))) {
+
+    ParsedInternalKey parsed;
+    if (!Parse(internal_key, &parsed)) {
         _valid = false;
         return;
     }
-    auto user_key_length =
-        internal_key.length() -
-        (strlen(format_prefix) + ts_length + delete_tag_length);
-    TimeStamp buf_ts;
-    char buf_delete_tag;
-    std::unique_ptr<char[]> buf_user_key(new char[user_key_length + 1]());
 
-    auto index = internal_key.data();
-    index += strlen(format_prefix);
-
-    strncpy(buf_user_key.get(), index, user_key_length);
-    index += user_key_length;
+    _valid = true;
+    _user_key = DecodeUserKey(parsed.user_key);
+    _is_delete = parsed.is_delete;
+    _ts = parsed.ts;
+}
 
-    if (1 != sscanf(index, format_ts, &buf_ts)) {
+void InternalKey::decode_legacy(const std::string &internal_key) {
+    const size_t prefix_length = strlen(legacy_prefix);
+    if (internal_key.length() <
+        prefix_length + legacy_ts_length + legacy_delete_tag_length) {
         _valid = false;
         return;
     }
-    index += ts_length;
-
-    if (1 != sscanf(index, format_delete_tag, &buf_delete_tag)) {
-        _valid = false;
-        return;
+    auto user_key_length =
+        internal_key.length() -
+        (prefix_length + legacy_ts_length + legacy_delete_tag_length);
+
+    auto index = internal_key.data() + prefix_length + user_key_length;
+    TimeStamp buf_ts = 0;
+    for (int i = 0; i < legacy_ts_length; i++) {
+        char c = index[i];
+        int d;
+        if (c >= '0' && c <= '9') {
+            d = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            d = c - 'a' + 10;
+        } else {
+            _valid = false;
+            return;
+        }
+        buf_ts = (buf_ts << 4) | d;
     }
-    index += delete_tag_length;
+    index += legacy_ts_length;
 
     _valid = true;
-    _user_key = std::string(buf_user_key.get());
-    _is_delete = buf_delete_tag != '0';
+    _user_key = internal_key.substr(prefix_length, user_key_length);
+    _is_delete = *index != '0';
     _ts = ~buf_ts;
 }
 }  // namespace storage
@@ -0,0 +1,310 @@
+#include "version_cache.h"
+
+#include <butil/logging.h>
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <mutex>
+
+#include "utils.h"
+
+DEFINE_int64(storage_latest_cache_capacity, 64 << 20,
+             "bytes of the cache of the newest versions of hot keys, 0 "
+             "disables it");
+DEFINE_int32(storage_latest_cache_shards, 16,
+             "number of lru shards of the newest version cache");
+
+namespace azino {
+namespace storage {
+namespace {
+// bookkeeping bytes of an entry besides its key and value
+const size_t entry_overhead = 64;
+}  // namespace
+
+LatestVersionCache::LatestVersionCache(size_t capacity, size_t shards)
+    : _shard_capacity(capacity / std::max<size_t>(shards, 1)) {
+    for (size_t i = 0; i < std::max<size_t>(shards, 1); i++) {
+        _shards.emplace_back(new Shard());
+    }
+}
+
+LatestVersionCache::Shard& LatestVersionCache::shard(const std::string& key) {
+    return *_shards[std::hash<std::string>()(key) % _shards.size()];
+}
+
+bool LatestVersionCache::Lookup(const std::string& key, Version& version) {
+    Shard& s = shard(key);
+    std::lock_guard<bthread::Mutex> lck(s.mutex);
+    auto it = s.index.find(key);
+    if (it == s.index.end()) {
+        return false;
+    }
+    s.lru.splice(s.lru.begin(), s.lru, it->second);
+    version = it->second->version;
+    return true;
+}
+
+void LatestVersionCache::Update(const std::string& key, TimeStamp ts,
+                                bool is_delete, const std::string& value) {
+    Shard& s = shard(key);
+    std::lock_guard<bthread::Mutex> lck(s.mutex);
+    s.epoch++;
+    auto it = s.index.find(key);
+    if (it != s.index.end()) {
+        if (it->second->version.ts > ts) {
+            return;
+        }
+        erase(s, it->second);
+    }
+    insert(s, key, Version{ts, is_delete, value});
+}
+
+void LatestVersionCache::Invalidate(const std::string& key, TimeStamp ts) {
+    Shard& s = shard(key);
+    std::lock_guard<bthread::Mutex> lck(s.mutex);
+    s.epoch++;
+    auto it = s.index.find(key);
+    if (it != s.index.end() && it->second->version.ts == ts) {
+        erase(s, it->second);
+    }
+}
+
+uint64_t LatestVersionCache::Epoch(const std::string& key) {
+    Shard& s = shard(key);
+    std::lock_guard<bthread::Mutex> lck(s.mutex);
+    return s.epoch;
+}
+
+void LatestVersionCache::Fill(const std::string& key, const Version& version,
+                              uint64_t epoch) {
+    Shard& s = shard(key);
+    std::lock_guard<bthread::Mutex> lck(s.mutex);
+    if (s.epoch != epoch || s.index.count(key) != 0) {
+        return;
+    }
+    insert(s, key, version);
+}
+
+void LatestVersionCache::Clear() {
+    for (auto& s : _shards) {
+        std::lock_guard<bthread::Mutex> lck(s->mutex);
+        s->epoch++;
+        s->lru.clear();
+        s->index.clear();
+        s->bytes = 0;
+    }
+}
+
+size_t LatestVersionCache::Bytes() const {
+    size_t bytes = 0;
+    for (auto& s : _shards) {
+        std::lock_guard<bthread::Mutex> lck(s->mutex);
+        bytes += s->bytes;
+    }
+    return bytes;
+}
+
+void LatestVersionCache::insert(Shard& s, const std::string& key,
+                                const Version& version) {
+    size_t charge = key.size() + version.value.size() + entry_overhead;
+    if (charge > _shard_capacity) {
+        return;
+    }
+    while (s.bytes + charge > _shard_capacity) {
+        erase(s, std::prev(s.lru.end()));
+    }
+    s.lru.push_front(Entry{key, version, charge});
+    s.index[key] = s.lru.begin();
+    s.bytes += charge;
+}
+
+void LatestVersionCache::erase(Shard& s, std::list<Entry>::iterator it) {
+    s.bytes -= it->charge;
+    s.index.erase(it->key);
+    s.lru.erase(it);
+}
+
+CachedStorage::CachedStorage(Storage* base, size_t capacity,
+                             const std::string& prefix)
+    : _base(base), _cache(capacity, FLAGS_storage_latest_cache_shards) {
+    _hits.expose_as(prefix, "latest_cache_hit");
+    _misses.expose_as(prefix, "latest_cache_miss");
+}
+
+StorageStatus CachedStorage::Put(const std::string& key,
+                                 const std::string& value) {
+    StorageStatus ss = _base->Put(key, value);
+    ParsedInternalKey parsed;
+    if (ss.error_code() == StorageStatus::Ok &&
+        InternalKey::Parse(key, &parsed)) {
+        _cache.Update(parsed.user_key.ToString(), parsed.ts, parsed.is_delete,
+                      value);
+    }
+    return ss;
+}
+
+StorageStatus CachedStorage::Delete(const std::string& key) {
+    StorageStatus ss = _base->Delete(key);
+    ParsedInternalKey parsed;
+    if (InternalKey::Parse(key, &parsed)) {
+        _cache.Invalidate(parsed.user_key.ToString(), parsed.ts);
+    }
+    return ss;
+}
+
+StorageStatus CachedStorage::BatchStore(const std::vector<Data>& datas) {
+    StorageStatus ss = _base->BatchStore(datas);
+    update(datas, ss);
+    return ss;
+}
+
+StorageStatus CachedStorage::SyncBatchStore(const std::vector<Data>& datas) {
+    StorageStatus ss = _base->SyncBatchStore(datas);
+    update(datas, ss);
+    return ss;
+}
+
+void CachedStorage::update(const std::vector<Data>& datas,
+                           const StorageStatus& ss) {
+    if (ss.error_code() != StorageStatus::Ok) {
+        return;
+    }
+    for (auto& data : datas) {
+        _cache.Update(InternalKey::EncodeUserKey(data.key), data.ts,
+                      data.is_delete, data.value);
+    }
+}
+
+StorageStatus CachedStorage::BatchDelete(const std::vector<std::string>& keys) {
+    StorageStatus ss = _base->BatchDelete(keys);
+    ParsedInternalKey parsed;
+    for (auto& key : keys) {
+        if (InternalKey::Parse(key, &parsed)) {
+            _cache.Invalidate(parsed.user_key.ToString(), parsed.ts);
+        }
+    }
+    return ss;
+}
+
+StorageStatus CachedStorage::FinishBulkLoad(TimeStamp ts) {
+    StorageStatus ss = _base->FinishBulkLoad(ts);
+    _cache.Clear();
+    return ss;
+}
+
+StorageStatus CachedStorage::MVCCGet(const std::string& key, TimeStamp ts,
+                                     std::string& value,
+                                     TimeStamp& seeked_ts) {
+    StorageStatus ss;
+    if (lookup(key, ts, value, seeked_ts, ss)) {
+        _hits << 1;
+        return ss;
+    }
+    _misses << 1;
+    if (read_latest(key, ts, value, seeked_ts, ss)) {
+        return ss;
+    }
+    return _base->MVCCGet(key, ts, value, seeked_ts);
+}
+
+StorageStatus CachedStorage::BatchMVCCGet(
+    const std::vector<std::string>& keys, TimeStamp ts,
+    std::vector<std::string>& values, std::vector<TimeStamp>& seeked_ts,
+    std::vector<StorageStatus>& statuses) {
+    values.assign(keys.size(), std::string());
+    seeked_ts.assign(keys.size(), 0);
+    statuses.assign(keys.size(), StorageStatus());
+    std::vector<size_t> missed;
+    std::vector<std::string> missed_keys;
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (lookup(keys[i], ts, values[i], seeked_ts[i], statuses[i])) {
+            _hits << 1;
+        } else {
+            _misses << 1;
+            missed.push_back(i);
+            missed_keys.push_back(keys[i]);
+        }
+    }
+
+    StorageStatus ss;
+    ss.set_error_code(StorageStatus::Ok);
+    if (missed.empty()) {
+        return ss;
+    }
+    std::vector<std::string> missed_values;
+    std::vector<TimeStamp> missed_ts;
+    std::vector<StorageStatus> missed_statuses;
+    ss = _base->BatchMVCCGet(missed_keys, ts, missed_values, missed_ts,
+                             missed_statuses);
+    if (ss.error_code() != StorageStatus::Ok) {
+        return ss;
+    }
+    for (size_t j = 0; j < missed.size(); j++) {
+        values[missed[j]].swap(missed_values[j]);
+        seeked_ts[missed[j]] = missed_ts[j];
+        statuses[missed[j]].Swap(&missed_statuses[j]);
+    }
+    return ss;
+}
+
+bool CachedStorage::lookup(const std::string& key, TimeStamp ts,
+                           std::string& value, TimeStamp& seeked_ts,
+                           StorageStatus& ss) {
+    LatestVersionCache::Version version;
+    if (!_cache.Lookup(InternalKey::EncodeUserKey(key), version) ||
+        version.ts > ts) {
+        return false;
+    }
+    if (version.is_delete) {
+        ss.set_error_code(StorageStatus::NotFound);
+    } else {
+        value.swap(version.value);
+        seeked_ts = version.ts;
+        ss.set_error_code(StorageStatus::Ok);
+    }
+    return true;
+}
+
+bool CachedStorage::read_latest(const std::string& key, TimeStamp ts,
+                                std::string& value, TimeStamp& seeked_ts,
+                                StorageStatus& ss) {
+    if (!_base->MVCCKeyMayExist(key)) {
+        ss.set_error_code(StorageStatus::NotFound);
+        return true;
+    }
+    std::string user_key = InternalKey::EncodeUserKey(key);
+    uint64_t epoch = _cache.Epoch(user_key);
+    std::unique_ptr<leveldb::Iterator> iter(_base->NewIterator(MAX_TIMESTAMP));
+    if (iter == nullptr) {
+        return false;
+    }
+    iter->Seek(user_key);
+    ParsedInternalKey parsed;
+    if (!iter->Valid() || !InternalKey::Parse(iter->key(), &parsed) ||
+        parsed.user_key != user_key) {
+        if (!iter->status().ok()) {
+            return false;
+        }
+        ss.set_error_code(StorageStatus::NotFound);
+        return true;
+    }
+
+    LatestVersionCache::Version version{parsed.ts, parsed.is_delete,
+                                        iter->value().ToString()};
+    _cache.Fill(user_key, version, epoch);
+    if (version.ts > ts) {
+        return false;
+    }
+    if (version.is_delete) {
+        ss.set_error_code(StorageStatus::NotFound);
+    } else {
+        value.swap(version.value);
+        seeked_ts = version.ts;
+        ss.set_error_code(StorageStatus::Ok);
+    }
+    return true;
+}
+
+}  // namespace storage
+}  // namespace azino
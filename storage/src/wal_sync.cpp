@@ -0,0 +1,144 @@
+#include "wal_sync.h"
+
+#include <butil/logging.h>
+#include <butil/time.h>
+#include <bvar/bvar.h>
+
+#include <mutex>
+
+#include "storage.h"
+
+DEFINE_string(storage_durability, "async",
+              "durability of the writes which do not ask for one: async, "
+              "periodic or sync");
+DEFINE_int32(storage_sync_interval_ms, 100,
+             "max time a periodic durability write stays unsynced");
+static bvar::GFlag gflag_storage_sync_interval_ms("storage_sync_interval_ms");
+DEFINE_int64(storage_sync_bytes, 4 << 20,
+             "bytes of periodic durability writes which trigger a sync at "
+             "once, 0 means no limit");
+static bvar::GFlag gflag_storage_sync_bytes("storage_sync_bytes");
+
+namespace azino {
+namespace storage {
+namespace {
+bvar::LatencyRecorder g_sync_latency("storage_wal_sync");
+bvar::IntRecorder g_sync_writes("storage_wal_sync_writes");
+bvar::LatencyRecorder g_write_async("storage_write_async");
+bvar::LatencyRecorder g_write_periodic("storage_write_periodic");
+bvar::LatencyRecorder g_write_sync("storage_write_sync");
+}  // namespace
+
+WALSyncer::WALSyncer(Storage* storage)
+    : _storage(storage),
+      _default_level(Durability::Async),
+      _committed(0),
+      _synced(0),
+      _unsynced_bytes(0),
+      _syncing(false) {
+    fn = WALSyncer::execute;
+    if (FLAGS_storage_durability == "periodic") {
+        _default_level = Durability::Periodic;
+    } else if (FLAGS_storage_durability == "sync") {
+        _default_level = Durability::Sync;
+    } else if (FLAGS_storage_durability != "async") {
+        LOG(ERROR) << " Unknown storage durability: "
+                   << FLAGS_storage_durability << ", use async";
+    }
+}
+
+Durability::Level WALSyncer::Resolve(Durability::Level level) const {
+    return level == Durability::Default ? _default_level : level;
+}
+
+StorageStatus WALSyncer::Commit(Durability::Level level, size_t bytes) {
+    level = Resolve(level);
+    if (level == Durability::Periodic) {
+        bool sync;
+        {
+            std::lock_guard<bthread::Mutex> lck(_sync_mutex);
+            _committed++;
+            _unsynced_bytes += bytes;
+            sync = FLAGS_storage_sync_bytes > 0 &&
+                   _unsynced_bytes >= size_t(FLAGS_storage_sync_bytes);
+        }
+        if (sync) {
+            return Sync();
+        }
+    }
+    StorageStatus ss;
+    ss.set_error_code(StorageStatus::Ok);
+    return ss;
+}
+
+StorageStatus WALSyncer::Sync() {
+    StorageStatus ss;
+    ss.set_error_code(StorageStatus::Ok);
+    std::unique_lock<bthread::Mutex> lck(_sync_mutex);
+    const uint64_t target = _committed;
+    while (_synced < target) {
+        if (_syncing) {
+            _sync_cond.wait(lck);
+            continue;
+        }
+        // Writes committed from now on are not covered by this sync.
+        _syncing = true;
+        const uint64_t covered = _committed;
+        const size_t bytes = _unsynced_bytes;
+        _unsynced_bytes = 0;
+        lck.unlock();
+        int64_t start_us = butil::gettimeofday_us();
+        ss = _storage->Sync();
+        g_sync_latency << butil::gettimeofday_us() - start_us;
+        lck.lock();
+        _syncing = false;
+        if (ss.error_code() == StorageStatus::Ok) {
+            g_sync_writes << covered - _synced;
+            _synced = covered;
+        } else {
+            _unsynced_bytes += bytes;
+            LOG(ERROR) << " Fail to sync storage error code: "
+                       << ss.error_code()
+                       << " error message: " << ss.error_message();
+        }
+        _sync_cond.notify_all();
+        if (ss.error_code() != StorageStatus::Ok) {
+            break;
+        }
+    }
+    return ss;
+}
+
+void WALSyncer::RecordWrite(Durability::Level level, int64_t latency_us) {
+    switch (level) {
+        case Durability::Periodic:
+            g_write_periodic << latency_us;
+            break;
+        case Durability::Sync:
+            g_write_sync << latency_us;
+            break;
+        default:
+            g_write_async << latency_us;
+            break;
+    }
+}
+
+void* WALSyncer::execute(void* args) {
+    auto p = reinterpret_cast<WALSyncer*>(args);
+    while (true) {
+        bthread_usleep(FLAGS_storage_sync_interval_ms * 1000);
+        {
+            std::lock_guard<bthread::Mutex> lck(p->_mutex);
+            if (p->_stopped) {
+                break;
+            }
+        }
+        p->Sync();
+    }
+    // leave nothing committed unsynced on a clean stop
+    p->Sync();
+    return nullptr;
+}
+
+}  // namespace storage
+}  // namespace azino
@@ -1,10 +1,25 @@
+#include <butil/time.h>
 #include <gtest/gtest.h>
 #include <leveldb/db.h>
+#include <unistd.h>
 
+#include <cstdio>
+#include <atomic>
 #include <string>
+#include <thread>
 
+#include "blob.h"
+#include "gc.h"
+#include "group_commit.h"
+#include "io_pool.h"
+#include "monitor.h"
+#include "parallel_scan.h"
+#include "sharded.h"
+#include "snapshot_export.h"
 #include "storage.h"
 #include "utils.h"
+#include "version_cache.h"
+#include "wal_sync.h"
 
 class DBImplTest : public testing::Test {
    public:
@@ -137,6 +152,14 @@ TEST_F(DBImplTest, mvccscan) {
     ASSERT_EQ(3, res.size());
     ASSERT_EQ("1", res[0]);
     ASSERT_EQ("2", res[1]);
+    // an empty right key means no limit
+    res.clear();
+    ress.clear();
+    resss.clear();
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCScan("b", "", 3, resss, res, ress).error_code());
+    ASSERT_EQ(2, res.size());
+    ASSERT_EQ("3", res[1]);
 }
 
 TEST_F(DBImplTest, mvccbatch) {
@@ -178,3 +201,1359 @@ TEST_F(DBImplTest, mvccbatch) {
     ASSERT_EQ(storage->MVCCGet("233", 16, seeked_value, ts).error_code(),
               azino::storage::StorageStatus_Code_NotFound);
 }
+
+TEST_F(DBImplTest, internalkey) {
+    // user keys with NULs, ordered by user key asc, then ts desc
+    std::vector<std::pair<std::string, azino::TimeStamp>> keys{
+        {"", 7},
+        {std::string("\0", 1), 2},
+        {"a", 5},
+        {"a", 3},
+        {std::string("a\0", 2), 9},
+        {std::string("a\0b", 3), 1},
+        {"ab", 1},
+        {"b", UINT64_MAX},
+        {"b", 0}};
+    std::vector<std::string> encoded;
+    for (auto &k : keys) {
+        encoded.push_back(
+            azino::storage::InternalKey(k.first, k.second, false).Encode());
+    }
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (i > 0) {
+            ASSERT_LT(encoded[i - 1], encoded[i]);
+        }
+        azino::storage::ParsedInternalKey parsed;
+        ASSERT_TRUE(azino::storage::InternalKey::Parse(encoded[i], &parsed));
+        ASSERT_EQ(keys[i].second, parsed.ts);
+        ASSERT_FALSE(parsed.is_delete);
+        ASSERT_EQ(azino::storage::InternalKey::EncodeUserKey(keys[i].first),
+                  parsed.user_key.ToString());
+
+        azino::storage::InternalKey decoded(encoded[i]);
+        ASSERT_TRUE(decoded.Valid());
+        ASSERT_EQ(keys[i].first, decoded.UserKey());
+        ASSERT_EQ(keys[i].second, decoded.TS());
+    }
+
+    azino::storage::InternalKey deleted(
+        azino::storage::InternalKey("k", 4, true).Encode());
+    ASSERT_TRUE(deleted.IsDelete());
+    ASSERT_FALSE(azino::storage::InternalKey("hello").Valid());
+
+    std::string nul_key("k\0ey", 4), seeked_value;
+    azino::TimeStamp ts;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCPut(nul_key, 5, "v").error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_NotFound,
+              storage->MVCCGet("k", 10, seeked_value, ts).error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCGet(nul_key, 10, seeked_value, ts).error_code());
+    ASSERT_EQ("v", seeked_value);
+}
+
+TEST_F(DBImplTest, legacykey) {
+    char legacy[64];
+    snprintf(legacy, sizeof(legacy), "MVCCKEYold%016lx0",
+             ~static_cast<azino::TimeStamp>(5));
+    // a database written by an old version
+    delete storage;
+    leveldb::Options opt;
+    leveldb::DestroyDB("TestDB", opt);
+    opt.create_if_missing = true;
+    leveldb::DB *db;
+    ASSERT_TRUE(leveldb::DB::Open(opt, "TestDB", &db).ok());
+    ASSERT_TRUE(db->Put(leveldb::WriteOptions(), legacy, "legacy").ok());
+    delete db;
+
+    storage = azino::storage::Storage::DefaultStorage();
+    storage->Open("TestDB");
+
+    std::string seeked_value;
+    azino::TimeStamp ts;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCGet("old", 10, seeked_value, ts).error_code());
+    ASSERT_EQ("legacy", seeked_value);
+    ASSERT_EQ(5, ts);
+    ASSERT_EQ(azino::storage::StorageStatus_Code_NotFound,
+              storage->Get(legacy, seeked_value).error_code());
+}
+
+TEST_F(DBImplTest, mvccscanskip) {
+    std::vector<std::string> keys;
+    std::vector<std::string> values;
+    std::vector<azino::TimeStamp> tss;
+    for (azino::TimeStamp ts = 1; ts <= 50; ts++) {
+        ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+                  storage->MVCCPut("k1", ts, std::to_string(ts)).error_code());
+        ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+                  storage->MVCCPut("k2", ts, std::to_string(ts)).error_code());
+    }
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCDelete("k3", 10).error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCPut("k3", 5, "5").error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCPut("k4", 60, "60").error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->Put("raw", "raw").error_code());
+
+    // both skipping by Next() and re-seeking should give the same result
+    for (int max_skipped : {1000, 3, 0}) {
+        FLAGS_mvcc_scan_max_skipped_versions = max_skipped;
+        keys.clear();
+        values.clear();
+        tss.clear();
+        ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+                  storage->MVCCScan("k1", "k5", 30, keys, values, tss)
+                      .error_code());
+        ASSERT_EQ(2, keys.size());
+        ASSERT_EQ("k1", keys[0]);
+        ASSERT_EQ("30", values[0]);
+        ASSERT_EQ(30, tss[0]);
+        ASSERT_EQ("k2", keys[1]);
+        ASSERT_EQ("30", values[1]);
+
+        keys.clear();
+        values.clear();
+        tss.clear();
+        ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+                  storage->MVCCScan("k2", "k4", 8, keys, values, tss)
+                      .error_code());
+        ASSERT_EQ(2, keys.size());
+        ASSERT_EQ("k2", keys[0]);
+        ASSERT_EQ("8", values[0]);
+        ASSERT_EQ("k3", keys[1]);
+        ASSERT_EQ("5", values[1]);
+    }
+    FLAGS_mvcc_scan_max_skipped_versions = 16;
+}
+
+TEST_F(DBImplTest, mvccscanpage) {
+    for (int i = 0; i < 10; i++) {
+        ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+                  storage->MVCCPut("page" + std::to_string(i), 1, "value")
+                      .error_code());
+    }
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCDelete("page3", 2).error_code());
+
+    azino::storage::Storage::ScanOptions options;
+    options.limit = 4;
+    std::vector<std::string> keys, all_keys;
+    std::vector<std::string> values;
+    std::vector<azino::TimeStamp> tss;
+    std::string left_key = "page", resume_key;
+    int pages = 0;
+    do {
+        keys.clear();
+        values.clear();
+        tss.clear();
+        ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+                  storage
+                      ->MVCCScan(left_key, "pagf", 5, options, keys, values,
+                                 tss, resume_key)
+                      .error_code());
+        ASSERT_LE(keys.size(), options.limit);
+        ASSERT_EQ(keys.size(), values.size());
+        all_keys.insert(all_keys.end(), keys.begin(), keys.end());
+        left_key = resume_key;
+        pages++;
+    } while (!resume_key.empty());
+    ASSERT_EQ(3, pages);
+    ASSERT_EQ(9, all_keys.size());
+    ASSERT_EQ("page4", all_keys[3]);
+
+    // at least one key is returned even if it is bigger than max_bytes
+    options.limit = 0;
+    options.max_bytes = 1;
+    options.keys_only = true;
+    keys.clear();
+    values.clear();
+    tss.clear();
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage
+                  ->MVCCScan("page", "pagf", 5, options, keys, values, tss,
+                             resume_key)
+                  .error_code());
+    ASSERT_EQ(1, keys.size());
+    ASSERT_EQ(0, values.size());
+    ASSERT_EQ("page1", resume_key);
+}
+
+TEST_F(DBImplTest, batchmvccget) {
+    for (int i = 0; i < 100; i++) {
+        ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+                  storage->MVCCPut("bk" + std::to_string(i), 5, "old")
+                      .error_code());
+        ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+                  storage->MVCCPut("bk" + std::to_string(i), 10, "new")
+                      .error_code());
+    }
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCDelete("bk7", 8).error_code());
+
+    // unsorted, with duplicates, deleted and missing keys
+    std::vector<std::string> keys{"bk9", "bk1", "bk7", "bk", "bk1", "bk99",
+                                  "bk50", "zz"};
+    std::vector<std::string> values;
+    std::vector<azino::TimeStamp> tss;
+    std::vector<azino::storage::StorageStatus> statuses;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->BatchMVCCGet(keys, 9, values, tss, statuses)
+                  .error_code());
+    ASSERT_EQ(keys.size(), statuses.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        azino::TimeStamp ts;
+        std::string value;
+        auto ss = storage->MVCCGet(keys[i], 9, value, ts);
+        ASSERT_EQ(ss.error_code(), statuses[i].error_code()) << keys[i];
+        if (ss.error_code() == azino::storage::StorageStatus_Code_Ok) {
+            ASSERT_EQ(value, values[i]);
+            ASSERT_EQ(ts, tss[i]);
+        }
+    }
+    ASSERT_EQ("old", values[0]);
+    ASSERT_EQ(azino::storage::StorageStatus_Code_NotFound,
+              statuses[2].error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_NotFound,
+              statuses[3].error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_NotFound,
+              statuses[7].error_code());
+}
+
+TEST_F(DBImplTest, readview) {
+    std::string value;
+    azino::TimeStamp ts;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCPut("view", 10, "10").error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCGet("view", 20, value, ts).error_code());
+    ASSERT_EQ("10", value);
+
+    // an old snapshot still serves reads below the new write
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCPut("view", 30, "30").error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCGet("view", 20, value, ts).error_code());
+    ASSERT_EQ("10", value);
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCGet("view", 30, value, ts).error_code());
+    ASSERT_EQ("30", value);
+
+    // but not reads at or above the new write
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCPut("view", 15, "15").error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCGet("view", 20, value, ts).error_code());
+    ASSERT_EQ("15", value);
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->Put("raw", "raw").error_code());
+    std::string found_key;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->Seek("raw", found_key, value).error_code());
+    ASSERT_EQ("raw", value);
+
+    // a reused iterator is not positioned
+    {
+        std::unique_ptr<leveldb::Iterator> iter(storage->NewIterator(20));
+        iter->SeekToFirst();
+        ASSERT_TRUE(iter->Valid());
+    }
+    std::unique_ptr<leveldb::Iterator> iter(storage->NewIterator(20));
+    ASSERT_FALSE(iter->Valid());
+}
+
+TEST_F(DBImplTest, userkeyrecord) {
+    std::string user_key = azino::storage::InternalKey::EncodeUserKey("rec");
+    std::string internal_key =
+        azino::storage::InternalKey("rec", 5, false).Encode();
+    ASSERT_TRUE(azino::storage::InternalKey::IsEncodedUserKey(user_key));
+    ASSERT_FALSE(azino::storage::InternalKey::IsEncodedUserKey(internal_key));
+    ASSERT_FALSE(azino::storage::InternalKey::IsEncodedUserKey(
+        azino::storage::InternalKey("rec", 0xff, true).Encode()));
+
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCPut("rec", 5, "5").error_code());
+    std::string value, found_key;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->Get(user_key, value).error_code());
+    ASSERT_FALSE(storage->MVCCKeyMayExist("rec0"));
+    ASSERT_TRUE(storage->MVCCKeyMayExist("rec"));
+
+    // user key records are invisible to iterators
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->Seek(user_key, found_key, value).error_code());
+    ASSERT_EQ(internal_key, found_key);
+    ASSERT_EQ("5", value);
+}
+
+TEST_F(DBImplTest, gc) {
+    // "a": versions on both sides of the safe point
+    for (azino::TimeStamp ts : {2, 4, 6, 12}) {
+        ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+                  storage->MVCCPut("gca", ts, std::to_string(ts)).error_code());
+    }
+    // "b": deleted below the safe point
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCPut("gcb", 3, "3").error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCDelete("gcb", 5).error_code());
+    // "c": deleted above the safe point
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCPut("gcc", 3, "3").error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCDelete("gcc", 15).error_code());
+
+    azino::storage::MVCCGC gc(storage, nullptr);
+    std::vector<std::string> garbage;
+    std::string next;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              gc.CollectGarbage(azino::storage::InternalKey::EncodeUserKey(""),
+                                10, 1, garbage, next)
+                  .error_code());
+    ASSERT_EQ(2, garbage.size());
+    ASSERT_EQ(azino::storage::InternalKey::EncodeUserKey("gcb"), next);
+
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              gc.GCRound(10).error_code());
+    std::vector<std::string> keys, values;
+    std::vector<azino::TimeStamp> tss;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCScan("gc", "gd", 10, keys, values, tss)
+                  .error_code());
+    ASSERT_EQ(2, keys.size());
+    ASSERT_EQ("gca", keys[0]);
+    ASSERT_EQ("6", values[0]);
+    ASSERT_EQ("gcc", keys[1]);
+    ASSERT_EQ("3", values[1]);
+
+    // nothing but the visible versions at or above the safe point are left
+    std::unique_ptr<leveldb::Iterator> iter(
+        storage->NewIterator(MAX_TIMESTAMP));
+    int versions = 0;
+    for (iter->Seek(azino::storage::InternalKey::EncodeUserKey(""));
+         iter->Valid() &&
+         azino::storage::InternalKey::IsInternalKey(iter->key());
+         iter->Next()) {
+        versions++;
+    }
+    ASSERT_EQ(4, versions);
+
+    // the user key record goes with the last version of its key
+    std::string value;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_NotFound,
+              storage->Get(azino::storage::InternalKey::EncodeUserKey("gcb"),
+                           value)
+                  .error_code());
+    ASSERT_FALSE(storage->MVCCKeyMayExist("gcb"));
+    // but stays while the key has versions
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage
+                  ->BatchDelete(
+                      {azino::storage::InternalKey::EncodeUserKey("gca")})
+                  .error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->Get(azino::storage::InternalKey::EncodeUserKey("gca"),
+                           value)
+                  .error_code());
+    ASSERT_TRUE(storage->MVCCKeyMayExist("gca"));
+}
+
+TEST_F(DBImplTest, groupcommit) {
+    const int writers = 8, rounds = 50;
+    {
+        azino::storage::GroupCommitter committer(storage);
+        std::vector<std::thread> threads;
+        for (int w = 0; w < writers; w++) {
+            threads.emplace_back([&committer, w]() {
+                for (int r = 0; r < rounds; r++) {
+                    std::string key = "gc" + std::to_string(w);
+                    std::vector<azino::storage::Storage::Data> datas{
+                        {key, std::to_string(r), azino::TimeStamp(r + 1),
+                         false}};
+                    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+                              committer.BatchStore(&datas).error_code());
+                }
+            });
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+    }
+
+    for (int w = 0; w < writers; w++) {
+        std::string value;
+        azino::TimeStamp ts;
+        ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+                  storage->MVCCGet("gc" + std::to_string(w), MAX_TIMESTAMP,
+                                   value, ts)
+                      .error_code());
+        ASSERT_EQ(std::to_string(rounds - 1), value);
+        ASSERT_EQ(rounds, ts);
+    }
+}
+
+DECLARE_string(storage_shard_split_keys);
+
+TEST_F(DBImplTest, sharded) {
+    FLAGS_storage_shards = 4;
+    FLAGS_storage_shard_split_keys = "b,d,f";
+    auto sharded = new azino::storage::ShardedStorage();
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              sharded->Open("TestShardedDB").error_code());
+    ASSERT_EQ(4, sharded->ShardCount());
+
+    std::vector<azino::storage::Storage::Data> datas;
+    for (auto key : {"a", "b", "c", "d", "e", "f", "g"}) {
+        datas.push_back({key, std::string(key) + "1", 1, false});
+        datas.push_back({key, std::string(key) + "2", 2, false});
+    }
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              sharded->BatchStore(datas).error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              sharded->MVCCDelete("e", 3).error_code());
+    ASSERT_EQ(0, sharded->ShardOf(azino::storage::InternalKey("a", 1, false)
+                                      .Encode()));
+    ASSERT_EQ(2, sharded->ShardOf(azino::storage::InternalKey("d", 1, false)
+                                      .Encode()));
+
+    std::string value;
+    azino::TimeStamp ts;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_NotFound,
+              sharded->MVCCGet("h", 10, value, ts).error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              sharded->MVCCGet("f", 1, value, ts).error_code());
+    ASSERT_EQ("f1", value);
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              sharded->Sync().error_code());
+
+    // a scan goes through all the shards in order
+    std::vector<std::string> keys, values;
+    std::vector<azino::TimeStamp> tss;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              sharded->MVCCScan("a", "z", 10, keys, values, tss)
+                  .error_code());
+    ASSERT_EQ(std::vector<std::string>({"a", "b", "c", "d", "f", "g"}), keys);
+    ASSERT_EQ("c2", values[2]);
+
+    keys.clear();
+    values.clear();
+    tss.clear();
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              sharded->MVCCScan("c", "f", 2, keys, values, tss).error_code());
+    ASSERT_EQ(std::vector<std::string>({"c", "d", "e"}), keys);
+    ASSERT_EQ("e2", values[2]);
+
+    // backward iteration crosses the shards too
+    std::unique_ptr<leveldb::Iterator> iter(sharded->NewIterator(10));
+    iter->Seek(azino::storage::InternalKey::EncodeUserKey("d"));
+    ASSERT_TRUE(iter->Valid());
+    iter->Prev();
+    ASSERT_TRUE(iter->Valid());
+    ASSERT_EQ("c", azino::storage::InternalKey(iter->key().ToString())
+                       .UserKey());
+    iter.reset();
+
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              sharded->Put("raw", "value").error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              sharded->Get("raw", value).error_code());
+    ASSERT_EQ("value", value);
+    delete sharded;
+
+    // the layout can not be changed
+    FLAGS_storage_shard_split_keys = "c,d,f";
+    sharded = new azino::storage::ShardedStorage();
+    ASSERT_EQ(azino::storage::StorageStatus_Code_InvalidArgument,
+              sharded->Open("TestShardedDB").error_code());
+    delete sharded;
+
+    FLAGS_storage_shards = 1;
+    FLAGS_storage_shard_split_keys = "";
+    leveldb::Options opt;
+    for (int i = 0; i < 4; i++) {
+        leveldb::DestroyDB("TestShardedDB/shard_" + std::to_string(i), opt);
+    }
+    rmdir("TestShardedDB");
+}
+
+TEST_F(DBImplTest, iopool) {
+    std::atomic<bool> stalled(true);
+    std::atomic<int> writes(0);
+    {
+        azino::storage::IOWorkerPool pool(2, 1);
+        // the only writer is stalled
+        ASSERT_TRUE(pool.Dispatch(azino::storage::IOWorkerPool::WRITE, [&]() {
+            while (stalled) {
+                std::this_thread::yield();
+            }
+            writes++;
+        }));
+        ASSERT_TRUE(pool.Dispatch(azino::storage::IOWorkerPool::WRITE,
+                                  [&]() { writes++; }));
+
+        // reads still go on
+        std::string value;
+        azino::TimeStamp ts;
+        azino::storage::StorageStatus ss;
+        pool.Run(azino::storage::IOWorkerPool::READ, [&]() {
+            ss = storage->MVCCGet("nothing", 10, value, ts);
+            // a worker runs nested tasks itself
+            ASSERT_FALSE(pool.Dispatch(azino::storage::IOWorkerPool::READ,
+                                       []() {}));
+        });
+        ASSERT_EQ(azino::storage::StorageStatus_Code_NotFound,
+                  ss.error_code());
+        ASSERT_EQ(0, writes);
+        stalled = false;
+        // the queued tasks are done before the workers quit
+        pool.Stop();
+        ASSERT_EQ(2, writes);
+        // and nothing is queued once stopped
+        ASSERT_FALSE(pool.Dispatch(azino::storage::IOWorkerPool::WRITE,
+                                   [&]() { writes++; }));
+    }
+    ASSERT_EQ(2, writes);
+
+    azino::storage::IOWorkerPool inline_pool(0, 0);
+    ASSERT_FALSE(inline_pool.Dispatch(azino::storage::IOWorkerPool::READ,
+                                      []() {}));
+}
+
+TEST_F(DBImplTest, latestcache) {
+    // "storage" is owned by the cache from now on
+    auto cached = new azino::storage::CachedStorage(storage, 1 << 20);
+    storage = cached;
+
+    std::vector<azino::storage::Storage::Data> datas{
+        {"a", "a1", 1, false}, {"a", "a3", 3, false}, {"b", "", 2, true}};
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->BatchStore(datas).error_code());
+
+    std::string value;
+    azino::TimeStamp ts;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCGet("a", 5, value, ts).error_code());
+    ASSERT_EQ("a3", value);
+    ASSERT_EQ(3, ts);
+    ASSERT_EQ(azino::storage::StorageStatus_Code_NotFound,
+              storage->MVCCGet("b", 5, value, ts).error_code());
+    ASSERT_EQ(2, cached->Hits());
+
+    // below the cached version, read from storage
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCGet("a", 2, value, ts).error_code());
+    ASSERT_EQ("a1", value);
+    ASSERT_EQ(1, cached->Misses());
+
+    // an older version does not replace the cached one
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCPut("a", 2, "a2").error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCGet("a", 5, value, ts).error_code());
+    ASSERT_EQ("a3", value);
+    ASSERT_EQ(3, cached->Hits());
+
+    // a key not written through the cache is filled by a read
+    azino::storage::LatestVersionCache::Version version;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->Put(azino::storage::InternalKey("c", 4, false).Encode(),
+                           "c4")
+                  .error_code());
+    cached->Cache().Invalidate(azino::storage::InternalKey::EncodeUserKey("c"),
+                               4);
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCGet("c", 5, value, ts).error_code());
+    ASSERT_EQ("c4", value);
+    ASSERT_TRUE(cached->Cache().Lookup(
+        azino::storage::InternalKey::EncodeUserKey("c"), version));
+    ASSERT_EQ(4, version.ts);
+
+    std::vector<std::string> values;
+    std::vector<azino::TimeStamp> tss;
+    std::vector<azino::storage::StorageStatus> statuses;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->BatchMVCCGet({"a", "b", "c", "d"}, 3, values, tss,
+                                    statuses)
+                  .error_code());
+    ASSERT_EQ("a3", values[0]);
+    ASSERT_EQ(azino::storage::StorageStatus_Code_NotFound,
+              statuses[1].error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_NotFound,
+              statuses[2].error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_NotFound,
+              statuses[3].error_code());
+
+    // the cache is bounded
+    azino::storage::LatestVersionCache small(1024, 1);
+    for (int i = 0; i < 100; i++) {
+        small.Update(std::to_string(i), 1, false, std::string(100, 'v'));
+    }
+    ASSERT_LE(small.Bytes(), 1024);
+    ASSERT_TRUE(small.Lookup("99", version));
+    ASSERT_FALSE(small.Lookup("0", version));
+}
+
+DECLARE_int32(storage_blob_min_size);
+DECLARE_int64(storage_blob_file_size);
+DECLARE_int32(storage_blob_gc_period_s);
+DECLARE_double(storage_blob_gc_ratio);
+
+TEST_F(DBImplTest, blob) {
+    FLAGS_storage_blob_min_size = 64;
+    FLAGS_storage_blob_gc_period_s = 1;
+    FLAGS_storage_blob_gc_ratio = 0.1;
+    delete storage;
+    storage = azino::storage::Storage::DefaultStorage();
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->Open("TestBlobDB").error_code());
+
+    std::string a1(100, '1'), a2(200, '2'), c1(300, '3');
+    std::vector<azino::storage::Storage::Data> datas{
+        {"a", a1, 1, false}, {"a", a2, 2, false}, {"b", "b1", 1, false}};
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->BatchStore(datas).error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCPut("c", 1, c1).error_code());
+
+    std::string value;
+    azino::TimeStamp ts;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCGet("a", 1, value, ts).error_code());
+    ASSERT_EQ(a1, value);
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCGet("a", 5, value, ts).error_code());
+    ASSERT_EQ(a2, value);
+    ASSERT_EQ(2, ts);
+    std::vector<std::string> keys, values;
+    std::vector<azino::TimeStamp> tss;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCScan("a", "d", 5, keys, values, tss).error_code());
+    ASSERT_EQ((std::vector<std::string>{"a", "b", "c"}), keys);
+    ASSERT_EQ((std::vector<std::string>{a2, "b1", c1}), values);
+
+    // start a new blob file, and make a1 garbage
+    FLAGS_storage_blob_file_size = 1;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCPut("d", 1, c1).error_code());
+    FLAGS_storage_blob_file_size = 64 << 20;
+    azino::storage::MVCCGC gc(storage, nullptr);
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              gc.GCRound(10).error_code());
+
+    // the live values are moved out of the first blob file before it goes
+    for (int i = 0; i < 50 && access("TestBlobDB/blob/1.blob", F_OK) == 0;
+         i++) {
+        usleep(100 * 1000);
+    }
+    ASSERT_NE(0, access("TestBlobDB/blob/1.blob", F_OK));
+    keys.clear();
+    values.clear();
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCScan("a", "e", 5, keys, values, tss).error_code());
+    ASSERT_EQ((std::vector<std::string>{"a", "b", "c", "d"}), keys);
+    ASSERT_EQ((std::vector<std::string>{a2, "b1", c1, c1}), values);
+    ASSERT_EQ(azino::storage::StorageStatus_Code_NotFound,
+              storage->MVCCGet("a", 1, value, ts).error_code());
+
+    delete storage;
+    storage = azino::storage::Storage::DefaultStorage();
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->Open("TestBlobDB").error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCGet("c", 1, value, ts).error_code());
+    ASSERT_EQ(c1, value);
+
+    delete storage;
+    storage = azino::storage::Storage::DefaultStorage();
+    storage->Open("TestDB");
+    leveldb::Options opt;
+    leveldb::DestroyDB("TestBlobDB", opt);
+    FLAGS_storage_blob_min_size = 0;
+    FLAGS_storage_blob_gc_period_s = 60;
+    FLAGS_storage_blob_gc_ratio = 0.5;
+}
+
+TEST_F(DBImplTest, blob_rewrite) {
+    FLAGS_storage_blob_min_size = 64;
+    delete storage;
+    storage = azino::storage::Storage::DefaultStorage();
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->Open("TestBlobRewriteDB").error_code());
+
+    std::string e1(100, '1'), value;
+    azino::TimeStamp ts;
+    std::string inline_key =
+        azino::storage::InternalKey("e", 1, false).Encode();
+    std::string blob_key(inline_key);
+    azino::storage::InternalKey::SetBlobFlag(&blob_key);
+    // the dead bytes of the first blob file
+    const std::string dead_key = "\x02azino_blob_dead1";
+    const uint64_t record =
+        azino::storage::BlobStore::RecordSize(blob_key.size(), e1.size());
+
+    // rewriting a version counts the blob record replaced as dead
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCPut("e", 1, e1).error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_NotFound,
+              storage->Get(dead_key, value).error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCPut("e", 1, e1).error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->Get(dead_key, value).error_code());
+    ASSERT_EQ(std::to_string(record), value);
+
+    // a version rewritten inline replaces its blob form, and the other way
+    FLAGS_storage_blob_min_size = 0;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCPut("e", 1, "e1").error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_NotFound,
+              storage->Get(blob_key, value).error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->Get(dead_key, value).error_code());
+    ASSERT_EQ(std::to_string(2 * record), value);
+    std::vector<std::string> keys, values;
+    std::vector<azino::TimeStamp> tss;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCScan("a", "f", 5, keys, values, tss).error_code());
+    ASSERT_EQ((std::vector<std::string>{"e"}), keys);
+    ASSERT_EQ((std::vector<std::string>{"e1"}), values);
+
+    FLAGS_storage_blob_min_size = 64;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCPut("e", 1, e1).error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_NotFound,
+              storage->Get(inline_key, value).error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCGet("e", 1, value, ts).error_code());
+    ASSERT_EQ(e1, value);
+
+    // a key deleted twice in a batch is counted as dead once
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->BatchDelete({blob_key, blob_key}).error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->Get(dead_key, value).error_code());
+    ASSERT_EQ(std::to_string(3 * record), value);
+    ASSERT_EQ(azino::storage::StorageStatus_Code_NotFound,
+              storage->MVCCGet("e", 1, value, ts).error_code());
+
+    delete storage;
+    storage = azino::storage::Storage::DefaultStorage();
+    storage->Open("TestDB");
+    leveldb::Options opt;
+    leveldb::DestroyDB("TestBlobRewriteDB", opt);
+    FLAGS_storage_blob_min_size = 0;
+}
+
+TEST_F(DBImplTest, bulkload) {
+    std::string value;
+    azino::TimeStamp ts;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCPut("b", 5, "b5").error_code());
+    // unsorted, the storage sorts each batch
+    std::vector<azino::storage::Storage::Data> datas{
+        {"c", "c10", 0, false}, {"a", "a10", 0, false}, {"b", "b10", 0, false}};
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->BulkLoad(10, datas).error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_NotFound,
+              storage->MVCCGet("a", 20, value, ts).error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCGet("b", 20, value, ts).error_code());
+    ASSERT_EQ("b5", value);
+
+    // still hidden after a restart
+    delete storage;
+    storage = azino::storage::Storage::DefaultStorage();
+    storage->Open("TestDB");
+    std::vector<std::string> keys, values;
+    std::vector<azino::TimeStamp> tss;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCScan("a", "d", 20, keys, values, tss).error_code());
+    ASSERT_EQ((std::vector<std::string>{"b"}), keys);
+
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->FinishBulkLoad(10).error_code());
+    keys.clear();
+    values.clear();
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCScan("a", "d", 20, keys, values, tss).error_code());
+    ASSERT_EQ((std::vector<std::string>{"a", "b", "c"}), keys);
+    ASSERT_EQ((std::vector<std::string>{"a10", "b10", "c10"}), values);
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCGet("b", 8, value, ts).error_code());
+    ASSERT_EQ("b5", value);
+
+    // an aborted load leaves nothing behind, while the versions of its ts
+    // not loaded are neither hidden nor removed
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCPut("e", 30, "e30").error_code());
+    std::vector<azino::storage::Storage::Data> more{{"b", "b30", 0, false},
+                                                     {"d", "d30", 0, false}};
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->BulkLoad(30, more).error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCGet("e", 40, value, ts).error_code());
+    ASSERT_EQ("e30", value);
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->AbortBulkLoad(30).error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCGet("e", 40, value, ts).error_code());
+    ASSERT_EQ("e30", value);
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->FinishBulkLoad(30).error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_NotFound,
+              storage->MVCCGet("d", 40, value, ts).error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCGet("b", 40, value, ts).error_code());
+    ASSERT_EQ("b10", value);
+    ASSERT_EQ(10, ts);
+    ASSERT_EQ(azino::storage::StorageStatus_Code_InvalidArgument,
+              storage->BulkLoad(0, more).error_code());
+}
+
+TEST_F(DBImplTest, sharded_bulkload) {
+    FLAGS_storage_shards = 2;
+    FLAGS_storage_shard_split_keys = "m";
+    auto sharded = new azino::storage::ShardedStorage();
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              sharded->Open("TestShardedLoadDB").error_code());
+    std::vector<azino::storage::Storage::Data> datas{{"a", "a10", 0, false},
+                                                      {"z", "z10", 0, false}};
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              sharded->BulkLoad(10, datas).error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              sharded->FinishBulkLoad(10).error_code());
+    std::vector<std::string> keys, values;
+    std::vector<azino::TimeStamp> tss;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              sharded->MVCCScan("a", "", 20, keys, values, tss).error_code());
+    ASSERT_EQ((std::vector<std::string>{"a", "z"}), keys);
+
+    // a load recorded as being finished before a crash is finished on open
+    datas = {{"b", "b30", 0, false}, {"y", "y30", 0, false}};
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              sharded->BulkLoad(30, datas).error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              sharded->Sync().error_code());
+    delete sharded;
+    auto shard = azino::storage::Storage::DefaultStorage();
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              shard->Open("TestShardedLoadDB/shard_0").error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              shard->Put("\x02azino_finishing_load30", "").error_code());
+    delete shard;
+    sharded = new azino::storage::ShardedStorage();
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              sharded->Open("TestShardedLoadDB").error_code());
+    keys.clear();
+    values.clear();
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              sharded->MVCCScan("a", "", 40, keys, values, tss).error_code());
+    ASSERT_EQ((std::vector<std::string>{"a", "b", "y", "z"}), keys);
+    delete sharded;
+
+    FLAGS_storage_shards = 1;
+    FLAGS_storage_shard_split_keys = "";
+    leveldb::Options opt;
+    for (int i = 0; i < 2; i++) {
+        leveldb::DestroyDB("TestShardedLoadDB/shard_" + std::to_string(i),
+                           opt);
+    }
+    rmdir("TestShardedLoadDB");
+}
+
+// counts the mvcc scans reaching the wrapped storage
+class ScanCountingStorage : public azino::storage::CachedStorage {
+   public:
+    ScanCountingStorage(azino::storage::Storage *base)
+        : CachedStorage(base, 0, "scan_counting") {}
+
+    virtual azino::storage::StorageStatus MVCCScan(
+        const std::string &left_key, const std::string &right_key,
+        azino::TimeStamp ts, const ScanOptions &options,
+        std::vector<std::string> &key, std::vector<std::string> &value,
+        std::vector<azino::TimeStamp> &seeked_ts,
+        std::string &resume_key) override {
+        scans++;
+        return CachedStorage::MVCCScan(left_key, right_key, ts, options, key,
+                                       value, seeked_ts, resume_key);
+    }
+
+    virtual std::vector<std::unique_ptr<leveldb::Iterator>> NewIterators(
+        azino::TimeStamp ts, size_t n) override {
+        split_scans++;
+        return CachedStorage::NewIterators(ts, n);
+    }
+
+    std::atomic<int> scans{0};
+    // number of scans split into sub-ranges on one snapshot
+    std::atomic<int> split_scans{0};
+};
+
+TEST_F(DBImplTest, parallelscan) {
+    std::vector<azino::storage::Storage::Data> datas;
+    for (int i = 0; i < 200; i++) {
+        char key[16];
+        snprintf(key, sizeof(key), "ps%03d", i);
+        datas.push_back({key, std::string(1000, 'v'), 1, i % 10 == 0});
+    }
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->BatchStore(datas).error_code());
+    azino::storage::ParallelScanner scanner(storage);
+    ASSERT_TRUE(scanner.Split("ps", "pt").empty());
+
+    FLAGS_storage_scan_split_bytes = 20000;
+    std::vector<std::string> splits = scanner.Split("ps", "pt");
+    ASSERT_EQ(3, splits.size());
+    ASSERT_TRUE(std::is_sorted(splits.begin(), splits.end()));
+    ASSERT_GT(splits.front(), "ps");
+    ASSERT_LT(splits.back(), "pt");
+
+    // the same as a scan on one iterator, with or without a limit
+    for (size_t limit : {0, 1, 50, 170}) {
+        azino::storage::Storage::ScanOptions options;
+        options.limit = limit;
+        std::vector<std::string> keys, values, expected_keys, expected_values;
+        std::vector<azino::TimeStamp> tss, expected_tss;
+        std::string resume_key, expected_resume_key;
+        ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+                  scanner
+                      .MVCCScan("ps", "pt", 5, options, keys, values, tss,
+                                resume_key)
+                      .error_code());
+        ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+                  storage
+                      ->MVCCScan("ps", "pt", 5, options, expected_keys,
+                                 expected_values, expected_tss,
+                                 expected_resume_key)
+                      .error_code());
+        ASSERT_EQ(expected_keys, keys);
+        ASSERT_EQ(expected_values, values);
+        ASSERT_EQ(expected_tss, tss);
+        ASSERT_EQ(expected_resume_key, resume_key);
+    }
+
+    // the sub-ranges are read from one snapshot, which misses later writes
+    auto iters = storage->NewIterators(5, 2);
+    ASSERT_EQ(2, iters.size());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCPut("ps999", 2, "new").error_code());
+    for (auto &iter : iters) {
+        iter->Seek(azino::storage::InternalKey::EncodeUserKey("ps999"));
+        ASSERT_TRUE(!iter->Valid() ||
+                    !iter->key().starts_with(
+                        azino::storage::InternalKey::EncodeUserKey("ps999")));
+    }
+    iters.clear();
+
+    // only the unbounded scans are split
+    // "storage" is owned by the counter from now on
+    auto counted = new ScanCountingStorage(storage);
+    storage = counted;
+    azino::storage::ParallelScanner counted_scanner(storage);
+    for (size_t limit : {0, 50}) {
+        azino::storage::Storage::ScanOptions options;
+        options.limit = limit;
+        std::vector<std::string> keys, values;
+        std::vector<azino::TimeStamp> tss;
+        std::string resume_key;
+        counted->scans = 0;
+        counted->split_scans = 0;
+        ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+                  counted_scanner
+                      .MVCCScan("ps", "pt", 5, options, keys, values, tss,
+                                resume_key)
+                      .error_code());
+        ASSERT_EQ(limit == 0 ? 0 : 1, counted->scans);
+        ASSERT_EQ(limit == 0 ? 1 : 0, counted->split_scans);
+    }
+    FLAGS_storage_scan_split_bytes = 32 << 20;
+}
+
+TEST_F(DBImplTest, scanfilter) {
+    std::vector<azino::storage::Storage::Data> datas;
+    for (int i = 0; i < 30; i++) {
+        char key[16];
+        snprintf(key, sizeof(key), "f%d%d", i / 10, i % 10);
+        datas.push_back({key, i % 2 ? "odd" : "even", 1, false});
+    }
+    datas.push_back({"g", "even", 1, false});
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->BatchStore(datas).error_code());
+
+    azino::storage::Storage::ScanOptions options;
+    options.key_prefix = "f1";
+    options.value_prefix = "ev";
+    std::vector<std::string> keys, values;
+    std::vector<azino::TimeStamp> tss;
+    std::string resume_key;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage
+                  ->MVCCScan("a", "z", 5, options, keys, values, tss,
+                             resume_key)
+                  .error_code());
+    ASSERT_EQ((std::vector<std::string>{"f10", "f12", "f14", "f16", "f18"}),
+              keys);
+
+    // only the matched keys count for the limit
+    keys.clear();
+    options.key_prefix.clear();
+    options.value_prefix.clear();
+    options.match_value = true;
+    options.value_equals = "odd";
+    options.limit = 2;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage
+                  ->MVCCScan("f05", "z", 5, options, keys, values, tss,
+                             resume_key)
+                  .error_code());
+    ASSERT_EQ((std::vector<std::string>{"f05", "f07"}), keys);
+    ASSERT_EQ("f09", resume_key);
+
+    // aggregated, on one iterator or in parallel
+    keys.clear();
+    options.limit = 0;
+    options.value_equals = "even";
+    azino::storage::Storage::ScanAggregate aggregate;
+    options.aggregate = &aggregate;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage
+                  ->MVCCScan("f01", "z", 5, options, keys, values, tss,
+                             resume_key)
+                  .error_code());
+    ASSERT_TRUE(keys.empty());
+    ASSERT_EQ(15, aggregate.count);
+    ASSERT_EQ("f02", aggregate.min_key);
+    ASSERT_EQ("g", aggregate.max_key);
+
+    FLAGS_storage_scan_split_bytes = 100;
+    azino::storage::ParallelScanner scanner(storage);
+    ASSERT_FALSE(scanner.Split("f", "h").empty());
+    azino::storage::Storage::ScanAggregate parallel;
+    options.aggregate = &parallel;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              scanner
+                  .MVCCScan("f01", "z", 5, options, keys, values, tss,
+                            resume_key)
+                  .error_code());
+    ASSERT_EQ(15, parallel.count);
+    ASSERT_EQ("f02", parallel.min_key);
+    ASSERT_EQ("g", parallel.max_key);
+    FLAGS_storage_scan_split_bytes = 32 << 20;
+}
+
+DECLARE_int64(storage_export_bytes_per_sec);
+
+TEST_F(DBImplTest, snapshotexport) {
+    std::vector<azino::storage::Storage::Data> datas;
+    for (int i = 0; i < 20; i++) {
+        char key[16];
+        snprintf(key, sizeof(key), "ex%02d", i);
+        datas.push_back({key, std::string(100, 'a' + i % 26), 2, i == 5});
+    }
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->BatchStore(datas).error_code());
+    azino::storage::SnapshotExport exporter(storage, "ex", "ey", 3, 0);
+
+    // neither newer versions nor deletes after the export starts are seen
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCPut("ex00", 3, "new").error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage
+                  ->BatchDelete({azino::storage::InternalKey("ex01", 2, false)
+                                     .Encode()})
+                  .error_code());
+
+    std::vector<std::string> keys, values;
+    int batches = 0;
+    while (!exporter.Done()) {
+        std::vector<std::string> key, value;
+        std::vector<azino::TimeStamp> ts;
+        std::string resume_key;
+        ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+                  exporter.Next(250, key, value, ts, resume_key).error_code());
+        ASSERT_EQ(exporter.Done(), resume_key.empty());
+        keys.insert(keys.end(), key.begin(), key.end());
+        values.insert(values.end(), value.begin(), value.end());
+        batches++;
+    }
+    ASSERT_EQ(19, keys.size());
+    ASSERT_EQ(7, batches);
+    ASSERT_EQ("ex00", keys[0]);
+    ASSERT_EQ(std::string(100, 'a'), values[0]);
+    ASSERT_EQ("ex01", keys[1]);
+    ASSERT_EQ("ex06", keys[5]);
+    ASSERT_EQ(19 * 104, exporter.bytes());
+
+    // the reads are throttled to the rate
+    FLAGS_storage_export_bytes_per_sec = 10000;
+    azino::storage::SnapshotExport throttled(storage, "ex", "ey", 3, 50000);
+    int64_t start_us = butil::gettimeofday_us();
+    while (!throttled.Done()) {
+        throttled.Throttle();
+        std::vector<std::string> key, value;
+        std::vector<azino::TimeStamp> ts;
+        std::string resume_key;
+        throttled.Next(1000, key, value, ts, resume_key);
+    }
+    ASSERT_GE(butil::gettimeofday_us() - start_us, 100000);
+    FLAGS_storage_export_bytes_per_sec = 32 << 20;
+}
+
+// counts the syncs and the synced writes reaching the wrapped storage
+class SyncCountingStorage : public azino::storage::CachedStorage {
+   public:
+    SyncCountingStorage(azino::storage::Storage *base)
+        : CachedStorage(base, 0, "sync_counting") {}
+
+    virtual azino::storage::StorageStatus Sync() override {
+        syncs++;
+        return CachedStorage::Sync();
+    }
+
+    virtual azino::storage::StorageStatus SyncBatchStore(
+        const std::vector<Data> &datas) override {
+        synced_writes++;
+        return CachedStorage::SyncBatchStore(datas);
+    }
+
+    std::atomic<int> syncs{0};
+    std::atomic<int> synced_writes{0};
+};
+
+DECLARE_int32(storage_sync_interval_ms);
+DECLARE_int64(storage_sync_bytes);
+
+TEST_F(DBImplTest, walsync) {
+    using azino::storage::Durability;
+    // "storage" is owned by the counter from now on
+    auto counted = new SyncCountingStorage(storage);
+    storage = counted;
+    azino::storage::WALSyncer syncer(storage);
+    ASSERT_EQ(Durability::Async, syncer.Resolve(Durability::Default));
+
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              syncer.Commit(Durability::Async, 10).error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              syncer.Commit(Durability::Periodic, 10).error_code());
+    ASSERT_EQ(0, counted->syncs);
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              syncer.Sync().error_code());
+    ASSERT_EQ(1, counted->syncs);
+    // nothing committed since the last sync
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              syncer.Sync().error_code());
+    ASSERT_EQ(1, counted->syncs);
+    // a sync write is synced by the storage itself
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              syncer.Commit(Durability::Sync, 10).error_code());
+    ASSERT_EQ(1, counted->syncs);
+
+    // enough periodic bytes sync at once
+    FLAGS_storage_sync_bytes = 100;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              syncer.Commit(Durability::Periodic, 60).error_code());
+    ASSERT_EQ(1, counted->syncs);
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              syncer.Commit(Durability::Periodic, 60).error_code());
+    ASSERT_EQ(2, counted->syncs);
+    FLAGS_storage_sync_bytes = 4 << 20;
+
+    // the background syncs the periodic writes
+    FLAGS_storage_sync_interval_ms = 10;
+    ASSERT_EQ(0, syncer.Start());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              syncer.Commit(Durability::Periodic, 10).error_code());
+    for (int i = 0; i < 100 && counted->syncs == 2; i++) {
+        usleep(10 * 1000);
+    }
+    ASSERT_EQ(3, counted->syncs);
+    ASSERT_EQ(0, syncer.Stop());
+    FLAGS_storage_sync_interval_ms = 100;
+
+    // a group of sync batch stores is written synced once
+    const int writers = 8, rounds = 20;
+    {
+        azino::storage::GroupCommitter committer(storage, nullptr, &syncer);
+        std::vector<std::thread> threads;
+        for (int w = 0; w < writers; w++) {
+            threads.emplace_back([&committer, w]() {
+                for (int r = 0; r < rounds; r++) {
+                    std::vector<azino::storage::Storage::Data> datas{
+                        {"ws" + std::to_string(w), std::to_string(r),
+                         azino::TimeStamp(r + 1), false}};
+                    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+                              committer.BatchStore(&datas, Durability::Sync)
+                                  .error_code());
+                }
+            });
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+    }
+    ASSERT_EQ(3, counted->syncs);
+    ASSERT_GT(counted->synced_writes, 0);
+    ASSERT_LE(counted->synced_writes, writers * rounds);
+    std::string value;
+    azino::TimeStamp ts;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCGet("ws0", MAX_TIMESTAMP, value, ts).error_code());
+    ASSERT_EQ(std::to_string(rounds - 1), value);
+}
+
+class StatsStorage : public azino::storage::CachedStorage {
+   public:
+    StatsStorage(azino::storage::Storage *base)
+        : CachedStorage(base, 0, "stats") {}
+
+    virtual void GetStats(Stats &s) override { s = stats; }
+
+    Stats stats;
+};
+
+DECLARE_int64(storage_backpressure_pending_bytes);
+DECLARE_int32(storage_backpressure_max_delay_ms);
+
+TEST_F(DBImplTest, monitor) {
+    azino::storage::Storage::Stats stats;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCPut("mon", 1, "v").error_code());
+    storage->GetStats(stats);
+    ASSERT_GE(stats.level0_files, 0);
+    ASSERT_GE(stats.pending_compaction_bytes, 0);
+    ASSERT_GE(stats.write_stall_us, 0);
+
+    auto stub = new StatsStorage(storage);
+    storage = stub;
+    azino::storage::StorageMonitor monitor(storage);
+    monitor.Refresh();
+    ASSERT_EQ(0, monitor.Current().level());
+    ASSERT_EQ(0, monitor.Current().delay_ms());
+
+    // level-0 tables half way from the compaction to the stop trigger
+    stub->stats.level0_files = 8;
+    monitor.Refresh();
+    ASSERT_EQ(50, monitor.Current().level());
+    ASSERT_EQ(FLAGS_storage_backpressure_max_delay_ms / 2,
+              monitor.Current().delay_ms());
+
+    // pending compaction bytes over the limit press the most
+    stub->stats.pending_compaction_bytes =
+        FLAGS_storage_backpressure_pending_bytes * 2;
+    monitor.Refresh();
+    ASSERT_EQ(100, monitor.Current().level());
+    ASSERT_EQ(FLAGS_storage_backpressure_max_delay_ms,
+              monitor.Current().delay_ms());
+
+    // stalls count only once
+    stub->stats.level0_files = 0;
+    stub->stats.pending_compaction_bytes = 0;
+    stub->stats.write_stall_us = 3600LL * 1000 * 1000;
+    monitor.Refresh();
+    ASSERT_EQ(100, monitor.Current().level());
+    monitor.Refresh();
+    ASSERT_EQ(0, monitor.Current().level());
+}
+
+class MemStorageTest : public testing::Test {
+   public:
+    azino::storage::Storage *storage;
+
+   protected:
+    void SetUp() {
+        FLAGS_storage_engine = "memory";
+        storage = azino::storage::Storage::DefaultStorage();
+        FLAGS_storage_engine = "leveldb";
+        storage->Open("TestMemDB");
+    }
+    void TearDown() { delete storage; }
+};
+
+TEST_F(MemStorageTest, crud) {
+    std::string value, found_key;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->Put("hello", "world").error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->Put("hello", "again").error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->Get("hello", value).error_code());
+    ASSERT_EQ("again", value);
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->Seek("h", found_key, value).error_code());
+    ASSERT_EQ("hello", found_key);
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->Delete("hello").error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_NotFound,
+              storage->Get("hello", value).error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_NotFound,
+              storage->Seek("h", found_key, value).error_code());
+}
+
+TEST_F(MemStorageTest, mvcc) {
+    std::vector<azino::storage::Storage::Data> datas{
+        {"a", "a1", 1, false}, {"a", "a3", 3, false}, {"b", "b1", 1, false},
+        {"b", "", 2, true},    {"c", "c2", 2, false}};
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->BatchStore(datas).error_code());
+
+    std::string value;
+    azino::TimeStamp ts;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCGet("a", 2, value, ts).error_code());
+    ASSERT_EQ("a1", value);
+    ASSERT_EQ(1, ts);
+    ASSERT_EQ(azino::storage::StorageStatus_Code_NotFound,
+              storage->MVCCGet("b", 2, value, ts).error_code());
+
+    std::vector<std::string> keys, values;
+    std::vector<azino::TimeStamp> tss;
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCScan("a", "d", 5, keys, values, tss).error_code());
+    ASSERT_EQ(std::vector<std::string>({"a", "c"}), keys);
+    ASSERT_EQ(std::vector<std::string>({"a3", "c2"}), values);
+
+    // a garbage collected version is gone, the others stay
+    azino::storage::MVCCGC gc(storage, nullptr);
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              gc.GCRound(5).error_code());
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCGet("a", 5, value, ts).error_code());
+    ASSERT_EQ("a3", value);
+    ASSERT_EQ(azino::storage::StorageStatus_Code_NotFound,
+              storage->MVCCGet("a", 2, value, ts).error_code());
+}
+
+TEST_F(MemStorageTest, snapshot) {
+    ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+              storage->MVCCPut("k", 1, "v1").error_code());
+    std::unique_ptr<leveldb::Iterator> iter(
+        storage->NewIterator(MAX_TIMESTAMP));
+
+    // a reader keeps its snapshot while a writer goes on
+    std::thread writer([this]() {
+        for (azino::TimeStamp ts = 2; ts < 1000; ts++) {
+            std::vector<azino::storage::Storage::Data> datas{
+                {"k", "v" + std::to_string(ts), ts, false},
+                {"l" + std::to_string(ts), "v", ts, false}};
+            ASSERT_EQ(azino::storage::StorageStatus_Code_Ok,
+                      storage->BatchStore(datas).error_code());
+        }
+    });
+    for (int i = 0; i < 100; i++) {
+        int n = 0;
+        for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+            n++;
+        }
+        ASSERT_EQ(1, n);
+    }
+    writer.join();
+
+    int n = 0;
+    iter.reset(storage->NewIterator(MAX_TIMESTAMP));
+    for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
+        n++;
+    }
+    ASSERT_EQ(999 + 998, n);
+}
@@ -0,0 +1,208 @@
+// Loads sorted key value files into a storage server at one commit
+// timestamp, bypassing transactions. Each line of a file is a key and a value
+// separated by a tab, in which a backslash, a tab and a newline are written as
+// "\\", "\t" and "\n". The keys should be ascending across all the files.
+//
+// The timestamp is reserved from txplanner as the commit timestamp of an
+// empty transaction, so no transaction commits at it. Nothing loaded is
+// visible until every file is loaded, the load is aborted on any error. A
+// load whose finish failed is finished by rerunning the tool with its -ts.
+#include <brpc/channel.h>
+#include <butil/logging.h>
+#include <gflags/gflags.h>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "escape.h"
+#include "service/storage/storage.pb.h"
+#include "service/txplanner/txplanner.pb.h"
+
+DEFINE_string(storage_addr, "0.0.0.0:8000", "Address of storage");
+DEFINE_string(txplanner_addr, "0.0.0.0:8001", "Address of txplanner");
+DEFINE_uint64(ts, 0,
+              "timestamp of a load left unfinished, which is finished "
+              "instead of loading -files, or aborted with -abort");
+DEFINE_bool(abort, false, "abort the load of -ts instead of finishing it");
+DEFINE_string(files, "", "comma separated files to load, in key order");
+DEFINE_int32(batch_bytes, 1 << 20, "bytes of keys and values per request");
+DEFINE_int32(timeout_ms, 60000, "timeout of a request");
+
+namespace {
+
+using azino::storage::Unescape;
+
+// Reserve a timestamp for a load: the commit timestamp of an empty
+// transaction.
+bool Reserve(brpc::Channel& channel, uint64_t* ts) {
+    azino::txplanner::TxService_Stub stub(&channel);
+    brpc::Controller cntl;
+    azino::txplanner::BeginTxRequest begin_req;
+    azino::txplanner::BeginTxResponse begin_resp;
+    stub.BeginTx(&cntl, &begin_req, &begin_resp, NULL);
+    if (cntl.Failed()) {
+        LOG(ERROR) << "Controller failed error code: " << cntl.ErrorCode()
+                   << " error text: " << cntl.ErrorText();
+        return false;
+    }
+
+    cntl.Reset();
+    azino::txplanner::CommitTxRequest commit_req;
+    azino::txplanner::CommitTxResponse commit_resp;
+    commit_req.mutable_txid()->CopyFrom(begin_resp.txid());
+    commit_req.mutable_txid()->mutable_status()->set_status_code(
+        azino::TxStatus_Code_Preput);
+    stub.CommitTx(&cntl, &commit_req, &commit_resp, NULL);
+    if (cntl.Failed()) {
+        LOG(ERROR) << "Controller failed error code: " << cntl.ErrorCode()
+                   << " error text: " << cntl.ErrorText();
+        return false;
+    }
+    if (commit_resp.txid().status().status_code() !=
+        azino::TxStatus_Code_Commit) {
+        LOG(ERROR) << "Fail to reserve a timestamp, tx: "
+                   << commit_resp.txid().ShortDebugString();
+        return false;
+    }
+    *ts = commit_resp.txid().commit_ts();
+    return true;
+}
+
+bool Send(azino::storage::StorageService_Stub& stub,
+          const azino::storage::BulkLoadRequest& req) {
+    brpc::Controller cntl;
+    azino::storage::BulkLoadResponse resp;
+    stub.BulkLoad(&cntl, &req, &resp, NULL);
+    if (cntl.Failed()) {
+        LOG(ERROR) << "Controller failed error code: " << cntl.ErrorCode()
+                   << " error text: " << cntl.ErrorText();
+        return false;
+    }
+    if (resp.status().error_code() != azino::storage::StorageStatus::Ok) {
+        LOG(ERROR) << "Fail to bulk load error code: "
+                   << resp.status().error_code()
+                   << " error message: " << resp.status().error_message();
+        return false;
+    }
+    return true;
+}
+
+bool Load(azino::storage::StorageService_Stub& stub, uint64_t ts,
+          uint64_t* total) {
+    azino::storage::BulkLoadRequest req;
+    req.set_ts(ts);
+    req.set_action(azino::storage::BulkLoadRequest::Load);
+    std::string last_key, key, value;
+    bool first = true;
+    size_t bytes = 0;
+
+    std::istringstream files(FLAGS_files);
+    std::string file;
+    while (std::getline(files, file, ',')) {
+        std::ifstream in(file);
+        if (!in) {
+            LOG(ERROR) << "Fail to open " << file;
+            return false;
+        }
+        std::string line;
+        for (uint64_t n = 1; std::getline(in, line); n++) {
+            size_t tab = line.find('\t');
+            if (tab == std::string::npos ||
+                !Unescape(line.substr(0, tab), &key) ||
+                !Unescape(line.substr(tab + 1), &value)) {
+                LOG(ERROR) << "Malformed line " << n << " of " << file;
+                return false;
+            }
+            if (!first && key <= last_key) {
+                LOG(ERROR) << "Key is not ascending at line " << n << " of "
+                           << file;
+                return false;
+            }
+            first = false;
+            last_key = key;
+            bytes += key.size() + value.size();
+            req.add_keys()->swap(key);
+            req.add_values()->swap(value);
+            if (bytes >= size_t(FLAGS_batch_bytes)) {
+                if (!Send(stub, req)) {
+                    return false;
+                }
+                *total += req.keys_size();
+                req.clear_keys();
+                req.clear_values();
+                bytes = 0;
+            }
+        }
+        if (in.bad()) {
+            LOG(ERROR) << "Fail to read " << file;
+            return false;
+        }
+    }
+    if (req.keys_size() > 0) {
+        if (!Send(stub, req)) {
+            return false;
+        }
+        *total += req.keys_size();
+    }
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    if ((FLAGS_ts == 0) == FLAGS_files.empty()) {
+        std::cerr << "Either -files or -ts should be set" << std::endl;
+        return -1;
+    }
+
+    brpc::Channel channel;
+    brpc::ChannelOptions options;
+    options.timeout_ms = FLAGS_timeout_ms;
+    if (channel.Init(FLAGS_storage_addr.c_str(), &options) != 0) {
+        LOG(ERROR) << "Fail to initialize storage channel";
+        return -1;
+    }
+    azino::storage::StorageService_Stub stub(&channel);
+
+    uint64_t ts = FLAGS_ts, total = 0;
+    azino::storage::BulkLoadRequest req;
+    if (ts == 0) {
+        brpc::Channel txplanner;
+        if (txplanner.Init(FLAGS_txplanner_addr.c_str(), &options) != 0 ||
+            !Reserve(txplanner, &ts)) {
+            std::cerr << "Fail to reserve a timestamp from txplanner"
+                      << std::endl;
+            return -1;
+        }
+        req.set_ts(ts);
+        if (!Load(stub, ts, &total)) {
+            req.set_action(azino::storage::BulkLoadRequest::Abort);
+            Send(stub, req);
+            std::cerr << "Bulk load of ts " << ts << " is aborted"
+                      << std::endl;
+            return -1;
+        }
+    }
+    req.set_ts(ts);
+    if (FLAGS_abort) {
+        req.set_action(azino::storage::BulkLoadRequest::Abort);
+        if (!Send(stub, req)) {
+            std::cerr << "Fail to abort bulk load of ts " << ts << std::endl;
+            return -1;
+        }
+        std::cout << "Aborted bulk load of ts " << ts << std::endl;
+        return 0;
+    }
+    req.set_action(azino::storage::BulkLoadRequest::Finish);
+    if (!Send(stub, req)) {
+        std::cerr << "Fail to finish bulk load of ts " << ts
+                  << ", retry with -ts=" << ts << std::endl;
+        return -1;
+    }
+    std::cout << "Loaded " << total << " keys at ts " << ts << std::endl;
+    return 0;
+}
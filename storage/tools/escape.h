@@ -0,0 +1,63 @@
+#ifndef AZINO_STORAGE_TOOLS_ESCAPE_H
+#define AZINO_STORAGE_TOOLS_ESCAPE_H
+
+#include <string>
+
+namespace azino {
+namespace storage {
+
+// The key value files of storage_bulk_load and storage_export_snapshot have
+// a key and a value separated by a tab on each line, in which a backslash, a
+// tab and a newline are written as "\\", "\t" and "\n".
+inline std::string Escape(const std::string& field) {
+    std::string out;
+    out.reserve(field.size());
+    for (char c : field) {
+        switch (c) {
+            case '\\':
+                out += "\\\\";
+                break;
+            case '\t':
+                out += "\\t";
+                break;
+            case '\n':
+                out += "\\n";
+                break;
+            default:
+                out.push_back(c);
+        }
+    }
+    return out;
+}
+
+// Undo the escapes of a field, return false if it is malformed.
+inline bool Unescape(const std::string& field, std::string* out) {
+    out->clear();
+    for (size_t i = 0; i < field.size(); i++) {
+        if (field[i] != '\\') {
+            out->push_back(field[i]);
+            continue;
+        }
+        if (++i == field.size()) {
+            return false;
+        }
+        switch (field[i]) {
+            case '\\':
+                out->push_back('\\');
+                break;
+            case 't':
+                out->push_back('\t');
+                break;
+            case 'n':
+                out->push_back('\n');
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace storage
+}  // namespace azino
+#endif  // AZINO_STORAGE_TOOLS_ESCAPE_H
@@ -0,0 +1,314 @@
+// Exports the visible versions of a key range at one timestamp from a storage
+// server into chunk files of a local directory, while the server keeps
+// serving. The chunks are in the format of storage_bulk_load: each line is a
+// key and a value separated by a tab, in which a backslash, a tab and a
+// newline are written as "\\", "\t" and "\n".
+//
+// A chunk is written to "<dir>/chunk-NNNNNN.tmp" and renamed once complete,
+// then recorded in "<dir>/MANIFEST" along with the key the export goes on
+// from. A chunk is synced to disk before it is recorded, and so is the
+// manifest before the next chunk starts. Rerunning the tool on the same
+// directory resumes an interrupted export from the last chunk recorded, with
+// the timestamp and range of the manifest. The versions are read from one
+// snapshot per run, a resumed export is consistent as long as ts stays above
+// the gc safe point of txplanner.
+#include <brpc/channel.h>
+#include <brpc/stream.h>
+#include <bthread/countdown_event.h>
+#include <butil/iobuf.h>
+#include <butil/logging.h>
+#include <gflags/gflags.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "escape.h"
+#include "service/storage/storage.pb.h"
+
+DEFINE_string(storage_addr, "0.0.0.0:8000", "Address of storage");
+DEFINE_uint64(ts, 0, "timestamp of the snapshot to export");
+DEFINE_string(left_key, "", "first key of the range to export");
+DEFINE_string(right_key, "",
+              "key after the range to export, empty means no limit");
+DEFINE_string(dir, "", "directory of the chunk files and the manifest");
+DEFINE_int64(chunk_bytes, 64 << 20, "bytes of keys and values per chunk");
+DEFINE_uint64(bytes_per_sec, 0,
+              "max bytes per second read by storage, 0 means the limit of "
+              "storage");
+DEFINE_int32(timeout_ms, 60000, "timeout of starting the export");
+
+namespace {
+
+using azino::storage::Escape;
+using azino::storage::Unescape;
+
+const char manifest_name[] = "MANIFEST";
+
+std::string ChunkName(int chunk) {
+    char name[32];
+    snprintf(name, sizeof(name), "chunk-%06d", chunk);
+    return name;
+}
+
+// Flush "path", a file or a directory, to disk. Return false on failure.
+bool SyncPath(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+// The manifest starts with a line of the timestamp and the range, followed
+// by a line per complete chunk: its name and the key the export goes on
+// from, which is empty after the last chunk.
+struct Manifest {
+    uint64_t ts = 0;
+    std::string left_key;
+    std::string right_key;
+    int chunks = 0;
+    std::string resume_key;
+    bool done = false;
+};
+
+// Return false if the manifest is malformed, "exists" tells if it is found.
+bool ReadManifest(const std::string& path, Manifest* m, bool* exists) {
+    std::ifstream in(path);
+    *exists = bool(in);
+    if (!in) {
+        return true;
+    }
+    std::string line;
+    if (!std::getline(in, line)) {
+        return false;
+    }
+    size_t tab1 = line.find('\t');
+    size_t tab2 = line.find('\t', tab1 + 1);
+    if (tab1 == std::string::npos || tab2 == std::string::npos) {
+        return false;
+    }
+    m->ts = std::stoull(line.substr(0, tab1));
+    if (!Unescape(line.substr(tab1 + 1, tab2 - tab1 - 1), &m->left_key) ||
+        !Unescape(line.substr(tab2 + 1), &m->right_key)) {
+        return false;
+    }
+    m->resume_key = m->left_key;
+    while (std::getline(in, line)) {
+        size_t tab = line.find('\t');
+        if (tab == std::string::npos ||
+            line.substr(0, tab) != ChunkName(m->chunks + 1) ||
+            !Unescape(line.substr(tab + 1), &m->resume_key)) {
+            return false;
+        }
+        m->chunks++;
+        m->done = m->resume_key.empty();
+    }
+    return true;
+}
+
+// Writes the batches of the export stream into chunks, and records every
+// complete chunk in the manifest.
+class ChunkWriter : public brpc::StreamInputHandler {
+   public:
+    ChunkWriter(const std::string& dir, int chunks)
+        : _dir(dir), _chunks(chunks), _bytes(0), _keys(0), _closed(1) {
+        _status.set_error_code(azino::storage::StorageStatus::Ok);
+    }
+
+    virtual int on_received_messages(brpc::StreamId id,
+                                     butil::IOBuf* const messages[],
+                                     size_t size) override {
+        for (size_t i = 0; i < size && ok(); i++) {
+            azino::storage::MVCCScanResponse batch;
+            butil::IOBufAsZeroCopyInputStream wrapper(*messages[i]);
+            if (!batch.ParseFromZeroCopyStream(&wrapper)) {
+                fail("Fail to parse export batch");
+                break;
+            }
+            if (batch.status().error_code() !=
+                    azino::storage::StorageStatus::Ok &&
+                batch.status().error_code() !=
+                    azino::storage::StorageStatus::NotFound) {
+                _status.CopyFrom(batch.status());
+                break;
+            }
+            write(batch);
+        }
+        return 0;
+    }
+
+    virtual void on_idle_timeout(brpc::StreamId id) override {}
+
+    virtual void on_closed(brpc::StreamId id) override { _closed.signal(); }
+
+    // Block until the stream is closed.
+    void Wait() { _closed.wait(); }
+
+    bool ok() const {
+        return _status.error_code() == azino::storage::StorageStatus::Ok;
+    }
+
+    bool done() const { return _done; }
+
+    const azino::storage::StorageStatus& status() const { return _status; }
+
+    uint64_t keys() const { return _keys; }
+
+   private:
+    void fail(const std::string& message) {
+        _status.set_error_code(azino::storage::StorageStatus::IOError);
+        _status.set_error_message(message);
+    }
+
+    void write(const azino::storage::MVCCScanResponse& batch) {
+        if (!_out.is_open()) {
+            _out.open(tmp_path(), std::ios::trunc);
+        }
+        for (int i = 0; i < batch.key_size() && i < batch.value_size(); i++) {
+            _out << Escape(batch.key(i)) << '\t' << Escape(batch.value(i))
+                 << '\n';
+            _bytes += batch.key(i).size() + batch.value(i).size();
+        }
+        _keys += batch.key_size();
+        if (!_out) {
+            fail("Fail to write " + tmp_path());
+            return;
+        }
+        // a chunk ends with a batch, where the export can go on from
+        if (_bytes >= FLAGS_chunk_bytes || !batch.has_resume_key()) {
+            seal(batch.resume_key());
+        }
+    }
+
+    // Complete the current chunk and record it in the manifest.
+    void seal(const std::string& resume_key) {
+        _out.close();
+        std::string path = _dir + "/" + ChunkName(_chunks + 1);
+        // the chunk is on disk before the manifest records it
+        if (!_out || !SyncPath(tmp_path()) ||
+            rename(tmp_path().c_str(), path.c_str()) != 0 ||
+            !SyncPath(_dir)) {
+            fail("Fail to complete " + path);
+            return;
+        }
+        const std::string manifest_path = _dir + "/" + manifest_name;
+        std::ofstream manifest(manifest_path, std::ios::app);
+        manifest << ChunkName(_chunks + 1) << '\t' << Escape(resume_key)
+                 << '\n';
+        manifest.close();
+        if (!manifest || !SyncPath(manifest_path)) {
+            fail("Fail to write the manifest");
+            return;
+        }
+        _chunks++;
+        _bytes = 0;
+        _done = resume_key.empty();
+    }
+
+    std::string tmp_path() const {
+        return _dir + "/" + ChunkName(_chunks + 1) + ".tmp";
+    }
+
+    const std::string _dir;
+    int _chunks;
+    int64_t _bytes;
+    uint64_t _keys;
+    bool _done = false;
+    std::ofstream _out;
+    azino::storage::StorageStatus _status;
+    bthread::CountdownEvent _closed;
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    if (FLAGS_dir.empty()) {
+        std::cerr << "-dir should be set" << std::endl;
+        return -1;
+    }
+    const std::string manifest_path = FLAGS_dir + "/" + manifest_name;
+    Manifest m;
+    bool exists;
+    if (!ReadManifest(manifest_path, &m, &exists)) {
+        std::cerr << "Malformed manifest " << manifest_path << std::endl;
+        return -1;
+    }
+    if (exists) {
+        if (m.done) {
+            std::cout << "Export of ts " << m.ts << " is already done"
+                      << std::endl;
+            return 0;
+        }
+        LOG(INFO) << "Resume export of ts " << m.ts << " after chunk "
+                  << m.chunks;
+    } else {
+        if (FLAGS_ts == 0) {
+            std::cerr << "-ts should be set" << std::endl;
+            return -1;
+        }
+        m.ts = FLAGS_ts;
+        m.left_key = m.resume_key = FLAGS_left_key;
+        m.right_key = FLAGS_right_key;
+        std::ofstream manifest(manifest_path);
+        manifest << m.ts << '\t' << Escape(m.left_key) << '\t'
+                 << Escape(m.right_key) << '\n';
+        manifest.close();
+        if (!manifest || !SyncPath(manifest_path) || !SyncPath(FLAGS_dir)) {
+            std::cerr << "Fail to create " << manifest_path << std::endl;
+            return -1;
+        }
+    }
+
+    brpc::Channel channel;
+    brpc::ChannelOptions options;
+    options.timeout_ms = FLAGS_timeout_ms;
+    if (channel.Init(FLAGS_storage_addr.c_str(), &options) != 0) {
+        LOG(ERROR) << "Fail to initialize storage channel";
+        return -1;
+    }
+    azino::storage::StorageService_Stub stub(&channel);
+
+    ChunkWriter writer(FLAGS_dir, m.chunks);
+    brpc::Controller cntl;
+    brpc::StreamOptions stream_options;
+    stream_options.handler = &writer;
+    brpc::StreamId stream;
+    if (brpc::StreamCreate(&stream, cntl, &stream_options) != 0) {
+        LOG(ERROR) << "Fail to create export stream";
+        return -1;
+    }
+    azino::storage::ExportSnapshotRequest req;
+    azino::storage::ExportSnapshotResponse resp;
+    req.set_left_key(m.resume_key);
+    req.set_right_key(m.right_key);
+    req.set_ts(m.ts);
+    req.set_bytes_per_sec(FLAGS_bytes_per_sec);
+    stub.ExportSnapshot(&cntl, &req, &resp, NULL);
+    if (cntl.Failed()) {
+        LOG(ERROR) << "Controller failed error code: " << cntl.ErrorCode()
+                   << " error text: " << cntl.ErrorText();
+        brpc::StreamClose(stream);
+        return -1;
+    }
+    writer.Wait();
+    if (!writer.ok() || !writer.done()) {
+        LOG(ERROR) << "Export is interrupted error code: "
+                   << writer.status().error_code()
+                   << " error message: " << writer.status().error_message();
+        std::cerr << "Export of ts " << m.ts << " is interrupted, rerun to "
+                  << "resume it" << std::endl;
+        return -1;
+    }
+    std::cout << "Exported " << writer.keys() << " keys at ts " << m.ts
+              << std::endl;
+    return 0;
+}
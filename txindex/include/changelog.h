@@ -0,0 +1,73 @@
+#ifndef AZINO_TXINDEX_INCLUDE_CHANGELOG_H
+#define AZINO_TXINDEX_INCLUDE_CHANGELOG_H
+
+#include <butil/macros.h>
+#include <gflags/gflags.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "azino/kv.h"
+#include "bthread/mutex.h"
+#include "mvccvalue.h"
+#include "service/tx.pb.h"
+
+DECLARE_bool(enable_change_log);
+
+namespace azino {
+namespace txindex {
+
+// A version committed to a region, its value tells a delete.
+struct Change {
+    std::string key;
+    TimeStamp ts;
+    ValuePtr value;
+};
+
+// ChangeLog keeps the versions committed to a region for change data capture,
+// ordered by their commit ts. A change is released to the readers once it is
+// sealed: no transaction can commit below the seal any more, which is the
+// min ats of txplanner capped by the intents held, see KVRegion::SealChanges,
+// so the released changes never go out of order.
+//
+// The log starts at the first change or seal after txindex starts, and keeps
+// up to -change_log_max_bytes, the oldest changes are dropped beyond that,
+// even if no reader has read them yet.
+class ChangeLog {
+   public:
+    ChangeLog() = default;
+    DISALLOW_COPY_AND_ASSIGN(ChangeLog);
+    ~ChangeLog() = default;
+
+    void Append(const std::string& key, TimeStamp ts, ValuePtr value);
+
+    // Release the changes committed before "ts".
+    void Seal(TimeStamp ts);
+
+    // Read the released changes committed after "from_ts" in commit ts order,
+    // up to about "max_bytes", the changes of one ts are never split. All the
+    // changes committed up to "resolved_ts" have been read then, it is the
+    // "from_ts" of the next read. Return NotExist if some changes after
+    // "from_ts" are dropped.
+    TxOpStatus Read(TimeStamp from_ts, size_t max_bytes,
+                    std::vector<Change>& changes, TimeStamp& resolved_ts);
+
+   private:
+    // Start the log at "ts" if it is not started yet.
+    void start(TimeStamp ts);
+
+    bthread::Mutex _mutex;
+    std::multimap<TimeStamp, Change> _changes;
+    size_t _bytes = 0;
+    // the changes before it are released
+    TimeStamp _sealed_ts = MIN_TIMESTAMP;
+    // the changes up to it may be dropped, or committed before the start
+    TimeStamp _dropped_ts = MIN_TIMESTAMP;
+    bool _started = false;
+};
+
+}  // namespace txindex
+}  // namespace azino
+
+#endif  // AZINO_TXINDEX_INCLUDE_CHANGELOG_H
@@ -1,14 +1,21 @@
 #ifndef AZINO_TXINDEX_INCLUDE_INDEX_H
 #define AZINO_TXINDEX_INCLUDE_INDEX_H
 
+#include <atomic>
 #include <functional>
+#include <memory>
+#include <set>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
+#include "azino/comparator.h"
 #include "azino/kv.h"
 #include "azino/partition.h"
 #include "azino/range.h"
+#include "azino/skiplist.h"
 #include "bthread/bthread.h"
+#include "changelog.h"
 #include "depedence.h"
 #include "gflags/gflags.h"
 #include "metric.h"
@@ -17,6 +24,7 @@
 #include "persist.h"
 #include "service/kv.pb.h"
 #include "service/tx.pb.h"
+#include "slab.h"
 
 DECLARE_int32(latch_bucket_num);
 DECLARE_string(txindex_addr);
@@ -109,8 +117,54 @@ class TxIndex {
                             const TxIdentifier& txid,
                             std::function<void()> callback);
 
+    // The batch versions of the ops above for the keys of one tx, the status
+    // of "keys[i]" is set to "stss[i]". The keys are grouped by regions and
+    // buckets so that each latch is taken once. BatchWriteIntent and
+    // BatchRead stop at the first key blocked and return its status, the
+    // keys after it are not run. "callback" is called once it is unblocked,
+    // then the whole batch should be retried, the keys run are run again
+    // without harm. Otherwise Ok is returned.
+    virtual TxOpStatus BatchWriteIntent(const std::vector<std::string>& keys,
+                                        const std::vector<Value>& values,
+                                        const TxIdentifier& txid,
+                                        std::function<void()> callback,
+                                        std::vector<TxOpStatus>& stss);
+    virtual void BatchClean(const std::vector<std::string>& keys,
+                            const TxIdentifier& txid,
+                            std::vector<TxOpStatus>& stss);
+    virtual void BatchCommit(const std::vector<std::string>& keys,
+                             const TxIdentifier& txid,
+                             std::vector<TxOpStatus>& stss);
+    virtual TxOpStatus BatchRead(const std::vector<std::string>& keys,
+                                 const TxIdentifier& txid,
+                                 std::function<void()> callback,
+                                 std::vector<Value>& values,
+                                 std::vector<TxOpStatus>& stss);
+
+    // Read the versions of the keys in [left_key, right_key) like Read, in key
+    // order across the regions overlapping the range, "" right_key means no
+    // limit. Only the keys kept by txindex are read, their versions are newer
+    // than the ones in storage. Return ReadBlock at the first key blocked,
+    // "callback" is called once it is unblocked.
+    virtual TxOpStatus Scan(const std::string& left_key,
+                            const std::string& right_key,
+                            const TxIdentifier& txid,
+                            std::function<void()> callback,
+                            std::vector<std::string>& keys,
+                            std::vector<Value>& values);
+
+    // Read the changes of the region of "key", see ChangeLog::Read.
+    virtual TxOpStatus ReadChanges(const std::string& key, TimeStamp from_ts,
+                                   size_t max_bytes,
+                                   std::vector<Change>& changes,
+                                   TimeStamp& resolved_ts);
+
    private:
     KVRegionPtr route(const std::string& key);
+    // Group the indexes of "keys" by their regions, "stss" of the keys not
+    // routed are set to PartitionErr.
+    std::map<KVRegionPtr, std::vector<size_t>> group(
+        const std::vector<std::string>& keys, std::vector<TxOpStatus>& stss);
     void init_region_table(const Partition& p);
     void init_storage(const Partition& p);
 
@@ -126,10 +180,42 @@ class TxIndex {
     PartitionManager _pm;
 };
 
-typedef struct {
+// A key of a bucket published to the snapshot reads, which find it without
+// the latch, see KVBucket::Read.
+struct KeySlot {
+    explicit KeySlot(const std::string& k) : key(k) {}
+    const std::string key;
+    // replaced under the latch by std::atomic_store, nullptr once the key is
+    // collected by gc
+    MVCCSnapshotPtr snapshot;
+};
+typedef std::shared_ptr<KeySlot> KeySlotPtr;
+
+struct KeySlotCmp {
+    bool operator()(const KeySlotPtr& lhs, const KeySlotPtr& rhs) const {
+        return BitWiseComparator()(lhs->key, rhs->key);
+    }
+};
+typedef SkipList<KeySlotPtr, KeySlotCmp> KeySlotList;
+
+struct ValueAndMetric {
+    explicit ValueAndMetric(const SlabAllocator<Version>& alloc) : mv(alloc) {}
     KeyMetric km;
     MVCCValue mv;
-} ValueAndMetric;
+    KeySlotPtr slot;
+};
+
+// The result of a key of a batch write, "done" tells if the key is written
+// before the batch stops at a blocked one, "rewritten" that the key holds the
+// intent of the tx already, written by an earlier run of a blocked batch, so
+// only its value is replaced and nothing is recorded for it again.
+struct WriteResult {
+    TxOpStatus sts;
+    bool done = false;
+    bool rewritten = false;
+    bool is_lock_update = false;
+    bool is_pess_key = false;
+};
 
 class KVBucket {
    public:
@@ -145,30 +231,126 @@ class KVBucket {
                            std::function<void()> callback, Deps& deps,
                            bool& is_lock_update, bool& is_pess_key);
     TxOpStatus Clean(const std::string& key, const TxIdentifier& txid);
-    TxOpStatus Commit(const std::string& key, const TxIdentifier& txid);
+    // The committed value is appended to "changes" under the latch if it is
+    // not nullptr, so that no seal passes it, see KVRegion::SealChanges.
+    TxOpStatus Commit(const std::string& key, const TxIdentifier& txid,
+                      ChangeLog* changes = nullptr);
+    // If "kept_only" is set, NotExist is returned for a key not kept without
+    // tracking the read.
+    // The read goes without the latch if the snapshot of the key tells it
+    // needs not block, or the key has no snapshot, unless the reads are
+    // tracked by -enable_dep_reporter.
     TxOpStatus Read(const std::string& key, Value& v, const TxIdentifier& txid,
-                    std::function<void()> callback, Deps& deps);
+                    std::function<void()> callback, Deps& deps,
+                    bool kept_only = false);
+
+    // The batch versions of the ops above on "keys[i]" for each i in "idx",
+    // the latch is taken once. The result of "keys[i]" is set to "results[i]"
+    // or "stss[i]". A write or read stops at the first key blocked and returns
+    // its status, otherwise Ok.
+    TxOpStatus BatchWriteIntent(const std::vector<std::string>& keys,
+                                const std::vector<Value>& values,
+                                const std::vector<size_t>& idx,
+                                const TxIdentifier& txid,
+                                std::function<void()> callback, Deps& deps,
+                                std::vector<WriteResult>& results);
+    void BatchClean(const std::vector<std::string>& keys,
+                    const std::vector<size_t>& idx, const TxIdentifier& txid,
+                    std::vector<TxOpStatus>& stss);
+    void BatchCommit(const std::vector<std::string>& keys,
+                     const std::vector<size_t>& idx, const TxIdentifier& txid,
+                     std::vector<TxOpStatus>& stss,
+                     ChangeLog* changes = nullptr);
+    // done[i] is set once keys[i] is read, the blocked one included.
+    TxOpStatus BatchRead(const std::vector<std::string>& keys,
+                         const std::vector<size_t>& idx,
+                         const TxIdentifier& txid,
+                         std::function<void()> callback, Deps& deps,
+                         std::vector<Value>& values,
+                         std::vector<TxOpStatus>& stss,
+                         std::vector<bool>& done);
+
+    // Collect about "max_cnt" versions committed after "min_ats", 0 means
+    // -max_data_to_persist_per_round.
     int GetPersisting(std::vector<txindex::DataToPersist>& datas,
-                      uint64_t min_ats);
+                      uint64_t min_ats, int max_cnt = 0);
     int ClearPersisted(const std::vector<txindex::DataToPersist>& datas);
 
-    void gc_mv(RegionMetric* regionMetric);
+    // Return the number of keys collected.
+    int gc_mv(RegionMetric* regionMetric);
+
+    bool Contains(const std::string& key);
+
+    // The smallest start ts of the intents held, MAX_TIMESTAMP if none.
+    TimeStamp MinIntentStartTs();
+
+    // Allocate the keys, values and versions from "pool" from now on, before
+    // any key is added.
+    void SetPool(std::shared_ptr<SlabPool> pool);
+
+    // nullptr if the bucket is on operator new
+    inline const std::shared_ptr<SlabPool>& Pool() const { return _pool; }
 
    private:
+    typedef std::pair<const std::string, ValueAndMetric> KV;
+    typedef std::unordered_map<std::string, ValueAndMetric,
+                               std::hash<std::string>,
+                               std::equal_to<std::string>, SlabAllocator<KV>>
+        KVMap;
+
+    // Find "key", or add it if not found.
+    ValueAndMetric& kv(const std::string& key);
+    // Release the empty slabs once some versions are gone.
+    void trim();
+
     TxOpStatus Write(MVCCLock lock_type, const TxIdentifier& txid,
                      const std::string& key, const Value& v,
                      std::function<void()> callback, Deps& deps,
                      bool& is_lock_update, bool& is_pess_key);
 
+    // The ops without taking the latch.
+    TxOpStatus write_key(MVCCLock lock_type, const TxIdentifier& txid,
+                         const std::string& key, const Value& v,
+                         std::function<void()> callback, Deps& deps,
+                         bool& is_lock_update, bool& is_pess_key);
+    TxOpStatus clean(const std::string& key, const TxIdentifier& txid);
+    TxOpStatus commit(const std::string& key, const TxIdentifier& txid,
+                      ChangeLog* changes);
+    TxOpStatus read(const std::string& key, Value& v, const TxIdentifier& txid,
+                    std::function<void()> callback, Deps& deps,
+                    bool kept_only);
+
+    // Read "key" from its published snapshot without the latch, return false
+    // if the read needs the latch.
+    bool snapshot_read(const std::string& key, Value& v,
+                       const TxIdentifier& txid, TxOpStatus& sts);
+    // Publish the state of "vm" to the snapshot reads, under the latch.
+    void publish(const std::string& key, ValueAndMetric& vm);
+
     TxOpStatus write(ValueAndMetric& vm, MVCCLock lock_type,
                      const TxIdentifier& txid, const std::string& key,
                      const Value& v, std::function<void()> callback, Deps& deps,
                      bool& is_lock_update);
 
-    std::unordered_map<std::string, ValueAndMetric> _kvs;
+    // the nodes of _kvs and the values and versions of its keys are
+    // allocated from it
+    std::shared_ptr<SlabPool> _pool;
+    KVMap _kvs;
     bthread::Mutex _latch;
+    // The slots of the keys ever published, inserted under the latch and
+    // read lock-free. The slots of the keys collected by gc are reused if
+    // the keys come back, and dropped once they are many.
+    std::shared_ptr<KeySlotList> _slots = std::make_shared<KeySlotList>();
+    size_t _slot_cnt = 0;
+    size_t _stale_slot_cnt = 0;
+    // the start ts of each intent held, kept along with the intents under
+    // the latch
+    std::multiset<TimeStamp> _intent_ts;
 };
 
+// The keys of a region in order, see KVRegion::Scan.
+typedef SkipList<std::string, BitWiseComparator> KeyList;
+
 class KVRegion {
    public:
     KVRegion(const Range& range, brpc::Channel* storage_channel,
@@ -185,6 +367,39 @@ class KVRegion {
     TxOpStatus Commit(const std::string& key, const TxIdentifier& txid);
     TxOpStatus Read(const std::string& key, Value& v, const TxIdentifier& txid,
                     std::function<void()> callback);
+    TxOpStatus Scan(const std::string& left_key, const std::string& right_key,
+                    const TxIdentifier& txid, std::function<void()> callback,
+                    std::vector<std::string>& keys, std::vector<Value>& values);
+
+    // The batch versions of the ops above on "keys[i]" for each i in "idx",
+    // grouped by buckets so each latch is taken once, see KVBucket.
+    TxOpStatus BatchWriteIntent(const std::vector<std::string>& keys,
+                                const std::vector<Value>& values,
+                                const std::vector<size_t>& idx,
+                                const TxIdentifier& txid,
+                                std::function<void()> callback,
+                                std::vector<TxOpStatus>& stss);
+    void BatchClean(const std::vector<std::string>& keys,
+                    const std::vector<size_t>& idx, const TxIdentifier& txid,
+                    std::vector<TxOpStatus>& stss);
+    void BatchCommit(const std::vector<std::string>& keys,
+                     const std::vector<size_t>& idx, const TxIdentifier& txid,
+                     std::vector<TxOpStatus>& stss);
+    TxOpStatus BatchRead(const std::vector<std::string>& keys,
+                         const std::vector<size_t>& idx,
+                         const TxIdentifier& txid,
+                         std::function<void()> callback,
+                         std::vector<Value>& values,
+                         std::vector<TxOpStatus>& stss);
+
+    // Drop the keys collected by gc from the key list once they are many,
+    // "gc_cnt" keys are collected since the last call.
+    void CompactKeys(size_t gc_cnt);
+
+    // Release the changes committed before "min_ats", but not past the
+    // intents held: their txs may have got commit ts below "min_ats" from
+    // txplanner and be committing them.
+    void SealChanges(TimeStamp min_ats);
 
     inline std::vector<KVBucket>& KVBuckets() { return _kvbs; }
 
@@ -192,9 +407,24 @@ class KVRegion {
 
     inline const Range& GetRange() { return _range; }
 
+    inline ChangeLog& Changes() { return _changes; }
+
    private:
+    // Add "key" to the key list once it is written.
+    void index_key(const std::string& key);
+
     Range _range;
     std::vector<KVBucket> _kvbs;
+    // The keys ever written, read lock-free by the scans. A key collected by
+    // gc stays until the list is rebuilt by CompactKeys, the scans skip it.
+    std::shared_ptr<KeyList> _keys;
+    bthread::Mutex _keys_mutex;
+    size_t _key_cnt;
+    size_t _gc_key_cnt;
+    std::atomic<bool> _compacting;
+    // the keys indexed while the list is rebuilt, added to the new one
+    std::vector<std::string> _compact_keys;
+    ChangeLog _changes;
     RegionPersist _persistor;
     Dependence _deprpt;
 
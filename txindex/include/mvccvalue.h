@@ -5,23 +5,41 @@
 #include <bvar/bvar.h>
 
 #include <functional>
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "azino/kv.h"
 #include "gflags/gflags.h"
 #include "service/kv.pb.h"
 #include "service/tx.pb.h"
+#include "slab.h"
 
 namespace azino {
 namespace txindex {
 typedef std::shared_ptr<Value> ValuePtr;
-typedef struct TxIdentifierCmp {
-    bool operator()(const TxIdentifier& lhs, const TxIdentifier& rhs) const {
-        return lhs.commit_ts() > rhs.commit_ts();
+
+// A committed version of a key, the start ts of its tx is kept for the
+// dependencies.
+struct Version {
+    TimeStamp commit_ts;
+    TimeStamp start_ts;
+    ValuePtr value;
+
+    // The tx committed it, with only its start ts and commit ts set.
+    TxIdentifier Tx() const {
+        TxIdentifier txid;
+        txid.set_start_ts(start_ts);
+        txid.set_commit_ts(commit_ts);
+        return txid;
     }
-} TxIdentifierCmp;
-typedef std::map<TxIdentifier, ValuePtr, TxIdentifierCmp> MultiVersionValue;
+};
+
+// The committed versions of a key in descending order of commit ts. A key
+// holds a few versions until they are persisted, so they are kept flat and
+// searched by their timestamps.
+typedef std::vector<Version, SlabAllocator<Version>> MultiVersionValue;
 typedef std::unordered_map<TimeStamp, TxIdentifier> ReaderMap;
 
 enum MVCCLock {
@@ -30,20 +48,38 @@ enum MVCCLock {
     WriteIntent = 2,
 };
 
+// The state of a key read by a snapshot read, never changed once published,
+// see MVCCValue::Snapshot.
+struct MVCCSnapshot {
+    MVCCLock lock;
+    TimeStamp lock_start_ts;
+    std::shared_ptr<const MultiVersionValue> mvv;
+
+    // Finds committed values whose timestamp is smaller or equal than "ts"
+    MultiVersionValue::const_iterator Seek(TimeStamp ts) const;
+};
+typedef std::shared_ptr<const MVCCSnapshot> MVCCSnapshotPtr;
+
 class MVCCValue {
    public:
-    MVCCValue();
+    // The values and versions are allocated by "alloc".
+    explicit MVCCValue(
+        const SlabAllocator<Version>& alloc = SlabAllocator<Version>());
     DISALLOW_COPY_AND_ASSIGN(MVCCValue);
     ~MVCCValue() = default;
     inline MVCCLock LockType() const { return _lock; }
-    inline TxIdentifier LockHolder() const { return _lock_holder; }
+    inline const TxIdentifier& LockHolder() const { return _lock_holder; }
     inline txindex::ValuePtr IntentValue() const { return _lock_value; }
-    inline size_t Size() const { return _mvv.size(); }
+    inline size_t Size() const { return _mvv->size(); }
     void Lock(const TxIdentifier& txid);
     void Prewrite(const Value& v, const TxIdentifier& txid);
     void Clean();
     void Commit(const TxIdentifier& txid);
-    inline MultiVersionValue& MVV() { return _mvv; }
+    inline const MultiVersionValue& MVV() const { return *_mvv; }
+
+    // The current state for the snapshot reads. The committed versions are
+    // copied on write, so a snapshot only holds them.
+    MVCCSnapshotPtr Snapshot() const;
 
     MultiVersionValue::const_iterator LargestTSValue() const;
 
@@ -54,7 +90,7 @@ class MVCCValue {
 
     // Truncate committed values whose timestamp is smaller or equal than "ts",
     // return the number of values truncated
-    unsigned Truncate(const TxIdentifier& txid);
+    unsigned Truncate(TimeStamp ts);
 
     inline void AddReader(const TxIdentifier& txid) {
         _readers.insert(std::make_pair(txid.start_ts(), txid));
@@ -67,10 +103,11 @@ class MVCCValue {
     void WakeUpWaiters();
 
    private:
+    SlabAllocator<Version> _alloc;
     MVCCLock _lock;
     TxIdentifier _lock_holder;
     ValuePtr _lock_value;
-    MultiVersionValue _mvv;
+    std::shared_ptr<const MultiVersionValue> _mvv;
     ReaderMap _readers;
     std::vector<std::function<void()>> _waiters;
 };
@@ -48,6 +48,9 @@ class RegionPersist : public azino::BackgroundTask {
     size_t _last_persist_bucket_num;
     int64_t _last_get_min_ats_time;
     uint64_t _min_ats;
+    // the backpressure of the storage on the last batch store
+    uint32_t _backpressure_level;
+    uint32_t _delay_ms;
 };
 
 }  // namespace txindex
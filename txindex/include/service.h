@@ -1,8 +1,12 @@
 #ifndef AZINO_TXINDEX_INCLUDE_SERVICE_H
 #define AZINO_TXINDEX_INCLUDE_SERVICE_H
 
+#include <brpc/stream.h>
+#include <bthread/condition_variable.h>
+#include <bthread/mutex.h>
 #include <butil/macros.h>
 
+#include <set>
 #include <string>
 
 #include "service/txindex/txindex.pb.h"
@@ -18,6 +22,10 @@ class TxOpServiceImpl : public TxOpService {
     DISALLOW_COPY_AND_ASSIGN(TxOpServiceImpl);
     ~TxOpServiceImpl();
 
+    // Close the change streams and wait for their loops to exit, call it
+    // once the server stops and before the index is destroyed.
+    void Stop();
+
     virtual void WriteIntent(
         ::google::protobuf::RpcController* controller,
         const ::azino::txindex::WriteIntentRequest* request,
@@ -39,9 +47,47 @@ class TxOpServiceImpl : public TxOpService {
                       const ::azino::txindex::ReadRequest* request,
                       ::azino::txindex::ReadResponse* response,
                       ::google::protobuf::Closure* done) override;
+    virtual void BatchWriteIntent(
+        ::google::protobuf::RpcController* controller,
+        const ::azino::txindex::BatchWriteIntentRequest* request,
+        ::azino::txindex::BatchWriteIntentResponse* response,
+        ::google::protobuf::Closure* done) override;
+    virtual void BatchClean(
+        ::google::protobuf::RpcController* controller,
+        const ::azino::txindex::BatchCleanRequest* request,
+        ::azino::txindex::BatchCleanResponse* response,
+        ::google::protobuf::Closure* done) override;
+    virtual void BatchCommit(
+        ::google::protobuf::RpcController* controller,
+        const ::azino::txindex::BatchCommitRequest* request,
+        ::azino::txindex::BatchCommitResponse* response,
+        ::google::protobuf::Closure* done) override;
+    virtual void BatchRead(
+        ::google::protobuf::RpcController* controller,
+        const ::azino::txindex::BatchReadRequest* request,
+        ::azino::txindex::BatchReadResponse* response,
+        ::google::protobuf::Closure* done) override;
+    virtual void ScanIntent(
+        ::google::protobuf::RpcController* controller,
+        const ::azino::txindex::ScanIntentRequest* request,
+        ::azino::txindex::ScanIntentResponse* response,
+        ::google::protobuf::Closure* done) override;
+    virtual void SubscribeChanges(
+        ::google::protobuf::RpcController* controller,
+        const ::azino::txindex::SubscribeChangesRequest* request,
+        ::azino::txindex::SubscribeChangesResponse* response,
+        ::google::protobuf::Closure* done) override;
 
    private:
+    bool stopped();
+
     TxIndex* _index;
+
+    // the running change streams, closed by Stop()
+    bthread::Mutex _stream_mutex;
+    bthread::ConditionVariable _stream_cond;
+    std::set<brpc::StreamId> _streams;
+    bool _stopped = false;
 };
 }  // namespace txindex
 }  // namespace azino
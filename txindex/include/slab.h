@@ -0,0 +1,121 @@
+#ifndef AZINO_TXINDEX_INCLUDE_SLAB_H
+#define AZINO_TXINDEX_INCLUDE_SLAB_H
+
+#include <butil/macros.h>
+#include <gflags/gflags.h>
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+#include "bthread/mutex.h"
+
+DECLARE_bool(enable_slab_alloc);
+
+namespace azino {
+namespace txindex {
+
+// SlabPool hands out small blocks of a few size classes from 16KB slabs, so
+// that the keys, values and versions of a latch bucket are not malloced one
+// by one. Each bucket has its own pool under -enable_slab_alloc: the
+// allocations run under the bucket latch, so the class mutexes are only
+// contended by the blocks freed from other threads. A freed block goes back
+// to its slab at once, while a slab with no block in use is only released to
+// the system by Trim, which is run after the versions are persisted and
+// truncated, or collected by gc.
+//
+// Blocks larger than the largest class go to operator new.
+class SlabPool {
+   public:
+    SlabPool() = default;
+    DISALLOW_COPY_AND_ASSIGN(SlabPool);
+    // All the blocks should have been freed.
+    ~SlabPool();
+
+    void* Allocate(size_t bytes);
+    void Deallocate(void* p, size_t bytes);
+
+    // Release the slabs with no block in use, return the number of slabs
+    // released.
+    size_t Trim();
+
+    // Bytes of the slabs held, and of the blocks in use.
+    size_t ReservedBytes() const { return _reserved_bytes; }
+    size_t UsedBytes() const { return _used_bytes; }
+
+    // a slab is aligned to its size, so a block finds its slab by its address
+    static const size_t slab_bytes = 16 << 10;
+    static const int num_size_classes = 8;
+
+   private:
+    struct Slab;
+    struct SizeClass {
+        bthread::Mutex mutex;
+        // the slabs with free blocks
+        Slab* partial = nullptr;
+    };
+
+    Slab* new_slab();
+    static void link(SizeClass& c, Slab* s);
+    static void unlink(SizeClass& c, Slab* s);
+
+    SizeClass _classes[num_size_classes];
+    std::atomic<size_t> _reserved_bytes{0};
+    std::atomic<size_t> _used_bytes{0};
+};
+
+// An allocator of the std containers and std::allocate_shared on a SlabPool,
+// which it keeps alive, so whatever is allocated may outlive its region. A
+// default constructed one goes to operator new.
+template <class T>
+class SlabAllocator {
+   public:
+    typedef T value_type;
+    // a container moved or swapped takes the pool along
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    SlabAllocator() = default;
+    explicit SlabAllocator(std::shared_ptr<SlabPool> pool)
+        : _pool(std::move(pool)) {}
+    template <class U>
+    SlabAllocator(const SlabAllocator<U>& other) : _pool(other.pool()) {}
+
+    T* allocate(size_t n) {
+        size_t bytes = n * sizeof(T);
+        if (_pool == nullptr) {
+            return static_cast<T*>(::operator new(bytes));
+        }
+        return static_cast<T*>(_pool->Allocate(bytes));
+    }
+
+    void deallocate(T* p, size_t n) {
+        if (_pool == nullptr) {
+            ::operator delete(p);
+            return;
+        }
+        _pool->Deallocate(p, n * sizeof(T));
+    }
+
+    const std::shared_ptr<SlabPool>& pool() const { return _pool; }
+
+   private:
+    std::shared_ptr<SlabPool> _pool;
+};
+
+template <class T, class U>
+bool operator==(const SlabAllocator<T>& lhs, const SlabAllocator<U>& rhs) {
+    return lhs.pool() == rhs.pool();
+}
+
+template <class T, class U>
+bool operator!=(const SlabAllocator<T>& lhs, const SlabAllocator<U>& rhs) {
+    return !(lhs == rhs);
+}
+
+}  // namespace txindex
+}  // namespace azino
+
+#endif  // AZINO_TXINDEX_INCLUDE_SLAB_H
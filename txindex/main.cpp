@@ -56,6 +56,8 @@ int main(int argc, char* argv[]) {
     }
 
     server.RunUntilAskedToQuit();
+    // the change streams read from the index
+    tx_op_service_impl.Stop();
 
     delete txindex;
 }
\ No newline at end of file
@@ -0,0 +1,99 @@
+#include "changelog.h"
+
+#include <butil/logging.h>
+#include <bvar/bvar.h>
+
+#include <algorithm>
+#include <mutex>
+
+DEFINE_bool(enable_change_log, false,
+            "keep the committed versions of every region for the change "
+            "streams");
+static bvar::GFlag gflag_enable_change_log("enable_change_log");
+DEFINE_int64(change_log_max_bytes, 16 << 20,
+             "max bytes of keys and values kept by the change log of a "
+             "region");
+static bvar::GFlag gflag_change_log_max_bytes("change_log_max_bytes");
+
+namespace azino {
+namespace txindex {
+namespace {
+
+bvar::Adder<int64_t> g_change_log_dropped("txindex_change_log_dropped");
+bvar::Adder<int64_t> g_change_log_late("txindex_change_log_late");
+
+size_t ChangeBytes(const Change& change) {
+    return change.key.size() + change.value->content().size();
+}
+
+}  // namespace
+
+void ChangeLog::start(TimeStamp ts) {
+    if (!_started) {
+        _started = true;
+        _dropped_ts = ts > MIN_TIMESTAMP ? ts - 1 : MIN_TIMESTAMP;
+    }
+}
+
+void ChangeLog::Append(const std::string& key, TimeStamp ts,
+                       ValuePtr value) {
+    std::lock_guard<bthread::Mutex> lck(_mutex);
+    start(ts);
+    if (ts < _sealed_ts) {
+        // the readers past it miss it
+        g_change_log_late << 1;
+        LOG(WARNING) << "Change of key: " << key << " ts: " << ts
+                     << " is committed after the seal: " << _sealed_ts;
+    }
+    Change change{key, ts, std::move(value)};
+    _bytes += ChangeBytes(change);
+    _changes.emplace(ts, std::move(change));
+    while (_bytes > size_t(FLAGS_change_log_max_bytes) &&
+           !_changes.empty()) {
+        auto oldest = _changes.begin();
+        _bytes -= ChangeBytes(oldest->second);
+        _dropped_ts = std::max(_dropped_ts, oldest->first);
+        _changes.erase(oldest);
+        g_change_log_dropped << 1;
+    }
+}
+
+void ChangeLog::Seal(TimeStamp ts) {
+    std::lock_guard<bthread::Mutex> lck(_mutex);
+    start(ts);
+    _sealed_ts = std::max(_sealed_ts, ts);
+}
+
+TxOpStatus ChangeLog::Read(TimeStamp from_ts, size_t max_bytes,
+                           std::vector<Change>& changes,
+                           TimeStamp& resolved_ts) {
+    TxOpStatus sts;
+    std::lock_guard<bthread::Mutex> lck(_mutex);
+    resolved_ts = from_ts;
+    if (_started && from_ts < _dropped_ts) {
+        sts.set_error_code(TxOpStatus_Code_NotExist);
+        sts.set_error_message("changes up to ts " +
+                              std::to_string(_dropped_ts) +
+                              " are not kept");
+        return sts;
+    }
+    sts.set_error_code(TxOpStatus_Code_Ok);
+    size_t bytes = 0;
+    auto it = _changes.upper_bound(from_ts);
+    for (; it != _changes.end() && it->first < _sealed_ts; it++) {
+        if (bytes >= max_bytes && it->first != resolved_ts) {
+            return sts;
+        }
+        bytes += ChangeBytes(it->second);
+        changes.push_back(it->second);
+        resolved_ts = it->first;
+    }
+    // all the sealed changes are read
+    if (_sealed_ts > MIN_TIMESTAMP) {
+        resolved_ts = std::max(resolved_ts, _sealed_ts - 1);
+    }
+    return sts;
+}
+
+}  // namespace txindex
+}  // namespace azino
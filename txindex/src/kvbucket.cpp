@@ -2,7 +2,10 @@
 #include <butil/hash.h>
 #include <gflags/gflags.h>
 
+#include <algorithm>
 #include <functional>
+#include <memory>
+#include <tuple>
 #include <unordered_map>
 
 #include "depedence.h"
@@ -23,12 +26,12 @@ DEFINE_bool(first_commit_wins, false, "first commit wins");
     do {                                                                 \
         auto iter = mv.LargestTSValue();                                 \
         if (iter != mv.MVV().end() &&                                    \
-            iter->first.commit_ts() >= txid.start_ts()) {                \
+            iter->commit_ts >= txid.start_ts()) {                        \
             LOG(INFO) << "Tx(" << txid.ShortDebugString() << ") write "  \
                       << type << " on key: " << key << " too late. "     \
                       << "Find largest version: "                        \
-                      << iter->first.ShortDebugString()                  \
-                      << " value: " << iter->second->ShortDebugString(); \
+                      << iter->Tx().ShortDebugString()                   \
+                      << " value: " << iter->value->ShortDebugString();  \
             sts.set_error_code(TxOpStatus_Code_WriteTooLate);            \
             return sts;                                                  \
         }                                                                \
@@ -45,10 +48,26 @@ DEFINE_bool(first_commit_wins, false, "first commit wins");
 
 DEFINE_double(lambda, 0.3, "lambda hyper parameter");
 static bvar::GFlag gflag_lambda("lambda");
+DEFINE_bool(enable_snapshot_read, true,
+            "read the published snapshot of a key without the bucket latch "
+            "if the read needs not block");
+static bvar::GFlag gflag_enable_snapshot_read("enable_snapshot_read");
+
+// the slots are not rebuilt for fewer stale ones
+static const size_t min_stale_slots_to_rebuild = 1024;
+
+static bvar::Adder<int64_t> g_snapshot_read("txindex_snapshot_read");
 
 namespace azino {
 namespace txindex {
 
+void KVBucket::SetPool(std::shared_ptr<SlabPool> pool) {
+    std::lock_guard<bthread::Mutex> lck(_latch);
+    _pool = std::move(pool);
+    _kvs = KVMap(0, std::hash<std::string>(), std::equal_to<std::string>(),
+                 SlabAllocator<KV>(_pool));
+}
+
 TxOpStatus KVBucket::WriteLock(const std::string& key, const TxIdentifier& txid,
                                std::function<void()> callback, Deps& deps,
                                bool& is_lock_update, bool& is_pess_key) {
@@ -66,9 +85,113 @@ TxOpStatus KVBucket::WriteIntent(const std::string& key, const Value& v,
 
 TxOpStatus KVBucket::Clean(const std::string& key, const TxIdentifier& txid) {
     std::lock_guard<bthread::Mutex> lck(_latch);
+    return clean(key, txid);
+}
+
+TxOpStatus KVBucket::Commit(const std::string& key, const TxIdentifier& txid,
+                            ChangeLog* changes) {
+    std::lock_guard<bthread::Mutex> lck(_latch);
+    return commit(key, txid, changes);
+}
+
+TxOpStatus KVBucket::Read(const std::string& key, Value& v,
+                          const TxIdentifier& txid,
+                          std::function<void()> callback, Deps& deps,
+                          bool kept_only) {
+    TxOpStatus sts;
+    if (snapshot_read(key, v, txid, sts)) {
+        return sts;
+    }
+    std::lock_guard<bthread::Mutex> lck(_latch);
+    return read(key, v, txid, callback, deps, kept_only);
+}
+
+TxOpStatus KVBucket::BatchWriteIntent(const std::vector<std::string>& keys,
+                                      const std::vector<Value>& values,
+                                      const std::vector<size_t>& idx,
+                                      const TxIdentifier& txid,
+                                      std::function<void()> callback,
+                                      Deps& deps,
+                                      std::vector<WriteResult>& results) {
+    std::lock_guard<bthread::Mutex> lck(_latch);
+    for (size_t i : idx) {
+        WriteResult& r = results[i];
+        auto it = _kvs.find(keys[i]);
+        if (it != _kvs.end() &&
+            it->second.mv.LockType() == MVCCLock::WriteIntent &&
+            it->second.mv.LockHolder().start_ts() == txid.start_ts()) {
+            // the value is replaced like a repeated WriteIntent does
+            it->second.mv.Prewrite(values[i], txid);
+            publish(keys[i], it->second);
+            r.sts.set_error_code(TxOpStatus_Code_Ok);
+            r.done = r.rewritten = true;
+            continue;
+        }
+        r.sts = write_key(MVCCLock::WriteIntent, txid, keys[i], values[i],
+                          callback, deps, r.is_lock_update, r.is_pess_key);
+        r.done = true;
+        if (r.sts.error_code() == TxOpStatus_Code_WriteBlock) {
+            return r.sts;
+        }
+    }
+    TxOpStatus sts;
+    sts.set_error_code(TxOpStatus_Code_Ok);
+    return sts;
+}
+
+void KVBucket::BatchClean(const std::vector<std::string>& keys,
+                          const std::vector<size_t>& idx,
+                          const TxIdentifier& txid,
+                          std::vector<TxOpStatus>& stss) {
+    std::lock_guard<bthread::Mutex> lck(_latch);
+    for (size_t i : idx) {
+        stss[i] = clean(keys[i], txid);
+    }
+}
 
+void KVBucket::BatchCommit(const std::vector<std::string>& keys,
+                           const std::vector<size_t>& idx,
+                           const TxIdentifier& txid,
+                           std::vector<TxOpStatus>& stss,
+                           ChangeLog* changes) {
+    std::lock_guard<bthread::Mutex> lck(_latch);
+    for (size_t i : idx) {
+        stss[i] = commit(keys[i], txid, changes);
+    }
+}
+
+TxOpStatus KVBucket::BatchRead(const std::vector<std::string>& keys,
+                               const std::vector<size_t>& idx,
+                               const TxIdentifier& txid,
+                               std::function<void()> callback, Deps& deps,
+                               std::vector<Value>& values,
+                               std::vector<TxOpStatus>& stss,
+                               std::vector<bool>& done) {
+    std::vector<size_t> rest;
+    for (size_t i : idx) {
+        if (snapshot_read(keys[i], values[i], txid, stss[i])) {
+            done[i] = true;
+        } else {
+            rest.push_back(i);
+        }
+    }
+    std::lock_guard<bthread::Mutex> lck(_latch);
+    for (size_t i : rest) {
+        stss[i] = read(keys[i], values[i], txid, callback, deps, false);
+        done[i] = true;
+        if (stss[i].error_code() == TxOpStatus_Code_ReadBlock) {
+            return stss[i];
+        }
+    }
+    TxOpStatus sts;
+    sts.set_error_code(TxOpStatus_Code_Ok);
+    return sts;
+}
+
+TxOpStatus KVBucket::clean(const std::string& key, const TxIdentifier& txid) {
     TxOpStatus sts;
-    MVCCValue& mv = _kvs[key].mv;
+    ValueAndMetric& vm = kv(key);
+    MVCCValue& mv = vm.mv;
 
     if (mv.LockType() == MVCCLock::None ||
         mv.LockHolder().start_ts() != txid.start_ts()) {
@@ -78,19 +201,23 @@ TxOpStatus KVBucket::Clean(const std::string& key, const TxIdentifier& txid) {
         return sts;
     }
 
+    if (mv.LockType() == MVCCLock::WriteIntent) {
+        _intent_ts.erase(_intent_ts.find(txid.start_ts()));
+    }
     mv.Clean();
+    publish(key, vm);
     mv.WakeUpWaiters();
 
     sts.set_error_code(TxOpStatus_Code_Ok);
     return sts;
 }
 
-TxOpStatus KVBucket::Commit(const std::string& key, const TxIdentifier& txid) {
-    std::lock_guard<bthread::Mutex> lck(_latch);
-
+TxOpStatus KVBucket::commit(const std::string& key, const TxIdentifier& txid,
+                            ChangeLog* changes) {
     TxOpStatus sts;
 
-    MVCCValue& mv = _kvs[key].mv;
+    ValueAndMetric& vm = kv(key);
+    MVCCValue& mv = vm.mv;
 
     if (mv.LockType() != MVCCLock::WriteIntent ||
         mv.LockHolder().start_ts() != txid.start_ts()) {
@@ -100,21 +227,31 @@ TxOpStatus KVBucket::Commit(const std::string& key, const TxIdentifier& txid) {
         return sts;
     }
 
+    if (changes != nullptr && mv.IntentValue() != nullptr) {
+        changes->Append(key, txid.commit_ts(), mv.IntentValue());
+    }
+    _intent_ts.erase(_intent_ts.find(txid.start_ts()));
     mv.Commit(txid);
+    publish(key, vm);
     mv.WakeUpWaiters();
 
     sts.set_error_code(TxOpStatus_Code_Ok);
     return sts;
 }
 
-TxOpStatus KVBucket::Read(const std::string& key, Value& v,
+TxOpStatus KVBucket::read(const std::string& key, Value& v,
                           const TxIdentifier& txid,
-                          std::function<void()> callback, Deps& deps) {
-    std::lock_guard<bthread::Mutex> lck(_latch);
-
+                          std::function<void()> callback, Deps& deps,
+                          bool kept_only) {
     TxOpStatus sts;
 
-    MVCCValue& mv = _kvs[key].mv;
+    // a key not kept is only added to track its reader
+    if ((kept_only || !FLAGS_enable_dep_reporter) &&
+        _kvs.find(key) == _kvs.end()) {
+        sts.set_error_code(TxOpStatus_Code_NotExist);
+        return sts;
+    }
+    MVCCValue& mv = kv(key).mv;
 
     if (mv.LockType() != MVCCLock::None &&
         mv.LockHolder().start_ts() == txid.start_ts()) {
@@ -147,9 +284,9 @@ TxOpStatus KVBucket::Read(const std::string& key, Value& v,
         // committed RW dep
         auto iter = mv.LargestTSValue();
         while (iter != mv.MVV().end() &&
-               iter->first.commit_ts() > txid.start_ts()) {
+               iter->commit_ts > txid.start_ts()) {
             deps.push_back(txindex::Dep{key, txindex::DepType::READWRITE, txid,
-                                        iter->first});
+                                        iter->Tx()});
             iter++;
         }
 
@@ -160,14 +297,14 @@ TxOpStatus KVBucket::Read(const std::string& key, Value& v,
     auto iter = mv.Seek(txid.start_ts());
     if (iter != mv.MVV().end()) {
         sts.set_error_code(TxOpStatus_Code_Ok);
-        v.CopyFrom(*(iter->second));
+        v.CopyFrom(*(iter->value));
     } else {
         sts.set_error_code(TxOpStatus_Code_NotExist);
     }
     return sts;
 }
 
-void KVBucket::gc_mv(RegionMetric* regionMetric) {
+int KVBucket::gc_mv(RegionMetric* regionMetric) {
     std::lock_guard<bthread::Mutex> lck(_latch);
 
     std::vector<std::string> gc_keys;
@@ -183,16 +320,69 @@ void KVBucket::gc_mv(RegionMetric* regionMetric) {
         LOG(NOTICE) << "GC MV Size:" << gc_keys.size();
     }
     for (auto& key : gc_keys) {
-        _kvs.erase(key);
+        auto it = _kvs.find(key);
+        if (it->second.slot != nullptr) {
+            std::atomic_store(&it->second.slot->snapshot, MVCCSnapshotPtr());
+            _stale_slot_cnt++;
+        }
+        _kvs.erase(it);
+    }
+    if (_stale_slot_cnt >=
+        std::max(_slot_cnt / 2, min_stale_slots_to_rebuild)) {
+        // the snapshot reads go on with the old slots
+        std::shared_ptr<KeySlotList> slots = std::make_shared<KeySlotList>();
+        size_t cnt = 0;
+        for (auto& it : _kvs) {
+            if (it.second.slot != nullptr) {
+                slots->Insert(it.second.slot);
+                cnt++;
+            }
+        }
+        std::atomic_store(&_slots, slots);
+        _slot_cnt = cnt;
+        _stale_slot_cnt = 0;
     }
+    if (!gc_keys.empty()) {
+        trim();
+    }
+    return gc_keys.size();
+}
+
+ValueAndMetric& KVBucket::kv(const std::string& key) {
+    auto it = _kvs.find(key);
+    if (it == _kvs.end()) {
+        it = _kvs.emplace(std::piecewise_construct, std::forward_as_tuple(key),
+                          std::forward_as_tuple(SlabAllocator<Version>(_pool)))
+                 .first;
+    }
+    return it->second;
+}
+
+void KVBucket::trim() {
+    if (_pool != nullptr) {
+        _pool->Trim();
+    }
+}
+
+TimeStamp KVBucket::MinIntentStartTs() {
+    std::lock_guard<bthread::Mutex> lck(_latch);
+    return _intent_ts.empty() ? MAX_TIMESTAMP : *_intent_ts.begin();
+}
+
+bool KVBucket::Contains(const std::string& key) {
+    std::lock_guard<bthread::Mutex> lck(_latch);
+    return _kvs.find(key) != _kvs.end();
 }
 
 int KVBucket::GetPersisting(std::vector<txindex::DataToPersist>& datas,
-                            uint64_t min_ats) {
+                            uint64_t min_ats, int max_cnt) {
     std::lock_guard<bthread::Mutex> lck(_latch);
+    if (max_cnt <= 0) {
+        max_cnt = FLAGS_max_data_to_persist_per_round;
+    }
     int cnt = 0;
     for (auto& it : _kvs) {
-        if (cnt > FLAGS_max_data_to_persist_per_round) {
+        if (cnt > max_cnt) {
             break;
         }
         auto& mv = it.second.mv;
@@ -217,8 +407,9 @@ int KVBucket::ClearPersisted(const std::vector<txindex::DataToPersist>& datas) {
             goto out;
         }
 
-        auto& mv = _kvs[it.key].mv;
-        auto n = mv.Truncate(it.t2vs.begin()->first);
+        auto& vm = kv(it.key);
+        auto n = vm.mv.Truncate(it.t2vs.begin()->commit_ts);
+        publish(it.key, vm);
         if (it.t2vs.size() != n) {
             LOG(ERROR)
                 << "UserKey: " << it.key
@@ -230,17 +421,88 @@ int KVBucket::ClearPersisted(const std::vector<txindex::DataToPersist>& datas) {
     }
 
 out:
+    trim();
     return cnt;
 }
 
+bool KVBucket::snapshot_read(const std::string& key, Value& v,
+                             const TxIdentifier& txid, TxOpStatus& sts) {
+    // the tracked reads are added to the readers under the latch
+    if (!FLAGS_enable_snapshot_read || FLAGS_enable_dep_reporter) {
+        return false;
+    }
+    std::shared_ptr<KeySlotList> slots = std::atomic_load(&_slots);
+    // the probe is not owned, the aliasing pointer allocates nothing
+    KeySlot probe_slot(key);
+    KeySlotPtr probe(KeySlotPtr(), &probe_slot);
+    KeySlotList::Iterator iter(slots.get());
+    iter.Seek(probe);
+    MVCCSnapshotPtr snapshot;
+    if (iter.Valid() && iter.key()->key == key) {
+        snapshot = std::atomic_load(&iter.key()->snapshot);
+    }
+    // every change of a key is published, a key never published or collected
+    // by gc since holds neither a lock nor a version
+    if (snapshot == nullptr) {
+        g_snapshot_read << 1;
+        sts.set_error_code(TxOpStatus_Code_NotExist);
+        return true;
+    }
+    // the own lock and the intents blocking the read are left to the latch
+    if (snapshot->lock != MVCCLock::None &&
+        (snapshot->lock_start_ts == txid.start_ts() ||
+         (snapshot->lock == MVCCLock::WriteIntent &&
+          snapshot->lock_start_ts < txid.start_ts()))) {
+        return false;
+    }
+    g_snapshot_read << 1;
+    auto version = snapshot->Seek(txid.start_ts());
+    if (version != snapshot->mvv->end()) {
+        sts.set_error_code(TxOpStatus_Code_Ok);
+        v.CopyFrom(*(version->value));
+    } else {
+        sts.set_error_code(TxOpStatus_Code_NotExist);
+    }
+    return true;
+}
+
+void KVBucket::publish(const std::string& key, ValueAndMetric& vm) {
+    if (vm.slot == nullptr) {
+        KeySlotPtr slot(new KeySlot(key));
+        KeySlotList::Iterator iter(_slots.get());
+        iter.Seek(slot);
+        if (iter.Valid() && iter.key()->key == key) {
+            // the key is collected by gc before
+            vm.slot = iter.key();
+            _stale_slot_cnt--;
+        } else {
+            _slots->Insert(slot);
+            vm.slot = slot;
+            _slot_cnt++;
+        }
+    }
+    std::atomic_store(&vm.slot->snapshot, vm.mv.Snapshot());
+}
+
 TxOpStatus KVBucket::Write(MVCCLock lock_type, const TxIdentifier& txid,
                            const std::string& key, const Value& v,
                            std::function<void()> callback, Deps& deps,
                            bool& is_lock_update, bool& is_pess_key) {
     std::lock_guard<bthread::Mutex> lck(_latch);
-    ValueAndMetric& vm = _kvs[key];
+    return write_key(lock_type, txid, key, v, callback, deps, is_lock_update,
+                     is_pess_key);
+}
+
+TxOpStatus KVBucket::write_key(MVCCLock lock_type, const TxIdentifier& txid,
+                               const std::string& key, const Value& v,
+                               std::function<void()> callback, Deps& deps,
+                               bool& is_lock_update, bool& is_pess_key) {
+    ValueAndMetric& vm = kv(key);
     TxOpStatus sts =
         write(vm, lock_type, txid, key, v, callback, deps, is_lock_update);
+    if (sts.error_code() == TxOpStatus_Code_Ok) {
+        publish(key, vm);
+    }
     if (!is_lock_update) {
         KeyMetric& km = vm.km;
         km.RecordWrite();
@@ -284,6 +546,11 @@ TxOpStatus KVBucket::write(ValueAndMetric& vm, MVCCLock lock_type,
             return sts;
         } else {
             LOG_WRITE_ERROR(repeated)
+            // a repeated intent replaces the value of the tx
+            if (lock_type == MVCCLock::WriteIntent &&
+                mv.LockType() == MVCCLock::WriteIntent) {
+                mv.Prewrite(v, txid);
+            }
             sts.set_error_code(TxOpStatus_Code_Ok);
             return sts;
         }
@@ -296,6 +563,9 @@ out:
 
     switch (lock_type) {
         case MVCCLock::WriteIntent:
+            if (mv.LockType() != MVCCLock::WriteIntent) {
+                _intent_ts.insert(txid.start_ts());
+            }
             mv.Prewrite(v, txid);
             break;
         case MVCCLock::WriteLock:
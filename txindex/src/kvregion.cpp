@@ -2,13 +2,19 @@
 #include <butil/time.h>
 #include <gflags/gflags.h>
 
+#include <algorithm>
 #include <functional>
+#include <map>
+#include <mutex>
 
 #include "depedence.h"
 #include "index.h"
 
 DEFINE_int32(latch_bucket_num, 128, "latch buckets number");
 
+// the key list is not rebuilt for fewer keys collected
+static const size_t min_gc_keys_to_compact = 1024;
+
 #define DO_RW_DEP_REPORT(deps)              \
     if (FLAGS_enable_dep_reporter) {        \
         _deprpt.AsyncReadWriteReport(deps); \
@@ -17,13 +23,33 @@ DEFINE_int32(latch_bucket_num, 128, "latch buckets number");
 namespace azino {
 namespace txindex {
 
+// Group the indexes "idx" of "keys" by their buckets.
+static std::map<size_t, std::vector<size_t>> group_by_bucket(
+    const std::vector<std::string>& keys, const std::vector<size_t>& idx) {
+    std::map<size_t, std::vector<size_t>> groups;
+    for (size_t i : idx) {
+        groups[butil::Hash(keys[i]) % FLAGS_latch_bucket_num].push_back(i);
+    }
+    return groups;
+}
+
 KVRegion::KVRegion(const Range& range, brpc::Channel* storage_channel,
                    brpc::Channel* txplaner_channel)
     : _range(range),
       _kvbs(FLAGS_latch_bucket_num),
+      _keys(new KeyList()),
+      _key_cnt(0),
+      _gc_key_cnt(0),
+      _compacting(false),
       _persistor(this, storage_channel, txplaner_channel),
       _deprpt(this, txplaner_channel),
       _metric(this, txplaner_channel) {
+    if (FLAGS_enable_slab_alloc) {
+        // a pool per bucket, whose allocations run under the bucket latch
+        for (auto& kvb : _kvbs) {
+            kvb.SetPool(std::make_shared<SlabPool>());
+        }
+    }
     if (FLAGS_enable_persistor) {
         _persistor.Start();
     }
@@ -50,6 +76,7 @@ TxOpStatus KVRegion::WriteLock(const std::string& key, const TxIdentifier& txid,
     auto bucket_num = butil::Hash(key) % FLAGS_latch_bucket_num;
     auto sts = _kvbs[bucket_num].WriteLock(key, txid, callback, deps,
                                            is_lock_update, is_pess_key);
+    index_key(key);
     DO_RW_DEP_REPORT(deps);
     if (!is_lock_update) {
         _metric.RecordWrite(key, sts, start_time);
@@ -70,6 +97,7 @@ TxOpStatus KVRegion::WriteIntent(const std::string& key, const Value& value,
     auto bucket_num = butil::Hash(key) % FLAGS_latch_bucket_num;
     auto sts = _kvbs[bucket_num].WriteIntent(key, value, txid, callback, deps,
                                              is_lock_update, is_pess_key);
+    index_key(key);
     DO_RW_DEP_REPORT(deps);
     if (!is_lock_update) {
         _metric.RecordWrite(key, sts, start_time);
@@ -87,7 +115,8 @@ TxOpStatus KVRegion::Clean(const std::string& key, const TxIdentifier& txid) {
 
 TxOpStatus KVRegion::Commit(const std::string& key, const TxIdentifier& txid) {
     auto bucket_num = butil::Hash(key) % FLAGS_latch_bucket_num;
-    return _kvbs[bucket_num].Commit(key, txid);
+    return _kvbs[bucket_num].Commit(
+        key, txid, FLAGS_enable_change_log ? &_changes : nullptr);
 }
 
 TxOpStatus KVRegion::Read(const std::string& key, Value& v,
@@ -102,5 +131,194 @@ TxOpStatus KVRegion::Read(const std::string& key, Value& v,
     return sts;
 }
 
+TxOpStatus KVRegion::BatchWriteIntent(const std::vector<std::string>& keys,
+                                      const std::vector<Value>& values,
+                                      const std::vector<size_t>& idx,
+                                      const TxIdentifier& txid,
+                                      std::function<void()> callback,
+                                      std::vector<TxOpStatus>& stss) {
+    int64_t start_time = butil::gettimeofday_us();
+    Deps deps;
+    std::vector<WriteResult> results(keys.size());
+    TxOpStatus sts;
+    sts.set_error_code(TxOpStatus_Code_Ok);
+    for (auto& it : group_by_bucket(keys, idx)) {
+        sts = _kvbs[it.first].BatchWriteIntent(keys, values, it.second, txid,
+                                               callback, deps, results);
+        if (sts.error_code() != TxOpStatus_Code_Ok) {
+            break;
+        }
+    }
+    for (size_t i : idx) {
+        const WriteResult& r = results[i];
+        if (!r.done) {
+            continue;
+        }
+        stss[i] = r.sts;
+        if (r.rewritten) {
+            continue;
+        }
+        index_key(keys[i]);
+        if (!r.is_lock_update) {
+            _metric.RecordWrite(keys[i], r.sts, start_time);
+        }
+        if (r.is_pess_key && FLAGS_enable_region_metric_report) {
+            _metric.RecordPessKey(keys[i]);
+        }
+    }
+    DO_RW_DEP_REPORT(deps);
+    return sts;
+}
+
+void KVRegion::BatchClean(const std::vector<std::string>& keys,
+                          const std::vector<size_t>& idx,
+                          const TxIdentifier& txid,
+                          std::vector<TxOpStatus>& stss) {
+    for (auto& it : group_by_bucket(keys, idx)) {
+        _kvbs[it.first].BatchClean(keys, it.second, txid, stss);
+    }
+}
+
+void KVRegion::BatchCommit(const std::vector<std::string>& keys,
+                           const std::vector<size_t>& idx,
+                           const TxIdentifier& txid,
+                           std::vector<TxOpStatus>& stss) {
+    ChangeLog* changes = FLAGS_enable_change_log ? &_changes : nullptr;
+    for (auto& it : group_by_bucket(keys, idx)) {
+        _kvbs[it.first].BatchCommit(keys, it.second, txid, stss, changes);
+    }
+}
+
+TxOpStatus KVRegion::BatchRead(const std::vector<std::string>& keys,
+                               const std::vector<size_t>& idx,
+                               const TxIdentifier& txid,
+                               std::function<void()> callback,
+                               std::vector<Value>& values,
+                               std::vector<TxOpStatus>& stss) {
+    int64_t start_time = butil::gettimeofday_us();
+    Deps deps;
+    std::vector<bool> done(keys.size());
+    TxOpStatus sts;
+    sts.set_error_code(TxOpStatus_Code_Ok);
+    for (auto& it : group_by_bucket(keys, idx)) {
+        sts = _kvbs[it.first].BatchRead(keys, it.second, txid, callback, deps,
+                                        values, stss, done);
+        if (sts.error_code() != TxOpStatus_Code_Ok) {
+            break;
+        }
+    }
+    DO_RW_DEP_REPORT(deps);
+    for (size_t i : idx) {
+        if (done[i]) {
+            _metric.RecordRead(stss[i], start_time);
+        }
+    }
+    return sts;
+}
+
+TxOpStatus KVRegion::Scan(const std::string& left_key,
+                          const std::string& right_key,
+                          const TxIdentifier& txid,
+                          std::function<void()> callback,
+                          std::vector<std::string>& keys,
+                          std::vector<Value>& values) {
+    int64_t start_time = butil::gettimeofday_us();
+    Deps deps;
+    TxOpStatus sts;
+    sts.set_error_code(TxOpStatus_Code_Ok);
+    BitWiseComparator cmp;
+    std::shared_ptr<KeyList> list = std::atomic_load(&_keys);
+    KeyList::Iterator iter(list.get());
+    for (iter.Seek(left_key); iter.Valid(); iter.Next()) {
+        const std::string& key = iter.key();
+        if (!right_key.empty() && !cmp(key, right_key)) {
+            break;
+        }
+        Value v;
+        auto bucket_num = butil::Hash(key) % FLAGS_latch_bucket_num;
+        auto key_sts =
+            _kvbs[bucket_num].Read(key, v, txid, callback, deps, true);
+        if (key_sts.error_code() == TxOpStatus_Code_Ok) {
+            keys.push_back(key);
+            values.push_back(v);
+        } else if (key_sts.error_code() != TxOpStatus_Code_NotExist) {
+            sts = key_sts;
+            break;
+        }
+    }
+    DO_RW_DEP_REPORT(deps);
+    _metric.RecordRead(sts, start_time);
+    return sts;
+}
+
+void KVRegion::SealChanges(TimeStamp min_ats) {
+    if (!FLAGS_enable_change_log) {
+        return;
+    }
+    // "min_ats" is got before the intents are seen. A commit is appended
+    // under the latch of its intent, so each one below "min_ats" is either
+    // seen as an intent here or already in the log.
+    TimeStamp ts = min_ats;
+    for (auto& kvb : _kvbs) {
+        ts = std::min(ts, kvb.MinIntentStartTs());
+    }
+    _changes.Seal(ts);
+}
+
+void KVRegion::CompactKeys(size_t gc_cnt) {
+    std::shared_ptr<KeyList> old;
+    {
+        std::lock_guard<bthread::Mutex> lck(_keys_mutex);
+        _gc_key_cnt += gc_cnt;
+        if (_compacting ||
+            _gc_key_cnt < std::max(_key_cnt / 2, min_gc_keys_to_compact)) {
+            return;
+        }
+        _compacting = true;
+        old = _keys;
+    }
+    // the writes and scans go on with the old list meanwhile
+    std::shared_ptr<KeyList> list(new KeyList());
+    size_t cnt = 0;
+    KeyList::Iterator iter(old.get());
+    for (iter.SeekToFirst(); iter.Valid(); iter.Next()) {
+        const std::string& key = iter.key();
+        auto bucket_num = butil::Hash(key) % FLAGS_latch_bucket_num;
+        if (_kvbs[bucket_num].Contains(key)) {
+            list->Insert(key);
+            cnt++;
+        }
+    }
+    std::lock_guard<bthread::Mutex> lck(_keys_mutex);
+    // the keys written meanwhile may be checked in their buckets before
+    for (auto& key : _compact_keys) {
+        if (list->Insert(key)) {
+            cnt++;
+        }
+    }
+    _compact_keys.clear();
+    LOG(INFO) << "Compact keys of region: " << Describe()
+              << " from: " << _key_cnt << " to: " << cnt;
+    std::atomic_store(&_keys, list);
+    _key_cnt = cnt;
+    _gc_key_cnt = 0;
+    _compacting = false;
+}
+
+void KVRegion::index_key(const std::string& key) {
+    // most writes are on the keys already in the list, which may be dropped
+    // by a rebuild having checked the bucket before the write though
+    if (!_compacting && std::atomic_load(&_keys)->Contains(key)) {
+        return;
+    }
+    std::lock_guard<bthread::Mutex> lck(_keys_mutex);
+    if (_keys->Insert(key)) {
+        _key_cnt++;
+    }
+    if (_compacting) {
+        _compact_keys.push_back(key);
+    }
+}
+
 }  // namespace txindex
 }  // namespace azino
\ No newline at end of file
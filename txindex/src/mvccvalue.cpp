@@ -1,5 +1,7 @@
 #include "mvccvalue.h"
 
+#include <algorithm>
+
 #include "bthread/bthread.h"
 
 extern "C" void* CallbackWrapper(void* arg) {
@@ -12,6 +14,13 @@ extern "C" void* CallbackWrapper(void* arg) {
 namespace azino {
 namespace txindex {
 
+static MultiVersionValue::const_iterator seek(const MultiVersionValue& mvv,
+                                              TimeStamp ts) {
+    return std::partition_point(
+        mvv.begin(), mvv.end(),
+        [ts](const Version& v) { return v.commit_ts > ts; });
+}
+
 void MVCCValue::Lock(const TxIdentifier& txid) {
     _lock = MVCCLock::WriteLock;
     _lock_holder.CopyFrom(txid);
@@ -19,7 +28,7 @@ void MVCCValue::Lock(const TxIdentifier& txid) {
 void MVCCValue::Prewrite(const Value& v, const TxIdentifier& txid) {
     _lock = MVCCLock::WriteIntent;
     _lock_holder.CopyFrom(txid);
-    _lock_value.reset(new Value(v));
+    _lock_value = std::allocate_shared<Value>(SlabAllocator<Value>(_alloc), v);
 }
 void MVCCValue::Clean() {
     _lock = MVCCLock::None;
@@ -29,30 +38,54 @@ void MVCCValue::Clean() {
 void MVCCValue::Commit(const TxIdentifier& txid) {
     _lock = MVCCLock::None;
     _lock_holder.Clear();
-    _mvv.insert(std::make_pair(txid, std::move(_lock_value)));
+    auto iter = Seek(txid.commit_ts());
+    if (iter != _mvv->end() && iter->commit_ts == txid.commit_ts()) {
+        _lock_value.reset();
+        return;
+    }
+    // mostly the newest version, which goes to the front
+    std::shared_ptr<MultiVersionValue> mvv =
+        std::allocate_shared<MultiVersionValue>(_alloc, _alloc);
+    mvv->reserve(_mvv->size() + 1);
+    mvv->insert(mvv->end(), _mvv->begin(), iter);
+    mvv->push_back(
+        Version{txid.commit_ts(), txid.start_ts(), std::move(_lock_value)});
+    mvv->insert(mvv->end(), iter, _mvv->end());
+    _mvv = mvv;
 }
 
 MultiVersionValue::const_iterator MVCCValue::LargestTSValue() const {
-    return _mvv.begin();
+    return _mvv->begin();
 }
 
 MultiVersionValue::const_iterator MVCCValue::Seek(TimeStamp ts) const {
-    TxIdentifier tmp_tx;
-    tmp_tx.set_commit_ts(ts);
-    return _mvv.lower_bound(tmp_tx);
+    return seek(*_mvv, ts);
 }
 
 MultiVersionValue::const_iterator MVCCValue::Seek2(TimeStamp ts) const {
-    TxIdentifier tmp_tx;
-    tmp_tx.set_commit_ts(ts);
-    return _mvv.upper_bound(tmp_tx);
+    return std::partition_point(
+        _mvv->begin(), _mvv->end(),
+        [ts](const Version& v) { return v.commit_ts >= ts; });
+}
+
+unsigned MVCCValue::Truncate(TimeStamp ts) {
+    auto iter = Seek(ts);
+    unsigned ans = _mvv->end() - iter;
+    if (ans > 0) {
+        _mvv = std::allocate_shared<MultiVersionValue>(_alloc, _mvv->begin(),
+                                                       iter, _alloc);
+    }
+    return ans;
+}
+
+MVCCSnapshotPtr MVCCValue::Snapshot() const {
+    return std::allocate_shared<MVCCSnapshot>(
+        SlabAllocator<MVCCSnapshot>(_alloc),
+        MVCCSnapshot{_lock, _lock_holder.start_ts(), _mvv});
 }
 
-unsigned MVCCValue::Truncate(const TxIdentifier& txid) {
-    auto iter = _mvv.lower_bound(txid);
-    auto ans = _mvv.size();
-    _mvv.erase(iter, _mvv.end());
-    return ans - _mvv.size();
+MultiVersionValue::const_iterator MVCCSnapshot::Seek(TimeStamp ts) const {
+    return seek(*mvv, ts);
 }
 
 void MVCCValue::WakeUpWaiters() {
@@ -67,8 +100,12 @@ void MVCCValue::WakeUpWaiters() {
     _waiters.clear();
 }
 
-MVCCValue::MVCCValue()
-    : _lock(MVCCLock::None), _lock_holder(), _lock_value(), _mvv() {}
+MVCCValue::MVCCValue(const SlabAllocator<Version>& alloc)
+    : _alloc(alloc),
+      _lock(MVCCLock::None),
+      _lock_holder(),
+      _lock_value(),
+      _mvv(std::allocate_shared<MultiVersionValue>(alloc, alloc)) {}
 
 }  // namespace txindex
 }  // namespace azino
\ No newline at end of file
@@ -2,6 +2,8 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
+
 #include "index.h"
 
 DEFINE_bool(enable_persistor, true,
@@ -11,6 +13,13 @@ DEFINE_int32(persist_period_ms, 100, "persist period time");
 static bvar::GFlag gflag_persist_period_ms("persist_period_ms");
 DEFINE_int32(getminats_period_s, 2, "get min_ats period time");
 static bvar::GFlag gflag_getminats_period_s("getminats_period_s");
+DEFINE_int32(min_data_to_persist_per_round, 10,
+             "min number of versions persisted per round under the full "
+             "backpressure of the storage");
+static bvar::GFlag gflag_min_data_to_persist_per_round(
+    "min_data_to_persist_per_round");
+
+DECLARE_int32(max_data_to_persist_per_round);
 
 namespace azino {
 namespace txindex {
@@ -22,14 +31,17 @@ RegionPersist::RegionPersist(KVRegion *region, brpc::Channel *storage_channel,
       _txplanner_stub(txplaner_channel),
       _last_persist_bucket_num(0),
       _last_get_min_ats_time(0),
-      _min_ats(0) {
+      _min_ats(0),
+      _backpressure_level(0),
+      _delay_ms(0) {
     fn = RegionPersist::execute;
 }
 
 void *RegionPersist::execute(void *args) {
     auto p = reinterpret_cast<RegionPersist *>(args);
     while (true) {
-        bthread_usleep(FLAGS_persist_period_ms * 1000);
+        // back off as long as the storage asks to
+        bthread_usleep((FLAGS_persist_period_ms + p->_delay_ms) * 1000);
         {
             std::lock_guard<bthread::Mutex> lck(p->_mutex);
             if (p->_stopped) {
@@ -50,9 +62,14 @@ void RegionPersist::persist() {
 
     size_t persist_bucket_num =
         (_last_persist_bucket_num + 1) % _region->KVBuckets().size();
-    _region->KVBuckets()[persist_bucket_num].gc_mv(&_region->_metric);
-    auto cnt =
-        _region->KVBuckets()[persist_bucket_num].GetPersisting(datas, _min_ats);
+    // shrink the batch with the backpressure of the storage
+    int max_cnt = std::max<int>(FLAGS_max_data_to_persist_per_round *
+                                    (100 - _backpressure_level) / 100,
+                                FLAGS_min_data_to_persist_per_round);
+    _region->CompactKeys(
+        _region->KVBuckets()[persist_bucket_num].gc_mv(&_region->_metric));
+    auto cnt = _region->KVBuckets()[persist_bucket_num].GetPersisting(
+        datas, _min_ats, max_cnt);
     if (cnt == 0) {
         goto out;
     }
@@ -66,14 +83,24 @@ void RegionPersist::persist() {
         for (auto &tv : kv.t2vs) {
             azino::storage::StoreData *d = req.add_datas();
             d->set_key(kv.key);
-            d->set_ts(tv.first.commit_ts());
+            d->set_ts(tv.commit_ts);
             // req take over the "value *" and will free the memory later
-            d->set_allocated_value(new Value(*tv.second));
+            d->set_allocated_value(new Value(*tv.value));
         }
     }
 
     _storage_stub.BatchStore(&cntl, &req, &resp, NULL);
 
+    if (!cntl.Failed()) {
+        _backpressure_level =
+            std::min<uint32_t>(resp.backpressure().level(), 100);
+        _delay_ms = resp.backpressure().delay_ms();
+        if (_backpressure_level > 0) {
+            LOG(INFO) << "storage backpressure, region:" << _region->Describe()
+                      << " level:" << _backpressure_level
+                      << " delay_ms:" << _delay_ms;
+        }
+    }
     if (cntl.Failed()) {
         LOG(WARNING) << "Controller failed error code: " << cntl.ErrorCode()
                      << " error text: " << cntl.ErrorText();
@@ -108,6 +135,7 @@ void RegionPersist::get_min_ats() {
 
     _min_ats = resp.min_ats();
     _last_get_min_ats_time = butil::gettimeofday_s();
+    _region->SealChanges(_min_ats);
 
     //    LOG(INFO) << "get min ats region:"
     //              << " min_ats:" << _min_ats;
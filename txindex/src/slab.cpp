@@ -0,0 +1,181 @@
+#include "slab.h"
+
+#include <bvar/bvar.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+
+DEFINE_bool(enable_slab_alloc, false,
+            "allocate the keys, values and versions of txindex from the slabs "
+            "of their latch buckets");
+static bvar::GFlag gflag_enable_slab_alloc("enable_slab_alloc");
+
+namespace azino {
+namespace txindex {
+namespace {
+
+bvar::Adder<int64_t> g_slab_reserved_bytes("txindex_slab_reserved_bytes");
+bvar::Adder<int64_t> g_slab_used_bytes("txindex_slab_used_bytes");
+bvar::Adder<int64_t> g_slab_large_bytes("txindex_slab_large_bytes");
+bvar::Adder<int64_t> g_slab_released("txindex_slab_released");
+
+const size_t slab_header_bytes = 64;
+const size_t min_block_bytes = 16;
+
+size_t block_bytes(int cls) { return min_block_bytes << cls; }
+
+uint32_t capacity(int cls) {
+    return (SlabPool::slab_bytes - slab_header_bytes) / block_bytes(cls);
+}
+
+}  // namespace
+
+const size_t SlabPool::slab_bytes;
+const int SlabPool::num_size_classes;
+
+struct SlabPool::Slab {
+    // in the partial list of its class
+    Slab* prev;
+    Slab* next;
+    // a free block points to the next one
+    void* free;
+    uint32_t used;
+    // blocks ever handed out, the ones after them are not touched yet
+    uint32_t carved;
+    int cls;
+};
+
+// Return -1 if "bytes" is larger than the largest class.
+static int size_class(size_t bytes, int num_classes) {
+    int cls = 0;
+    while (cls < num_classes && block_bytes(cls) < bytes) {
+        cls++;
+    }
+    return cls < num_classes ? cls : -1;
+}
+
+SlabPool::~SlabPool() {
+    for (auto& c : _classes) {
+        while (c.partial != nullptr) {
+            Slab* s = c.partial;
+            unlink(c, s);
+            std::free(s);
+            g_slab_reserved_bytes << -int64_t(slab_bytes);
+        }
+    }
+}
+
+void* SlabPool::Allocate(size_t bytes) {
+    int cls = size_class(bytes, num_size_classes);
+    if (cls < 0) {
+        g_slab_large_bytes << bytes;
+        return ::operator new(bytes);
+    }
+    SizeClass& c = _classes[cls];
+    void* p;
+    {
+        std::lock_guard<bthread::Mutex> lck(c.mutex);
+        Slab* s = c.partial;
+        if (s == nullptr) {
+            s = new_slab();
+            s->cls = cls;
+            link(c, s);
+        }
+        if (s->free != nullptr) {
+            p = s->free;
+            s->free = *static_cast<void**>(p);
+        } else {
+            p = reinterpret_cast<char*>(s) + slab_header_bytes +
+                s->carved++ * block_bytes(cls);
+        }
+        if (++s->used == capacity(cls)) {
+            unlink(c, s);
+        }
+    }
+    _used_bytes += block_bytes(cls);
+    g_slab_used_bytes << block_bytes(cls);
+    return p;
+}
+
+void SlabPool::Deallocate(void* p, size_t bytes) {
+    int cls = size_class(bytes, num_size_classes);
+    if (cls < 0) {
+        g_slab_large_bytes << -int64_t(bytes);
+        ::operator delete(p);
+        return;
+    }
+    Slab* s = reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(p) &
+                                      ~uintptr_t(slab_bytes - 1));
+    SizeClass& c = _classes[cls];
+    {
+        std::lock_guard<bthread::Mutex> lck(c.mutex);
+        *static_cast<void**>(p) = s->free;
+        s->free = p;
+        if (s->used-- == capacity(cls)) {
+            link(c, s);
+        }
+    }
+    _used_bytes -= block_bytes(cls);
+    g_slab_used_bytes << -int64_t(block_bytes(cls));
+}
+
+size_t SlabPool::Trim() {
+    size_t released = 0;
+    for (auto& c : _classes) {
+        std::lock_guard<bthread::Mutex> lck(c.mutex);
+        Slab* s = c.partial;
+        while (s != nullptr) {
+            Slab* next = s->next;
+            if (s->used == 0) {
+                unlink(c, s);
+                std::free(s);
+                released++;
+            }
+            s = next;
+        }
+    }
+    _reserved_bytes -= released * slab_bytes;
+    g_slab_reserved_bytes << -int64_t(released * slab_bytes);
+    g_slab_released << released;
+    return released;
+}
+
+SlabPool::Slab* SlabPool::new_slab() {
+    static_assert(sizeof(Slab) <= slab_header_bytes, "slab header too large");
+    void* mem = nullptr;
+    if (posix_memalign(&mem, slab_bytes, slab_bytes) != 0) {
+        throw std::bad_alloc();
+    }
+    Slab* s = static_cast<Slab*>(mem);
+    s->prev = s->next = nullptr;
+    s->free = nullptr;
+    s->used = s->carved = 0;
+    _reserved_bytes += slab_bytes;
+    g_slab_reserved_bytes << slab_bytes;
+    return s;
+}
+
+void SlabPool::link(SizeClass& c, Slab* s) {
+    s->prev = nullptr;
+    s->next = c.partial;
+    if (c.partial != nullptr) {
+        c.partial->prev = s;
+    }
+    c.partial = s;
+}
+
+void SlabPool::unlink(SizeClass& c, Slab* s) {
+    if (s->prev != nullptr) {
+        s->prev->next = s->next;
+    } else {
+        c.partial = s->next;
+    }
+    if (s->next != nullptr) {
+        s->next->prev = s->prev;
+    }
+    s->prev = s->next = nullptr;
+}
+
+}  // namespace txindex
+}  // namespace azino
@@ -71,6 +71,94 @@ TxOpStatus TxIndex::Read(const std::string &key, Value &v,
     return region->Read(key, v, txid, callback);
 }
 
+TxOpStatus TxIndex::BatchWriteIntent(const std::vector<std::string> &keys,
+                                     const std::vector<Value> &values,
+                                     const TxIdentifier &txid,
+                                     std::function<void()> callback,
+                                     std::vector<TxOpStatus> &stss) {
+    stss.assign(keys.size(), TxOpStatus());
+    TxOpStatus sts;
+    sts.set_error_code(TxOpStatus_Code_Ok);
+    for (auto &it : group(keys, stss)) {
+        sts = it.first->BatchWriteIntent(keys, values, it.second, txid,
+                                         callback, stss);
+        if (sts.error_code() != TxOpStatus_Code_Ok) {
+            break;
+        }
+    }
+    return sts;
+}
+
+void TxIndex::BatchClean(const std::vector<std::string> &keys,
+                         const TxIdentifier &txid,
+                         std::vector<TxOpStatus> &stss) {
+    stss.assign(keys.size(), TxOpStatus());
+    for (auto &it : group(keys, stss)) {
+        it.first->BatchClean(keys, it.second, txid, stss);
+    }
+}
+
+void TxIndex::BatchCommit(const std::vector<std::string> &keys,
+                          const TxIdentifier &txid,
+                          std::vector<TxOpStatus> &stss) {
+    stss.assign(keys.size(), TxOpStatus());
+    for (auto &it : group(keys, stss)) {
+        it.first->BatchCommit(keys, it.second, txid, stss);
+    }
+}
+
+TxOpStatus TxIndex::BatchRead(const std::vector<std::string> &keys,
+                              const TxIdentifier &txid,
+                              std::function<void()> callback,
+                              std::vector<Value> &values,
+                              std::vector<TxOpStatus> &stss) {
+    stss.assign(keys.size(), TxOpStatus());
+    values.assign(keys.size(), Value());
+    TxOpStatus sts;
+    sts.set_error_code(TxOpStatus_Code_Ok);
+    for (auto &it : group(keys, stss)) {
+        sts = it.first->BatchRead(keys, it.second, txid, callback, values,
+                                  stss);
+        if (sts.error_code() != TxOpStatus_Code_Ok) {
+            break;
+        }
+    }
+    return sts;
+}
+
+TxOpStatus TxIndex::Scan(const std::string &left_key,
+                         const std::string &right_key,
+                         const TxIdentifier &txid,
+                         std::function<void()> callback,
+                         std::vector<std::string> &keys,
+                         std::vector<Value> &values) {
+    TxOpStatus sts;
+    sts.set_error_code(TxOpStatus_Code_Ok);
+    // only the regions overlapping [left_key, right_key), in key order
+    auto regions = _region_table.equal_range(Range(left_key, right_key, 1, 0));
+    for (auto it = regions.first; it != regions.second; it++) {
+        sts = it->second->Scan(left_key, right_key, txid, callback, keys,
+                               values);
+        if (sts.error_code() != TxOpStatus_Code_Ok) {
+            break;
+        }
+    }
+    return sts;
+}
+
+TxOpStatus TxIndex::ReadChanges(const std::string &key, TimeStamp from_ts,
+                                size_t max_bytes, std::vector<Change> &changes,
+                                TimeStamp &resolved_ts) {
+    auto region = route(key);
+    if (region == nullptr) {
+        LOG(WARNING) << "Fail to route key:" << key;
+        TxOpStatus sts;
+        sts.set_error_code(TxOpStatus_Code_PartitionErr);
+        return sts;
+    }
+    return region->Changes().Read(from_ts, max_bytes, changes, resolved_ts);
+}
+
 KVRegionPtr TxIndex::route(const std::string &key) {
     auto key_range = Range(key, key, 1, 1);
     auto iter = _region_table.lower_bound(key_range);
@@ -83,6 +171,21 @@ KVRegionPtr TxIndex::route(const std::string &key) {
     return res;
 }
 
+std::map<KVRegionPtr, std::vector<size_t>> TxIndex::group(
+    const std::vector<std::string> &keys, std::vector<TxOpStatus> &stss) {
+    std::map<KVRegionPtr, std::vector<size_t>> groups;
+    for (size_t i = 0; i < keys.size(); i++) {
+        auto region = route(keys[i]);
+        if (region == nullptr) {
+            LOG(WARNING) << "Fail to route key:" << keys[i];
+            stss[i].set_error_code(TxOpStatus_Code_PartitionErr);
+            continue;
+        }
+        groups[region].push_back(i);
+    }
+    return groups;
+}
+
 void TxIndex::init_region_table(const Partition &p) {
     const auto &pcm = p.GetPartitionConfigMap();
     for (auto iter = pcm.begin(); iter != pcm.end(); iter++) {
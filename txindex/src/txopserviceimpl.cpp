@@ -1,12 +1,53 @@
 #include <brpc/server.h>
+#include <brpc/stream.h>
+#include <bthread/bthread.h>
+#include <butil/time.h>
+#include <bvar/bvar.h>
+#include <gflags/gflags.h>
 
+#include "azino/stream.h"
 #include "index.h"
 #include "service.h"
 
+DEFINE_int32(change_stream_batch_bytes, 1 << 20,
+             "bytes of keys and values per batch of a change stream");
+static bvar::GFlag gflag_change_stream_batch_bytes(
+    "change_stream_batch_bytes");
+DEFINE_int32(change_stream_buf_bytes, 8 << 20,
+             "max bytes buffered by a change stream before it waits for the "
+             "consumer");
+static bvar::GFlag gflag_change_stream_buf_bytes("change_stream_buf_bytes");
+DEFINE_int32(change_stream_poll_ms, 100,
+             "period of checking for new changes once a stream catches up");
+static bvar::GFlag gflag_change_stream_poll_ms("change_stream_poll_ms");
+DEFINE_int32(change_stream_heartbeat_ms, 1000,
+             "max interval between two batches of a change stream, an empty "
+             "one is sent if there is no change");
+static bvar::GFlag gflag_change_stream_heartbeat_ms(
+    "change_stream_heartbeat_ms");
+
 namespace azino {
 namespace txindex {
+
 TxOpServiceImpl::TxOpServiceImpl(TxIndex* index) : _index(index) {}
-TxOpServiceImpl::~TxOpServiceImpl() = default;
+TxOpServiceImpl::~TxOpServiceImpl() { Stop(); }
+
+void TxOpServiceImpl::Stop() {
+    std::unique_lock<bthread::Mutex> lck(_stream_mutex);
+    _stopped = true;
+    // a loop waiting for a slow consumer wakes up once its stream is closed
+    for (brpc::StreamId stream : _streams) {
+        brpc::StreamClose(stream);
+    }
+    while (!_streams.empty()) {
+        _stream_cond.wait(lck);
+    }
+}
+
+bool TxOpServiceImpl::stopped() {
+    std::lock_guard<bthread::Mutex> lck(_stream_mutex);
+    return _stopped;
+}
 
 void TxOpServiceImpl::WriteIntent(
     ::google::protobuf::RpcController* controller,
@@ -130,5 +171,258 @@ void TxOpServiceImpl::Read(::google::protobuf::RpcController* controller,
     response->set_allocated_tx_op_status(sts);
     response->set_allocated_value(v);
 }
+
+void TxOpServiceImpl::BatchWriteIntent(
+    ::google::protobuf::RpcController* controller,
+    const ::azino::txindex::BatchWriteIntentRequest* request,
+    ::azino::txindex::BatchWriteIntentResponse* response,
+    ::google::protobuf::Closure* done) {
+    brpc::ClosureGuard done_guard(done);
+    brpc::Controller* cntl = static_cast<brpc::Controller*>(controller);
+
+    if (request->keys_size() != request->values_size()) {
+        cntl->SetFailed("Keys and values of batch write intent mismatch");
+        return;
+    }
+    std::vector<std::string> keys(request->keys().begin(),
+                                  request->keys().end());
+    std::vector<Value> values(request->values().begin(),
+                              request->values().end());
+    std::vector<TxOpStatus> stss;
+    TxOpStatus sts = _index->BatchWriteIntent(
+        keys, values, request->txid(),
+        std::bind(&TxOpServiceImpl::BatchWriteIntent, this, controller,
+                  request, response, done),
+        stss);
+
+    LOG(INFO) << cntl->remote_side()
+              << " tx: " << request->txid().ShortDebugString()
+              << " batch write intent"
+              << " keys: " << keys.size()
+              << " error code: " << sts.error_code()
+              << " error message: " << sts.error_message();
+
+    if (sts.error_code() == TxOpStatus_Code_WriteBlock) {
+        done_guard.release();
+        return;
+    }
+    for (auto& key_sts : stss) {
+        response->add_results()->mutable_tx_op_status()->Swap(&key_sts);
+    }
+}
+
+void TxOpServiceImpl::BatchClean(
+    ::google::protobuf::RpcController* controller,
+    const ::azino::txindex::BatchCleanRequest* request,
+    ::azino::txindex::BatchCleanResponse* response,
+    ::google::protobuf::Closure* done) {
+    brpc::ClosureGuard done_guard(done);
+    brpc::Controller* cntl = static_cast<brpc::Controller*>(controller);
+
+    std::vector<std::string> keys(request->keys().begin(),
+                                  request->keys().end());
+    std::vector<TxOpStatus> stss;
+    _index->BatchClean(keys, request->txid(), stss);
+
+    LOG(INFO) << cntl->remote_side()
+              << " tx: " << request->txid().ShortDebugString()
+              << " batch clean"
+              << " keys: " << keys.size();
+
+    for (auto& key_sts : stss) {
+        response->add_results()->mutable_tx_op_status()->Swap(&key_sts);
+    }
+}
+
+void TxOpServiceImpl::BatchCommit(
+    ::google::protobuf::RpcController* controller,
+    const ::azino::txindex::BatchCommitRequest* request,
+    ::azino::txindex::BatchCommitResponse* response,
+    ::google::protobuf::Closure* done) {
+    brpc::ClosureGuard done_guard(done);
+    brpc::Controller* cntl = static_cast<brpc::Controller*>(controller);
+
+    std::vector<std::string> keys(request->keys().begin(),
+                                  request->keys().end());
+    std::vector<TxOpStatus> stss;
+    _index->BatchCommit(keys, request->txid(), stss);
+
+    LOG(INFO) << cntl->remote_side()
+              << " tx: " << request->txid().ShortDebugString()
+              << " batch commit"
+              << " keys: " << keys.size();
+
+    for (auto& key_sts : stss) {
+        response->add_results()->mutable_tx_op_status()->Swap(&key_sts);
+    }
+}
+
+void TxOpServiceImpl::BatchRead(
+    ::google::protobuf::RpcController* controller,
+    const ::azino::txindex::BatchReadRequest* request,
+    ::azino::txindex::BatchReadResponse* response,
+    ::google::protobuf::Closure* done) {
+    brpc::ClosureGuard done_guard(done);
+    brpc::Controller* cntl = static_cast<brpc::Controller*>(controller);
+
+    std::vector<std::string> keys(request->keys().begin(),
+                                  request->keys().end());
+    std::vector<Value> values;
+    std::vector<TxOpStatus> stss;
+    TxOpStatus sts = _index->BatchRead(
+        keys, request->txid(),
+        std::bind(&TxOpServiceImpl::BatchRead, this, controller, request,
+                  response, done),
+        values, stss);
+
+    LOG(INFO) << cntl->remote_side()
+              << " tx: " << request->txid().ShortDebugString()
+              << " batch read"
+              << " keys: " << keys.size()
+              << " error code: " << sts.error_code()
+              << " error message: " << sts.error_message();
+
+    if (sts.error_code() == TxOpStatus_Code_ReadBlock) {
+        done_guard.release();
+        return;
+    }
+    for (size_t i = 0; i < stss.size(); i++) {
+        auto* result = response->add_results();
+        result->mutable_tx_op_status()->Swap(&stss[i]);
+        result->mutable_value()->Swap(&values[i]);
+    }
+}
+
+void TxOpServiceImpl::ScanIntent(
+    ::google::protobuf::RpcController* controller,
+    const ::azino::txindex::ScanIntentRequest* request,
+    ::azino::txindex::ScanIntentResponse* response,
+    ::google::protobuf::Closure* done) {
+    brpc::ClosureGuard done_guard(done);
+    brpc::Controller* cntl = static_cast<brpc::Controller*>(controller);
+
+    std::vector<std::string> keys;
+    std::vector<Value> values;
+    TxOpStatus* sts = new TxOpStatus(_index->Scan(
+        request->left_key(), request->right_key(), request->txid(),
+        std::bind(&TxOpServiceImpl::ScanIntent, this, controller, request,
+                  response, done),
+        keys, values));
+
+    LOG(INFO) << cntl->remote_side()
+              << " tx: " << request->txid().ShortDebugString() << " scan"
+              << " left key: " << request->left_key()
+              << " right key: " << request->right_key()
+              << " keys: " << keys.size()
+              << " error code: " << sts->error_code()
+              << " error message: " << sts->error_message();
+
+    if (sts->error_code() == TxOpStatus_Code_ReadBlock) {
+        done_guard.release();
+        delete sts;
+        return;
+    }
+    response->set_allocated_tx_op_status(sts);
+    for (size_t i = 0; i < keys.size(); i++) {
+        response->add_keys(keys[i]);
+        response->add_values()->Swap(&values[i]);
+    }
+}
+
+void TxOpServiceImpl::SubscribeChanges(
+    ::google::protobuf::RpcController* controller,
+    const ::azino::txindex::SubscribeChangesRequest* request,
+    ::azino::txindex::SubscribeChangesResponse* response,
+    ::google::protobuf::Closure* done) {
+    brpc::ClosureGuard done_guard(done);
+    brpc::Controller* cntl = static_cast<brpc::Controller*>(controller);
+
+    TxOpStatus* sts = new TxOpStatus();
+    response->set_allocated_tx_op_status(sts);
+    if (!FLAGS_enable_change_log) {
+        sts->set_error_code(TxOpStatus_Code_NotExist);
+        sts->set_error_message("change log is disabled");
+        return;
+    }
+    brpc::StreamId stream;
+    brpc::StreamOptions stream_options;
+    // bounds what a slow consumer holds up in memory
+    stream_options.max_buf_size = FLAGS_change_stream_buf_bytes;
+    if (brpc::StreamAccept(&stream, *cntl, &stream_options) != 0) {
+        cntl->SetFailed("Fail to accept stream");
+        LOG(ERROR) << cntl->remote_side() << " subscribe changes"
+                   << " fail to accept stream";
+        return;
+    }
+    {
+        std::lock_guard<bthread::Mutex> lck(_stream_mutex);
+        if (_stopped) {
+            brpc::StreamClose(stream);
+            sts->set_error_code(TxOpStatus_Code_NotExist);
+            sts->set_error_message("txindex is stopping");
+            return;
+        }
+        _streams.insert(stream);
+    }
+    sts->set_error_code(TxOpStatus_Code_Ok);
+    // The stream is usable only after the response is sent.
+    const butil::EndPoint remote_side = cntl->remote_side();
+    const SubscribeChangesRequest req(*request);
+    done_guard.reset(nullptr);
+
+    TimeStamp from_ts = req.from_ts();
+    uint64_t total = 0;
+    int64_t last_sent_us = 0;
+    TxOpStatus status;
+    while (!stopped()) {
+        std::vector<Change> changes;
+        TimeStamp resolved_ts;
+        status = _index->ReadChanges(req.key(), from_ts,
+                                     FLAGS_change_stream_batch_bytes, changes,
+                                     resolved_ts);
+        int64_t now_us = butil::gettimeofday_us();
+        if (status.error_code() == TxOpStatus_Code_Ok && changes.empty() &&
+            now_us - last_sent_us <
+                FLAGS_change_stream_heartbeat_ms * 1000L) {
+            bthread_usleep(FLAGS_change_stream_poll_ms * 1000L);
+            continue;
+        }
+
+        ChangeBatch batch;
+        batch.mutable_tx_op_status()->CopyFrom(status);
+        for (auto& change : changes) {
+            auto c = batch.add_changes();
+            c->set_key(change.key);
+            c->set_commit_ts(change.ts);
+            c->mutable_value()->CopyFrom(*change.value);
+        }
+        batch.set_resolved_ts(resolved_ts);
+        if (WriteStreamMessage(stream, batch) != 0) {
+            // mostly closed by the consumer
+            break;
+        }
+        last_sent_us = now_us;
+        total += changes.size();
+        from_ts = resolved_ts;
+        if (status.error_code() != TxOpStatus_Code_Ok) {
+            break;
+        }
+    }
+    {
+        std::lock_guard<bthread::Mutex> lck(_stream_mutex);
+        _streams.erase(stream);
+        // or closed by Stop() already
+        if (!_stopped) {
+            brpc::StreamClose(stream);
+        }
+        _stream_cond.notify_all();
+    }
+
+    LOG(INFO) << remote_side << " subscribe changes"
+              << " request: " << req.ShortDebugString()
+              << " changes: " << total << " resolved ts: " << from_ts
+              << " error code: " << status.error_code()
+              << " error message: " << status.error_message();
+}
 }  // namespace txindex
 }  // namespace azino
\ No newline at end of file
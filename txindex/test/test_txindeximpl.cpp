@@ -3,6 +3,8 @@
 #include <butil/hash.h>
 #include <gtest/gtest.h>
 
+#include <set>
+
 #include "depedence.h"
 #include "index.h"
 #include "persist.h"
@@ -543,6 +545,469 @@ TEST_F(TxIndexImplTest, persist) {
               azino::TxOpStatus_Code_NotExist);
 }
 
+TEST_F(TxIndexImplTest, mvcc_value) {
+    azino::txindex::MVCCValue mv;
+    // committed out of order
+    for (azino::TimeStamp ts : {5, 3, 9, 7}) {
+        azino::TxIdentifier t;
+        t.set_start_ts(ts - 1);
+        t.set_commit_ts(ts);
+        v1.set_content(std::to_string(ts));
+        mv.Prewrite(v1, t);
+        mv.Commit(t);
+    }
+    ASSERT_EQ(4, mv.Size());
+    ASSERT_EQ(9, mv.LargestTSValue()->commit_ts);
+    ASSERT_EQ(7, mv.Seek(8)->commit_ts);
+    ASSERT_EQ(7, mv.Seek(7)->commit_ts);
+    ASSERT_EQ("7", mv.Seek(7)->value->content());
+    ASSERT_EQ(6, mv.Seek(7)->Tx().start_ts());
+    ASSERT_EQ(5, mv.Seek2(7)->commit_ts);
+    ASSERT_TRUE(mv.Seek(2) == mv.MVV().end());
+    ASSERT_EQ(2, mv.Truncate(5));
+    ASSERT_EQ(2, mv.Size());
+    ASSERT_EQ(7, mv.MVV().back().commit_ts);
+}
+
+// the reads served without the latch so far
+static int64_t SnapshotReads() {
+    return std::stoll(
+        bvar::Variable::describe_exposed("txindex_snapshot_read"));
+}
+
+TEST_F(TxIndexImplTest, snapshot_read) {
+    FLAGS_enable_dep_reporter = false;
+    std::vector<azino::txindex::Dep> deps;
+    azino::Value read_value;
+    int64_t reads = SnapshotReads();
+    // never written, no key is added
+    ASSERT_EQ(azino::TxOpStatus_Code_NotExist,
+              ti->Read(k2, read_value, t2, nullptr, deps).error_code());
+    ASSERT_EQ(++reads, SnapshotReads());
+    ASSERT_FALSE(ti->Contains(k2));
+
+    ASSERT_EQ(
+        azino::TxOpStatus_Code_Ok,
+        ti->WriteIntent(k1, v1, t1, nullptr, deps, is_lock_update, is_pess_key)
+            .error_code());
+    // blocked by the intent, under the latch
+    ASSERT_EQ(
+        azino::TxOpStatus_Code_ReadBlock,
+        ti->Read(k1, read_value, t2,
+                 std::bind(&TxIndexImplTest::dummyCallback, this), deps)
+            .error_code());
+    ASSERT_EQ(reads, SnapshotReads());
+    t1.set_commit_ts(3);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k1, t1).error_code());
+    waitDummyCallback();
+
+    azino::TxIdentifier t3;
+    t3.set_start_ts(4);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok,
+              ti->Read(k1, read_value, t3, nullptr, deps).error_code());
+    ASSERT_EQ(v1.content(), read_value.content());
+    ASSERT_EQ(azino::TxOpStatus_Code_NotExist,
+              ti->Read(k1, read_value, t2, nullptr, deps).error_code());
+    reads += 2;
+    ASSERT_EQ(reads, SnapshotReads());
+
+    // persisted and collected by gc
+    std::vector<azino::txindex::DataToPersist> datas;
+    ASSERT_EQ(1, ti->GetPersisting(datas, 5));
+    ASSERT_EQ(1, ti->ClearPersisted(datas));
+    ASSERT_EQ(azino::TxOpStatus_Code_NotExist,
+              ti->Read(k1, read_value, t3, nullptr, deps).error_code());
+    ASSERT_EQ(1, ti->gc_mv(nullptr));
+    ASSERT_EQ(azino::TxOpStatus_Code_NotExist,
+              ti->Read(k1, read_value, t3, nullptr, deps).error_code());
+    reads += 2;
+    ASSERT_EQ(reads, SnapshotReads());
+    ASSERT_FALSE(ti->Contains(k1));
+    ASSERT_TRUE(deps.empty());
+}
+
+TEST_F(TxIndexImplTest, batch) {
+    std::vector<azino::txindex::Dep> deps;
+    std::vector<std::string> keys = {k1, k2};
+    std::vector<azino::Value> values = {v1, v2};
+    std::vector<size_t> idx = {0, 1};
+    std::vector<azino::txindex::WriteResult> results(keys.size());
+    std::vector<azino::TxOpStatus> stss(keys.size());
+
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok,
+              ti->BatchWriteIntent(keys, values, idx, t1, nullptr, deps,
+                                   results)
+                  .error_code());
+    ASSERT_TRUE(results[0].done);
+    ASSERT_TRUE(results[1].done);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, results[1].sts.error_code());
+    ASSERT_FALSE(results[1].rewritten);
+
+    // a rerun records nothing again for the keys written
+    std::vector<azino::txindex::WriteResult> rerun(keys.size());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok,
+              ti->BatchWriteIntent(keys, values, idx, t1, nullptr, deps, rerun)
+                  .error_code());
+    ASSERT_TRUE(rerun[0].rewritten);
+    ASSERT_TRUE(rerun[1].rewritten);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, rerun[1].sts.error_code());
+
+    // stops at the first key blocked
+    std::vector<azino::txindex::WriteResult> blocked(keys.size());
+    ASSERT_EQ(azino::TxOpStatus_Code_WriteBlock,
+              ti->BatchWriteIntent(
+                    keys, values, idx, t2,
+                    std::bind(&TxIndexImplTest::dummyCallback, this), deps,
+                    blocked)
+                  .error_code());
+    ASSERT_TRUE(blocked[0].done);
+    ASSERT_FALSE(blocked[1].done);
+
+    t1.set_commit_ts(3);
+    ti->BatchCommit(keys, idx, t1, stss);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, stss[0].error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, stss[1].error_code());
+    waitDummyCallback();
+
+    azino::TxIdentifier t3;
+    t3.set_start_ts(4);
+    std::vector<azino::Value> read_values(keys.size());
+    std::vector<bool> done(keys.size());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok,
+              ti->BatchRead(keys, idx, t3, nullptr, deps, read_values, stss,
+                            done)
+                  .error_code());
+    ASSERT_TRUE(done[0]);
+    ASSERT_TRUE(done[1]);
+    ASSERT_EQ(v1.content(), read_values[0].content());
+    ASSERT_EQ(v2.content(), read_values[1].content());
+
+    ti->BatchClean(keys, idx, t1, stss);
+    ASSERT_EQ(azino::TxOpStatus_Code_NotExist, stss[0].error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_NotExist, stss[1].error_code());
+}
+
+TEST_F(TxIndexImplTest, batch_rewrite) {
+    FLAGS_enable_dep_reporter = false;
+    std::vector<azino::txindex::Dep> deps;
+    std::vector<std::string> keys = {k1, k2};
+    std::vector<azino::Value> values = {v1, v1};
+    std::vector<size_t> idx = {0, 1};
+    std::vector<azino::txindex::WriteResult> results(keys.size());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok,
+              ti->BatchWriteIntent(keys, values, idx, t1, nullptr, deps,
+                                   results)
+                  .error_code());
+
+    // a rewritten intent takes the new value, like a repeated WriteIntent
+    values = {v2, v2};
+    std::vector<azino::txindex::WriteResult> rerun(keys.size());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok,
+              ti->BatchWriteIntent(keys, values, idx, t1, nullptr, deps, rerun)
+                  .error_code());
+    ASSERT_TRUE(rerun[0].rewritten);
+    ASSERT_TRUE(rerun[1].rewritten);
+    ASSERT_EQ(
+        azino::TxOpStatus_Code_Ok,
+        ti->WriteIntent(k2, v1, t1, nullptr, deps, is_lock_update, is_pess_key)
+            .error_code());
+    ASSERT_EQ(1, ti->MinIntentStartTs());
+
+    t1.set_commit_ts(3);
+    std::vector<azino::TxOpStatus> stss(keys.size());
+    ti->BatchCommit(keys, idx, t1, stss);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, stss[0].error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, stss[1].error_code());
+    ASSERT_EQ(MAX_TIMESTAMP, ti->MinIntentStartTs());
+
+    azino::TxIdentifier t3;
+    t3.set_start_ts(4);
+    azino::Value v;
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok,
+              ti->Read(k1, v, t3, nullptr, deps).error_code());
+    ASSERT_EQ(v2.content(), v.content());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok,
+              ti->Read(k2, v, t3, nullptr, deps).error_code());
+    ASSERT_EQ(v1.content(), v.content());
+}
+
+DECLARE_int64(change_log_max_bytes);
+
+TEST_F(TxIndexImplTest, change_log) {
+    std::vector<azino::txindex::Dep> deps;
+    azino::txindex::ChangeLog log;
+    std::vector<azino::txindex::Change> changes;
+    azino::TimeStamp resolved_ts;
+    ASSERT_EQ(
+        azino::TxOpStatus_Code_Ok,
+        ti->WriteIntent(k1, v1, t1, nullptr, deps, is_lock_update, is_pess_key)
+            .error_code());
+    t1.set_commit_ts(3);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k1, t1, &log).error_code());
+    log.Append(k2, 7, std::make_shared<azino::Value>(v2));
+    log.Append(k2, 5, std::make_shared<azino::Value>(v1));
+    // the log starts at its first change, nothing is released before the
+    // seal
+    ASSERT_EQ(azino::TxOpStatus_Code_NotExist,
+              log.Read(1, 1024, changes, resolved_ts).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok,
+              log.Read(2, 1024, changes, resolved_ts).error_code());
+    ASSERT_EQ(0, changes.size());
+    ASSERT_EQ(2, resolved_ts);
+
+    log.Seal(7);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok,
+              log.Read(2, 1024, changes, resolved_ts).error_code());
+    ASSERT_EQ(2, changes.size());
+    ASSERT_EQ(3, changes[0].ts);
+    ASSERT_EQ(k1, changes[0].key);
+    ASSERT_EQ(v1.content(), changes[0].value->content());
+    ASSERT_EQ(5, changes[1].ts);
+    ASSERT_EQ(6, resolved_ts);
+    // resume from a ts, one change per read
+    changes.clear();
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok,
+              log.Read(2, 1, changes, resolved_ts).error_code());
+    ASSERT_EQ(1, changes.size());
+    ASSERT_EQ(3, resolved_ts);
+    changes.clear();
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok,
+              log.Read(3, 1, changes, resolved_ts).error_code());
+    ASSERT_EQ(1, changes.size());
+    ASSERT_EQ(6, resolved_ts);
+
+    // the oldest changes are dropped beyond the bound
+    FLAGS_change_log_max_bytes = 30;
+    log.Append(k1, 8, std::make_shared<azino::Value>(v2));
+    changes.clear();
+    ASSERT_EQ(azino::TxOpStatus_Code_NotExist,
+              log.Read(2, 1024, changes, resolved_ts).error_code());
+    log.Seal(9);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok,
+              log.Read(7, 1024, changes, resolved_ts).error_code());
+    ASSERT_EQ(1, changes.size());
+    ASSERT_EQ(8, changes[0].ts);
+    ASSERT_EQ(8, resolved_ts);
+    FLAGS_change_log_max_bytes = 16 << 20;
+}
+
+DECLARE_bool(enable_persistor);
+DECLARE_bool(enable_region_metric_report);
+
+TEST_F(TxIndexImplTest, scan) {
+    FLAGS_enable_persistor = false;
+    FLAGS_enable_region_metric_report = false;
+    FLAGS_enable_dep_reporter = false;
+    azino::txindex::KVRegion region(azino::Range("", "", 0, 0), nullptr,
+                                    nullptr);
+    std::vector<std::string> keys;
+    std::vector<azino::Value> values;
+    std::string k0 = "key0";
+    std::string k3 = "key3";
+
+    // written out of key order, key3 is pending
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok,
+              region.WriteIntent(k2, v2, t1, nullptr).error_code());
+    t1.set_commit_ts(3);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, region.Commit(k2, t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok,
+              region.WriteIntent(k1, v1, t2, nullptr).error_code());
+    t2.set_commit_ts(5);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, region.Commit(k1, t2).error_code());
+    azino::TxIdentifier t3;
+    t3.set_start_ts(6);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok,
+              region.WriteIntent(k3, v1, t3, nullptr).error_code());
+
+    azino::TxIdentifier t4;
+    t4.set_start_ts(4);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok,
+              region.Scan(k0, "", t4, nullptr, keys, values).error_code());
+    ASSERT_EQ(1, keys.size());
+    ASSERT_EQ(k2, keys[0]);
+    ASSERT_EQ(v2.content(), values[0].content());
+
+    // the own intent is skipped, the range excludes right key
+    keys.clear();
+    values.clear();
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok,
+              region.Scan(k0, "", t3, nullptr, keys, values).error_code());
+    ASSERT_EQ(2, keys.size());
+    ASSERT_EQ(k1, keys[0]);
+    ASSERT_EQ(k2, keys[1]);
+    keys.clear();
+    values.clear();
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok,
+              region.Scan(k2, k3, t3, nullptr, keys, values).error_code());
+    ASSERT_EQ(1, keys.size());
+    ASSERT_EQ(k2, keys[0]);
+
+    // blocked by the intent of an earlier tx
+    azino::TxIdentifier t5;
+    t5.set_start_ts(8);
+    keys.clear();
+    values.clear();
+    ASSERT_EQ(azino::TxOpStatus_Code_ReadBlock,
+              region
+                  .Scan(k0, "", t5,
+                        std::bind(&TxIndexImplTest::dummyCallback, this), keys,
+                        values)
+                  .error_code());
+    t3.set_commit_ts(7);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, region.Commit(k3, t3).error_code());
+    waitDummyCallback();
+    keys.clear();
+    values.clear();
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok,
+              region.Scan(k0, "", t5, nullptr, keys, values).error_code());
+    ASSERT_EQ(3, keys.size());
+    ASSERT_EQ(k3, keys[2]);
+    ASSERT_EQ(v1.content(), values[2].content());
+
+    FLAGS_enable_persistor = true;
+    FLAGS_enable_region_metric_report = true;
+}
+
+TEST_F(TxIndexImplTest, change_log_seal) {
+    FLAGS_enable_persistor = false;
+    FLAGS_enable_region_metric_report = false;
+    FLAGS_enable_dep_reporter = false;
+    FLAGS_enable_change_log = true;
+    azino::txindex::KVRegion region(azino::Range("", "", 0, 0), nullptr,
+                                    nullptr);
+    std::vector<azino::txindex::Change> changes;
+    azino::TimeStamp resolved_ts;
+
+    // t1 has got its commit ts, min ats is past it, but the commit has not
+    // reached txindex yet
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok,
+              region.WriteIntent(k1, v1, t1, nullptr).error_code());
+    region.SealChanges(10);
+    ASSERT_EQ(
+        azino::TxOpStatus_Code_Ok,
+        region.Changes().Read(0, 1024, changes, resolved_ts).error_code());
+    ASSERT_EQ(0, changes.size());
+    ASSERT_EQ(0, resolved_ts);
+
+    t1.set_commit_ts(5);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, region.Commit(k1, t1).error_code());
+    region.SealChanges(10);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok,
+              region.Changes()
+                  .Read(resolved_ts, 1024, changes, resolved_ts)
+                  .error_code());
+    ASSERT_EQ(1, changes.size());
+    ASSERT_EQ(5, changes[0].ts);
+    ASSERT_EQ(k1, changes[0].key);
+    ASSERT_EQ(9, resolved_ts);
+    FLAGS_enable_change_log = false;
+}
+
+TEST_F(TxIndexImplTest, min_intent_start_ts) {
+    std::vector<azino::txindex::Dep> deps;
+    std::string k3 = "key3";
+    ASSERT_EQ(MAX_TIMESTAMP, ti->MinIntentStartTs());
+    ASSERT_EQ(
+        azino::TxOpStatus_Code_Ok,
+        ti->WriteIntent(k1, v1, t1, nullptr, deps, is_lock_update, is_pess_key)
+            .error_code());
+    // a repeated intent is counted once
+    ASSERT_EQ(
+        azino::TxOpStatus_Code_Ok,
+        ti->WriteIntent(k1, v1, t1, nullptr, deps, is_lock_update, is_pess_key)
+            .error_code());
+    ASSERT_EQ(
+        azino::TxOpStatus_Code_Ok,
+        ti->WriteLock(k2, t1, nullptr, deps, is_lock_update, is_pess_key)
+            .error_code());
+    ASSERT_EQ(
+        azino::TxOpStatus_Code_Ok,
+        ti->WriteIntent(k3, v2, t2, nullptr, deps, is_lock_update, is_pess_key)
+            .error_code());
+    ASSERT_EQ(1, ti->MinIntentStartTs());
+
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Clean(k1, t1).error_code());
+    ASSERT_EQ(2, ti->MinIntentStartTs());
+
+    // the lock of t1 turns into an intent
+    ASSERT_EQ(
+        azino::TxOpStatus_Code_Ok,
+        ti->WriteIntent(k2, v1, t1, nullptr, deps, is_lock_update, is_pess_key)
+            .error_code());
+    ASSERT_EQ(1, ti->MinIntentStartTs());
+
+    t1.set_commit_ts(3);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k2, t1).error_code());
+    ASSERT_EQ(2, ti->MinIntentStartTs());
+    t2.set_commit_ts(4);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k3, t2).error_code());
+    ASSERT_EQ(MAX_TIMESTAMP, ti->MinIntentStartTs());
+}
+
+TEST_F(TxIndexImplTest, slab) {
+    using azino::txindex::SlabPool;
+    SlabPool pool;
+    std::vector<void*> blocks;
+    for (int i = 0; i < 10000; i++) {
+        blocks.push_back(pool.Allocate(24));
+    }
+    ASSERT_EQ(10000 * 32, pool.UsedBytes());
+    size_t reserved = pool.ReservedBytes();
+    for (auto p : blocks) {
+        pool.Deallocate(p, 24);
+    }
+    ASSERT_EQ(0, pool.UsedBytes());
+    ASSERT_EQ(reserved, pool.ReservedBytes());
+    ASSERT_EQ(reserved / SlabPool::slab_bytes, pool.Trim());
+    ASSERT_EQ(0, pool.ReservedBytes());
+
+    // each bucket of a region has its own pool
+    FLAGS_enable_persistor = false;
+    FLAGS_enable_region_metric_report = false;
+    FLAGS_enable_dep_reporter = false;
+    FLAGS_enable_slab_alloc = true;
+    azino::txindex::KVRegion region(azino::Range("", "", 0, 0), nullptr,
+                                    nullptr);
+    FLAGS_enable_slab_alloc = false;
+    std::set<SlabPool*> pools;
+    for (auto& kvb : region.KVBuckets()) {
+        ASSERT_NE(nullptr, kvb.Pool());
+        ASSERT_EQ(0, kvb.Pool()->ReservedBytes());
+        pools.insert(kvb.Pool().get());
+    }
+    ASSERT_EQ(region.KVBuckets().size(), pools.size());
+    t1.set_commit_ts(3);
+    for (int i = 0; i < 100; i++) {
+        std::string key = "slab" + std::to_string(i);
+        ASSERT_EQ(azino::TxOpStatus_Code_Ok,
+                  region.WriteIntent(key, v1, t1, nullptr).error_code());
+        ASSERT_EQ(azino::TxOpStatus_Code_Ok,
+                  region.Commit(key, t1).error_code());
+    }
+    size_t used = 0;
+    reserved = 0;
+    for (auto& kvb : region.KVBuckets()) {
+        used += kvb.Pool()->UsedBytes();
+        reserved += kvb.Pool()->ReservedBytes();
+    }
+
+    // the versions go back to the pools once persisted and collected, and
+    // the slabs emptied are released
+    size_t used_after = 0;
+    size_t reserved_after = 0;
+    for (auto& kvb : region.KVBuckets()) {
+        std::vector<azino::txindex::DataToPersist> datas;
+        kvb.GetPersisting(datas, 5);
+        kvb.ClearPersisted(datas);
+        datas.clear();
+        kvb.gc_mv(nullptr);
+        used_after += kvb.Pool()->UsedBytes();
+        reserved_after += kvb.Pool()->ReservedBytes();
+    }
+    ASSERT_LT(used_after, used);
+    ASSERT_LT(reserved_after, reserved);
+}
+
 TEST_F(TxIndexImplTest, read_dep_report) {
     std::vector<azino::txindex::Dep> deps;
     ASSERT_EQ(